@@ -0,0 +1,429 @@
+// Benchmarks for libnbt. Run using `make bench`, or `bench/bench [-n samples] [files...]` to benchmark particular NBT
+// files (in any compression) rather than the built-in inputs.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NBT_IMPLEMENTATION
+#include "../nbt.h"
+
+#define MAX_SAMPLES 101
+#define MIN_SAMPLE_NS 20000000ull // Each sample runs the operation enough times to take at least 20 ms.
+
+typedef struct {
+  const char* name;
+  uint8_t* raw; // Uncompressed data.
+  size_t raw_size;
+  nbt_tag_t* tag;
+  size_t tag_count;
+  const char** keys; // Every (compound, key) pair in the tree, for lookups.
+  nbt_tag_t** key_compounds;
+  size_t key_count;
+} bench_input_t;
+
+typedef struct {
+  bench_input_t* input;
+  int parse_flags;
+  int write_flags;
+  uint8_t* data; // input->raw in the compression being benchmarked.
+  size_t size;
+} bench_case_t;
+
+static uint64_t get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+// Keeps the compiler from optimising away results which are never looked at.
+static volatile uintptr_t sink;
+
+// Each operation runs `iterations` times and returns the time taken in nanoseconds, timing only the part being
+// measured.
+
+static uint64_t op_parse(bench_case_t* c, size_t iterations) {
+  uint64_t start = get_time_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    nbt_tag_t* tag = nbt_parse_memory(c->data, c->size, c->parse_flags);
+    sink += (uintptr_t)tag;
+    nbt_free_tag(tag);
+  }
+  return get_time_ns() - start;
+}
+
+static uint64_t op_write(bench_case_t* c, size_t iterations) {
+  uint64_t start = get_time_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    size_t size;
+    uint8_t* data = nbt_write_memory(c->input->tag, c->write_flags, &size);
+    sink += size;
+    nbt_free(data);
+  }
+  return get_time_ns() - start;
+}
+
+static uint64_t op_free(bench_case_t* c, size_t iterations) {
+  nbt_tag_t** tags = (nbt_tag_t**)malloc(iterations * sizeof(nbt_tag_t*));
+  for (size_t i = 0; i < iterations; i++) {
+    tags[i] = nbt_parse_memory(c->input->raw, c->input->raw_size, NBT_PARSE_FLAG_USE_RAW);
+  }
+  uint64_t start = get_time_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    nbt_free_tag(tags[i]);
+  }
+  uint64_t time = get_time_ns() - start;
+  free(tags);
+  return time;
+}
+
+static uint64_t op_lookup(bench_case_t* c, size_t iterations) {
+  bench_input_t* input = c->input;
+  uint64_t start = get_time_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    for (size_t j = 0; j < input->key_count; j++) {
+      sink += (uintptr_t)nbt_tag_compound_get(input->key_compounds[j], input->keys[j]);
+    }
+  }
+  return get_time_ns() - start;
+}
+
+static uint64_t op_round_trip(bench_case_t* c, size_t iterations) {
+  uint64_t start = get_time_ns();
+  for (size_t i = 0; i < iterations; i++) {
+    nbt_tag_t* tag = nbt_parse_memory(c->data, c->size, c->parse_flags);
+    size_t size;
+    uint8_t* data = nbt_write_memory(tag, c->write_flags, &size);
+    sink += size;
+    nbt_free(data);
+    nbt_free_tag(tag);
+  }
+  return get_time_ns() - start;
+}
+
+static int compare_doubles(const void* a, const void* b) {
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Runs an operation for the given number of samples and prints the median time along with throughput, allocations
+// and the spread of the samples.
+static void run(bench_case_t* c, const char* compression, const char* op_name, uint64_t (*op)(bench_case_t*, size_t), size_t samples, int per_lookup) {
+
+  // Warm up, then work out how many iterations make a sample long enough to time reliably.
+  size_t iterations = 1;
+  uint64_t time = op(c, 1);
+  while (time < MIN_SAMPLE_NS && iterations < ((size_t)1 << 30)) {
+    size_t scale = time > 0 ? (size_t)(MIN_SAMPLE_NS / time) + 1 : 16;
+    iterations *= scale < 2 ? 2 : (scale > 16 ? 16 : scale);
+    time = op(c, iterations);
+  }
+
+  double per_op[MAX_SAMPLES];
+  nbt_alloc_stats_t stats;
+
+  nbt_reset_alloc_stats();
+  for (size_t i = 0; i < samples; i++) {
+    per_op[i] = (double)op(c, iterations) / (double)iterations;
+  }
+  nbt_get_alloc_stats(&stats);
+  uint64_t allocations = stats.allocations;
+  uint64_t reallocations = stats.reallocations;
+  uint64_t bytes = stats.allocated_bytes;
+
+  // Measure the peak memory use of a single run on its own, as tracking it slows down allocation.
+  nbt_set_alloc_size_tracking(1);
+  nbt_reset_alloc_stats();
+  op(c, 1);
+  nbt_get_alloc_stats(&stats);
+  nbt_set_alloc_size_tracking(0);
+  double peak = (double)stats.peak_bytes;
+
+  qsort(per_op, samples, sizeof(double), compare_doubles);
+  double median = per_op[samples / 2];
+  double spread = samples > 1 ? (per_op[samples * 9 / 10] - per_op[samples / 10]) / median * 100 : 0;
+  double runs = (double)samples * (double)iterations;
+
+  // The free benchmark parses outside of the timed section, so its allocations don't belong to it.
+  if (op == op_free) {
+    allocations = reallocations = bytes = 0;
+    peak = 0;
+  }
+
+  if (per_lookup) {
+    double lookups_per_second = (double)c->input->key_count / (median / 1e9);
+    printf("%-12s %-5s %-10s %12s %11.2fM %10s %10s %10s %10s %11.3f %6.1f%%\n", c->input->name, compression, op_name, "-",
+      lookups_per_second / 1e6, "-", "-", "-", "-", median / 1e6, spread);
+  } else {
+    double mb_per_second = (double)c->input->raw_size / (median / 1e9) / 1e6;
+    double tags_per_second = (double)c->input->tag_count / (median / 1e9);
+    printf("%-12s %-5s %-10s %12.1f %11.2fM %10.0f %10.0f %10.2f %10.2f %11.3f %6.1f%%\n", c->input->name, compression, op_name,
+      mb_per_second, tags_per_second / 1e6, allocations / runs, reallocations / runs, bytes / runs / 1e6, peak / 1e6,
+      median / 1e6, spread);
+  }
+
+}
+
+static size_t count_tags(nbt_tag_t* tag) {
+  size_t count = 1;
+  if (tag->type == NBT_TYPE_LIST) {
+    for (size_t i = 0; i < tag->tag_list.size; i++) {
+      count += count_tags(tag->tag_list.value[i]);
+    }
+  } else if (tag->type == NBT_TYPE_COMPOUND) {
+    for (size_t i = 0; i < tag->tag_compound.size; i++) {
+      count += count_tags(tag->tag_compound.value[i]);
+    }
+  }
+  return count;
+}
+
+static void collect_keys(bench_input_t* input, nbt_tag_t* tag) {
+  if (tag->type == NBT_TYPE_LIST) {
+    for (size_t i = 0; i < tag->tag_list.size; i++) {
+      collect_keys(input, tag->tag_list.value[i]);
+    }
+  } else if (tag->type == NBT_TYPE_COMPOUND) {
+    for (size_t i = 0; i < tag->tag_compound.size; i++) {
+      input->keys[input->key_count] = tag->tag_compound.value[i]->name;
+      input->key_compounds[input->key_count] = tag;
+      input->key_count++;
+      collect_keys(input, tag->tag_compound.value[i]);
+    }
+  }
+}
+
+// Takes ownership of tag and prepares it for benchmarking.
+static void init_input(bench_input_t* input, const char* name, nbt_tag_t* tag) {
+  input->name = name;
+  input->tag = tag;
+  input->raw = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_RAW, &input->raw_size);
+  input->tag_count = count_tags(tag);
+  input->keys = (const char**)malloc(input->tag_count * sizeof(const char*));
+  input->key_compounds = (nbt_tag_t**)malloc(input->tag_count * sizeof(nbt_tag_t*));
+  input->key_count = 0;
+  collect_keys(input, tag);
+}
+
+static void free_input(bench_input_t* input) {
+  nbt_free_tag(input->tag);
+  nbt_free(input->raw);
+  free(input->keys);
+  free(input->key_compounds);
+}
+
+static uint64_t random_state;
+
+static uint32_t random_next(void) {
+  random_state = random_state * 6364136223846793005ull + 1442695040888963407ull;
+  return (uint32_t)(random_state >> 33);
+}
+
+static nbt_tag_t* named(nbt_tag_t* tag, const char* name) {
+  nbt_set_tag_name(tag, name, strlen(name));
+  return tag;
+}
+
+// Builds a document shaped roughly like a chunk, with the given number of entities and sections.
+static nbt_tag_t* make_document(size_t entities, size_t sections) {
+
+  static const char* ids[] = { "minecraft:zombie", "minecraft:cow", "minecraft:item", "minecraft:armor_stand" };
+
+  nbt_tag_t* root = named(nbt_new_tag_compound(), "");
+  nbt_tag_compound_append(root, named(nbt_new_tag_int(3465), "DataVersion"));
+  nbt_tag_compound_append(root, named(nbt_new_tag_int((int32_t)random_next()), "xPos"));
+  nbt_tag_compound_append(root, named(nbt_new_tag_int((int32_t)random_next()), "zPos"));
+  nbt_tag_compound_append(root, named(nbt_new_tag_long(random_next()), "LastUpdate"));
+  nbt_tag_compound_append(root, named(nbt_new_tag_string("minecraft:full", 14), "Status"));
+
+  nbt_tag_t* section_list = named(nbt_new_tag_list(NBT_TYPE_COMPOUND), "sections");
+  for (size_t i = 0; i < sections; i++) {
+    nbt_tag_t* section = nbt_new_tag_compound();
+    nbt_tag_compound_append(section, named(nbt_new_tag_byte((int8_t)i), "Y"));
+    nbt_tag_t* palette = named(nbt_new_tag_list(NBT_TYPE_COMPOUND), "palette");
+    for (size_t j = 0; j < 8; j++) {
+      nbt_tag_t* entry = nbt_new_tag_compound();
+      char block[32];
+      int length = snprintf(block, sizeof(block), "minecraft:block_%u", random_next() % 500);
+      nbt_tag_compound_append(entry, named(nbt_new_tag_string(block, (size_t)length), "Name"));
+      nbt_tag_list_append(palette, entry);
+    }
+    int64_t data[256];
+    for (size_t j = 0; j < 256; j++) {
+      data[j] = ((int64_t)random_next() << 32) | random_next();
+    }
+    nbt_tag_t* block_states = named(nbt_new_tag_compound(), "block_states");
+    nbt_tag_compound_append(block_states, palette);
+    nbt_tag_compound_append(block_states, named(nbt_new_tag_long_array(data, 256), "data"));
+    nbt_tag_compound_append(section, block_states);
+    int8_t light[2048];
+    for (size_t j = 0; j < sizeof(light); j++) {
+      light[j] = (int8_t)random_next();
+    }
+    nbt_tag_compound_append(section, named(nbt_new_tag_byte_array(light, sizeof(light)), "SkyLight"));
+    nbt_tag_list_append(section_list, section);
+  }
+  nbt_tag_compound_append(root, section_list);
+
+  nbt_tag_t* entity_list = named(nbt_new_tag_list(NBT_TYPE_COMPOUND), "Entities");
+  for (size_t i = 0; i < entities; i++) {
+    nbt_tag_t* entity = nbt_new_tag_compound();
+    const char* id = ids[random_next() % 4];
+    nbt_tag_compound_append(entity, named(nbt_new_tag_string(id, strlen(id)), "id"));
+    nbt_tag_t* pos = named(nbt_new_tag_list(NBT_TYPE_DOUBLE), "Pos");
+    nbt_tag_t* motion = named(nbt_new_tag_list(NBT_TYPE_DOUBLE), "Motion");
+    for (size_t j = 0; j < 3; j++) {
+      nbt_tag_list_append(pos, nbt_new_tag_double((double)random_next() / 1000.0));
+      nbt_tag_list_append(motion, nbt_new_tag_double((double)(random_next() % 1000) / 1e4));
+    }
+    nbt_tag_compound_append(entity, pos);
+    nbt_tag_compound_append(entity, motion);
+    nbt_tag_t* rotation = named(nbt_new_tag_list(NBT_TYPE_FLOAT), "Rotation");
+    nbt_tag_list_append(rotation, nbt_new_tag_float((float)(random_next() % 360)));
+    nbt_tag_list_append(rotation, nbt_new_tag_float((float)(random_next() % 180) - 90.0f));
+    nbt_tag_compound_append(entity, rotation);
+    nbt_tag_compound_append(entity, named(nbt_new_tag_short((int16_t)(random_next() % 20)), "Health"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_byte((int8_t)(random_next() & 1)), "OnGround"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_float(0.0f), "FallDistance"));
+    int32_t uuid[4] = { (int32_t)random_next(), (int32_t)random_next(), (int32_t)random_next(), (int32_t)random_next() };
+    nbt_tag_compound_append(entity, named(nbt_new_tag_int_array(uuid, 4), "UUID"));
+    nbt_tag_list_append(entity_list, entity);
+  }
+  nbt_tag_compound_append(root, entity_list);
+
+  return root;
+
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+  fseek(file, 0, SEEK_END);
+  long length = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t* data = (uint8_t*)malloc(length > 0 ? (size_t)length : 1);
+  *size = fread(data, 1, length > 0 ? (size_t)length : 0, file);
+  fclose(file);
+  return data;
+}
+
+static void bench_input(bench_input_t* input, size_t samples) {
+
+  static const struct {
+    const char* name;
+    int parse_flags;
+    int write_flags;
+  } compressions[] = {
+    { "raw", NBT_PARSE_FLAG_USE_RAW, NBT_WRITE_FLAG_USE_RAW },
+    { "zlib", NBT_PARSE_FLAG_USE_ZLIB, NBT_WRITE_FLAG_USE_ZLIB },
+    { "gzip", NBT_PARSE_FLAG_USE_GZIP, NBT_WRITE_FLAG_USE_GZIP }
+  };
+
+  printf("# %s: %zu bytes uncompressed, %zu tags\n", input->name, input->raw_size, input->tag_count);
+
+  for (size_t i = 0; i < sizeof(compressions) / sizeof(compressions[0]); i++) {
+    bench_case_t c;
+    c.input = input;
+    c.parse_flags = compressions[i].parse_flags;
+    c.write_flags = compressions[i].write_flags;
+    c.data = nbt_write_memory(input->tag, c.write_flags, &c.size);
+
+    run(&c, compressions[i].name, "parse", op_parse, samples, 0);
+    run(&c, compressions[i].name, "write", op_write, samples, 0);
+    run(&c, compressions[i].name, "round-trip", op_round_trip, samples, 0);
+    // Freeing and lookups don't depend on the compression.
+    if (i == 0) {
+      run(&c, compressions[i].name, "free", op_free, samples, 0);
+      run(&c, compressions[i].name, "lookup", op_lookup, samples, 1);
+    }
+
+    nbt_free(c.data);
+  }
+
+}
+
+static void print_header(void) {
+  printf("%-12s %-5s %-10s %12s %12s %10s %10s %10s %10s %11s %7s\n", "input", "comp", "op", "MB/s", "tags/s", "allocs/op",
+    "reallocs", "MB alloc", "MB peak", "median ms", "spread");
+}
+
+int main(int argc, char** argv) {
+
+  size_t samples = 11;
+  int file_count = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      samples = (size_t)atoi(argv[++i]);
+      if (samples < 1) {
+        samples = 1;
+      } else if (samples > MAX_SAMPLES) {
+        samples = MAX_SAMPLES;
+      }
+    } else {
+      argv[++file_count] = argv[i];
+    }
+  }
+
+  printf("samples: %zu, MB/s and tags/s are of uncompressed data at the median time, spread is the 10-90%% range\n", samples);
+  print_header();
+
+  if (file_count > 0) {
+    for (int i = 1; i <= file_count; i++) {
+      size_t size;
+      uint8_t* data = read_file(argv[i], &size);
+      nbt_tag_t* tag = NULL;
+      if (data) {
+        // Work out the compression from the first byte.
+        int flags = size > 0 && data[0] == 0x1f ? NBT_PARSE_FLAG_USE_GZIP : size > 0 && data[0] == 0x78 ? NBT_PARSE_FLAG_USE_ZLIB : NBT_PARSE_FLAG_USE_RAW;
+        tag = nbt_parse_memory(data, size, flags);
+        free(data);
+      }
+      if (!tag) {
+        fprintf(stderr, "could not read %s\n", argv[i]);
+        continue;
+      }
+      bench_input_t input;
+      init_input(&input, argv[i], tag);
+      bench_input(&input, samples);
+      free_input(&input);
+    }
+    return 0;
+  }
+
+  // By default, benchmark bigtest along with generated documents of about 64 KB, 1 MB and 16 MB.
+  static const struct {
+    const char* name;
+    size_t entities;
+    size_t sections;
+  } sizes[] = {
+    { "small", 64, 1 },
+    { "medium", 2048, 24 },
+    { "large", 32768, 384 }
+  };
+
+  size_t size;
+  uint8_t* data = read_file("bigtest_raw.nbt", &size);
+  if (data) {
+    bench_input_t input;
+    init_input(&input, "bigtest", nbt_parse_memory(data, size, NBT_PARSE_FLAG_USE_RAW));
+    bench_input(&input, samples);
+    free_input(&input);
+    free(data);
+  }
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    random_state = i + 1;
+    bench_input_t input;
+    init_input(&input, sizes[i].name, make_document(sizes[i].entities, sizes[i].sections));
+    bench_input(&input, samples);
+    free_input(&input);
+  }
+
+  return 0;
+
+}
@@ -0,0 +1,674 @@
+// Generates NBT files for benchmarking, shaped like the data Minecraft writes. The same seed always gives the same
+// output.
+//
+// Usage: bench/generate [-s seed] [-c raw|zlib|gzip] kind size output
+//
+// kind is one of:
+// * chunks: A list of chunks, each with sections (block palettes with packed long arrays, biomes and light),
+//   heightmaps, entities and block entities.
+// * level: A level.dat, with enabled data packs added until it reaches the size.
+// * player: Player data, with items added to the inventory and ender chest until it reaches the size.
+// * arrays: Large flat byte, int and long arrays.
+//
+// size is the approximate size of the uncompressed output in bytes, and can end in K, M or G. The whole tag structure
+// is built in memory before being written with nbt_write, so generating large files needs a similar amount of memory.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NBT_IMPLEMENTATION
+#include "../nbt.h"
+
+static uint64_t random_state;
+
+// PCG32, so that output doesn't depend on the C library's rand().
+static uint32_t random_next(void) {
+  uint64_t state = random_state;
+  random_state = state * 6364136223846793005ull + 1442695040888963407ull;
+  uint32_t shifted = (uint32_t)(((state >> 18) ^ state) >> 27);
+  uint32_t rotation = (uint32_t)(state >> 59);
+  return (shifted >> rotation) | (shifted << ((32 - rotation) & 31));
+}
+
+static uint32_t random_below(uint32_t limit) {
+  return (uint32_t)(((uint64_t)random_next() * limit) >> 32);
+}
+
+static double random_double(double min, double max) {
+  return min + (max - min) * (random_next() / 4294967296.0);
+}
+
+// Size of the serialized data generated so far, kept up to date by the functions below.
+static uint64_t generated_size;
+
+static uint64_t payload_size(nbt_tag_t* tag) {
+  switch (tag->type) {
+    case NBT_TYPE_BYTE: return 1;
+    case NBT_TYPE_SHORT: return 2;
+    case NBT_TYPE_INT: return 4;
+    case NBT_TYPE_LONG: return 8;
+    case NBT_TYPE_FLOAT: return 4;
+    case NBT_TYPE_DOUBLE: return 8;
+    case NBT_TYPE_BYTE_ARRAY: return 4 + (uint64_t)tag->tag_byte_array.size;
+    case NBT_TYPE_STRING: return 2 + (uint64_t)tag->tag_string.size;
+    case NBT_TYPE_LIST: return 5;
+    case NBT_TYPE_COMPOUND: return 1;
+    case NBT_TYPE_INT_ARRAY: return 4 + (uint64_t)tag->tag_int_array.size * 4;
+    case NBT_TYPE_LONG_ARRAY: return 4 + (uint64_t)tag->tag_long_array.size * 8;
+    default: return 0;
+  }
+}
+
+// Adds a named tag to a compound and returns it.
+static nbt_tag_t* put(nbt_tag_t* compound, const char* name, nbt_tag_t* tag) {
+  nbt_set_tag_name(tag, name, strlen(name));
+  nbt_tag_compound_append(compound, tag);
+  generated_size += 3 + strlen(name) + payload_size(tag);
+  return tag;
+}
+
+// Adds a tag to a list and returns it.
+static nbt_tag_t* add(nbt_tag_t* list, nbt_tag_t* tag) {
+  nbt_tag_list_append(list, tag);
+  generated_size += payload_size(tag);
+  return tag;
+}
+
+static nbt_tag_t* new_string(const char* value) {
+  return nbt_new_tag_string(value, strlen(value));
+}
+
+static nbt_tag_t* new_root(void) {
+  nbt_tag_t* root = nbt_new_tag_compound();
+  nbt_set_tag_name(root, "", 0);
+  generated_size += 3 + payload_size(root);
+  return root;
+}
+
+static void put_uuid(nbt_tag_t* compound) {
+  int32_t uuid[4];
+  for (int i = 0; i < 4; i++) {
+    uuid[i] = (int32_t)random_next();
+  }
+  put(compound, "UUID", nbt_new_tag_int_array(uuid, 4));
+}
+
+static nbt_tag_t* put_double_list(nbt_tag_t* compound, const char* name, double a, double b, double c) {
+  nbt_tag_t* list = put(compound, name, nbt_new_tag_list(NBT_TYPE_DOUBLE));
+  add(list, nbt_new_tag_double(a));
+  add(list, nbt_new_tag_double(b));
+  add(list, nbt_new_tag_double(c));
+  return list;
+}
+
+static nbt_tag_t* put_float_list(nbt_tag_t* compound, const char* name, float a, float b) {
+  nbt_tag_t* list = put(compound, name, nbt_new_tag_list(NBT_TYPE_FLOAT));
+  add(list, nbt_new_tag_float(a));
+  add(list, nbt_new_tag_float(b));
+  return list;
+}
+
+// Packs values of the given number of bits into longs in the same way as chunk sections, where values don't span
+// more than one long.
+static nbt_tag_t* new_packed_array(const uint32_t* values, size_t count, int bits) {
+  size_t per_long = 64 / (size_t)bits;
+  size_t size = (count + per_long - 1) / per_long;
+  int64_t* longs = (int64_t*)calloc(size, sizeof(int64_t));
+  for (size_t i = 0; i < count; i++) {
+    longs[i / per_long] |= (int64_t)((uint64_t)values[i] << ((i % per_long) * (size_t)bits));
+  }
+  nbt_tag_t* tag = nbt_new_tag_long_array(longs, size);
+  free(longs);
+  return tag;
+}
+
+static int bits_for(uint32_t count, int min_bits) {
+  int bits = min_bits;
+  while ((1u << bits) < count) {
+    bits++;
+  }
+  return bits;
+}
+
+static const char* stone_blocks[] = {
+  "minecraft:stone", "minecraft:deepslate", "minecraft:andesite", "minecraft:diorite", "minecraft:granite",
+  "minecraft:tuff", "minecraft:gravel", "minecraft:dirt", "minecraft:coal_ore", "minecraft:iron_ore",
+  "minecraft:copper_ore", "minecraft:gold_ore", "minecraft:redstone_ore", "minecraft:lapis_ore",
+  "minecraft:diamond_ore", "minecraft:water", "minecraft:lava", "minecraft:cave_air", "minecraft:glow_lichen",
+  "minecraft:pointed_dripstone", "minecraft:moss_block", "minecraft:clay"
+};
+
+static const char* surface_blocks[] = {
+  "minecraft:grass_block", "minecraft:dirt", "minecraft:oak_log", "minecraft:oak_leaves", "minecraft:grass",
+  "minecraft:tall_grass", "minecraft:dandelion", "minecraft:poppy", "minecraft:sand", "minecraft:water",
+  "minecraft:birch_log", "minecraft:birch_leaves", "minecraft:stone", "minecraft:snow"
+};
+
+static const char* biomes[] = {
+  "minecraft:plains", "minecraft:forest", "minecraft:river", "minecraft:dripstone_caves", "minecraft:lush_caves",
+  "minecraft:deep_dark", "minecraft:birch_forest", "minecraft:taiga"
+};
+
+static const char* entity_ids[] = {
+  "minecraft:zombie", "minecraft:skeleton", "minecraft:creeper", "minecraft:cow", "minecraft:sheep",
+  "minecraft:chicken", "minecraft:item", "minecraft:bat", "minecraft:spider"
+};
+
+static const char* item_ids[] = {
+  "minecraft:cobblestone", "minecraft:oak_planks", "minecraft:torch", "minecraft:iron_ingot", "minecraft:bread",
+  "minecraft:diamond_pickaxe", "minecraft:iron_sword", "minecraft:bow", "minecraft:arrow", "minecraft:coal",
+  "minecraft:redstone", "minecraft:diamond_chestplate", "minecraft:shield", "minecraft:golden_apple"
+};
+
+static const char* enchantments[] = {
+  "minecraft:efficiency", "minecraft:unbreaking", "minecraft:mending", "minecraft:fortune", "minecraft:sharpness",
+  "minecraft:protection"
+};
+
+#define COUNT(array) (sizeof(array) / sizeof((array)[0]))
+
+static nbt_tag_t* new_item(int slot) {
+  nbt_tag_t* item = nbt_new_tag_compound();
+  const char* id = item_ids[random_below(COUNT(item_ids))];
+  if (slot >= 0) {
+    put(item, "Slot", nbt_new_tag_byte((int8_t)slot));
+  }
+  put(item, "id", new_string(id));
+  put(item, "Count", nbt_new_tag_byte((int8_t)(1 + random_below(64))));
+  // Tools and armour get damage and enchantments.
+  if (strstr(id, "pickaxe") || strstr(id, "sword") || strstr(id, "chestplate") || strstr(id, "bow") || strstr(id, "shield")) {
+    nbt_tag_t* tag = put(item, "tag", nbt_new_tag_compound());
+    put(tag, "Damage", nbt_new_tag_int((int32_t)random_below(1500)));
+    nbt_tag_t* list = put(tag, "Enchantments", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+    uint32_t count = random_below(4);
+    for (uint32_t i = 0; i < count; i++) {
+      nbt_tag_t* enchantment = add(list, nbt_new_tag_compound());
+      put(enchantment, "id", new_string(enchantments[random_below(COUNT(enchantments))]));
+      put(enchantment, "lvl", nbt_new_tag_short((int16_t)(1 + random_below(5))));
+    }
+  }
+  return item;
+}
+
+static void generate_section(nbt_tag_t* sections, int y) {
+
+  nbt_tag_t* section = add(sections, nbt_new_tag_compound());
+  put(section, "Y", nbt_new_tag_byte((int8_t)y));
+
+  // Sections near the surface are the most varied, with the sky being empty and the deep underground mostly stone.
+  nbt_tag_t* block_states = put(section, "block_states", nbt_new_tag_compound());
+  nbt_tag_t* palette = put(block_states, "palette", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+  uint32_t palette_size;
+  const char** names;
+  if (y > 6) {
+    palette_size = 1;
+    names = NULL;
+  } else if (y >= 3) {
+    palette_size = 2 + random_below(COUNT(surface_blocks) - 1);
+    names = surface_blocks;
+  } else {
+    palette_size = 2 + random_below(COUNT(stone_blocks) - 1);
+    names = stone_blocks;
+  }
+
+  for (uint32_t i = 0; i < palette_size; i++) {
+    nbt_tag_t* entry = add(palette, nbt_new_tag_compound());
+    if (!names) {
+      put(entry, "Name", new_string("minecraft:air"));
+      continue;
+    }
+    const char* name = i == 0 ? names[0] : names[random_below((uint32_t)(y >= 3 ? COUNT(surface_blocks) : COUNT(stone_blocks)))];
+    put(entry, "Name", new_string(name));
+    if (strstr(name, "log") || strstr(name, "leaves") || strstr(name, "water") || strstr(name, "lava")) {
+      nbt_tag_t* properties = put(entry, "Properties", nbt_new_tag_compound());
+      if (strstr(name, "log")) {
+        put(properties, "axis", new_string("y"));
+      } else if (strstr(name, "leaves")) {
+        put(properties, "distance", new_string("1"));
+        put(properties, "persistent", new_string("false"));
+        put(properties, "waterlogged", new_string("false"));
+      } else {
+        put(properties, "level", new_string("0"));
+      }
+    }
+  }
+
+  if (palette_size > 1) {
+    // Blocks come in runs, with the first palette entry being the most common.
+    uint32_t values[4096];
+    uint32_t current = 0;
+    for (size_t i = 0; i < 4096; i++) {
+      if (random_below(8) == 0) {
+        current = random_below(4) == 0 ? random_below(palette_size) : 0;
+      }
+      values[i] = current;
+    }
+    put(block_states, "data", new_packed_array(values, 4096, bits_for(palette_size, 4)));
+  }
+
+  nbt_tag_t* biome_states = put(section, "biomes", nbt_new_tag_compound());
+  nbt_tag_t* biome_palette = put(biome_states, "palette", nbt_new_tag_list(NBT_TYPE_STRING));
+  uint32_t biome_count = 1 + random_below(3);
+  for (uint32_t i = 0; i < biome_count; i++) {
+    add(biome_palette, new_string(biomes[random_below(COUNT(biomes))]));
+  }
+  if (biome_count > 1) {
+    uint32_t values[64];
+    for (size_t i = 0; i < 64; i++) {
+      values[i] = random_below(biome_count);
+    }
+    put(biome_states, "data", new_packed_array(values, 64, bits_for(biome_count, 1)));
+  }
+
+  int8_t light[2048];
+  for (size_t i = 0; i < sizeof(light); i++) {
+    light[i] = (int8_t)(y > 4 ? 0xff : random_next());
+  }
+  put(section, "SkyLight", nbt_new_tag_byte_array(light, sizeof(light)));
+  if (y < 4 && random_below(2) == 0) {
+    for (size_t i = 0; i < sizeof(light); i++) {
+      light[i] = (int8_t)(random_below(16) == 0 ? random_next() : 0);
+    }
+    put(section, "BlockLight", nbt_new_tag_byte_array(light, sizeof(light)));
+  }
+
+}
+
+static void generate_entity(nbt_tag_t* entities, int32_t x, int32_t z) {
+  nbt_tag_t* entity = add(entities, nbt_new_tag_compound());
+  const char* id = entity_ids[random_below(COUNT(entity_ids))];
+  put(entity, "id", new_string(id));
+  put_double_list(entity, "Pos", x * 16 + random_double(0, 16), random_double(-64, 200), z * 16 + random_double(0, 16));
+  put_double_list(entity, "Motion", random_double(-0.1, 0.1), -0.0784000015258789, random_double(-0.1, 0.1));
+  put_float_list(entity, "Rotation", (float)random_double(0, 360), (float)random_double(-90, 90));
+  put(entity, "FallDistance", nbt_new_tag_float(0.0f));
+  put(entity, "Fire", nbt_new_tag_short(-1));
+  put(entity, "Air", nbt_new_tag_short(300));
+  put(entity, "OnGround", nbt_new_tag_byte(1));
+  put(entity, "Invulnerable", nbt_new_tag_byte(0));
+  put(entity, "PortalCooldown", nbt_new_tag_int(0));
+  put_uuid(entity);
+  if (strcmp(id, "minecraft:item") == 0) {
+    put(entity, "Age", nbt_new_tag_short((int16_t)random_below(6000)));
+    put(entity, "PickupDelay", nbt_new_tag_short(0));
+    put(entity, "Item", new_item(-1));
+  } else {
+    put(entity, "Health", nbt_new_tag_float((float)(1 + random_below(20))));
+    put(entity, "HurtTime", nbt_new_tag_short(0));
+    put(entity, "DeathTime", nbt_new_tag_short(0));
+    put(entity, "CanPickUpLoot", nbt_new_tag_byte(0));
+    put(entity, "PersistenceRequired", nbt_new_tag_byte(0));
+    nbt_tag_t* armor = put(entity, "ArmorItems", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+    for (int i = 0; i < 4; i++) {
+      add(armor, nbt_new_tag_compound());
+    }
+    put_float_list(entity, "ArmorDropChances", 0.085f, 0.085f);
+  }
+}
+
+static void generate_block_entity(nbt_tag_t* block_entities, int32_t x, int32_t z) {
+  nbt_tag_t* block_entity = add(block_entities, nbt_new_tag_compound());
+  uint32_t kind = random_below(4);
+  put(block_entity, "id", new_string(kind == 0 ? "minecraft:sign" : kind == 1 ? "minecraft:furnace" : "minecraft:chest"));
+  put(block_entity, "keepPacked", nbt_new_tag_byte(0));
+  put(block_entity, "x", nbt_new_tag_int(x * 16 + (int32_t)random_below(16)));
+  put(block_entity, "y", nbt_new_tag_int((int32_t)random_below(256) - 64));
+  put(block_entity, "z", nbt_new_tag_int(z * 16 + (int32_t)random_below(16)));
+  if (kind == 0) {
+    for (int i = 1; i <= 4; i++) {
+      char name[6] = "Text0";
+      name[4] = (char)('0' + i);
+      put(block_entity, name, new_string(i == 1 ? "{\"text\":\"Welcome\"}" : "{\"text\":\"\"}"));
+    }
+    put(block_entity, "Color", new_string("black"));
+    put(block_entity, "GlowingText", nbt_new_tag_byte(0));
+  } else if (kind == 1) {
+    put(block_entity, "BurnTime", nbt_new_tag_short((int16_t)random_below(1600)));
+    put(block_entity, "CookTime", nbt_new_tag_short((int16_t)random_below(200)));
+    put(block_entity, "CookTimeTotal", nbt_new_tag_short(200));
+    put(block_entity, "Items", nbt_new_tag_list(NBT_TYPE_END));
+  } else {
+    nbt_tag_t* items = put(block_entity, "Items", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+    for (int slot = 0; slot < 27; slot++) {
+      if (random_below(3) == 0) {
+        add(items, new_item(slot));
+      }
+    }
+  }
+}
+
+static void generate_chunk(nbt_tag_t* chunks, int32_t x, int32_t z) {
+
+  nbt_tag_t* chunk = add(chunks, nbt_new_tag_compound());
+  put(chunk, "DataVersion", nbt_new_tag_int(3465));
+  put(chunk, "xPos", nbt_new_tag_int(x));
+  put(chunk, "yPos", nbt_new_tag_int(-4));
+  put(chunk, "zPos", nbt_new_tag_int(z));
+  put(chunk, "Status", new_string("minecraft:full"));
+  put(chunk, "LastUpdate", nbt_new_tag_long(1000000 + (int64_t)random_below(1000000)));
+  put(chunk, "InhabitedTime", nbt_new_tag_long((int64_t)random_below(100000)));
+  put(chunk, "isLightOn", nbt_new_tag_byte(1));
+
+  nbt_tag_t* sections = put(chunk, "sections", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+  for (int y = -4; y < 20; y++) {
+    generate_section(sections, y);
+  }
+
+  nbt_tag_t* heightmaps = put(chunk, "Heightmaps", nbt_new_tag_compound());
+  static const char* heightmap_names[] = { "MOTION_BLOCKING", "MOTION_BLOCKING_NO_LEAVES", "OCEAN_FLOOR", "WORLD_SURFACE" };
+  for (size_t i = 0; i < COUNT(heightmap_names); i++) {
+    uint32_t heights[256];
+    for (size_t j = 0; j < 256; j++) {
+      heights[j] = 120 + random_below(24);
+    }
+    put(heightmaps, heightmap_names[i], new_packed_array(heights, 256, 9));
+  }
+
+  nbt_tag_t* entities = put(chunk, "entities", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+  uint32_t entity_count = random_below(12);
+  for (uint32_t i = 0; i < entity_count; i++) {
+    generate_entity(entities, x, z);
+  }
+
+  nbt_tag_t* block_entities = put(chunk, "block_entities", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+  uint32_t block_entity_count = random_below(6);
+  for (uint32_t i = 0; i < block_entity_count; i++) {
+    generate_block_entity(block_entities, x, z);
+  }
+
+  nbt_tag_t* post_processing = put(chunk, "PostProcessing", nbt_new_tag_list(NBT_TYPE_LIST));
+  for (int i = 0; i < 24; i++) {
+    nbt_tag_t* list = add(post_processing, nbt_new_tag_list(NBT_TYPE_SHORT));
+    if (random_below(8) == 0) {
+      add(list, nbt_new_tag_short((int16_t)random_below(4096)));
+    }
+  }
+
+  nbt_tag_t* structures = put(chunk, "structures", nbt_new_tag_compound());
+  put(structures, "References", nbt_new_tag_compound());
+  put(structures, "starts", nbt_new_tag_compound());
+
+}
+
+static nbt_tag_t* generate_chunks(uint64_t size) {
+  nbt_tag_t* root = new_root();
+  nbt_tag_t* chunks = put(root, "Chunks", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+  // Chunks are laid out in 32x32 regions, like in a world.
+  int32_t index = 0;
+  do {
+    generate_chunk(chunks, index % 32 + index / 1024 * 32, index / 32 % 32);
+    index++;
+  } while (generated_size < size);
+  return root;
+}
+
+static nbt_tag_t* generate_level(uint64_t size) {
+
+  nbt_tag_t* root = new_root();
+  nbt_tag_t* data = put(root, "Data", nbt_new_tag_compound());
+
+  put(data, "LevelName", new_string("New World"));
+  put(data, "DataVersion", nbt_new_tag_int(3465));
+  put(data, "version", nbt_new_tag_int(19133));
+  put(data, "GameType", nbt_new_tag_int(0));
+  put(data, "Difficulty", nbt_new_tag_byte(2));
+  put(data, "DifficultyLocked", nbt_new_tag_byte(0));
+  put(data, "hardcore", nbt_new_tag_byte(0));
+  put(data, "allowCommands", nbt_new_tag_byte(0));
+  put(data, "initialized", nbt_new_tag_byte(1));
+  put(data, "Time", nbt_new_tag_long((int64_t)random_below(10000000)));
+  put(data, "DayTime", nbt_new_tag_long((int64_t)random_below(10000000)));
+  put(data, "LastPlayed", nbt_new_tag_long(1690000000000ll + (int64_t)random_below(1000000000)));
+  put(data, "SpawnX", nbt_new_tag_int((int32_t)random_below(512) - 256));
+  put(data, "SpawnY", nbt_new_tag_int(64 + (int32_t)random_below(32)));
+  put(data, "SpawnZ", nbt_new_tag_int((int32_t)random_below(512) - 256));
+  put(data, "SpawnAngle", nbt_new_tag_float(0.0f));
+  put(data, "clearWeatherTime", nbt_new_tag_int(0));
+  put(data, "raining", nbt_new_tag_byte(0));
+  put(data, "rainTime", nbt_new_tag_int((int32_t)random_below(100000)));
+  put(data, "thundering", nbt_new_tag_byte(0));
+  put(data, "thunderTime", nbt_new_tag_int((int32_t)random_below(100000)));
+  put(data, "WanderingTraderSpawnChance", nbt_new_tag_int(25));
+  put(data, "WanderingTraderSpawnDelay", nbt_new_tag_int(24000));
+  put(data, "BorderCenterX", nbt_new_tag_double(0.0));
+  put(data, "BorderCenterZ", nbt_new_tag_double(0.0));
+  put(data, "BorderSize", nbt_new_tag_double(59999968.0));
+  put(data, "BorderDamagePerBlock", nbt_new_tag_double(0.2));
+  put(data, "BorderSafeZone", nbt_new_tag_double(5.0));
+  put(data, "BorderWarningBlocks", nbt_new_tag_double(5.0));
+  put(data, "BorderWarningTime", nbt_new_tag_double(15.0));
+
+  nbt_tag_t* version = put(data, "Version", nbt_new_tag_compound());
+  put(version, "Id", nbt_new_tag_int(3465));
+  put(version, "Name", new_string("1.20.1"));
+  put(version, "Series", new_string("main"));
+  put(version, "Snapshot", nbt_new_tag_byte(0));
+
+  static const char* game_rules[][2] = {
+    { "announceAdvancements", "true" }, { "commandBlockOutput", "true" }, { "doDaylightCycle", "true" },
+    { "doEntityDrops", "true" }, { "doFireTick", "true" }, { "doImmediateRespawn", "false" },
+    { "doInsomnia", "true" }, { "doMobLoot", "true" }, { "doMobSpawning", "true" }, { "doTileDrops", "true" },
+    { "doWeatherCycle", "true" }, { "keepInventory", "false" }, { "maxEntityCramming", "24" },
+    { "mobGriefing", "true" }, { "naturalRegeneration", "true" }, { "randomTickSpeed", "3" },
+    { "spawnRadius", "10" }, { "spectatorsGenerateChunks", "true" }
+  };
+  nbt_tag_t* rules = put(data, "GameRules", nbt_new_tag_compound());
+  for (size_t i = 0; i < COUNT(game_rules); i++) {
+    put(rules, game_rules[i][0], new_string(game_rules[i][1]));
+  }
+
+  nbt_tag_t* world_gen = put(data, "WorldGenSettings", nbt_new_tag_compound());
+  put(world_gen, "bonus_chest", nbt_new_tag_byte(0));
+  put(world_gen, "generate_features", nbt_new_tag_byte(1));
+  put(world_gen, "seed", nbt_new_tag_long(((int64_t)random_next() << 32) | random_next()));
+  nbt_tag_t* dimensions = put(world_gen, "dimensions", nbt_new_tag_compound());
+  static const char* dimension_names[][2] = {
+    { "minecraft:overworld", "minecraft:overworld" }, { "minecraft:the_nether", "minecraft:nether" },
+    { "minecraft:the_end", "minecraft:end" }
+  };
+  for (size_t i = 0; i < COUNT(dimension_names); i++) {
+    nbt_tag_t* dimension = put(dimensions, dimension_names[i][0], nbt_new_tag_compound());
+    put(dimension, "type", new_string(dimension_names[i][0]));
+    nbt_tag_t* generator = put(dimension, "generator", nbt_new_tag_compound());
+    put(generator, "type", new_string("minecraft:noise"));
+    put(generator, "settings", new_string(dimension_names[i][1]));
+    nbt_tag_t* biome_source = put(generator, "biome_source", nbt_new_tag_compound());
+    put(biome_source, "type", new_string(i == 2 ? "minecraft:the_end" : "minecraft:multi_noise"));
+  }
+
+  nbt_tag_t* data_packs = put(data, "DataPacks", nbt_new_tag_compound());
+  nbt_tag_t* enabled = put(data_packs, "Enabled", nbt_new_tag_list(NBT_TYPE_STRING));
+  put(data_packs, "Disabled", nbt_new_tag_list(NBT_TYPE_STRING));
+  add(enabled, new_string("vanilla"));
+
+  // Pad out to the requested size with more data packs.
+  while (generated_size < size) {
+    char name[32];
+    snprintf(name, sizeof(name), "file/pack_%08x.zip", random_next());
+    add(enabled, new_string(name));
+  }
+
+  return root;
+
+}
+
+static nbt_tag_t* generate_player(uint64_t size) {
+
+  nbt_tag_t* root = new_root();
+
+  put(root, "DataVersion", nbt_new_tag_int(3465));
+  put(root, "Dimension", new_string("minecraft:overworld"));
+  put_double_list(root, "Pos", random_double(-1000, 1000), random_double(-64, 200), random_double(-1000, 1000));
+  put_double_list(root, "Motion", 0.0, -0.0784000015258789, 0.0);
+  put_float_list(root, "Rotation", (float)random_double(0, 360), (float)random_double(-90, 90));
+  put(root, "Health", nbt_new_tag_float(20.0f));
+  put(root, "foodLevel", nbt_new_tag_int(20));
+  put(root, "foodSaturationLevel", nbt_new_tag_float(5.0f));
+  put(root, "foodExhaustionLevel", nbt_new_tag_float((float)random_double(0, 4)));
+  put(root, "XpLevel", nbt_new_tag_int((int32_t)random_below(50)));
+  put(root, "XpP", nbt_new_tag_float((float)random_double(0, 1)));
+  put(root, "XpTotal", nbt_new_tag_int((int32_t)random_below(5000)));
+  put(root, "XpSeed", nbt_new_tag_int((int32_t)random_next()));
+  put(root, "Score", nbt_new_tag_int((int32_t)random_below(5000)));
+  put(root, "playerGameType", nbt_new_tag_int(0));
+  put(root, "SelectedItemSlot", nbt_new_tag_int((int32_t)random_below(9)));
+  put(root, "OnGround", nbt_new_tag_byte(1));
+  put(root, "Air", nbt_new_tag_short(300));
+  put(root, "Fire", nbt_new_tag_short(-20));
+  put_uuid(root);
+
+  nbt_tag_t* abilities = put(root, "abilities", nbt_new_tag_compound());
+  put(abilities, "flying", nbt_new_tag_byte(0));
+  put(abilities, "flySpeed", nbt_new_tag_float(0.05f));
+  put(abilities, "instabuild", nbt_new_tag_byte(0));
+  put(abilities, "invulnerable", nbt_new_tag_byte(0));
+  put(abilities, "mayBuild", nbt_new_tag_byte(1));
+  put(abilities, "mayfly", nbt_new_tag_byte(0));
+  put(abilities, "walkSpeed", nbt_new_tag_float(0.1f));
+
+  nbt_tag_t* recipe_book = put(root, "recipeBook", nbt_new_tag_compound());
+  nbt_tag_t* recipes = put(recipe_book, "recipes", nbt_new_tag_list(NBT_TYPE_STRING));
+  for (size_t i = 0; i < COUNT(item_ids); i++) {
+    add(recipes, new_string(item_ids[i]));
+  }
+
+  nbt_tag_t* inventory = put(root, "Inventory", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+  nbt_tag_t* ender_items = put(root, "EnderItems", nbt_new_tag_list(NBT_TYPE_COMPOUND));
+
+  // Fill the inventory and ender chest, and keep going (as if they were bigger) until the size is reached.
+  int slot = 0;
+  do {
+    add(slot % 2 ? ender_items : inventory, new_item(slot / 2 % 36));
+    slot++;
+  } while (generated_size < size || slot < 36);
+
+  return root;
+
+}
+
+static nbt_tag_t* generate_arrays(uint64_t size) {
+
+  nbt_tag_t* root = new_root();
+
+  // Split the size evenly between a byte array, an int array and a long array.
+  size_t count = (size_t)(size / 3);
+
+  int8_t* bytes = (int8_t*)malloc(count ? count : 1);
+  for (size_t i = 0; i < count; i++) {
+    bytes[i] = (int8_t)random_next();
+  }
+  put(root, "bytes", nbt_new_tag_byte_array(bytes, count));
+  free(bytes);
+
+  int32_t* ints = (int32_t*)malloc((count / 4 ? count / 4 : 1) * sizeof(int32_t));
+  for (size_t i = 0; i < count / 4; i++) {
+    ints[i] = (int32_t)random_next();
+  }
+  put(root, "ints", nbt_new_tag_int_array(ints, count / 4));
+  free(ints);
+
+  int64_t* longs = (int64_t*)malloc((count / 8 ? count / 8 : 1) * sizeof(int64_t));
+  for (size_t i = 0; i < count / 8; i++) {
+    longs[i] = ((int64_t)random_next() << 32) | random_next();
+  }
+  put(root, "longs", nbt_new_tag_long_array(longs, count / 8));
+  free(longs);
+
+  return root;
+
+}
+
+static size_t writer_write(void* userdata, uint8_t* data, size_t size) {
+  return fwrite(data, 1, size, (FILE*)userdata);
+}
+
+static int parse_size(const char* text, uint64_t* size) {
+  char* end;
+  double value = strtod(text, &end);
+  if (end == text || value < 0) {
+    return 0;
+  }
+  switch (*end) {
+    case 'k': case 'K': value *= 1024.0; end++; break;
+    case 'm': case 'M': value *= 1024.0 * 1024.0; end++; break;
+    case 'g': case 'G': value *= 1024.0 * 1024.0 * 1024.0; end++; break;
+    default: break;
+  }
+  *size = (uint64_t)value;
+  return *end == '\0';
+}
+
+static int usage(void) {
+  fprintf(stderr, "usage: generate [-s seed] [-c raw|zlib|gzip] chunks|level|player|arrays size output\n");
+  return 1;
+}
+
+int main(int argc, char** argv) {
+
+  uint64_t seed = 1;
+  int write_flags = NBT_WRITE_FLAG_USE_RAW;
+  const char* arguments[3];
+  int argument_count = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      seed = strtoull(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+      const char* compression = argv[++i];
+      if (strcmp(compression, "raw") == 0) {
+        write_flags = NBT_WRITE_FLAG_USE_RAW;
+      } else if (strcmp(compression, "zlib") == 0) {
+        write_flags = NBT_WRITE_FLAG_USE_ZLIB;
+      } else if (strcmp(compression, "gzip") == 0) {
+        write_flags = NBT_WRITE_FLAG_USE_GZIP;
+      } else {
+        return usage();
+      }
+    } else if (argument_count < 3) {
+      arguments[argument_count++] = argv[i];
+    } else {
+      return usage();
+    }
+  }
+
+  uint64_t size;
+  if (argument_count != 3 || !parse_size(arguments[1], &size)) {
+    return usage();
+  }
+
+  random_state = seed * 0x9e3779b97f4a7c15ull + 0x2545f4914f6cdd1dull;
+  random_next();
+
+  nbt_tag_t* tag;
+  if (strcmp(arguments[0], "chunks") == 0) {
+    tag = generate_chunks(size);
+  } else if (strcmp(arguments[0], "level") == 0) {
+    tag = generate_level(size);
+  } else if (strcmp(arguments[0], "player") == 0) {
+    tag = generate_player(size);
+  } else if (strcmp(arguments[0], "arrays") == 0) {
+    tag = generate_arrays(size);
+  } else {
+    return usage();
+  }
+
+  FILE* file = fopen(arguments[2], "wb");
+  if (!file) {
+    fprintf(stderr, "could not open %s\n", arguments[2]);
+    nbt_free_tag(tag);
+    return 1;
+  }
+
+  nbt_writer_t writer;
+  writer.write = writer_write;
+  writer.userdata = file;
+
+  nbt_write(writer, tag, write_flags);
+
+  fclose(file);
+  nbt_free_tag(tag);
+
+  return 0;
+
+}
@@ -30,6 +30,9 @@ extern "C" {
 #define NBT_FREE free
 #define NBT_MEMCPY memcpy
 #define NBT_MEMCMP memcmp
+#define NBT_MEMMOVE memmove
+#define NBT_STRTOD strtod
+#define NBT_STRTOF strtof
 #endif
 
 #ifndef NBT_NO_STDINT
@@ -42,6 +45,10 @@ extern "C" {
 #include "miniz.h"
 #endif
 
+#ifdef NBT_THREADS
+#include <pthread.h>
+#endif
+
 #ifndef Z_DEFAULT_WINDOW_BITS
 #define Z_DEFAULT_WINDOW_BITS 15
 #endif
@@ -52,6 +59,22 @@ extern "C" {
 
 #define NBT_COMPRESSION_LEVEL 9
 
+#ifndef NBT_MAX_DEPTH
+#define NBT_MAX_DEPTH 512
+#endif
+
+#ifndef NBT_PARALLEL_THREADS
+#define NBT_PARALLEL_THREADS 4
+#endif
+
+#ifndef NBT_PARALLEL_BLOCK_SIZE
+#define NBT_PARALLEL_BLOCK_SIZE 131072
+#endif
+
+#ifndef NBT_LAZY_DEPTH
+#define NBT_LAZY_DEPTH 1
+#endif
+
 typedef enum {
   NBT_TYPE_END,
   NBT_TYPE_BYTE,
@@ -71,12 +94,32 @@ typedef enum {
 
 typedef struct nbt_tag_t nbt_tag_t;
 
+// With NBT_COMPACT_TAGS defined, the type is stored in a single byte, lengths in 32 bits (the most NBT can hold) and
+// short names inside the tag itself, which makes tags 40 bytes rather than 48 on 64-bit platforms and saves a separate
+// allocation for most names.
+#ifdef NBT_COMPACT_TAGS
+#define NBT__TAG_TYPE uint8_t
+#define NBT__TAG_SIZE uint32_t
+#else
+#define NBT__TAG_TYPE nbt_tag_type_t
+#define NBT__TAG_SIZE size_t
+#endif
+
 struct nbt_tag_t {
 
+#ifdef NBT_COMPACT_TAGS
+  uint8_t type;
+  uint8_t flags; // Only used internally.
+  uint16_t name_size;
+  char name_inline[12]; // Names shorter than this are stored here, with name pointing to them.
+  char* name;
+#else
   nbt_tag_type_t type;
+  uint8_t flags; // Only used internally.
 
   char* name;
   size_t name_size;
+#endif
 
   union {
     struct {
@@ -99,28 +142,28 @@ struct nbt_tag_t {
     } tag_double;
     struct {
       int8_t* value;
-      size_t size;
+      NBT__TAG_SIZE size;
     } tag_byte_array;
     struct {
       char* value;
-      size_t size;
+      NBT__TAG_SIZE size;
     } tag_string;
     struct {
       nbt_tag_t** value;
-      nbt_tag_type_t type;
-      size_t size;
+      NBT__TAG_TYPE type;
+      NBT__TAG_SIZE size;
     } tag_list;
     struct {
       nbt_tag_t** value;
-      size_t size;
+      NBT__TAG_SIZE size;
     } tag_compound;
     struct {
       int32_t* value;
-      size_t size;
+      NBT__TAG_SIZE size;
     } tag_int_array;
     struct {
       int64_t* value;
-      size_t size;
+      NBT__TAG_SIZE size;
     } tag_long_array;
   };
 
@@ -140,17 +183,197 @@ typedef enum {
   NBT_PARSE_FLAG_USE_GZIP = 1,
   NBT_PARSE_FLAG_USE_ZLIB = 2,
   NBT_PARSE_FLAG_USE_RAW = 3,
+  NBT_PARSE_FLAG_BEDROCK = 8,
+  NBT_PARSE_FLAG_BEDROCK_NETWORK = 16,
+  NBT_PARSE_FLAG_NAMELESS_ROOT = 32,
+  NBT_PARSE_FLAG_LAZY = 64,
+  NBT_PARSE_FLAG_PREALLOCATE = 128
 } nbt_parse_flags_t;
 
 typedef enum {
   NBT_WRITE_FLAG_USE_GZIP = 1,
   NBT_WRITE_FLAG_USE_ZLIB = 2,
-  NBT_WRITE_FLAG_USE_RAW = 3
+  NBT_WRITE_FLAG_USE_RAW = 3,
+  NBT_WRITE_FLAG_PARALLEL = 4,
+  NBT_WRITE_FLAG_BEDROCK = 8,
+  NBT_WRITE_FLAG_BEDROCK_NETWORK = 16,
+  NBT_WRITE_FLAG_NAMELESS_ROOT = 32
 } nbt_write_flags_t;
 
+typedef struct nbt_context_t nbt_context_t;
+
+typedef struct {
+  void* (*malloc)(void* userdata, size_t size);
+  void* (*realloc)(void* userdata, void* pointer, size_t size);
+  void (*free)(void* userdata, void* pointer);
+  size_t (*size)(void* userdata, void* pointer);
+  void* userdata;
+} nbt_allocator_t;
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t reallocations;
+  uint64_t frees;
+  uint64_t allocated_bytes;
+  int64_t current_bytes;
+  int64_t peak_bytes;
+} nbt_alloc_stats_t;
+
+typedef enum {
+  NBT_PHASE_READ,
+  NBT_PHASE_INFLATE,
+  NBT_PHASE_BUILD,
+  NBT_PHASE_SERIALIZE,
+  NBT_PHASE_DEFLATE,
+  NBT_PHASE_WRITE,
+  NBT_PHASE_ALLOC,
+  NBT_PHASE_COUNT
+} nbt_phase_t;
+
+typedef struct {
+  uint64_t total_ns;
+  uint64_t time_ns[NBT_PHASE_COUNT];
+  uint64_t calls[NBT_PHASE_COUNT];
+} nbt_phase_stats_t;
+
+typedef struct {
+  size_t tag_count;
+  size_t type_counts[NBT_TYPE_LONG_ARRAY + 1];
+  size_t max_depth;
+  size_t payload_bytes;
+  size_t name_bytes;
+  size_t serialized_bytes;
+  size_t heap_bytes;
+  size_t heap_blocks;
+  size_t heap_usable_bytes;
+  size_t unparsed_bytes;
+} nbt_tree_stats_t;
+
+typedef struct {
+  size_t tag_count;
+  size_t type_counts[NBT_TYPE_LONG_ARRAY + 1];
+  size_t element_counts[NBT_TYPE_LONG_ARRAY + 1];
+  size_t max_depth;
+  size_t name_bytes;
+} nbt_scan_stats_t;
+
+typedef struct {
+  nbt_tag_type_t type;
+  const char* name;
+  size_t name_size;
+  size_t offset;
+  size_t size;
+  size_t length;
+  size_t tag_count;
+  size_t depth;
+} nbt_scan_entry_t;
+
+typedef struct nbt_incremental_parser_t nbt_incremental_parser_t;
+typedef struct nbt_incremental_writer_t nbt_incremental_writer_t;
+typedef struct nbt_path_t nbt_path_t;
+typedef struct nbt_columns_t nbt_columns_t;
+
+typedef enum {
+  NBT_INCREMENTAL_NEED_MORE,
+  NBT_INCREMENTAL_DONE,
+  NBT_INCREMENTAL_ERROR
+} nbt_incremental_status_t;
+
+typedef enum {
+  NBT_VISIT_KEEP,
+  NBT_VISIT_DROP
+} nbt_visit_result_t;
+
+typedef struct {
+  nbt_visit_result_t (*visit)(void* userdata, nbt_tag_t* tag, nbt_tag_t** path, size_t depth);
+  void* userdata;
+  int keep_list_elements;
+} nbt_visitor_t;
+
+typedef struct {
+  char* path;
+  nbt_tag_type_t type;
+  void* values;
+  size_t* offsets;
+  uint8_t* validity;
+  size_t size;
+} nbt_column_t;
+
 nbt_tag_t* nbt_parse(nbt_reader_t reader, int parse_flags);
 void nbt_write(nbt_writer_t writer, nbt_tag_t* tag, int write_flags);
 
+nbt_context_t* nbt_new_context(void);
+void nbt_free_context(nbt_context_t* context);
+
+void nbt_set_allocator(const nbt_allocator_t* allocator);
+void nbt_free(void* pointer);
+void nbt_set_alloc_size_tracking(int enabled);
+void nbt_get_alloc_stats(nbt_alloc_stats_t* stats);
+void nbt_reset_alloc_stats(void);
+void nbt_context_get_alloc_stats(nbt_context_t* context, nbt_alloc_stats_t* stats);
+
+void nbt_context_get_phase_stats(nbt_context_t* context, nbt_phase_stats_t* stats);
+void nbt_context_set_lazy_depth(nbt_context_t* context, size_t depth);
+void nbt_trace_begin(nbt_writer_t writer);
+void nbt_trace_end(void);
+
+nbt_tag_t* nbt_parse_ex(nbt_context_t* context, nbt_reader_t reader, int parse_flags);
+void nbt_write_ex(nbt_context_t* context, nbt_writer_t writer, nbt_tag_t* tag, int write_flags);
+
+size_t nbt_write_packet(nbt_writer_t writer, nbt_tag_t* tag, int write_flags);
+size_t nbt_write_packet_ex(nbt_context_t* context, nbt_writer_t writer, nbt_tag_t* tag, int write_flags);
+
+nbt_tag_t* nbt_parse_memory(const void* data, size_t size, int parse_flags);
+nbt_tag_t* nbt_parse_memory_ex(nbt_context_t* context, const void* data, size_t size, int parse_flags);
+
+size_t nbt_validate(const void* data, size_t size, int parse_flags);
+size_t nbt_scan(const void* data, size_t size, int parse_flags, nbt_scan_stats_t* stats, nbt_scan_entry_t* entries, size_t max_entries);
+
+#ifndef NBT_NO_STDIO
+nbt_tag_t* nbt_parse_file(const char* path, int parse_flags);
+nbt_tag_t* nbt_parse_file_ex(nbt_context_t* context, const char* path, int parse_flags);
+#endif
+
+nbt_tag_t* nbt_parse_snbt(const char* snbt, size_t size);
+
+nbt_incremental_parser_t* nbt_new_incremental_parser(int parse_flags);
+void nbt_free_incremental_parser(nbt_incremental_parser_t* parser);
+void nbt_incremental_parser_reset(nbt_incremental_parser_t* parser);
+nbt_incremental_status_t nbt_incremental_parser_feed(nbt_incremental_parser_t* parser, const void* data, size_t size, size_t* consumed);
+nbt_tag_t* nbt_incremental_parser_take_tag(nbt_incremental_parser_t* parser);
+
+nbt_incremental_writer_t* nbt_new_incremental_writer(nbt_writer_t writer, nbt_tag_t* tag, int write_flags);
+void nbt_free_incremental_writer(nbt_incremental_writer_t* incremental_writer);
+nbt_incremental_status_t nbt_write_step(nbt_incremental_writer_t* incremental_writer, size_t byte_budget, uint32_t time_budget_us);
+
+int nbt_transform(nbt_reader_t reader, int parse_flags, nbt_writer_t writer, int write_flags, nbt_visitor_t visitor);
+int nbt_transform_ex(nbt_context_t* context, nbt_reader_t reader, int parse_flags, nbt_writer_t writer, int write_flags, nbt_visitor_t visitor);
+
+nbt_path_t* nbt_path_compile(const char* path);
+void nbt_free_path(nbt_path_t* path);
+size_t nbt_path_get(nbt_path_t* path, nbt_tag_t* tag, nbt_tag_t** results, size_t max_results);
+size_t nbt_path_get_memory(nbt_path_t* path, const void* data, size_t size, int parse_flags, nbt_tag_t** results, size_t max_results);
+size_t nbt_path_get_memory_ex(nbt_context_t* context, nbt_path_t* path, const void* data, size_t size, int parse_flags, nbt_tag_t** results, size_t max_results);
+
+nbt_columns_t* nbt_new_columns(void);
+void nbt_free_columns(nbt_columns_t* columns);
+int nbt_columns_add(nbt_columns_t* columns, const char* path, nbt_tag_type_t type);
+nbt_column_t* nbt_columns_get(nbt_columns_t* columns, size_t index);
+void nbt_columns_clear(nbt_columns_t* columns);
+void nbt_columns_append(nbt_columns_t* columns, nbt_tag_t* tag);
+int nbt_columns_append_memory(nbt_columns_t* columns, const void* data, size_t size, int parse_flags);
+int nbt_columns_append_memory_ex(nbt_context_t* context, nbt_columns_t* columns, const void* data, size_t size, int parse_flags);
+void nbt_columns_write_csv(nbt_columns_t* columns, nbt_writer_t writer);
+void nbt_columns_write_binary(nbt_columns_t* columns, nbt_writer_t writer);
+
+uint8_t* nbt_write_memory(nbt_tag_t* tag, int write_flags, size_t* size);
+uint8_t* nbt_write_memory_ex(nbt_context_t* context, nbt_tag_t* tag, int write_flags, size_t* size);
+size_t nbt_write_memory_to(nbt_tag_t* tag, int write_flags, void* buffer, size_t capacity);
+size_t nbt_write_memory_to_ex(nbt_context_t* context, nbt_tag_t* tag, int write_flags, void* buffer, size_t capacity);
+
+void nbt_write_snbt(nbt_writer_t writer, nbt_tag_t* tag);
+void nbt_write_json(nbt_writer_t writer, nbt_tag_t* tag);
+
 nbt_tag_t* nbt_new_tag_byte(int8_t value);
 nbt_tag_t* nbt_new_tag_short(int16_t value);
 nbt_tag_t* nbt_new_tag_int(int32_t value);
@@ -170,9 +393,12 @@ void nbt_tag_list_append(nbt_tag_t* list, nbt_tag_t* value);
 nbt_tag_t* nbt_tag_list_get(nbt_tag_t* tag, size_t index);
 void nbt_tag_compound_append(nbt_tag_t* compound, nbt_tag_t* value);
 nbt_tag_t* nbt_tag_compound_get(nbt_tag_t* tag, const char* key);
+int nbt_tag_load(nbt_tag_t* tag);
 
 void nbt_free_tag(nbt_tag_t* tag);
 
+void nbt_tree_stats(nbt_tag_t* tag, nbt_tree_stats_t* stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -181,809 +407,7586 @@ void nbt_free_tag(nbt_tag_t* tag);
 
 #ifdef NBT_IMPLEMENTATION
 
-typedef struct {
-  uint8_t* buffer;
-  size_t buffer_offset;
-} nbt__read_stream_t;
+// clock_gettime is only declared where POSIX timers are available, which isn't the case in strict ISO C modes. C11's
+// timespec_get is used there instead, and clock() where neither is available. Without the C library there is no clock.
+#ifndef NBT_NO_STDLIB
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+#if defined(CLOCK_MONOTONIC) && (defined(__APPLE__) || (defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0))
+#define NBT__HAVE_CLOCK_GETTIME
+#elif defined(TIME_UTC)
+#define NBT__HAVE_TIMESPEC_GET
+#endif
+#endif
 
-static uint8_t nbt__get_byte(nbt__read_stream_t* stream) {
+#ifndef NBT_NO_STDIO
+#include <stdio.h>
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define NBT__HAVE_MMAP
+#endif
+#endif
 
-  return stream->buffer[stream->buffer_offset++];
+// Forces a function to be inlined, so that each call made with a constant format gets its own specialised copy.
+#if defined(_MSC_VER)
+#define NBT__INLINE static __forceinline
+#elif defined(__GNUC__)
+#define NBT__INLINE static inline __attribute__((always_inline))
+#else
+#define NBT__INLINE static inline
+#endif
 
-}
+#if (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__) || defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM64)
+#define NBT__LITTLE_ENDIAN_HOST
+#endif
 
-static int16_t nbt__get_int16(nbt__read_stream_t* stream) {
-  uint8_t bytes[2];
-  for (int i = 1; i >= 0; i--) {
-    bytes[i] = nbt__get_byte(stream);
-  }
-  return *(int16_t*)(bytes);
-}
+// Lets the allocator's bookkeeping work out how much memory a block really takes up, when using the C library's
+// allocator.
+#ifndef NBT_NO_STDLIB
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define NBT__USABLE_SIZE(pointer) malloc_usable_size(pointer)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define NBT__USABLE_SIZE(pointer) malloc_size(pointer)
+#elif defined(_WIN32)
+#include <malloc.h>
+#define NBT__USABLE_SIZE(pointer) _msize(pointer)
+#endif
+#endif
 
-static int32_t nbt__get_int32(nbt__read_stream_t* stream) {
-  uint8_t bytes[4];
-  for (int i = 3; i >= 0; i--) {
-    bytes[i] = nbt__get_byte(stream);
+// NBT_MEMMOVE wasn't always needed, so it isn't required when NBT_NO_STDLIB is defined.
+#ifndef NBT_MEMMOVE
+static void* nbt__memmove(void* destination, const void* source, size_t size) {
+  uint8_t* out = (uint8_t*)destination;
+  const uint8_t* in = (const uint8_t*)source;
+  if (out < in) {
+    for (size_t i = 0; i < size; i++) {
+      out[i] = in[i];
+    }
+  } else {
+    for (size_t i = size; i > 0; i--) {
+      out[i - 1] = in[i - 1];
+    }
   }
-  return *(int32_t*)(bytes);
+  return destination;
 }
+#define NBT_MEMMOVE nbt__memmove
+#endif
 
-static int64_t nbt__get_int64(nbt__read_stream_t* stream) {
-  uint8_t bytes[8];
-  for (int i = 7; i >= 0; i--) {
-    bytes[i] = nbt__get_byte(stream);
-  }
-  return *(int64_t*)(bytes);
+#if defined(_MSC_VER)
+#define NBT__THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define NBT__THREAD_LOCAL __thread
+#else
+#define NBT__THREAD_LOCAL _Thread_local
+#endif
+
+// Returns a timestamp in nanoseconds, for both the budgets of the incremental writer and the instrumentation below. This
+// is monotonic where possible, and otherwise the time of day. clock() is a last resort, as it measures the processor time
+// used by every thread, which isn't wall time. Without the C library this always returns 0, so time budgets never run out.
+static uint64_t nbt__get_time_ns(void) {
+#if defined(NBT__HAVE_CLOCK_GETTIME)
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#elif defined(NBT__HAVE_TIMESPEC_GET)
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#elif !defined(NBT_NO_STDLIB)
+  uint64_t ticks = (uint64_t)clock();
+  return ticks / CLOCKS_PER_SEC * 1000000000 + ticks % CLOCKS_PER_SEC * 1000000000 / CLOCKS_PER_SEC;
+#else
+  return 0;
+#endif
 }
 
-static float nbt__get_float(nbt__read_stream_t* stream) {
-  uint8_t bytes[4];
-  for (int i = 3; i >= 0; i--) {
-    bytes[i] = nbt__get_byte(stream);
+// Timing of each phase of parsing and writing, for working out where the time goes. This is compiled out unless
+// NBT_INSTRUMENT is defined, in which case NBT__PHASE times a statement as part of the given phase.
+#ifdef NBT_INSTRUMENT
+
+static const char* nbt__phase_names[NBT_PHASE_COUNT] = { "read", "inflate", "build", "serialize", "deflate", "write", "alloc" };
+
+typedef struct {
+  uint64_t time_ns[NBT_PHASE_COUNT];
+  uint64_t calls[NBT_PHASE_COUNT];
+  uint32_t alloc_calls;
+  uint64_t clock_cost; // Time taken to read the clock, or 0 if not measured yet.
+  int tracing;
+  int trace_first; // Whether the next trace event is the first, so needs no comma before it.
+  uint64_t trace_start;
+  nbt_writer_t trace_writer;
+  size_t trace_size;
+  char trace_buffer[4096];
+} nbt__instrument_state_t;
+
+static NBT__THREAD_LOCAL nbt__instrument_state_t nbt__instrument;
+
+static void nbt__trace_flush(void) {
+  nbt__instrument_state_t* state = &nbt__instrument;
+  size_t offset = 0;
+  while (offset < state->trace_size) {
+    size_t bytes_written = state->trace_writer.write(state->trace_writer.userdata, (uint8_t*)state->trace_buffer + offset, state->trace_size - offset);
+    if (bytes_written == 0) {
+      break;
+    }
+    offset += bytes_written;
   }
-  return *(float*)(bytes);
+  state->trace_size = 0;
 }
 
-static double nbt__get_double(nbt__read_stream_t* stream) {
-  uint8_t bytes[8];
-  for (int i = 7; i >= 0; i--) {
-    bytes[i] = nbt__get_byte(stream);
+static void nbt__trace_put(const char* text) {
+  nbt__instrument_state_t* state = &nbt__instrument;
+  while (*text) {
+    if (state->trace_size == sizeof(state->trace_buffer)) {
+      nbt__trace_flush();
+    }
+    state->trace_buffer[state->trace_size++] = *text++;
   }
-  return *(double*)(bytes);
 }
 
-static nbt_tag_t* nbt__parse(nbt__read_stream_t* stream, int parse_name, nbt_tag_type_t override_type) {
-
-  nbt_tag_t* tag = (nbt_tag_t*)NBT_MALLOC(sizeof(nbt_tag_t));
+static void nbt__trace_put_uint(uint64_t value) {
+  char digits[24];
+  char* p = digits + sizeof(digits);
+  *--p = '\0';
+  do {
+    *--p = (char)('0' + value % 10);
+    value /= 10;
+  } while (value > 0);
+  nbt__trace_put(p);
+}
 
-  if (override_type == NBT_NO_OVERRIDE) {
-    tag->type = nbt__get_byte(stream);
-  } else {
-    tag->type = override_type;
-  }
+// Writes a time in nanoseconds as microseconds, which is what trace files use.
+static void nbt__trace_put_time(uint64_t time_ns) {
+  char fraction[5] = { '.', (char)('0' + time_ns / 100 % 10), (char)('0' + time_ns / 10 % 10), (char)('0' + time_ns % 10), '\0' };
+  nbt__trace_put_uint(time_ns / 1000);
+  nbt__trace_put(fraction);
+}
 
-  if (parse_name && tag->type != NBT_TYPE_END) {
-    tag->name_size = nbt__get_int16(stream);
-    tag->name = (char*)NBT_MALLOC(tag->name_size + 1);
-    for (size_t i = 0; i < tag->name_size; i++) {
-      tag->name[i] = nbt__get_byte(stream);
+// Writes a complete event, with the time spent in each phase as arguments if phase_times isn't NULL.
+static void nbt__trace_event(const char* name, uint64_t start, uint64_t duration, const uint64_t* phase_times) {
+
+  nbt__instrument_state_t* state = &nbt__instrument;
+
+  nbt__trace_put(state->trace_first ? "\n" : ",\n");
+  state->trace_first = 0;
+
+  nbt__trace_put("{\"name\":\"");
+  nbt__trace_put(name);
+  nbt__trace_put("\",\"cat\":\"nbt\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+  // Each thread's state is in a different place, which is enough to tell the threads apart.
+  nbt__trace_put_uint((uint64_t)(uintptr_t)state / 64 % 1000000);
+  nbt__trace_put(",\"ts\":");
+  nbt__trace_put_time(start - state->trace_start);
+  nbt__trace_put(",\"dur\":");
+  nbt__trace_put_time(duration);
+
+  if (phase_times) {
+    nbt__trace_put(",\"args\":{");
+    for (int i = 0; i < NBT_PHASE_COUNT; i++) {
+      nbt__trace_put(i > 0 ? ",\"" : "\"");
+      nbt__trace_put(nbt__phase_names[i]);
+      nbt__trace_put("_us\":");
+      nbt__trace_put_time(phase_times[i]);
     }
-    tag->name[tag->name_size] = '\0';
-  } else {
-    tag->name = NULL;
-    tag->name_size = 0;
+    nbt__trace_put("}");
   }
 
-  switch (tag->type) {
-    case NBT_TYPE_END: {
-      // Don't do anything.
-      break;
-    }
-    case NBT_TYPE_BYTE: {
-      tag->tag_byte.value = nbt__get_byte(stream);
-      break;
-    }
-    case NBT_TYPE_SHORT: {
-      tag->tag_short.value = nbt__get_int16(stream);
-      break;
-    }
-    case NBT_TYPE_INT: {
-      tag->tag_int.value = nbt__get_int32(stream);
-      break;
-    }
-    case NBT_TYPE_LONG: {
-      tag->tag_long.value = nbt__get_int64(stream);
-      break;
-    }
-    case NBT_TYPE_FLOAT: {
-      tag->tag_float.value = nbt__get_float(stream);
-      break;
-    }
-    case NBT_TYPE_DOUBLE: {
-      tag->tag_double.value = nbt__get_double(stream);
-      break;
-    }
-    case NBT_TYPE_BYTE_ARRAY: {
-      tag->tag_byte_array.size = nbt__get_int32(stream);
-      tag->tag_byte_array.value = (int8_t*)NBT_MALLOC(tag->tag_byte_array.size);
-      for (size_t i = 0; i < tag->tag_byte_array.size; i++) {
-        tag->tag_byte_array.value[i] = nbt__get_byte(stream);
-      }
-      break;
-    }
-    case NBT_TYPE_STRING: {
-      tag->tag_string.size = nbt__get_int16(stream);
-      tag->tag_string.value = (char*)NBT_MALLOC(tag->tag_string.size + 1);
-      for (size_t i = 0; i < tag->tag_string.size; i++) {
-        tag->tag_string.value[i] = nbt__get_byte(stream);
-      }
-      tag->tag_string.value[tag->tag_string.size] = '\0';
-      break;
-    }
-    case NBT_TYPE_LIST: {
-      tag->tag_list.type = nbt__get_byte(stream);
-      tag->tag_list.size = nbt__get_int32(stream);
-      tag->tag_list.value = (nbt_tag_t**)NBT_MALLOC(tag->tag_list.size * sizeof(nbt_tag_t*));
-      for (size_t i = 0; i < tag->tag_list.size; i++) {
-        tag->tag_list.value[i] = nbt__parse(stream, 0, tag->tag_list.type);
-      }
-      break;
-    }
-    case NBT_TYPE_COMPOUND: {
-      tag->tag_compound.size = 0;
-      tag->tag_compound.value = NULL;
-      for (;;) {
-        nbt_tag_t* inner_tag = nbt__parse(stream, 1, NBT_NO_OVERRIDE);
+  nbt__trace_put("}");
 
-        if (inner_tag->type == NBT_TYPE_END) {
-          nbt_free_tag(inner_tag);
-          break;
-        } else {
-          tag->tag_compound.value = (nbt_tag_t**)NBT_REALLOC(tag->tag_compound.value, (tag->tag_compound.size + 1) * sizeof(nbt_tag_t*));
-          tag->tag_compound.value[tag->tag_compound.size] = inner_tag;
-          tag->tag_compound.size++;
-        }
-      }
-      break;
-    }
-    case NBT_TYPE_INT_ARRAY: {
-      tag->tag_int_array.size = nbt__get_int32(stream);
-      tag->tag_int_array.value = (int32_t*)NBT_MALLOC(tag->tag_int_array.size * sizeof(int32_t));
-      for (size_t i = 0; i < tag->tag_int_array.size; i++) {
-        tag->tag_int_array.value[i] = nbt__get_int32(stream);
-      }
-      break;
-    }
-    case NBT_TYPE_LONG_ARRAY: {
-      tag->tag_long_array.size = nbt__get_int32(stream);
-      tag->tag_long_array.value = (int64_t*)NBT_MALLOC(tag->tag_long_array.size * sizeof(int64_t));
-      for (size_t i = 0; i < tag->tag_long_array.size; i++) {
-        tag->tag_long_array.value[i] = nbt__get_int64(stream);
+}
+
+static void nbt__phase_end(nbt_phase_t phase, uint64_t start) {
+  nbt__instrument_state_t* state = &nbt__instrument;
+  uint64_t end = nbt__get_time_ns();
+  state->time_ns[phase] += end - start;
+  state->calls[phase]++;
+  if (state->tracing) {
+    nbt__trace_event(nbt__phase_names[phase], start, end - start, NULL);
+  }
+}
+
+#define NBT__PHASE(phase, statement) do { \
+    uint64_t nbt__phase_start = nbt__get_time_ns(); \
+    statement; \
+    nbt__phase_end(phase, nbt__phase_start); \
+  } while (0)
+
+// Adds a timed allocation to the total, less the time spent reading the clock, which is close to what most
+// allocations take.
+static void nbt__alloc_phase_end(uint64_t start) {
+  nbt__instrument_state_t* state = &nbt__instrument;
+  uint64_t end = nbt__get_time_ns();
+  if (state->clock_cost == 0) {
+    state->clock_cost = 1;
+    for (int i = 0; i < 16; i++) {
+      uint64_t a = nbt__get_time_ns();
+      uint64_t b = nbt__get_time_ns();
+      if (i == 0 || b - a < state->clock_cost) {
+        state->clock_cost = b - a > 0 ? b - a : 1;
       }
-      break;
-    }
-    default: {
-      NBT_FREE(tag);
-      return NULL;
     }
-
   }
+  if (end - start > state->clock_cost) {
+    state->time_ns[NBT_PHASE_ALLOC] += (end - start - state->clock_cost) * 16;
+  }
+}
 
-  return tag;
+// Reading the clock around every allocation would take longer than many of the allocations themselves, so only one
+// in 16 is timed and the total is scaled up to match.
+#define NBT__ALLOC_PHASE(statement) do { \
+    nbt__instrument_state_t* nbt__state = &nbt__instrument; \
+    nbt__state->calls[NBT_PHASE_ALLOC]++; \
+    if ((++nbt__state->alloc_calls & 15) == 0) { \
+      uint64_t nbt__phase_start = nbt__get_time_ns(); \
+      statement; \
+      nbt__alloc_phase_end(nbt__phase_start); \
+    } else { \
+      statement; \
+    } \
+  } while (0)
+
+void nbt_trace_begin(nbt_writer_t writer) {
+  nbt__instrument_state_t* state = &nbt__instrument;
+  state->tracing = 1;
+  state->trace_first = 1;
+  state->trace_start = nbt__get_time_ns();
+  state->trace_writer = writer;
+  state->trace_size = 0;
+  nbt__trace_put("[");
+}
 
+void nbt_trace_end(void) {
+  nbt__instrument_state_t* state = &nbt__instrument;
+  if (!state->tracing) {
+    return;
+  }
+  nbt__trace_put("\n]\n");
+  nbt__trace_flush();
+  state->tracing = 0;
 }
 
-nbt_tag_t* nbt_parse(nbt_reader_t reader, int parse_flags) {
+#else
 
-  int compressed;
-  int gzip_format;
-  switch (parse_flags & 3) {
-    case 0: { // Automatic detection (not yet implemented).
-      compressed = 1;
-      gzip_format = 1;
-      break;
-    }
-    case 1: { // gzip
-      compressed = 1;
-      gzip_format = 1;
-      break;
-    }
-    case 2: { // zlib
-      compressed = 1;
-      gzip_format = 0;
-      break;
-    }
-    case 3: { // raw
-      compressed = 0;
-      gzip_format = 0;
-      break;
-    }
-  }
+#define NBT__PHASE(phase, statement) do { statement; } while (0)
+#define NBT__ALLOC_PHASE(statement) do { statement; } while (0)
 
-  uint8_t* buffer = NULL;
-  size_t buffer_size = 0;
+void nbt_trace_begin(nbt_writer_t writer) {
+  (void)writer;
+}
 
-  nbt__read_stream_t stream;
+void nbt_trace_end(void) {
+}
 
-  if (compressed) {
-    z_stream stream;
-    stream.zalloc = Z_NULL;
-    stream.zfree = Z_NULL;
-    stream.opaque = Z_NULL;
-    stream.avail_in = 0;
-    stream.next_in = Z_NULL;
+#endif
 
-    if (gzip_format) {
-      uint8_t header[10];
-      reader.read(reader.userdata, header, 10);
-      int fhcrc = header[3] & 2;
-      int fextra = header[3] & 4;
-      int fname = header[3] & 8;
-      int fcomment = header[3] & 16;
+// Each thread has its own allocator and counters, so that workers don't contend with each other and can each be given
+// a budget.
+typedef struct {
+  nbt_allocator_t allocator;
+  int custom; // 0 to use NBT_MALLOC, NBT_REALLOC and NBT_FREE.
+  int track_sizes; // Finding out block sizes costs time, so current_bytes and peak_bytes are only kept if asked for.
+  nbt_alloc_stats_t stats;
+} nbt__alloc_state_t;
+
+static NBT__THREAD_LOCAL nbt__alloc_state_t nbt__alloc_state;
+
+// Returns the usable size of a block, or 0 if it can't be found out.
+static size_t nbt__usable_size(nbt__alloc_state_t* state, void* pointer) {
+  if (state->custom) {
+    return state->allocator.size ? state->allocator.size(state->allocator.userdata, pointer) : 0;
+  }
+#ifdef NBT__USABLE_SIZE
+  return NBT__USABLE_SIZE(pointer);
+#else
+  return 0;
+#endif
+}
 
-      (void)fextra; // I don't think many files use this.
+// Returns the size of a block for the current and peak byte counts, or 0 if they aren't being kept.
+NBT__INLINE size_t nbt__block_size(nbt__alloc_state_t* state, void* pointer) {
+  if (!state->track_sizes) {
+    return 0;
+  }
+  return nbt__usable_size(state, pointer);
+}
 
-      if (fname) {
-        uint8_t byte = 0;
-        do {
-          reader.read(reader.userdata, &byte, 1);
-        } while (byte != 0);
-      }
+NBT__INLINE void nbt__alloc_track(nbt__alloc_state_t* state, void* pointer) {
+  state->stats.current_bytes += (int64_t)nbt__block_size(state, pointer);
+  if (state->stats.current_bytes > state->stats.peak_bytes) {
+    state->stats.peak_bytes = state->stats.current_bytes;
+  }
+}
 
-      if (fcomment) {
-        uint8_t byte = 0;
-        do {
-          reader.read(reader.userdata, &byte, 1);
-        } while (byte != 0);
-      }
+static void* nbt__malloc(size_t size) {
+  nbt__alloc_state_t* state = &nbt__alloc_state;
+  void* pointer;
+  NBT__ALLOC_PHASE(pointer = state->custom ? state->allocator.malloc(state->allocator.userdata, size) : NBT_MALLOC(size));
+  if (pointer) {
+    state->stats.allocations++;
+    state->stats.allocated_bytes += size;
+    nbt__alloc_track(state, pointer);
+  }
+  return pointer;
+}
 
-      uint16_t crc;
-      if (fhcrc) {
-        reader.read(reader.userdata, (uint8_t*)&crc, 2);
-      }
+static void* nbt__realloc(void* pointer, size_t size) {
+  if (!pointer) {
+    return nbt__malloc(size);
+  }
+  nbt__alloc_state_t* state = &nbt__alloc_state;
+  size_t old_size = nbt__block_size(state, pointer);
+  void* new_pointer;
+  NBT__ALLOC_PHASE(new_pointer = state->custom ? state->allocator.realloc(state->allocator.userdata, pointer, size) : NBT_REALLOC(pointer, size));
+  if (new_pointer) {
+    state->stats.reallocations++;
+    state->stats.allocated_bytes += size;
+    state->stats.current_bytes -= (int64_t)old_size;
+    nbt__alloc_track(state, new_pointer);
+  }
+  return new_pointer;
+}
 
-      (void)crc;
+static void nbt__free(void* pointer) {
+  if (!pointer) {
+    return;
+  }
+  nbt__alloc_state_t* state = &nbt__alloc_state;
+  state->stats.frees++;
+  state->stats.current_bytes -= (int64_t)nbt__block_size(state, pointer);
+  NBT__ALLOC_PHASE(
+    if (state->custom) {
+      state->allocator.free(state->allocator.userdata, pointer);
+    } else {
+      NBT_FREE(pointer);
     }
+  );
+}
 
-    int ret = inflateInit2(&stream, gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS);
-    if (ret != Z_OK) {
-      NBT_FREE(buffer);
-      return NULL;
-    }
+// zlib's allocation functions, so that the compression state is counted too. miniz takes sizes as size_t, where zlib
+// uses uInt.
+#ifdef NBT_OWN_ZLIB
+typedef uInt nbt__zsize_t;
+#else
+typedef size_t nbt__zsize_t;
+#endif
 
-    uint8_t in_buffer[NBT_BUFFER_SIZE];
-    uint8_t out_buffer[NBT_BUFFER_SIZE];
-    do {
-      stream.avail_in = reader.read(reader.userdata, in_buffer, NBT_BUFFER_SIZE);
-      stream.next_in =  in_buffer;
+static voidpf nbt__zalloc(voidpf opaque, nbt__zsize_t items, nbt__zsize_t size) {
+  (void)opaque;
+  return nbt__malloc((size_t)items * size);
+}
 
-      do {
-        stream.avail_out = NBT_BUFFER_SIZE;
-        stream.next_out = out_buffer;
+static void nbt__zfree(voidpf opaque, voidpf address) {
+  (void)opaque;
+  nbt__free(address);
+}
 
-        ret = inflate(&stream, Z_NO_FLUSH);
+void nbt_set_allocator(const nbt_allocator_t* allocator) {
+  if (allocator) {
+    nbt__alloc_state.allocator = *allocator;
+    nbt__alloc_state.custom = 1;
+  } else {
+    nbt__alloc_state.custom = 0;
+  }
+}
 
-        size_t have = NBT_BUFFER_SIZE - stream.avail_out;
-        buffer = (uint8_t*)NBT_REALLOC(buffer, buffer_size + have);
-        NBT_MEMCPY(buffer + buffer_size, out_buffer, have);
-        buffer_size += have;
-        
-      } while (stream.avail_out == 0);
+void nbt_free(void* pointer) {
+  nbt__free(pointer);
+}
 
-      
-    } while (ret != Z_STREAM_END);
+void nbt_set_alloc_size_tracking(int enabled) {
+  nbt__alloc_state.track_sizes = enabled;
+}
 
-    inflateEnd(&stream);
-    
-  } else {
+void nbt_get_alloc_stats(nbt_alloc_stats_t* stats) {
+  *stats = nbt__alloc_state.stats;
+}
 
-    uint8_t in_buffer[NBT_BUFFER_SIZE];
-    size_t bytes_read;
-    do {
-      bytes_read = reader.read(reader.userdata, in_buffer, NBT_BUFFER_SIZE);
-      buffer = (uint8_t*)NBT_REALLOC(buffer, buffer_size + bytes_read);
-      NBT_MEMCPY(buffer + buffer_size, in_buffer, bytes_read);
-      buffer_size += bytes_read;
-    } while (bytes_read == NBT_BUFFER_SIZE);
+void nbt_reset_alloc_stats(void) {
+  nbt_alloc_stats_t* stats = &nbt__alloc_state.stats;
+  stats->allocations = 0;
+  stats->reallocations = 0;
+  stats->frees = 0;
+  stats->allocated_bytes = 0;
+  stats->current_bytes = 0;
+  stats->peak_bytes = 0;
+}
+
+// Marks the start of a call, so that the allocations made during it can be measured by nbt__alloc_measure.
+typedef struct {
+  nbt_alloc_stats_t start;
+} nbt__alloc_mark_t;
+
+static void nbt__alloc_mark(nbt__alloc_mark_t* mark) {
+  nbt_alloc_stats_t* stats = &nbt__alloc_state.stats;
+  mark->start = *stats;
+  // The peak is measured from where the call started, then put back afterwards.
+  stats->peak_bytes = stats->current_bytes;
+}
 
+static void nbt__alloc_measure(nbt__alloc_mark_t* mark, nbt_alloc_stats_t* result) {
+  nbt_alloc_stats_t* stats = &nbt__alloc_state.stats;
+  result->allocations = stats->allocations - mark->start.allocations;
+  result->reallocations = stats->reallocations - mark->start.reallocations;
+  result->frees = stats->frees - mark->start.frees;
+  result->allocated_bytes = stats->allocated_bytes - mark->start.allocated_bytes;
+  result->current_bytes = stats->current_bytes - mark->start.current_bytes;
+  result->peak_bytes = stats->peak_bytes - mark->start.current_bytes;
+  if (mark->start.peak_bytes > stats->peak_bytes) {
+    stats->peak_bytes = mark->start.peak_bytes;
   }
+}
 
-  stream.buffer = buffer;
-  stream.buffer_offset = 0;
+// How the tag data is encoded, which is picked by the parse and write flags.
+typedef enum {
+  NBT__FORMAT_JAVA, // Big-endian.
+  NBT__FORMAT_BEDROCK, // Little-endian.
+  NBT__FORMAT_BEDROCK_NETWORK // Little-endian, with varint ints, longs and lengths.
+} nbt__format_t;
+
+static nbt__format_t nbt__get_format(int flags) {
+  if (flags & NBT_PARSE_FLAG_BEDROCK_NETWORK) {
+    return NBT__FORMAT_BEDROCK_NETWORK;
+  } else if (flags & NBT_PARSE_FLAG_BEDROCK) {
+    return NBT__FORMAT_BEDROCK;
+  } else {
+    return NBT__FORMAT_JAVA;
+  }
+}
+
+// Fixed size loads and stores. These are written out byte by byte, which compilers turn into a single load or store
+// (with a byte swap when the byte order doesn't match the machine).
+NBT__INLINE uint16_t nbt__load_uint16(const uint8_t* data, nbt__format_t format) {
+  if (format == NBT__FORMAT_JAVA) {
+    return (uint16_t)(((uint32_t)data[0] << 8) | data[1]);
+  } else {
+    return (uint16_t)(((uint32_t)data[1] << 8) | data[0]);
+  }
+}
 
-  nbt_tag_t* tag = nbt__parse(&stream, 1, NBT_NO_OVERRIDE);
+NBT__INLINE uint32_t nbt__load_uint32(const uint8_t* data, nbt__format_t format) {
+  if (format == NBT__FORMAT_JAVA) {
+    return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+  } else {
+    return ((uint32_t)data[3] << 24) | ((uint32_t)data[2] << 16) | ((uint32_t)data[1] << 8) | data[0];
+  }
+}
 
-  NBT_FREE(buffer);
+NBT__INLINE uint64_t nbt__load_uint64(const uint8_t* data, nbt__format_t format) {
+  if (format == NBT__FORMAT_JAVA) {
+    return ((uint64_t)nbt__load_uint32(data, format) << 32) | nbt__load_uint32(data + 4, format);
+  } else {
+    return ((uint64_t)nbt__load_uint32(data + 4, format) << 32) | nbt__load_uint32(data, format);
+  }
+}
 
-  return tag;
+NBT__INLINE void nbt__store_uint16(uint8_t* data, uint16_t value, nbt__format_t format) {
+  if (format == NBT__FORMAT_JAVA) {
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+  } else {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+  }
+}
+
+NBT__INLINE void nbt__store_uint32(uint8_t* data, uint32_t value, nbt__format_t format) {
+  if (format == NBT__FORMAT_JAVA) {
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+  } else {
+    data[0] = (uint8_t)value;
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)(value >> 16);
+    data[3] = (uint8_t)(value >> 24);
+  }
+}
+
+NBT__INLINE void nbt__store_uint64(uint8_t* data, uint64_t value, nbt__format_t format) {
+  if (format == NBT__FORMAT_JAVA) {
+    nbt__store_uint32(data, (uint32_t)(value >> 32), format);
+    nbt__store_uint32(data + 4, (uint32_t)value, format);
+  } else {
+    nbt__store_uint32(data, (uint32_t)value, format);
+    nbt__store_uint32(data + 4, (uint32_t)(value >> 32), format);
+  }
+}
+
+// Zigzag encoding maps small negative numbers to small varints.
+static uint64_t nbt__zigzag_encode(int64_t value) {
+  return value < 0 ? ~((uint64_t)value << 1) : (uint64_t)value << 1;
+}
 
+static int64_t nbt__zigzag_decode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
 }
 
 typedef struct {
-  uint8_t* buffer;
-  size_t offset;
-  size_t size;
-  size_t alloc_size;
-} nbt__write_stream_t;
+  const uint8_t* buffer;
+  size_t buffer_offset;
+} nbt__read_stream_t;
 
-void nbt__put_byte(nbt__write_stream_t* stream, uint8_t value) {
-  if (stream->offset >= stream->alloc_size - 1) {
-    stream->buffer = (uint8_t*)NBT_REALLOC(stream->buffer, stream->alloc_size * 2);
-    stream->alloc_size *= 2;
+NBT__INLINE uint8_t nbt__get_byte(nbt__read_stream_t* stream) {
+
+  return stream->buffer[stream->buffer_offset++];
+
+}
+
+NBT__INLINE void nbt__get_bytes(nbt__read_stream_t* stream, void* data, size_t size) {
+  if (size > 0) {
+    NBT_MEMCPY(data, stream->buffer + stream->buffer_offset, size);
+    stream->buffer_offset += size;
   }
+}
 
-  stream->buffer[stream->offset++] = value;
-  stream->size++;
+static uint64_t nbt__get_varint(nbt__read_stream_t* stream) {
+  uint64_t value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte = nbt__get_byte(stream);
+    value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      break;
+    }
+  }
+  return value;
+}
+
+NBT__INLINE int16_t nbt__get_int16(nbt__read_stream_t* stream, nbt__format_t format) {
+  uint16_t value = nbt__load_uint16(stream->buffer + stream->buffer_offset, format);
+  stream->buffer_offset += 2;
+  return (int16_t)value;
+}
+
+NBT__INLINE int32_t nbt__get_int32(nbt__read_stream_t* stream, nbt__format_t format) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    return (int32_t)nbt__zigzag_decode(nbt__get_varint(stream));
+  }
+  uint32_t value = nbt__load_uint32(stream->buffer + stream->buffer_offset, format);
+  stream->buffer_offset += 4;
+  return (int32_t)value;
+}
+
+NBT__INLINE int64_t nbt__get_int64(nbt__read_stream_t* stream, nbt__format_t format) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    return nbt__zigzag_decode(nbt__get_varint(stream));
+  }
+  uint64_t value = nbt__load_uint64(stream->buffer + stream->buffer_offset, format);
+  stream->buffer_offset += 8;
+  return (int64_t)value;
+}
+
+NBT__INLINE float nbt__get_float(nbt__read_stream_t* stream, nbt__format_t format) {
+  uint32_t bits = nbt__load_uint32(stream->buffer + stream->buffer_offset, format);
+  stream->buffer_offset += 4;
+  float value;
+  NBT_MEMCPY(&value, &bits, 4);
+  return value;
+}
+
+NBT__INLINE double nbt__get_double(nbt__read_stream_t* stream, nbt__format_t format) {
+  uint64_t bits = nbt__load_uint64(stream->buffer + stream->buffer_offset, format);
+  stream->buffer_offset += 8;
+  double value;
+  NBT_MEMCPY(&value, &bits, 8);
+  return value;
 }
 
-void nbt__put_int16(nbt__write_stream_t* stream, int16_t value) {
-  uint8_t* value_array = (uint8_t*)&value;
-  for (int i = 1; i >= 0; i--) {
-    nbt__put_byte(stream, value_array[i]);
+// Reads the length of a name or string.
+NBT__INLINE size_t nbt__get_string_size(nbt__read_stream_t* stream, nbt__format_t format) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    return (uint32_t)nbt__get_varint(stream);
   }
+  return (uint16_t)nbt__get_int16(stream, format);
 }
 
-void nbt__put_int32(nbt__write_stream_t* stream, int32_t value) {
-  uint8_t* value_array = (uint8_t*)&value;
-  for (int i = 3; i >= 0; i--) {
-    nbt__put_byte(stream, value_array[i]);
+// Int and long arrays in the machine's byte order are copied straight out of the buffer.
+NBT__INLINE void nbt__get_int32_array(nbt__read_stream_t* stream, int32_t* values, size_t size, nbt__format_t format) {
+#ifdef NBT__LITTLE_ENDIAN_HOST
+  if (format == NBT__FORMAT_BEDROCK) {
+    nbt__get_bytes(stream, values, size * sizeof(int32_t));
+    return;
+  }
+#endif
+  for (size_t i = 0; i < size; i++) {
+    values[i] = nbt__get_int32(stream, format);
   }
 }
 
-void nbt__put_int64(nbt__write_stream_t* stream, int64_t value) {
-  uint8_t* value_array = (uint8_t*)&value;
-  for (int i = 7; i >= 0; i--) {
-    nbt__put_byte(stream, value_array[i]);
+NBT__INLINE void nbt__get_int64_array(nbt__read_stream_t* stream, int64_t* values, size_t size, nbt__format_t format) {
+#ifdef NBT__LITTLE_ENDIAN_HOST
+  if (format == NBT__FORMAT_BEDROCK) {
+    nbt__get_bytes(stream, values, size * sizeof(int64_t));
+    return;
+  }
+#endif
+  for (size_t i = 0; i < size; i++) {
+    values[i] = nbt__get_int64(stream, format);
   }
 }
 
-void nbt__put_float(nbt__write_stream_t* stream, float value) {
-  uint8_t* value_array = (uint8_t*)&value;
-  for (int i = 3; i >= 0; i--) {
-    nbt__put_byte(stream, value_array[i]);
+typedef enum {
+  NBT__SCAN_NEED_MORE,
+  NBT__SCAN_DONE,
+  NBT__SCAN_ERROR
+} nbt__scan_status_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t list_type;
+  uint32_t list_remaining;
+} nbt__scan_frame_t;
+
+// Reads a varint at *p, moving p past it. Like the other nbt__scan_ helpers, this returns NBT__SCAN_DONE once the
+// value has been read.
+static nbt__scan_status_t nbt__scan_varint(const uint8_t* buffer, size_t size, size_t* p, uint64_t* value) {
+  uint64_t result = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    if (*p >= size) {
+      return NBT__SCAN_NEED_MORE;
+    }
+    uint8_t byte = buffer[(*p)++];
+    result |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      *value = result;
+      return NBT__SCAN_DONE;
+    }
   }
+  return NBT__SCAN_ERROR; // Too long.
 }
 
-void nbt__put_double(nbt__write_stream_t* stream, double value) {
-  uint8_t* value_array = (uint8_t*)&value;
-  for (int i = 7; i >= 0; i--) {
-    nbt__put_byte(stream, value_array[i]);
+// Reads the length of a name or string if string is set, or of a list or array otherwise.
+static nbt__scan_status_t nbt__scan_length(const uint8_t* buffer, size_t size, size_t* p, int string, nbt__format_t format, uint32_t* length) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    uint64_t value;
+    nbt__scan_status_t status = nbt__scan_varint(buffer, size, p, &value);
+    if (status != NBT__SCAN_DONE) {
+      return status;
+    }
+    if (!string) {
+      int64_t signed_value = nbt__zigzag_decode(value);
+      if (signed_value < 0 || signed_value > 0x7fffffff) {
+        return NBT__SCAN_ERROR;
+      }
+      value = (uint64_t)signed_value;
+    } else if (value > 0xffffffff) {
+      return NBT__SCAN_ERROR;
+    }
+    *length = (uint32_t)value;
+  } else if (string) {
+    if (*p + 2 > size) {
+      return NBT__SCAN_NEED_MORE;
+    }
+    *length = nbt__load_uint16(buffer + *p, format);
+    *p += 2;
+  } else {
+    if (*p + 4 > size) {
+      return NBT__SCAN_NEED_MORE;
+    }
+    *length = nbt__load_uint32(buffer + *p, format);
+    if (*length & 0x80000000) {
+      return NBT__SCAN_ERROR;
+    }
+    *p += 4;
   }
+  return NBT__SCAN_DONE;
 }
 
-void nbt__write_tag(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type) {
+// Skips past the payload of a tag of the given type, which starts at *p. Lists only have their element type and
+// length skipped, and the element type is returned through list_type. The length of a list, array or string is
+// returned through length.
+NBT__INLINE nbt__scan_status_t nbt__scan_payload(const uint8_t* buffer, size_t size, size_t* p, int type, nbt__format_t format, uint8_t* list_type, uint32_t* length) {
+
+  int varints = format == NBT__FORMAT_BEDROCK_NETWORK;
+  nbt__scan_status_t status;
+  uint64_t value;
+
+  switch (type) {
+    case NBT_TYPE_BYTE: *p += 1; break;
+    case NBT_TYPE_SHORT: *p += 2; break;
+    case NBT_TYPE_FLOAT: *p += 4; break;
+    case NBT_TYPE_DOUBLE: *p += 8; break;
+    case NBT_TYPE_INT:
+    case NBT_TYPE_LONG: {
+      if (!varints) {
+        *p += type == NBT_TYPE_INT ? 4 : 8;
+      } else if ((status = nbt__scan_varint(buffer, size, p, &value)) != NBT__SCAN_DONE) {
+        return status;
+      }
+      break;
+    }
+    case NBT_TYPE_BYTE_ARRAY:
+    case NBT_TYPE_INT_ARRAY:
+    case NBT_TYPE_LONG_ARRAY: {
+      status = nbt__scan_length(buffer, size, p, 0, format, length);
+      if (status != NBT__SCAN_DONE) {
+        return status;
+      }
+      if (type == NBT_TYPE_BYTE_ARRAY || !varints) {
+        size_t element_size = type == NBT_TYPE_BYTE_ARRAY ? 1 : (type == NBT_TYPE_INT_ARRAY ? 4 : 8);
+        *p += (size_t)*length * element_size;
+      } else {
+        for (uint32_t i = 0; i < *length; i++) {
+          if ((status = nbt__scan_varint(buffer, size, p, &value)) != NBT__SCAN_DONE) {
+            return status;
+          }
+        }
+      }
+      break;
+    }
+    case NBT_TYPE_STRING: {
+      status = nbt__scan_length(buffer, size, p, 1, format, length);
+      if (status != NBT__SCAN_DONE) {
+        return status;
+      }
+      *p += *length;
+      break;
+    }
+    case NBT_TYPE_LIST: {
+      if (*p + 1 > size) {
+        return NBT__SCAN_NEED_MORE;
+      }
+      *list_type = buffer[(*p)++];
+      status = nbt__scan_length(buffer, size, p, 0, format, length);
+      if (status != NBT__SCAN_DONE) {
+        return status;
+      }
+      if (*list_type > NBT_TYPE_LONG_ARRAY || (*list_type == NBT_TYPE_END && *length > 0)) {
+        return NBT__SCAN_ERROR;
+      }
+      break;
+    }
+    case NBT_TYPE_COMPOUND: {
+      break;
+    }
+    default: {
+      return NBT__SCAN_ERROR;
+    }
+  }
+
+  return *p > size ? NBT__SCAN_NEED_MORE : NBT__SCAN_DONE;
 
-  if (write_type) {
-    nbt__put_byte(stream, tag->type);
+}
+
+// Returns the size of a tag's payload if it's always the same, or 0 if it depends on the tag.
+NBT__INLINE size_t nbt__fixed_payload_size(int type, nbt__format_t format) {
+  switch (type) {
+    case NBT_TYPE_BYTE: return 1;
+    case NBT_TYPE_SHORT: return 2;
+    case NBT_TYPE_FLOAT: return 4;
+    case NBT_TYPE_DOUBLE: return 8;
+    case NBT_TYPE_INT: return format == NBT__FORMAT_BEDROCK_NETWORK ? 0 : 4;
+    case NBT_TYPE_LONG: return format == NBT__FORMAT_BEDROCK_NETWORK ? 0 : 8;
+    default: return 0;
   }
+}
 
-  if (write_name && tag->type != NBT_TYPE_END) {
-    nbt__put_int16(stream, tag->name_size);
-    for (size_t i = 0; i < tag->name_size; i++) {
-      nbt__put_byte(stream, tag->name[i]);
+// Skips past the payload of a tag of the given type, along with everything inside it if it's a list or compound. The
+// stack starts out in local_frames, and is only allocated if the data is nested deeper than local_size.
+static nbt__scan_status_t nbt__skip_payload_frames(const uint8_t* buffer, size_t size, size_t* p, int type, nbt__format_t format, nbt__scan_frame_t* local_frames, size_t local_size) {
+
+  nbt__scan_frame_t* frames = local_frames;
+  size_t frames_alloc_size = local_size;
+  size_t depth = 0;
+  nbt__scan_status_t status;
+
+  for (;;) {
+
+    uint8_t list_type = 0;
+    uint32_t list_length = 0;
+
+    status = nbt__scan_payload(buffer, size, p, type, format, &list_type, &list_length);
+    if (status != NBT__SCAN_DONE) {
+      break;
+    }
+
+    // Lists of numbers can be skipped in one go.
+    size_t element_size = type == NBT_TYPE_LIST ? nbt__fixed_payload_size(list_type, format) : 0;
+    if (element_size) {
+      *p += (size_t)list_length * element_size;
+      list_length = 0;
+      if (*p > size) {
+        status = NBT__SCAN_NEED_MORE;
+        break;
+      }
+    }
+
+    if (type == NBT_TYPE_LIST || type == NBT_TYPE_COMPOUND) {
+      if (depth == NBT_MAX_DEPTH) {
+        status = NBT__SCAN_ERROR;
+        break;
+      }
+
+      if (depth == frames_alloc_size) {
+        frames_alloc_size *= 2;
+        if (frames == local_frames) {
+          frames = (nbt__scan_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__scan_frame_t));
+          NBT_MEMCPY(frames, local_frames, local_size * sizeof(nbt__scan_frame_t));
+        } else {
+          frames = (nbt__scan_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__scan_frame_t));
+        }
+      }
+
+      frames[depth].type = (uint8_t)type;
+      frames[depth].list_type = list_type;
+      frames[depth].list_remaining = list_length;
+      depth++;
+    }
+
+    // Find the next tag, moving back up past any lists and compounds which are finished.
+    type = NBT_TYPE_END;
+
+    while (depth > 0) {
+      nbt__scan_frame_t* frame = &frames[depth - 1];
+
+      if (frame->type == NBT_TYPE_LIST) {
+        if (frame->list_remaining > 0) {
+          frame->list_remaining--;
+          type = frame->list_type;
+          break;
+        }
+      } else {
+        if (*p + 1 > size) {
+          status = NBT__SCAN_NEED_MORE;
+          break;
+        }
+        type = buffer[(*p)++];
+        if (type != NBT_TYPE_END) {
+          uint32_t length;
+          status = nbt__scan_length(buffer, size, p, 1, format, &length);
+          if (status == NBT__SCAN_DONE) {
+            *p += length;
+          }
+          break;
+        }
+      }
+
+      depth--;
+    }
+
+    if (status != NBT__SCAN_DONE || type == NBT_TYPE_END) {
+      break;
+    }
+
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+  return status;
+
+}
+
+static nbt__scan_status_t nbt__skip_payload(const uint8_t* buffer, size_t size, size_t* p, int type, nbt__format_t format) {
+  nbt__scan_frame_t local_frames[32];
+  return nbt__skip_payload_frames(buffer, size, p, type, format, local_frames, 32);
+}
+
+// With NBT_PARSE_FLAG_PREALLOCATE, the whole structure is allocated as a single block which starts with the root tag,
+// so freeing the root tag frees everything. These are set in a tag's flags for the parts of it which are in the block,
+// and so mustn't be freed or reallocated separately.
+typedef enum {
+  NBT__IN_BLOCK_TAG = 1,
+  NBT__IN_BLOCK_NAME = 2,
+  NBT__IN_BLOCK_VALUE = 4
+} nbt__block_flags_t;
+
+// Names are normally allocated separately, but with NBT_COMPACT_TAGS short ones are kept in the tag itself, so these
+// are used wherever a tag's name is created or freed.
+NBT__INLINE int nbt__name_on_heap(nbt_tag_t* tag) {
+  if (tag->flags & NBT__IN_BLOCK_NAME) {
+    return 0;
+  }
+#ifdef NBT_COMPACT_TAGS
+  return tag->name && tag->name != tag->name_inline;
+#else
+  return tag->name != NULL;
+#endif
+}
+
+// Makes room for a name of the given size, returning where it should be copied to. The caller adds the terminator.
+NBT__INLINE char* nbt__alloc_name(nbt_tag_t* tag, size_t size) {
+  tag->flags &= ~NBT__IN_BLOCK_NAME;
+  tag->name_size = size;
+#ifdef NBT_COMPACT_TAGS
+  if (size < sizeof(tag->name_inline)) {
+    tag->name = tag->name_inline;
+    return tag->name;
+  }
+#endif
+  tag->name = (char*)nbt__malloc(size + 1);
+  return tag->name;
+}
+
+// Gives a tag a name which was allocated with nbt__malloc and is already terminated, taking ownership of it.
+NBT__INLINE void nbt__take_name(nbt_tag_t* tag, char* name, size_t size) {
+#ifdef NBT_COMPACT_TAGS
+  if (size < sizeof(tag->name_inline)) {
+    NBT_MEMCPY(nbt__alloc_name(tag, size), name, size + 1);
+    nbt__free(name);
+    return;
+  }
+#endif
+  tag->name = name;
+  tag->name_size = size;
+}
+
+NBT__INLINE void nbt__free_name(nbt_tag_t* tag) {
+  if (nbt__name_on_heap(tag)) {
+    nbt__free(tag->name);
+  }
+}
+
+// Reads a tag's name, if it has one. Returns 0 if the name can't be stored.
+NBT__INLINE int nbt__parse_name(nbt__read_stream_t* stream, nbt_tag_t* tag, int parse_name, nbt__format_t format) {
+  if (parse_name && tag->type != NBT_TYPE_END) {
+    size_t name_size = nbt__get_string_size(stream, format);
+#ifdef NBT_COMPACT_TAGS
+    if (name_size > 0xFFFF) {
+      return 0; // Too long to store (only possible in the Bedrock network format).
     }
+#endif
+    char* name = nbt__alloc_name(tag, name_size);
+    nbt__get_bytes(stream, name, name_size);
+    name[name_size] = '\0';
+  } else {
+    tag->name = NULL;
+    tag->name_size = 0;
+  }
+  return 1;
+}
+
+// With NBT_PARSE_FLAG_LAZY, lists and compounds deep enough in the tree are only skipped over while parsing, and
+// remember where their contents are so they can be parsed when they are first used. All of them share the parsed data,
+// which is freed along with the last of them.
+typedef struct {
+  size_t refs;
+  uint8_t* data;
+  size_t size;
+} nbt__lazy_buffer_t;
+
+// The contents of a list or compound which haven't been parsed yet. The tag's value points to this, with the bottom bit
+// set to tell it apart from an array of tags, and its size is 0.
+typedef struct {
+  nbt__lazy_buffer_t* buffer;
+  size_t offset; // Start of the payload.
+  size_t size;
+  nbt__format_t format;
+} nbt__lazy_tag_t;
+
+typedef struct {
+  nbt__lazy_buffer_t* buffer;
+  size_t depth; // Lists and compounds at this depth or below are left unparsed.
+} nbt__lazy_parse_t;
+
+NBT__INLINE nbt__lazy_tag_t* nbt__get_lazy(nbt_tag_t* tag) {
+  uintptr_t value;
+  if (tag->type == NBT_TYPE_LIST) {
+    value = (uintptr_t)tag->tag_list.value;
+  } else if (tag->type == NBT_TYPE_COMPOUND) {
+    value = (uintptr_t)tag->tag_compound.value;
+  } else {
+    return NULL;
+  }
+  return (value & 1) ? (nbt__lazy_tag_t*)(value - 1) : NULL;
+}
+
+static void nbt__lazy_release(nbt__lazy_tag_t* lazy_tag) {
+  nbt__lazy_buffer_t* buffer = lazy_tag->buffer;
+  if (--buffer->refs == 0) {
+    nbt__free(buffer->data);
+    nbt__free(buffer);
+  }
+  nbt__free(lazy_tag);
+}
+
+// Parses a single tag. Lists and compounds are left empty, to be filled in by nbt__parse, with the number of elements
+// a list should have being returned through list_size.
+NBT__INLINE nbt_tag_t* nbt__parse_tag(nbt__read_stream_t* stream, int parse_name, nbt_tag_type_t override_type, size_t* list_size, nbt__format_t format) {
+
+  nbt_tag_t* tag = (nbt_tag_t*)nbt__malloc(sizeof(nbt_tag_t));
+  tag->flags = 0;
+
+  if (override_type == NBT_NO_OVERRIDE) {
+    tag->type = nbt__get_byte(stream);
+  } else {
+    tag->type = override_type;
+  }
+
+  if (!nbt__parse_name(stream, tag, parse_name, format)) {
+    nbt__free(tag);
+    return NULL;
   }
 
   switch (tag->type) {
     case NBT_TYPE_END: {
-      // Do nothing.
+      // Don't do anything.
       break;
     }
     case NBT_TYPE_BYTE: {
-      nbt__put_byte(stream, tag->tag_byte.value);
+      tag->tag_byte.value = nbt__get_byte(stream);
       break;
     }
     case NBT_TYPE_SHORT: {
-      nbt__put_int16(stream, tag->tag_short.value);
+      tag->tag_short.value = nbt__get_int16(stream, format);
       break;
     }
     case NBT_TYPE_INT: {
-      nbt__put_int32(stream, tag->tag_int.value);
+      tag->tag_int.value = nbt__get_int32(stream, format);
       break;
     }
     case NBT_TYPE_LONG: {
-      nbt__put_int64(stream, tag->tag_long.value);
+      tag->tag_long.value = nbt__get_int64(stream, format);
       break;
     }
     case NBT_TYPE_FLOAT: {
-      nbt__put_float(stream, tag->tag_float.value);
+      tag->tag_float.value = nbt__get_float(stream, format);
       break;
     }
     case NBT_TYPE_DOUBLE: {
-      nbt__put_double(stream, tag->tag_double.value);
+      tag->tag_double.value = nbt__get_double(stream, format);
       break;
     }
     case NBT_TYPE_BYTE_ARRAY: {
-      nbt__put_int32(stream, tag->tag_byte_array.size);
-      for (size_t i = 0; i < tag->tag_byte_array.size; i++) {
-        nbt__put_byte(stream, tag->tag_byte_array.value[i]);
+      int32_t size = nbt__get_int32(stream, format);
+      if (size < 0) {
+        break;
       }
-      break;
+      tag->tag_byte_array.size = size;
+      tag->tag_byte_array.value = (int8_t*)nbt__malloc(tag->tag_byte_array.size);
+      nbt__get_bytes(stream, tag->tag_byte_array.value, tag->tag_byte_array.size);
+      return tag;
     }
     case NBT_TYPE_STRING: {
-      nbt__put_int16(stream, tag->tag_string.size);
-      for (size_t i = 0; i < tag->tag_string.size; i++) {
-        nbt__put_byte(stream, tag->tag_string.value[i]);
-      }
+      tag->tag_string.size = nbt__get_string_size(stream, format);
+      tag->tag_string.value = (char*)nbt__malloc(tag->tag_string.size + 1);
+      nbt__get_bytes(stream, tag->tag_string.value, tag->tag_string.size);
+      tag->tag_string.value[tag->tag_string.size] = '\0';
       break;
     }
     case NBT_TYPE_LIST: {
-      nbt__put_byte(stream, tag->tag_list.type);
-      nbt__put_int32(stream, tag->tag_list.size);
-      for (size_t i = 0; i < tag->tag_list.size; i++) {
-        nbt__write_tag(stream, tag->tag_list.value[i], 0, 0);
+      tag->tag_list.type = nbt__get_byte(stream);
+      int32_t size = nbt__get_int32(stream, format);
+      if (size < 0 || tag->tag_list.type > NBT_TYPE_LONG_ARRAY) {
+        break;
       }
-      break;
+      // The size is filled in as the elements are parsed, so that the tag can be freed part way through.
+      *list_size = size;
+      tag->tag_list.size = 0;
+      tag->tag_list.value = (nbt_tag_t**)nbt__malloc(size * sizeof(nbt_tag_t*));
+      return tag;
     }
     case NBT_TYPE_COMPOUND: {
-      for (size_t i = 0; i < tag->tag_compound.size; i++) {
-        nbt__write_tag(stream, tag->tag_compound.value[i], 1, 1);
-      }
-      nbt__put_byte(stream, 0); // End tag.
+      tag->tag_compound.size = 0;
+      tag->tag_compound.value = NULL;
       break;
     }
     case NBT_TYPE_INT_ARRAY: {
-      nbt__put_int32(stream, tag->tag_int_array.size);
-      for (size_t i = 0; i < tag->tag_int_array.size; i++) {
-        nbt__put_int32(stream, tag->tag_int_array.value[i]);
+      int32_t size = nbt__get_int32(stream, format);
+      if (size < 0) {
+        break;
       }
-      break;
+      tag->tag_int_array.size = size;
+      tag->tag_int_array.value = (int32_t*)nbt__malloc(tag->tag_int_array.size * sizeof(int32_t));
+      nbt__get_int32_array(stream, tag->tag_int_array.value, tag->tag_int_array.size, format);
+      return tag;
     }
     case NBT_TYPE_LONG_ARRAY: {
-      nbt__put_int32(stream, tag->tag_long_array.size);
-      for (size_t i = 0; i < tag->tag_long_array.size; i++) {
-        nbt__put_int64(stream, tag->tag_long_array.value[i]);
+      int32_t size = nbt__get_int32(stream, format);
+      if (size < 0) {
+        break;
       }
-      break;
+      tag->tag_long_array.size = size;
+      tag->tag_long_array.value = (int64_t*)nbt__malloc(tag->tag_long_array.size * sizeof(int64_t));
+      nbt__get_int64_array(stream, tag->tag_long_array.value, tag->tag_long_array.size, format);
+      return tag;
     }
     default: {
-      break;
+      nbt__free_name(tag);
+      nbt__free(tag);
+      return NULL;
     }
   }
 
+  if (tag->type == NBT_TYPE_BYTE_ARRAY || tag->type == NBT_TYPE_LIST || tag->type == NBT_TYPE_INT_ARRAY || tag->type == NBT_TYPE_LONG_ARRAY) {
+    // Negative length or bad list type.
+    nbt__free_name(tag);
+    nbt__free(tag);
+    return NULL;
+  }
+
+  return tag;
+
 }
 
-uint32_t nbt__crc_table[256];
+// Parses a single tag like nbt__parse_tag, except that lists and compounds are skipped over and left to be parsed
+// later.
+static nbt_tag_t* nbt__parse_lazy_tag(nbt__read_stream_t* stream, int parse_name, nbt_tag_type_t override_type, size_t* list_size, nbt__format_t format, nbt__lazy_parse_t* lazy) {
 
-int nbt__crc_table_computed = 0;
+  nbt__lazy_buffer_t* buffer = lazy->buffer;
 
-void nbt__make_crc_table(void) {
-  unsigned long c;
-  int n, k;
+  int type = override_type;
+  if (override_type == NBT_NO_OVERRIDE) {
+    if (stream->buffer_offset >= buffer->size) {
+      return NULL;
+    }
+    type = buffer->data[stream->buffer_offset];
+  }
 
-  for (n = 0; n < 256; n++) {
-    c = (uint32_t)n;
-    for (k = 0; k < 8; k++) {
-      if (c & 1) {
-        c = 0xedb88320L ^ (c >> 1);
-      } else {
-        c = c >> 1;
+  if (type != NBT_TYPE_LIST && type != NBT_TYPE_COMPOUND) {
+    return nbt__parse_tag(stream, parse_name, override_type, list_size, format);
+  }
+
+  nbt_tag_t* tag = (nbt_tag_t*)nbt__malloc(sizeof(nbt_tag_t));
+  tag->type = (NBT__TAG_TYPE)type;
+  tag->flags = 0;
+  if (override_type == NBT_NO_OVERRIDE) {
+    stream->buffer_offset++;
+  }
+
+  if (!nbt__parse_name(stream, tag, parse_name, format)) {
+    nbt__free(tag);
+    return NULL;
+  }
+
+  // The whole buffer was checked by nbt_validate before parsing started, so this only needs to find where the contents
+  // end. They can then be parsed later without running off the end of the data.
+  size_t offset = stream->buffer_offset;
+  size_t end = offset;
+  if (offset > buffer->size || nbt__skip_payload(buffer->data, buffer->size, &end, type, format) != NBT__SCAN_DONE) {
+    nbt__free_name(tag);
+    nbt__free(tag);
+    return NULL;
+  }
+  stream->buffer_offset = end;
+
+  nbt__lazy_tag_t* lazy_tag = (nbt__lazy_tag_t*)nbt__malloc(sizeof(nbt__lazy_tag_t));
+  lazy_tag->buffer = buffer;
+  lazy_tag->offset = offset;
+  lazy_tag->size = end - offset;
+  lazy_tag->format = format;
+  buffer->refs++;
+
+  nbt_tag_t** value = (nbt_tag_t**)((uintptr_t)lazy_tag | 1);
+  if (type == NBT_TYPE_LIST) {
+    tag->tag_list.type = (NBT__TAG_TYPE)buffer->data[offset];
+    tag->tag_list.value = value;
+    tag->tag_list.size = 0;
+  } else {
+    tag->tag_compound.value = value;
+    tag->tag_compound.size = 0;
+  }
+
+  return tag;
+
+}
+
+typedef struct {
+  nbt_tag_t* tag;
+  size_t size; // Number of list elements to parse, or the capacity of a compound's value array.
+} nbt__parse_frame_t;
+
+// Parses a tag and everything inside it. Rather than recursing for each list and compound, the tags which are still
+// being filled in are kept on an explicit stack, which is limited to NBT_MAX_DEPTH entries. This is inlined into
+// nbt__parse once for each format.
+NBT__INLINE nbt_tag_t* nbt__parse_format(nbt__read_stream_t* stream, int parse_name, nbt_tag_type_t override_type, nbt__format_t format, nbt__lazy_parse_t* lazy) {
+
+  nbt__parse_frame_t local_frames[32];
+  nbt__parse_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+  nbt_tag_t* root = NULL;
+
+  for (;;) {
+
+    size_t list_size = 0;
+    nbt_tag_t* tag;
+    if (lazy && depth >= lazy->depth) {
+      tag = nbt__parse_lazy_tag(stream, parse_name, override_type, &list_size, format, lazy);
+    } else {
+      tag = nbt__parse_tag(stream, parse_name, override_type, &list_size, format);
+    }
+    if (!tag) {
+      break; // Parsing failed.
+    }
+
+    // Add the tag to whatever it's inside of.
+    if (depth == 0) {
+      root = tag;
+    } else {
+      nbt__parse_frame_t* frame = &frames[depth - 1];
+      nbt_tag_t* parent = frame->tag;
+
+      if (parent->type == NBT_TYPE_LIST) {
+        parent->tag_list.value[parent->tag_list.size++] = tag;
+      } else if (tag->type != NBT_TYPE_END) {
+        // Grow the value array geometrically, then trim it once the compound is complete.
+        if (parent->tag_compound.size == frame->size) {
+          frame->size = frame->size ? frame->size * 2 : 8;
+          parent->tag_compound.value = (nbt_tag_t**)nbt__realloc(parent->tag_compound.value, frame->size * sizeof(nbt_tag_t*));
+        }
+        parent->tag_compound.value[parent->tag_compound.size++] = tag;
+      } else {
+        nbt__free(tag);
+        tag = NULL;
+        if (parent->tag_compound.size > 0 && parent->tag_compound.size < frame->size) {
+          parent->tag_compound.value = (nbt_tag_t**)nbt__realloc(parent->tag_compound.value, parent->tag_compound.size * sizeof(nbt_tag_t*));
+        }
+        depth--;
+      }
+    }
+
+    // Lists and compounds need their contents parsing before moving on, unless they are being left until later.
+    if (tag && (tag->type == NBT_TYPE_LIST || tag->type == NBT_TYPE_COMPOUND) && !(lazy && nbt__get_lazy(tag))) {
+      if (depth == NBT_MAX_DEPTH) {
+        depth++; // Makes sure the partially parsed tree is freed.
+        break;
+      }
+
+      if (depth == frames_alloc_size) {
+        frames_alloc_size *= 2;
+        if (frames == local_frames) {
+          frames = (nbt__parse_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__parse_frame_t));
+          NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+        } else {
+          frames = (nbt__parse_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__parse_frame_t));
+        }
+      }
+
+      frames[depth].tag = tag;
+      frames[depth].size = tag->type == NBT_TYPE_LIST ? list_size : 0;
+      depth++;
+    }
+
+    // Move back up the stack past any lists which are complete.
+    while (depth > 0 && frames[depth - 1].tag->type == NBT_TYPE_LIST && frames[depth - 1].tag->tag_list.size == frames[depth - 1].size) {
+      depth--;
+    }
+
+    if (depth == 0) {
+      break; // The root tag is complete.
+    }
+
+    // Work out how the next tag is stored.
+    if (frames[depth - 1].tag->type == NBT_TYPE_LIST) {
+      parse_name = 0;
+      override_type = (nbt_tag_type_t)frames[depth - 1].tag->tag_list.type;
+    } else {
+      parse_name = 1;
+      override_type = NBT_NO_OVERRIDE;
+    }
+
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+  if (depth > 0) {
+    // Something went wrong part way through, and the partially parsed tree can still be freed as normal.
+    nbt_free_tag(root);
+    return NULL;
+  }
+
+  return root;
+
+}
+
+// Parses a tag and everything inside it, apart from any lists and compounds left for later if lazy isn't NULL.
+static nbt_tag_t* nbt__parse(nbt__read_stream_t* stream, int parse_name, nbt_tag_type_t override_type, nbt__format_t format, nbt__lazy_parse_t* lazy) {
+
+  switch (format) {
+    case NBT__FORMAT_BEDROCK: {
+      return nbt__parse_format(stream, parse_name, override_type, NBT__FORMAT_BEDROCK, lazy);
+    }
+    case NBT__FORMAT_BEDROCK_NETWORK: {
+      return nbt__parse_format(stream, parse_name, override_type, NBT__FORMAT_BEDROCK_NETWORK, lazy);
+    }
+    default: {
+      return nbt__parse_format(stream, parse_name, override_type, NBT__FORMAT_JAVA, lazy);
+    }
+  }
+
+}
+
+// Parses the contents of a list or compound which was left unparsed. Any lists and compounds inside it are left
+// unparsed in turn. Returns 0 if the contents couldn't be parsed, in which case the tag is left as it was.
+static int nbt__lazy_load(nbt_tag_t* tag, nbt__lazy_tag_t* lazy_tag) {
+
+  nbt__lazy_parse_t lazy;
+  lazy.buffer = lazy_tag->buffer;
+  lazy.depth = 0;
+
+  nbt__read_stream_t stream;
+  stream.buffer = lazy_tag->buffer->data;
+  stream.buffer_offset = lazy_tag->offset;
+
+  nbt__format_t format = lazy_tag->format;
+  nbt_tag_t** value = NULL;
+  size_t size = 0;
+  int error = 0;
+
+  if (tag->type == NBT_TYPE_LIST) {
+    stream.buffer_offset++; // The element type, which is already known.
+    size_t list_size = (size_t)nbt__get_int32(&stream, format);
+    if (list_size > 0) {
+      value = (nbt_tag_t**)nbt__malloc(list_size * sizeof(nbt_tag_t*));
+    }
+    while (size < list_size) {
+      nbt_tag_t* child = nbt__parse(&stream, 0, (nbt_tag_type_t)tag->tag_list.type, format, &lazy);
+      if (!child) {
+        error = 1;
+        break;
+      }
+      value[size++] = child;
+    }
+  } else {
+    size_t alloc_size = 0;
+    for (;;) {
+      nbt_tag_t* child = nbt__parse(&stream, 1, NBT_NO_OVERRIDE, format, &lazy);
+      if (!child) {
+        error = 1;
+        break;
+      }
+      if (child->type == NBT_TYPE_END) {
+        nbt__free(child);
+        break;
+      }
+      if (size == alloc_size) {
+        alloc_size = alloc_size ? alloc_size * 2 : 8;
+        value = (nbt_tag_t**)nbt__realloc(value, alloc_size * sizeof(nbt_tag_t*));
+      }
+      value[size++] = child;
+    }
+    if (size > 0 && size < alloc_size) {
+      value = (nbt_tag_t**)nbt__realloc(value, size * sizeof(nbt_tag_t*));
+    }
+  }
+
+  if (error) {
+    for (size_t i = 0; i < size; i++) {
+      nbt_free_tag(value[i]);
+    }
+    nbt__free(value);
+    return 0;
+  }
+
+  if (tag->type == NBT_TYPE_LIST) {
+    tag->tag_list.value = value;
+    tag->tag_list.size = size;
+  } else {
+    tag->tag_compound.value = value;
+    tag->tag_compound.size = size;
+  }
+
+  nbt__lazy_release(lazy_tag);
+
+  return 1;
+
+}
+
+// Makes sure a list or compound has been parsed, returning 0 if that fails.
+NBT__INLINE int nbt__load(nbt_tag_t* tag) {
+  nbt__lazy_tag_t* lazy_tag = nbt__get_lazy(tag);
+  return lazy_tag ? nbt__lazy_load(tag, lazy_tag) : 1;
+}
+
+int nbt_tag_load(nbt_tag_t* tag) {
+  return nbt__load(tag);
+}
+
+struct nbt_context_t {
+  z_stream inflate_stream;
+  int inflate_window_bits; // 0 if inflate_stream has not been initialised.
+  z_stream deflate_stream;
+  int deflate_window_bits; // 0 if deflate_stream has not been initialised.
+  uint8_t* in_buffer;
+  uint8_t* out_buffer;
+  uint8_t* buffer; // Holds the decompressed data when parsing and the serialized data when writing.
+  size_t buffer_alloc_size;
+  nbt_alloc_stats_t alloc_stats; // Allocations made by the last call which used the context.
+  nbt_phase_stats_t phase_stats; // Time taken by the last call which used the context, with NBT_INSTRUMENT.
+  size_t lazy_depth;
+};
+
+nbt_context_t* nbt_new_context(void) {
+
+  nbt_context_t* context = (nbt_context_t*)nbt__malloc(sizeof(nbt_context_t));
+
+  context->inflate_window_bits = 0;
+  context->deflate_window_bits = 0;
+  context->in_buffer = NULL; // The I/O buffers are allocated on first use.
+  context->out_buffer = NULL;
+  context->buffer = NULL;
+  context->buffer_alloc_size = 0;
+  context->alloc_stats.allocations = 0;
+  context->alloc_stats.reallocations = 0;
+  context->alloc_stats.frees = 0;
+  context->alloc_stats.allocated_bytes = 0;
+  context->alloc_stats.current_bytes = 0;
+  context->alloc_stats.peak_bytes = 0;
+  context->lazy_depth = NBT_LAZY_DEPTH;
+  context->phase_stats.total_ns = 0;
+  for (int i = 0; i < NBT_PHASE_COUNT; i++) {
+    context->phase_stats.time_ns[i] = 0;
+    context->phase_stats.calls[i] = 0;
+  }
+
+  return context;
+
+}
+
+void nbt_free_context(nbt_context_t* context) {
+
+  if (context->inflate_window_bits != 0) {
+    inflateEnd(&context->inflate_stream);
+  }
+
+  if (context->deflate_window_bits != 0) {
+    deflateEnd(&context->deflate_stream);
+  }
+
+  nbt__free(context->in_buffer);
+  nbt__free(context->out_buffer);
+  nbt__free(context->buffer);
+  nbt__free(context);
+
+}
+
+void nbt_context_get_alloc_stats(nbt_context_t* context, nbt_alloc_stats_t* stats) {
+  *stats = context->alloc_stats;
+}
+
+void nbt_context_get_phase_stats(nbt_context_t* context, nbt_phase_stats_t* stats) {
+  *stats = context->phase_stats;
+}
+
+void nbt_context_set_lazy_depth(nbt_context_t* context, size_t depth) {
+  context->lazy_depth = depth;
+}
+
+// Marks the start of a public call which takes a context, to measure the allocations made during it (and, with
+// NBT_INSTRUMENT, the time spent in each phase).
+typedef struct {
+  nbt__alloc_mark_t alloc;
+#ifdef NBT_INSTRUMENT
+  uint64_t start;
+  uint64_t time_ns[NBT_PHASE_COUNT];
+  uint64_t calls[NBT_PHASE_COUNT];
+#endif
+} nbt__call_mark_t;
+
+static void nbt__call_begin(nbt__call_mark_t* mark) {
+  nbt__alloc_mark(&mark->alloc);
+#ifdef NBT_INSTRUMENT
+  for (int i = 0; i < NBT_PHASE_COUNT; i++) {
+    mark->time_ns[i] = nbt__instrument.time_ns[i];
+    mark->calls[i] = nbt__instrument.calls[i];
+  }
+  mark->start = nbt__get_time_ns();
+#endif
+}
+
+// Stores what happened during the call in the context, and adds it to the trace if one is being recorded.
+static void nbt__call_end(nbt__call_mark_t* mark, nbt_context_t* context, const char* name) {
+  nbt__alloc_measure(&mark->alloc, &context->alloc_stats);
+#ifdef NBT_INSTRUMENT
+  nbt_phase_stats_t* stats = &context->phase_stats;
+  stats->total_ns = nbt__get_time_ns() - mark->start;
+  for (int i = 0; i < NBT_PHASE_COUNT; i++) {
+    stats->time_ns[i] = nbt__instrument.time_ns[i] - mark->time_ns[i];
+    stats->calls[i] = nbt__instrument.calls[i] - mark->calls[i];
+  }
+  if (nbt__instrument.tracing) {
+    nbt__trace_event(name, mark->start, stats->total_ns, stats->time_ns);
+  }
+#else
+  (void)name;
+#endif
+}
+
+// Where the next part of each kind goes in a preallocated structure. The block is split into regions so that everything
+// is aligned: the tags, then long arrays, the value arrays of lists and compounds, int arrays, and lastly names,
+// strings and byte arrays. Each region is filled in the order the tags appear in the data.
+typedef struct {
+  nbt_tag_t* tags;
+  int64_t* longs;
+  nbt_tag_t** pointers;
+  int32_t* ints;
+  char* bytes;
+} nbt__block_t;
+
+typedef struct {
+  nbt_tag_t* tag;
+  size_t index; // Next list element, or where the compound's children start in the pending stack.
+} nbt__block_frame_t;
+
+// Like nbt__alloc_name, but takes the name from the block.
+NBT__INLINE char* nbt__block_alloc_name(nbt_tag_t* tag, nbt__block_t* block, size_t size) {
+  tag->name_size = size;
+#ifdef NBT_COMPACT_TAGS
+  if (size < sizeof(tag->name_inline)) {
+    tag->name = tag->name_inline;
+    return tag->name;
+  }
+#endif
+  tag->name = block->bytes;
+  block->bytes += size + 1;
+  tag->flags |= NBT__IN_BLOCK_NAME;
+  return tag->name;
+}
+
+// Builds a structure in a block which has been sized by nbt_scan, which has also checked the data is well formed, so
+// nothing needs checking here. The number of tags in a compound isn't known until its end is found, so they are kept
+// on a stack until then and copied into the block together. This is inlined into nbt__parse_block once for each format.
+NBT__INLINE nbt_tag_t* nbt__parse_block_format(nbt__read_stream_t* stream, int parse_name, nbt__format_t format, nbt__block_t* block) {
+
+  nbt__block_frame_t local_frames[32];
+  nbt__block_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+
+  nbt_tag_t* local_pending[64];
+  nbt_tag_t** pending = local_pending;
+  size_t pending_alloc_size = 64;
+  size_t pending_size = 0;
+
+  nbt_tag_t* root = block->tags;
+  int type = nbt__get_byte(stream);
+  int error = 0;
+
+  for (;;) {
+
+    nbt_tag_t* tag = block->tags++;
+    tag->type = (NBT__TAG_TYPE)type;
+    tag->flags = depth > 0 ? NBT__IN_BLOCK_TAG : 0;
+
+    if (parse_name) {
+      size_t name_size = nbt__get_string_size(stream, format);
+#ifdef NBT_COMPACT_TAGS
+      if (name_size > 0xFFFF) {
+        error = 1;
+        break;
+      }
+#endif
+      char* name = nbt__block_alloc_name(tag, block, name_size);
+      nbt__get_bytes(stream, name, name_size);
+      name[name_size] = '\0';
+    } else {
+      tag->name = NULL;
+      tag->name_size = 0;
+    }
+
+    // Add the tag to whatever it's inside of.
+    if (depth > 0) {
+      nbt__block_frame_t* frame = &frames[depth - 1];
+      if (frame->tag->type == NBT_TYPE_LIST) {
+        frame->tag->tag_list.value[frame->index++] = tag;
+      } else {
+        if (pending_size == pending_alloc_size) {
+          pending_alloc_size *= 2;
+          if (pending == local_pending) {
+            pending = (nbt_tag_t**)nbt__malloc(pending_alloc_size * sizeof(nbt_tag_t*));
+            NBT_MEMCPY(pending, local_pending, sizeof(local_pending));
+          } else {
+            pending = (nbt_tag_t**)nbt__realloc(pending, pending_alloc_size * sizeof(nbt_tag_t*));
+          }
+        }
+        pending[pending_size++] = tag;
+      }
+    }
+
+    switch (type) {
+      case NBT_TYPE_BYTE: {
+        tag->tag_byte.value = nbt__get_byte(stream);
+        break;
+      }
+      case NBT_TYPE_SHORT: {
+        tag->tag_short.value = nbt__get_int16(stream, format);
+        break;
+      }
+      case NBT_TYPE_INT: {
+        tag->tag_int.value = nbt__get_int32(stream, format);
+        break;
+      }
+      case NBT_TYPE_LONG: {
+        tag->tag_long.value = nbt__get_int64(stream, format);
+        break;
+      }
+      case NBT_TYPE_FLOAT: {
+        tag->tag_float.value = nbt__get_float(stream, format);
+        break;
+      }
+      case NBT_TYPE_DOUBLE: {
+        tag->tag_double.value = nbt__get_double(stream, format);
+        break;
+      }
+      case NBT_TYPE_BYTE_ARRAY: {
+        tag->tag_byte_array.size = (size_t)nbt__get_int32(stream, format);
+        tag->tag_byte_array.value = (int8_t*)block->bytes;
+        block->bytes += tag->tag_byte_array.size;
+        nbt__get_bytes(stream, tag->tag_byte_array.value, tag->tag_byte_array.size);
+        tag->flags |= NBT__IN_BLOCK_VALUE;
+        break;
+      }
+      case NBT_TYPE_STRING: {
+        tag->tag_string.size = nbt__get_string_size(stream, format);
+        tag->tag_string.value = block->bytes;
+        block->bytes += tag->tag_string.size + 1;
+        nbt__get_bytes(stream, tag->tag_string.value, tag->tag_string.size);
+        tag->tag_string.value[tag->tag_string.size] = '\0';
+        tag->flags |= NBT__IN_BLOCK_VALUE;
+        break;
+      }
+      case NBT_TYPE_INT_ARRAY: {
+        tag->tag_int_array.size = (size_t)nbt__get_int32(stream, format);
+        tag->tag_int_array.value = block->ints;
+        block->ints += tag->tag_int_array.size;
+        nbt__get_int32_array(stream, tag->tag_int_array.value, tag->tag_int_array.size, format);
+        tag->flags |= NBT__IN_BLOCK_VALUE;
+        break;
+      }
+      case NBT_TYPE_LONG_ARRAY: {
+        tag->tag_long_array.size = (size_t)nbt__get_int32(stream, format);
+        tag->tag_long_array.value = block->longs;
+        block->longs += tag->tag_long_array.size;
+        nbt__get_int64_array(stream, tag->tag_long_array.value, tag->tag_long_array.size, format);
+        tag->flags |= NBT__IN_BLOCK_VALUE;
+        break;
+      }
+      default: {
+        // Lists and compounds, which have their contents parsed before moving on.
+        if (type == NBT_TYPE_LIST) {
+          tag->tag_list.type = nbt__get_byte(stream);
+          tag->tag_list.size = (size_t)nbt__get_int32(stream, format);
+          tag->tag_list.value = tag->tag_list.size > 0 ? block->pointers : NULL;
+          block->pointers += tag->tag_list.size;
+        } else {
+          tag->tag_compound.size = 0;
+          tag->tag_compound.value = NULL;
+        }
+        tag->flags |= NBT__IN_BLOCK_VALUE;
+
+        if (depth == frames_alloc_size) {
+          frames_alloc_size *= 2;
+          if (frames == local_frames) {
+            frames = (nbt__block_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__block_frame_t));
+            NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+          } else {
+            frames = (nbt__block_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__block_frame_t));
+          }
+        }
+
+        frames[depth].tag = tag;
+        frames[depth].index = type == NBT_TYPE_LIST ? 0 : pending_size;
+        depth++;
+        break;
+      }
+    }
+
+    // Find the next tag, moving back up past any lists and compounds which are complete.
+    type = NBT_TYPE_END;
+
+    while (depth > 0) {
+      nbt__block_frame_t* frame = &frames[depth - 1];
+      nbt_tag_t* parent = frame->tag;
+
+      if (parent->type == NBT_TYPE_LIST) {
+        if (frame->index < parent->tag_list.size) {
+          type = parent->tag_list.type;
+          parse_name = 0;
+          break;
+        }
+      } else {
+        type = nbt__get_byte(stream);
+        if (type != NBT_TYPE_END) {
+          parse_name = 1;
+          break;
+        }
+        size_t size = pending_size - frame->index;
+        if (size > 0) {
+          parent->tag_compound.value = block->pointers;
+          parent->tag_compound.size = size;
+          NBT_MEMCPY(block->pointers, pending + frame->index, size * sizeof(nbt_tag_t*));
+          block->pointers += size;
+          pending_size = frame->index;
+        }
+      }
+
+      depth--;
+    }
+
+    if (type == NBT_TYPE_END) {
+      break;
+    }
+
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+  if (pending != local_pending) {
+    nbt__free(pending);
+  }
+
+  if (error) {
+    nbt__free(root);
+    return NULL;
+  }
+
+  return root;
+
+}
+
+// Parses a document into a single block, using a first pass over the data to find exactly how much memory it needs.
+static nbt_tag_t* nbt__parse_block(const uint8_t* buffer, size_t size, int parse_flags) {
+
+  nbt_scan_stats_t stats;
+  if (!nbt_scan(buffer, size, parse_flags, &stats, NULL, 0)) {
+    return NULL;
+  }
+
+  int parse_name = !(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT);
+  size_t named_tags = stats.element_counts[NBT_TYPE_COMPOUND] + (parse_name ? 1 : 0);
+
+  size_t tags_size = stats.tag_count * sizeof(nbt_tag_t);
+  size_t longs_size = stats.element_counts[NBT_TYPE_LONG_ARRAY] * sizeof(int64_t);
+  size_t pointers_size = (stats.element_counts[NBT_TYPE_LIST] + stats.element_counts[NBT_TYPE_COMPOUND]) * sizeof(nbt_tag_t*);
+  size_t ints_size = stats.element_counts[NBT_TYPE_INT_ARRAY] * sizeof(int32_t);
+  size_t bytes_size = stats.name_bytes + named_tags + stats.element_counts[NBT_TYPE_STRING] + stats.type_counts[NBT_TYPE_STRING] + stats.element_counts[NBT_TYPE_BYTE_ARRAY];
+
+  uint8_t* data = (uint8_t*)nbt__malloc(tags_size + longs_size + pointers_size + ints_size + bytes_size);
+
+  nbt__block_t block;
+  block.tags = (nbt_tag_t*)data;
+  block.longs = (int64_t*)(data + tags_size);
+  block.pointers = (nbt_tag_t**)(data + tags_size + longs_size);
+  block.ints = (int32_t*)(data + tags_size + longs_size + pointers_size);
+  block.bytes = (char*)(data + tags_size + longs_size + pointers_size + ints_size);
+
+  nbt__read_stream_t stream;
+  stream.buffer = buffer;
+  stream.buffer_offset = 0;
+
+  switch (nbt__get_format(parse_flags)) {
+    case NBT__FORMAT_BEDROCK: {
+      return nbt__parse_block_format(&stream, parse_name, NBT__FORMAT_BEDROCK, &block);
+    }
+    case NBT__FORMAT_BEDROCK_NETWORK: {
+      return nbt__parse_block_format(&stream, parse_name, NBT__FORMAT_BEDROCK_NETWORK, &block);
+    }
+    default: {
+      return nbt__parse_block_format(&stream, parse_name, NBT__FORMAT_JAVA, &block);
+    }
+  }
+
+}
+
+// Parses a whole document from a buffer of uncompressed data.
+static nbt_tag_t* nbt__parse_buffer(nbt_context_t* context, const uint8_t* buffer, size_t size, int parse_flags) {
+
+  nbt__read_stream_t stream;
+  stream.buffer = buffer;
+  stream.buffer_offset = 0;
+
+  int parse_name = !(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT);
+  nbt__format_t format = nbt__get_format(parse_flags);
+
+  nbt_tag_t* tag;
+
+  if (parse_flags & NBT_PARSE_FLAG_PREALLOCATE) {
+    NBT__PHASE(NBT_PHASE_BUILD, tag = nbt__parse_block(buffer, size, parse_flags));
+    return tag;
+  }
+
+  // The parser trusts the lengths in the data, so the whole document is checked before anything is built. This doesn't
+  // allocate, and is quick next to building the tags.
+  size_t valid_size;
+  NBT__PHASE(NBT_PHASE_BUILD, valid_size = nbt_validate(buffer, size, parse_flags));
+  if (!valid_size) {
+    return NULL;
+  }
+
+  if (!(parse_flags & NBT_PARSE_FLAG_LAZY)) {
+    NBT__PHASE(NBT_PHASE_BUILD, tag = nbt__parse(&stream, parse_name, NBT_NO_OVERRIDE, format, NULL));
+    return tag;
+  }
+
+  nbt__lazy_buffer_t* lazy_buffer = (nbt__lazy_buffer_t*)nbt__malloc(sizeof(nbt__lazy_buffer_t));
+  lazy_buffer->refs = 1;
+  lazy_buffer->data = (uint8_t*)buffer;
+  lazy_buffer->size = size;
+
+  nbt__lazy_parse_t lazy;
+  lazy.buffer = lazy_buffer;
+  lazy.depth = context->lazy_depth;
+
+  NBT__PHASE(NBT_PHASE_BUILD, tag = nbt__parse(&stream, parse_name, NBT_NO_OVERRIDE, format, &lazy));
+
+  if (lazy_buffer->refs == 1) {
+    nbt__free(lazy_buffer); // Nothing was left unparsed.
+    return tag;
+  }
+
+  // The unparsed tags need the data to outlive this call. The context's buffer can be handed over rather than copied,
+  // and the context will allocate a new one next time.
+  if (buffer == context->buffer) {
+    lazy_buffer->data = (uint8_t*)nbt__realloc(context->buffer, size);
+    context->buffer = NULL;
+    context->buffer_alloc_size = 0;
+  } else {
+    lazy_buffer->data = (uint8_t*)nbt__malloc(size);
+    NBT_MEMCPY(lazy_buffer->data, buffer, size);
+  }
+  lazy_buffer->refs--;
+
+  return tag;
+
+}
+
+// Makes sure the context's buffer can hold at least size bytes, growing it geometrically.
+static void nbt__context_reserve(nbt_context_t* context, size_t size) {
+  if (size > context->buffer_alloc_size) {
+    size_t alloc_size = context->buffer_alloc_size ? context->buffer_alloc_size * 2 : NBT_BUFFER_SIZE;
+    while (alloc_size < size) {
+      alloc_size *= 2;
+    }
+    context->buffer = (uint8_t*)nbt__realloc(context->buffer, alloc_size);
+    context->buffer_alloc_size = alloc_size;
+  }
+}
+
+// Prepares the context's inflate stream, only reallocating its state if the window bits have changed.
+static int nbt__context_inflate_begin(nbt_context_t* context, int window_bits) {
+
+  z_stream* stream = &context->inflate_stream;
+
+  if (context->inflate_window_bits == window_bits) {
+    return inflateReset(stream) == Z_OK;
+  }
+
+  if (context->inflate_window_bits != 0) {
+    inflateEnd(stream);
+    context->inflate_window_bits = 0;
+  }
+
+  stream->zalloc = nbt__zalloc;
+  stream->zfree = nbt__zfree;
+  stream->opaque = Z_NULL;
+  stream->avail_in = 0;
+  stream->next_in = Z_NULL;
+
+  if (inflateInit2(stream, window_bits) != Z_OK) {
+    return 0;
+  }
+
+  context->inflate_window_bits = window_bits;
+  return 1;
+
+}
+
+// Same as nbt__context_inflate_begin, but for the deflate stream.
+static int nbt__context_deflate_begin(nbt_context_t* context, int window_bits) {
+
+  z_stream* stream = &context->deflate_stream;
+
+  if (context->deflate_window_bits == window_bits) {
+    return deflateReset(stream) == Z_OK;
+  }
+
+  if (context->deflate_window_bits != 0) {
+    deflateEnd(stream);
+    context->deflate_window_bits = 0;
+  }
+
+  stream->zalloc = nbt__zalloc;
+  stream->zfree = nbt__zfree;
+  stream->opaque = Z_NULL;
+
+  if (deflateInit2(stream, NBT_COMPRESSION_LEVEL, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    return 0;
+  }
+
+  context->deflate_window_bits = window_bits;
+  return 1;
+
+}
+
+static void nbt__get_compression(int flags, int* compressed, int* gzip_format) {
+  switch (flags & 3) {
+    case 0: // Automatic detection (not yet implemented).
+    case 1: { // gzip
+      *compressed = 1;
+      *gzip_format = 1;
+      break;
+    }
+    case 2: { // zlib
+      *compressed = 1;
+      *gzip_format = 0;
+      break;
+    }
+    case 3: { // raw
+      *compressed = 0;
+      *gzip_format = 0;
+      break;
+    }
+  }
+}
+
+static nbt_tag_t* nbt__parse_ex(nbt_context_t* context, nbt_reader_t reader, int parse_flags) {
+
+  int compressed;
+  int gzip_format;
+  nbt__get_compression(parse_flags, &compressed, &gzip_format);
+
+  size_t buffer_size = 0;
+
+  if (compressed) {
+
+    if (gzip_format) {
+      uint8_t header[10];
+      reader.read(reader.userdata, header, 10);
+      int fhcrc = header[3] & 2;
+      int fextra = header[3] & 4;
+      int fname = header[3] & 8;
+      int fcomment = header[3] & 16;
+
+      (void)fextra; // I don't think many files use this.
+
+      if (fname) {
+        uint8_t byte = 0;
+        do {
+          reader.read(reader.userdata, &byte, 1);
+        } while (byte != 0);
+      }
+
+      if (fcomment) {
+        uint8_t byte = 0;
+        do {
+          reader.read(reader.userdata, &byte, 1);
+        } while (byte != 0);
+      }
+
+      uint16_t crc;
+      if (fhcrc) {
+        reader.read(reader.userdata, (uint8_t*)&crc, 2);
+      }
+
+      (void)crc;
+    }
+
+    if (!nbt__context_inflate_begin(context, gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS)) {
+      return NULL;
+    }
+
+    if (!context->in_buffer) {
+      context->in_buffer = (uint8_t*)nbt__malloc(NBT_BUFFER_SIZE);
+    }
+
+    z_stream* stream = &context->inflate_stream;
+    int ret = Z_OK;
+
+    do {
+      NBT__PHASE(NBT_PHASE_READ, stream->avail_in = reader.read(reader.userdata, context->in_buffer, NBT_BUFFER_SIZE));
+      stream->next_in = context->in_buffer;
+
+      if (stream->avail_in == 0) {
+        break; // Truncated stream.
+      }
+
+      // Inflate straight into the decode buffer, keeping going until all of the input has been consumed, as inflate
+      // can return before then.
+      do {
+        nbt__context_reserve(context, buffer_size + NBT_BUFFER_SIZE);
+
+        stream->next_out = context->buffer + buffer_size;
+        stream->avail_out = context->buffer_alloc_size - buffer_size;
+
+        NBT__PHASE(NBT_PHASE_INFLATE, ret = inflate(stream, Z_NO_FLUSH));
+
+        buffer_size = context->buffer_alloc_size - stream->avail_out;
+
+      } while (ret == Z_OK && (stream->avail_out == 0 || stream->avail_in > 0));
+
+    } while (ret == Z_OK || ret == Z_BUF_ERROR);
+
+    if (ret != Z_STREAM_END) {
+      return NULL;
+    }
+
+  } else {
+
+    size_t bytes_requested;
+    size_t bytes_read;
+    do {
+      nbt__context_reserve(context, buffer_size + NBT_BUFFER_SIZE);
+      bytes_requested = context->buffer_alloc_size - buffer_size;
+      NBT__PHASE(NBT_PHASE_READ, bytes_read = reader.read(reader.userdata, context->buffer + buffer_size, bytes_requested));
+      buffer_size += bytes_read;
+    } while (bytes_read == bytes_requested);
+
+  }
+
+  return nbt__parse_buffer(context, context->buffer, buffer_size, parse_flags);
+
+}
+
+nbt_tag_t* nbt_parse_ex(nbt_context_t* context, nbt_reader_t reader, int parse_flags) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  nbt_tag_t* tag = nbt__parse_ex(context, reader, parse_flags);
+
+  nbt__call_end(&mark, context, "nbt_parse");
+
+  return tag;
+
+}
+
+nbt_tag_t* nbt_parse(nbt_reader_t reader, int parse_flags) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  nbt_tag_t* tag = nbt_parse_ex(context, reader, parse_flags);
+
+  nbt_free_context(context);
+
+  return tag;
+
+}
+
+// Returns the size of the gzip header at the start of data, or 0 if it is malformed or truncated.
+static size_t nbt__get_gzip_header_size(const uint8_t* data, size_t size) {
+
+  if (size < 10 || data[0] != 31 || data[1] != 139) {
+    return 0;
+  }
+
+  int fhcrc = data[3] & 2;
+  int fextra = data[3] & 4;
+  int fname = data[3] & 8;
+  int fcomment = data[3] & 16;
+
+  size_t offset = 10;
+
+  if (fextra) {
+    if (offset + 2 > size) {
+      return 0;
+    }
+    offset += 2 + (data[offset] | (data[offset + 1] << 8));
+  }
+
+  if (fname) {
+    while (offset < size && data[offset] != 0) {
+      offset++;
+    }
+    offset++;
+  }
+
+  if (fcomment) {
+    while (offset < size && data[offset] != 0) {
+      offset++;
+    }
+    offset++;
+  }
+
+  if (fhcrc) {
+    offset += 2;
+  }
+
+  return offset <= size ? offset : 0;
+
+}
+
+// Gets hold of the uncompressed data in a buffer of serialized NBT data, inflating it into the context's buffer if
+// needed. Returns NULL if the data is corrupt or truncated.
+static const uint8_t* nbt__memory_inflate(nbt_context_t* context, const void* data, size_t size, int parse_flags, size_t* out_size) {
+
+  int compressed;
+  int gzip_format;
+  nbt__get_compression(parse_flags, &compressed, &gzip_format);
+
+  const uint8_t* in = (const uint8_t*)data;
+
+  if (compressed) {
+
+    size_t in_offset = 0;
+
+    if (gzip_format) {
+      in_offset = nbt__get_gzip_header_size(in, size);
+      if (in_offset == 0 || size - in_offset < 8) {
+        return NULL;
+      }
+
+      // The trailer holds the uncompressed size (modulo 2^32), which lets the buffer be allocated once up front. Deflate
+      // can't expand data by more than 1032 times, so a larger size means the trailer is corrupt and is only trusted up
+      // to that. The loop below grows the buffer if it turns out to be too small.
+      const uint8_t* trailer = in + size - 4;
+      size_t isize = (size_t)trailer[0] | ((size_t)trailer[1] << 8) | ((size_t)trailer[2] << 16) | ((size_t)trailer[3] << 24);
+      size_t limit = size < SIZE_MAX / 1032 ? size * 1032 : SIZE_MAX;
+      nbt__context_reserve(context, isize < limit ? isize : limit);
+    } else {
+      nbt__context_reserve(context, size < SIZE_MAX / 4 ? size * 4 : size);
+    }
+
+    if (!nbt__context_inflate_begin(context, gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS)) {
+      return NULL;
+    }
+
+    z_stream* z = &context->inflate_stream;
+    size_t buffer_size = 0;
+
+    z->avail_in = 0;
+
+    for (;;) {
+
+      // avail_in and avail_out are only 32 bits wide, so feed very large buffers through in pieces.
+      if (z->avail_in == 0 && in_offset < size) {
+        size_t chunk = size - in_offset < 0x40000000 ? size - in_offset : 0x40000000;
+        z->next_in = in + in_offset;
+        z->avail_in = chunk;
+        in_offset += chunk;
+      }
+
+      if (buffer_size == context->buffer_alloc_size) {
+        nbt__context_reserve(context, buffer_size + 1);
+      }
+
+      size_t out_space = context->buffer_alloc_size - buffer_size;
+      if (out_space > 0x40000000) {
+        out_space = 0x40000000;
+      }
+
+      z->next_out = context->buffer + buffer_size;
+      z->avail_out = out_space;
+
+      int ret;
+      NBT__PHASE(NBT_PHASE_INFLATE, ret = inflate(z, Z_NO_FLUSH));
+
+      buffer_size += out_space - z->avail_out;
+
+      if (ret == Z_STREAM_END) {
+        break;
+      }
+
+      if ((ret != Z_OK && ret != Z_BUF_ERROR) || (z->avail_in == 0 && in_offset == size && z->avail_out != 0)) {
+        return NULL; // Corrupt or truncated stream.
+      }
+
+    }
+
+    *out_size = buffer_size;
+    return context->buffer;
+
+  } else {
+
+    if (size == 0) {
+      return NULL;
+    }
+
+    // Uncompressed data can be used where it is.
+    *out_size = size;
+    return in;
+
+  }
+
+}
+
+static nbt_tag_t* nbt__parse_memory_ex(nbt_context_t* context, const void* data, size_t size, int parse_flags) {
+
+  size_t buffer_size;
+  const uint8_t* buffer = nbt__memory_inflate(context, data, size, parse_flags, &buffer_size);
+  if (!buffer) {
+    return NULL;
+  }
+
+  return nbt__parse_buffer(context, buffer, buffer_size, parse_flags);
+
+}
+
+nbt_tag_t* nbt_parse_memory_ex(nbt_context_t* context, const void* data, size_t size, int parse_flags) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  nbt_tag_t* tag = nbt__parse_memory_ex(context, data, size, parse_flags);
+
+  nbt__call_end(&mark, context, "nbt_parse_memory");
+
+  return tag;
+
+}
+
+nbt_tag_t* nbt_parse_memory(const void* data, size_t size, int parse_flags) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  nbt_tag_t* tag = nbt_parse_memory_ex(context, data, size, parse_flags);
+
+  nbt_free_context(context);
+
+  return tag;
+
+}
+
+size_t nbt_validate(const void* data, size_t size, int parse_flags) {
+
+  const uint8_t* buffer = (const uint8_t*)data;
+  nbt__format_t format = nbt__get_format(parse_flags);
+  size_t p = 0;
+
+  if (size == 0 || buffer[0] == NBT_TYPE_END) {
+    return 0;
+  }
+  int type = buffer[p++];
+
+  if (!(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT)) {
+    uint32_t name_size;
+    if (nbt__scan_length(buffer, size, &p, 1, format, &name_size) != NBT__SCAN_DONE) {
+      return 0;
+    }
+    p += name_size;
+  }
+
+  // The stack is big enough for the deepest nesting allowed, so it never needs allocating.
+  nbt__scan_frame_t frames[NBT_MAX_DEPTH];
+  if (p > size || nbt__skip_payload_frames(buffer, size, &p, type, format, frames, NBT_MAX_DEPTH) != NBT__SCAN_DONE) {
+    return 0;
+  }
+
+  return p;
+
+}
+
+typedef struct {
+  nbt__scan_frame_t scan;
+  size_t entry; // Index of the list or compound's entry.
+  size_t first_tag; // Value of tag_count before the list or compound was counted.
+  size_t children;
+} nbt__count_frame_t;
+
+size_t nbt_scan(const void* data, size_t size, int parse_flags, nbt_scan_stats_t* stats, nbt_scan_entry_t* entries, size_t max_entries) {
+
+  const uint8_t* buffer = (const uint8_t*)data;
+  nbt__format_t format = nbt__get_format(parse_flags);
+
+  nbt_scan_stats_t empty = { 0 };
+  *stats = empty;
+
+  if (size == 0 || buffer[0] == NBT_TYPE_END) {
+    return 0;
+  }
+
+  nbt__count_frame_t local_frames[32];
+  nbt__count_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+  size_t containers = 0;
+  nbt__scan_status_t status;
+
+  size_t p = 1;
+  size_t start = 0; // Where the current tag starts, including its type and name if it has them.
+  int type = buffer[0];
+  int named = !(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT);
+
+  for (;;) {
+
+    const char* name = NULL;
+    uint32_t name_size = 0;
+    if (named) {
+      status = nbt__scan_length(buffer, size, &p, 1, format, &name_size);
+      if (status != NBT__SCAN_DONE) {
+        break;
+      }
+      name = (const char*)buffer + p;
+      p += name_size;
+      stats->name_bytes += name_size;
+    }
+
+    uint8_t list_type = 0;
+    uint32_t length = 0;
+    status = nbt__scan_payload(buffer, size, &p, type, format, &list_type, &length);
+    if (status != NBT__SCAN_DONE) {
+      break;
+    }
+
+    size_t first_tag = stats->tag_count;
+    stats->tag_count++;
+    stats->type_counts[type]++;
+    stats->element_counts[type] += length;
+    if (depth + 1 > stats->max_depth) {
+      stats->max_depth = depth + 1;
+    }
+
+    // Lists of numbers are counted and skipped in one go.
+    size_t element_size = type == NBT_TYPE_LIST ? nbt__fixed_payload_size(list_type, format) : 0;
+    uint32_t remaining = length;
+    if (element_size) {
+      p += (size_t)length * element_size;
+      if (p > size) {
+        status = NBT__SCAN_NEED_MORE;
+        break;
+      }
+      stats->tag_count += length;
+      stats->type_counts[list_type] += length;
+      if (length > 0 && depth + 2 > stats->max_depth) {
+        stats->max_depth = depth + 2;
+      }
+      remaining = 0;
+    }
+
+    if (type == NBT_TYPE_LIST || type == NBT_TYPE_COMPOUND) {
+      if (depth == NBT_MAX_DEPTH) {
+        status = NBT__SCAN_ERROR;
+        break;
+      }
+
+      if (depth == frames_alloc_size) {
+        frames_alloc_size *= 2;
+        if (frames == local_frames) {
+          frames = (nbt__count_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__count_frame_t));
+          NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+        } else {
+          frames = (nbt__count_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__count_frame_t));
+        }
+      }
+
+      nbt__count_frame_t* frame = &frames[depth];
+      frame->scan.type = (uint8_t)type;
+      frame->scan.list_type = list_type;
+      frame->scan.list_remaining = remaining;
+      frame->entry = containers++;
+      frame->first_tag = first_tag;
+      frame->children = length;
+
+      // The rest of the entry is filled in once the end of the list or compound is found.
+      if (frame->entry < max_entries) {
+        nbt_scan_entry_t* entry = &entries[frame->entry];
+        entry->type = (nbt_tag_type_t)type;
+        entry->name = name;
+        entry->name_size = name_size;
+        entry->offset = start;
+        entry->depth = depth;
+      }
+
+      depth++;
+    }
+
+    // Find the next tag, moving back up past any lists and compounds which are finished.
+    type = NBT_TYPE_END;
+
+    while (depth > 0) {
+      nbt__count_frame_t* frame = &frames[depth - 1];
+
+      if (frame->scan.type == NBT_TYPE_LIST) {
+        if (frame->scan.list_remaining > 0) {
+          frame->scan.list_remaining--;
+          type = frame->scan.list_type;
+          start = p;
+          named = 0;
+          break;
+        }
+      } else {
+        if (p + 1 > size) {
+          status = NBT__SCAN_NEED_MORE;
+          break;
+        }
+        start = p;
+        type = buffer[p++];
+        if (type != NBT_TYPE_END) {
+          frame->children++;
+          stats->element_counts[NBT_TYPE_COMPOUND]++;
+          named = 1;
+          break;
+        }
+      }
+
+      if (frame->entry < max_entries) {
+        nbt_scan_entry_t* entry = &entries[frame->entry];
+        entry->size = p - entry->offset;
+        entry->length = frame->children;
+        entry->tag_count = stats->tag_count - frame->first_tag;
+      }
+      depth--;
+    }
+
+    if (status != NBT__SCAN_DONE || type == NBT_TYPE_END) {
+      break;
+    }
+
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+  return status == NBT__SCAN_DONE ? p : 0;
+
+}
+
+typedef struct {
+  uint8_t* buffer;
+  size_t offset;
+  size_t size;
+  size_t alloc_size;
+  int error; // Set if a list or compound left unparsed by NBT_PARSE_FLAG_LAZY couldn't be parsed.
+} nbt__write_stream_t;
+
+static void nbt__write_stream_grow(nbt__write_stream_t* stream, size_t size) {
+  while (stream->offset + size >= stream->alloc_size) {
+    stream->alloc_size *= 2;
+  }
+  stream->buffer = (uint8_t*)nbt__realloc(stream->buffer, stream->alloc_size);
+}
+
+// Makes room for size more bytes, returning where they should go.
+NBT__INLINE uint8_t* nbt__put_reserve(nbt__write_stream_t* stream, size_t size) {
+  if (stream->offset + size >= stream->alloc_size) {
+    nbt__write_stream_grow(stream, size);
+  }
+
+  uint8_t* data = stream->buffer + stream->offset;
+  stream->offset += size;
+  stream->size += size;
+  return data;
+}
+
+NBT__INLINE void nbt__put_byte(nbt__write_stream_t* stream, uint8_t value) {
+  *nbt__put_reserve(stream, 1) = value;
+}
+
+NBT__INLINE void nbt__put_bytes(nbt__write_stream_t* stream, const void* data, size_t size) {
+  if (size > 0) {
+    NBT_MEMCPY(nbt__put_reserve(stream, size), data, size);
+  }
+}
+
+static void nbt__put_varint(nbt__write_stream_t* stream, uint64_t value) {
+  while (value >= 0x80) {
+    nbt__put_byte(stream, (uint8_t)(value | 0x80));
+    value >>= 7;
+  }
+  nbt__put_byte(stream, (uint8_t)value);
+}
+
+NBT__INLINE void nbt__put_int16(nbt__write_stream_t* stream, int16_t value, nbt__format_t format) {
+  nbt__store_uint16(nbt__put_reserve(stream, 2), (uint16_t)value, format);
+}
+
+NBT__INLINE void nbt__put_int32(nbt__write_stream_t* stream, int32_t value, nbt__format_t format) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    nbt__put_varint(stream, nbt__zigzag_encode(value));
+  } else {
+    nbt__store_uint32(nbt__put_reserve(stream, 4), (uint32_t)value, format);
+  }
+}
+
+NBT__INLINE void nbt__put_int64(nbt__write_stream_t* stream, int64_t value, nbt__format_t format) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    nbt__put_varint(stream, nbt__zigzag_encode(value));
+  } else {
+    nbt__store_uint64(nbt__put_reserve(stream, 8), (uint64_t)value, format);
+  }
+}
+
+NBT__INLINE void nbt__put_float(nbt__write_stream_t* stream, float value, nbt__format_t format) {
+  uint32_t bits;
+  NBT_MEMCPY(&bits, &value, 4);
+  nbt__store_uint32(nbt__put_reserve(stream, 4), bits, format);
+}
+
+NBT__INLINE void nbt__put_double(nbt__write_stream_t* stream, double value, nbt__format_t format) {
+  uint64_t bits;
+  NBT_MEMCPY(&bits, &value, 8);
+  nbt__store_uint64(nbt__put_reserve(stream, 8), bits, format);
+}
+
+// Writes the length of a name or string.
+NBT__INLINE void nbt__put_string_size(nbt__write_stream_t* stream, size_t size, nbt__format_t format) {
+  if (format == NBT__FORMAT_BEDROCK_NETWORK) {
+    nbt__put_varint(stream, (uint32_t)size);
+  } else {
+    nbt__put_int16(stream, (int16_t)size, format);
+  }
+}
+
+// Int and long arrays in the machine's byte order are copied straight into the buffer.
+NBT__INLINE void nbt__put_int32_array(nbt__write_stream_t* stream, const int32_t* values, size_t size, nbt__format_t format) {
+#ifdef NBT__LITTLE_ENDIAN_HOST
+  if (format == NBT__FORMAT_BEDROCK) {
+    nbt__put_bytes(stream, values, size * sizeof(int32_t));
+    return;
+  }
+#endif
+  for (size_t i = 0; i < size; i++) {
+    nbt__put_int32(stream, values[i], format);
+  }
+}
+
+NBT__INLINE void nbt__put_int64_array(nbt__write_stream_t* stream, const int64_t* values, size_t size, nbt__format_t format) {
+#ifdef NBT__LITTLE_ENDIAN_HOST
+  if (format == NBT__FORMAT_BEDROCK) {
+    nbt__put_bytes(stream, values, size * sizeof(int64_t));
+    return;
+  }
+#endif
+  for (size_t i = 0; i < size; i++) {
+    nbt__put_int64(stream, values[i], format);
+  }
+}
+
+// Writes the payload of a list or compound which hasn't been parsed yet by copying it straight from the parsed data,
+// if it's being written in the format it was read in. Otherwise it's parsed, and 0 is returned so it's written as usual.
+// If parsing fails, nothing is written and the stream is marked as failed.
+static int nbt__write_lazy(nbt__write_stream_t* stream, nbt_tag_t* tag, nbt__format_t format) {
+  nbt__lazy_tag_t* lazy_tag = nbt__get_lazy(tag);
+  if (!lazy_tag) {
+    return 0;
+  }
+  if (lazy_tag->format == format) {
+    nbt__put_bytes(stream, lazy_tag->buffer->data + lazy_tag->offset, lazy_tag->size);
+    return 1;
+  }
+  if (!nbt__lazy_load(tag, lazy_tag)) {
+    stream->error = 1;
+    return 1;
+  }
+  return 0;
+}
+
+static void nbt__write_tag(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type, nbt__format_t format);
+
+// Writes a tag in the given format. This is inlined into one function per format by nbt__write_tag.
+NBT__INLINE void nbt__write_tag_format(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type, nbt__format_t format) {
+
+  if (write_type) {
+    nbt__put_byte(stream, tag->type);
+  }
+
+  if (write_name && tag->type != NBT_TYPE_END) {
+    nbt__put_string_size(stream, tag->name_size, format);
+    nbt__put_bytes(stream, tag->name, tag->name_size);
+  }
+
+  switch (tag->type) {
+    case NBT_TYPE_END: {
+      // Do nothing.
+      break;
+    }
+    case NBT_TYPE_BYTE: {
+      nbt__put_byte(stream, tag->tag_byte.value);
+      break;
+    }
+    case NBT_TYPE_SHORT: {
+      nbt__put_int16(stream, tag->tag_short.value, format);
+      break;
+    }
+    case NBT_TYPE_INT: {
+      nbt__put_int32(stream, tag->tag_int.value, format);
+      break;
+    }
+    case NBT_TYPE_LONG: {
+      nbt__put_int64(stream, tag->tag_long.value, format);
+      break;
+    }
+    case NBT_TYPE_FLOAT: {
+      nbt__put_float(stream, tag->tag_float.value, format);
+      break;
+    }
+    case NBT_TYPE_DOUBLE: {
+      nbt__put_double(stream, tag->tag_double.value, format);
+      break;
+    }
+    case NBT_TYPE_BYTE_ARRAY: {
+      nbt__put_int32(stream, (int32_t)tag->tag_byte_array.size, format);
+      nbt__put_bytes(stream, tag->tag_byte_array.value, tag->tag_byte_array.size);
+      break;
+    }
+    case NBT_TYPE_STRING: {
+      nbt__put_string_size(stream, tag->tag_string.size, format);
+      nbt__put_bytes(stream, tag->tag_string.value, tag->tag_string.size);
+      break;
+    }
+    case NBT_TYPE_LIST: {
+      if (nbt__write_lazy(stream, tag, format)) {
+        break;
+      }
+      nbt__put_byte(stream, tag->tag_list.type);
+      nbt__put_int32(stream, (int32_t)tag->tag_list.size, format);
+      for (size_t i = 0; i < tag->tag_list.size; i++) {
+        nbt__write_tag(stream, tag->tag_list.value[i], 0, 0, format);
+      }
+      break;
+    }
+    case NBT_TYPE_COMPOUND: {
+      if (nbt__write_lazy(stream, tag, format)) {
+        break;
+      }
+      for (size_t i = 0; i < tag->tag_compound.size; i++) {
+        nbt__write_tag(stream, tag->tag_compound.value[i], 1, 1, format);
+      }
+      nbt__put_byte(stream, 0); // End tag.
+      break;
+    }
+    case NBT_TYPE_INT_ARRAY: {
+      nbt__put_int32(stream, (int32_t)tag->tag_int_array.size, format);
+      nbt__put_int32_array(stream, tag->tag_int_array.value, tag->tag_int_array.size, format);
+      break;
+    }
+    case NBT_TYPE_LONG_ARRAY: {
+      nbt__put_int32(stream, (int32_t)tag->tag_long_array.size, format);
+      nbt__put_int64_array(stream, tag->tag_long_array.value, tag->tag_long_array.size, format);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+}
+
+static void nbt__write_tag_java(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type) {
+  nbt__write_tag_format(stream, tag, write_name, write_type, NBT__FORMAT_JAVA);
+}
+
+static void nbt__write_tag_bedrock(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type) {
+  nbt__write_tag_format(stream, tag, write_name, write_type, NBT__FORMAT_BEDROCK);
+}
+
+static void nbt__write_tag_bedrock_network(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type) {
+  nbt__write_tag_format(stream, tag, write_name, write_type, NBT__FORMAT_BEDROCK_NETWORK);
+}
+
+static void nbt__write_tag(nbt__write_stream_t* stream, nbt_tag_t* tag, int write_name, int write_type, nbt__format_t format) {
+
+  switch (format) {
+    case NBT__FORMAT_BEDROCK: {
+      nbt__write_tag_bedrock(stream, tag, write_name, write_type);
+      break;
+    }
+    case NBT__FORMAT_BEDROCK_NETWORK: {
+      nbt__write_tag_bedrock_network(stream, tag, write_name, write_type);
+      break;
+    }
+    default: {
+      nbt__write_tag_java(stream, tag, write_name, write_type);
+      break;
+    }
+  }
+
+}
+
+uint32_t nbt__crc_table[256];
+
+int nbt__crc_table_computed = 0;
+
+void nbt__make_crc_table(void) {
+  unsigned long c;
+  int n, k;
+
+  for (n = 0; n < 256; n++) {
+    c = (uint32_t)n;
+    for (k = 0; k < 8; k++) {
+      if (c & 1) {
+        c = 0xedb88320L ^ (c >> 1);
+      } else {
+        c = c >> 1;
+      }
+    }
+    nbt__crc_table[n] = c;
+  }
+  nbt__crc_table_computed = 1;
+}
+
+static uint32_t nbt__update_crc(uint32_t crc, uint8_t* buf, size_t len) {
+  uint32_t c = crc ^ 0xffffffffL;
+  size_t n;
+
+  if (!nbt__crc_table_computed) {
+    nbt__make_crc_table();
+  }
+
+  for (n = 0; n < len; n++) {
+    c = nbt__crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+  }
+  return c ^ 0xffffffffL;
+}
+
+// Passes serialized data on to a writer, compressing it on the way if needed. The data may be given in any number of
+// pieces, with the last one marked as finishing the stream.
+typedef struct {
+  nbt_writer_t writer;
+  nbt_context_t* context;
+  int compressed;
+  int gzip_format;
+  uint32_t crc;
+  size_t total_size;
+  int error;
+} nbt__sink_t;
+
+static void nbt__sink_output(nbt__sink_t* sink, uint8_t* data, size_t size) {
+  while (size > 0 && !sink->error) {
+    size_t bytes_written;
+    NBT__PHASE(NBT_PHASE_WRITE, bytes_written = sink->writer.write(sink->writer.userdata, data, size));
+    if (bytes_written == 0) {
+      sink->error = 1;
+    }
+    data += bytes_written;
+    size -= bytes_written;
+  }
+}
+
+#ifdef NBT_THREADS
+
+static uint32_t nbt__gf2_matrix_times(uint32_t* mat, uint32_t vec) {
+  uint32_t sum = 0;
+  while (vec) {
+    if (vec & 1) {
+      sum ^= *mat;
+    }
+    vec >>= 1;
+    mat++;
+  }
+  return sum;
+}
+
+static void nbt__gf2_matrix_square(uint32_t* square, uint32_t* mat) {
+  for (int n = 0; n < 32; n++) {
+    square[n] = nbt__gf2_matrix_times(mat, mat[n]);
+  }
+}
+
+// Returns the CRC of two concatenated blocks given the CRC of each block and the length of the second.
+static uint32_t nbt__crc_combine(uint32_t crc1, uint32_t crc2, size_t len2) {
+  uint32_t even[32];
+  uint32_t odd[32];
+
+  if (len2 == 0) {
+    return crc1;
+  }
+
+  // Operator for a single zero bit.
+  odd[0] = 0xedb88320L;
+  uint32_t row = 1;
+  for (int n = 1; n < 32; n++) {
+    odd[n] = row;
+    row <<= 1;
+  }
+
+  nbt__gf2_matrix_square(even, odd); // Two zero bits.
+  nbt__gf2_matrix_square(odd, even); // Four zero bits.
+
+  // Apply len2 zero bytes to crc1.
+  do {
+    nbt__gf2_matrix_square(even, odd);
+    if (len2 & 1) {
+      crc1 = nbt__gf2_matrix_times(even, crc1);
+    }
+    len2 >>= 1;
+    if (len2 == 0) {
+      break;
+    }
+    nbt__gf2_matrix_square(odd, even);
+    if (len2 & 1) {
+      crc1 = nbt__gf2_matrix_times(odd, crc1);
+    }
+    len2 >>= 1;
+  } while (len2 != 0);
+
+  return crc1 ^ crc2;
+}
+
+// Same as nbt__crc_combine, but for Adler-32 checksums.
+static uint32_t nbt__adler_combine(uint32_t adler1, uint32_t adler2, size_t len2) {
+  const uint32_t base = 65521;
+
+  uint32_t rem = (uint32_t)(len2 % base);
+  uint32_t sum1 = adler1 & 0xffff;
+  uint32_t sum2 = (uint32_t)(((uint64_t)rem * sum1) % base);
+  sum1 += (adler2 & 0xffff) + base - 1;
+  sum2 += ((adler1 >> 16) & 0xffff) + ((adler2 >> 16) & 0xffff) + base - rem;
+  if (sum1 >= base) sum1 -= base;
+  if (sum1 >= base) sum1 -= base;
+  if (sum2 >= (base << 1)) sum2 -= (base << 1);
+  if (sum2 >= base) sum2 -= base;
+
+  return sum1 | (sum2 << 16);
+}
+
+typedef struct {
+  uint8_t* in;
+  size_t in_size;
+  uint8_t* dict;
+  size_t dict_size;
+  int last;
+  int gzip_format;
+  uint8_t* out; // Allocated by the calling thread, as the allocator belongs to it.
+  size_t out_alloc_size;
+  size_t out_size;
+  uint32_t check;
+  int error;
+} nbt__deflate_job_t;
+
+typedef struct {
+  nbt__deflate_job_t* jobs;
+  size_t job_count;
+  size_t first;
+  size_t stride;
+  z_stream stream; // Set up by the calling thread, so that its state comes from that thread's allocator.
+} nbt__deflate_worker_t;
+
+static void nbt__deflate_job_run(nbt__deflate_job_t* job, z_stream* stream) {
+
+  job->out_size = 0;
+  job->error = 1;
+
+  if (!job->out || deflateReset(stream) != Z_OK) {
+    return;
+  }
+
+  // Priming each block with the end of the one before lets matches reach back into it, as they would in a single
+  // stream, which recovers most of the ratio lost by splitting the data.
+  if (job->dict_size > 0) {
+#ifdef NBT_OWN_ZLIB
+    deflateSetDictionary(stream, job->dict, job->dict_size);
+#else
+    // miniz doesn't support preset dictionaries. Instead, the end of the previous block is compressed first, flushed
+    // to a byte boundary and its output thrown away. The decoder has already seen that data by the time it reaches
+    // this block, so matches into it still work.
+    stream->next_in = job->dict;
+    stream->avail_in = job->dict_size;
+    stream->next_out = job->out;
+    stream->avail_out = job->out_alloc_size;
+    if (deflate(stream, Z_SYNC_FLUSH) != Z_OK || stream->avail_in != 0) {
+      return;
+    }
+#endif
+  }
+
+  stream->next_in = job->in;
+  stream->avail_in = job->in_size;
+  stream->next_out = job->out;
+  stream->avail_out = job->out_alloc_size;
+
+  // Every block except the last ends with an empty stored block, which byte-aligns the output without setting the
+  // final block bit. The output buffer is bigger than deflate can ever make a block, so it all happens in one call.
+  int flush = job->last ? Z_FINISH : Z_SYNC_FLUSH;
+  int ret = deflate(stream, flush);
+
+  job->out_size = job->out_alloc_size - stream->avail_out;
+
+  if (!(ret == Z_STREAM_END || (!job->last && ret == Z_OK && stream->avail_in == 0 && stream->avail_out != 0))) {
+    return;
+  }
+
+  if (job->gzip_format) {
+    job->check = nbt__update_crc(0, job->in, job->in_size);
+  } else {
+    job->check = adler32(1, job->in, job->in_size);
+  }
+
+  job->error = 0;
+
+}
+
+static void* nbt__deflate_worker(void* userdata) {
+  nbt__deflate_worker_t* worker = (nbt__deflate_worker_t*)userdata;
+
+  for (size_t i = worker->first; i < worker->job_count; i += worker->stride) {
+    nbt__deflate_job_run(&worker->jobs[i], &worker->stream);
+  }
+
+  return NULL;
+}
+
+// Runs every job, sharing them out between up to NBT_PARALLEL_THREADS threads. Returns 0 without running any of them if
+// the compressors couldn't be set up.
+static int nbt__deflate_jobs(nbt__deflate_job_t* jobs, size_t job_count) {
+
+  size_t thread_count = job_count < NBT_PARALLEL_THREADS ? job_count : NBT_PARALLEL_THREADS;
+
+  nbt__deflate_worker_t workers[NBT_PARALLEL_THREADS];
+  pthread_t threads[NBT_PARALLEL_THREADS];
+  int started[NBT_PARALLEL_THREADS];
+
+  // The allocator and its counts belong to the calling thread, so each worker's compressor is allocated here and only
+  // reset by the worker between blocks. Each block is a raw deflate stream so that they can be concatenated.
+  for (size_t i = 0; i < thread_count; i++) {
+    workers[i].jobs = jobs;
+    workers[i].job_count = job_count;
+    workers[i].first = i;
+    workers[i].stride = thread_count;
+    workers[i].stream.zalloc = nbt__zalloc;
+    workers[i].stream.zfree = nbt__zfree;
+    workers[i].stream.opaque = Z_NULL;
+
+    if (deflateInit2(&workers[i].stream, NBT_COMPRESSION_LEVEL, Z_DEFLATED, -Z_DEFAULT_WINDOW_BITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      for (size_t j = 0; j < i; j++) {
+        deflateEnd(&workers[j].stream);
+      }
+      return 0;
+    }
+  }
+
+  // The calling thread takes the first share of the work itself.
+  for (size_t i = 1; i < thread_count; i++) {
+    started[i] = pthread_create(&threads[i], NULL, nbt__deflate_worker, &workers[i]) == 0;
+  }
+
+  nbt__deflate_worker(&workers[0]);
+
+  for (size_t i = 1; i < thread_count; i++) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    } else {
+      nbt__deflate_worker(&workers[i]);
+    }
+  }
+
+  for (size_t i = 0; i < thread_count; i++) {
+    deflateEnd(&workers[i].stream);
+  }
+
+  return 1;
+
+}
+
+// Compresses the serialized tree in independent blocks on several threads and stitches them into a single stream.
+// Returns 0 if anything went wrong before output was written, in which case the caller should fall back to the
+// single-threaded path.
+static int nbt__write_parallel(nbt_writer_t writer, nbt__write_stream_t* write_stream, int gzip_format) {
+
+  size_t job_count = (write_stream->size + NBT_PARALLEL_BLOCK_SIZE - 1) / NBT_PARALLEL_BLOCK_SIZE;
+
+  nbt__deflate_job_t* jobs = (nbt__deflate_job_t*)nbt__malloc(job_count * sizeof(nbt__deflate_job_t));
+  if (!jobs) {
+    return 0;
+  }
+
+  for (size_t i = 0; i < job_count; i++) {
+    size_t offset = i * NBT_PARALLEL_BLOCK_SIZE;
+    size_t dict_size = offset < 32768 ? offset : 32768;
+
+    jobs[i].in = write_stream->buffer + offset;
+    jobs[i].in_size = write_stream->size - offset < NBT_PARALLEL_BLOCK_SIZE ? write_stream->size - offset : NBT_PARALLEL_BLOCK_SIZE;
+    jobs[i].dict = jobs[i].in - dict_size;
+    jobs[i].dict_size = dict_size;
+    jobs[i].last = (i == job_count - 1);
+    jobs[i].gzip_format = gzip_format;
+    size_t largest_size = jobs[i].in_size > dict_size ? jobs[i].in_size : dict_size; // Priming may write the dictionary.
+    jobs[i].out_alloc_size = largest_size + largest_size / 8 + 64;
+    jobs[i].out = (uint8_t*)nbt__malloc(jobs[i].out_alloc_size);
+  }
+
+  if (!nbt__crc_table_computed) {
+    nbt__make_crc_table(); // Avoid the worker threads racing to build the table.
+  }
+
+  int ran;
+  NBT__PHASE(NBT_PHASE_DEFLATE, ran = nbt__deflate_jobs(jobs, job_count));
+
+  int error = !ran;
+  for (size_t i = 0; i < job_count; i++) {
+    error |= jobs[i].error;
+  }
+
+  if (!error) {
+
+    // Output goes through the same loop as single-threaded output, which retries short writes and stops at the first
+    // failed one.
+    nbt__sink_t sink;
+    sink.writer = writer;
+    sink.error = 0;
+
+    if (gzip_format) {
+      uint8_t header[10] = { 31, 139, 8, 0, 0, 0, 0, 0, 2, 255 };
+      nbt__sink_output(&sink, header, 10);
+    } else {
+      uint8_t header[2] = { 0x78, 0xda };
+      nbt__sink_output(&sink, header, 2);
+    }
+
+    uint32_t check = gzip_format ? 0 : 1;
+
+    for (size_t i = 0; i < job_count; i++) {
+      nbt__sink_output(&sink, jobs[i].out, jobs[i].out_size);
+
+      if (gzip_format) {
+        check = nbt__crc_combine(check, jobs[i].check, jobs[i].in_size);
+      } else {
+        check = nbt__adler_combine(check, jobs[i].check, jobs[i].in_size);
+      }
+    }
+
+    uint8_t trailer[8];
+    if (gzip_format) {
+      for (int i = 0; i < 4; i++) {
+        trailer[i] = (uint8_t)(check >> (8 * i));
+        trailer[i + 4] = (uint8_t)(write_stream->size >> (8 * i));
+      }
+      nbt__sink_output(&sink, trailer, 8);
+    } else {
+      for (int i = 0; i < 4; i++) {
+        trailer[i] = (uint8_t)(check >> (24 - 8 * i));
+      }
+      nbt__sink_output(&sink, trailer, 4);
+    }
+
+  }
+
+  for (size_t i = 0; i < job_count; i++) {
+    nbt__free(jobs[i].out);
+  }
+  nbt__free(jobs);
+
+  return !error;
+
+}
+
+#endif
+
+// Serializes tag into the context's buffer, after the first offset bytes. Returns 0 if part of the tree couldn't be
+// parsed (see nbt__write_lazy).
+static int nbt__serialize(nbt_context_t* context, nbt__write_stream_t* write_stream, nbt_tag_t* tag, int write_flags, size_t offset) {
+
+  nbt__context_reserve(context, NBT_BUFFER_SIZE);
+
+  write_stream->buffer = context->buffer;
+  write_stream->offset = offset;
+  write_stream->size = 0;
+  write_stream->alloc_size = context->buffer_alloc_size;
+  write_stream->error = 0;
+
+  NBT__PHASE(NBT_PHASE_SERIALIZE, nbt__write_tag(write_stream, tag, !(write_flags & NBT_WRITE_FLAG_NAMELESS_ROOT), 1, nbt__get_format(write_flags)));
+
+  // Hold on to the grown buffer for next time.
+  context->buffer = write_stream->buffer;
+  context->buffer_alloc_size = write_stream->alloc_size;
+
+  return !write_stream->error;
+
+}
+
+static int nbt__sink_begin(nbt__sink_t* sink, nbt_context_t* context, nbt_writer_t writer, int write_flags) {
+
+  sink->writer = writer;
+  sink->context = context;
+  sink->crc = 0;
+  sink->total_size = 0;
+  sink->error = 0;
+  nbt__get_compression(write_flags, &sink->compressed, &sink->gzip_format);
+
+  if (sink->compressed) {
+
+    if (!nbt__context_deflate_begin(context, sink->gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS)) {
+      return 0;
+    }
+
+    if (!context->out_buffer) {
+      context->out_buffer = (uint8_t*)nbt__malloc(NBT_BUFFER_SIZE);
+    }
+
+    if (sink->gzip_format) {
+      uint8_t header[10] = { 31, 139, 8, 0, 0, 0, 0, 0, 2, 255 };
+      nbt__sink_output(sink, header, 10);
+    }
+
+  }
+
+  return 1;
+
+}
+
+static void nbt__sink_write(nbt__sink_t* sink, uint8_t* data, size_t size, int finish) {
+
+  sink->total_size += size;
+
+  if (!sink->compressed) {
+    nbt__sink_output(sink, data, size);
+    return;
+  }
+
+  z_stream* stream = &sink->context->deflate_stream;
+  uint8_t* out_buffer = sink->context->out_buffer;
+  size_t offset = 0;
+  int flush;
+
+  if (sink->gzip_format) {
+    NBT__PHASE(NBT_PHASE_DEFLATE, sink->crc = nbt__update_crc(sink->crc, data, size));
+  }
+
+  // Deflate straight from the serialized data, in pieces small enough for avail_in.
+  do {
+
+    size_t bytes_read = size - offset;
+    if (bytes_read > 0x40000000) {
+      bytes_read = 0x40000000;
+      flush = Z_NO_FLUSH;
+    } else {
+      flush = finish ? Z_FINISH : Z_NO_FLUSH;
+    }
+
+    stream->avail_in = bytes_read;
+    stream->next_in = data + offset;
+    offset += bytes_read;
+
+    do {
+      stream->avail_out = NBT_BUFFER_SIZE;
+      stream->next_out = out_buffer;
+
+      NBT__PHASE(NBT_PHASE_DEFLATE, deflate(stream, flush));
+
+      nbt__sink_output(sink, out_buffer, NBT_BUFFER_SIZE - stream->avail_out);
+
+    } while (stream->avail_out == 0);
+
+  } while (offset < size);
+
+  if (finish && sink->gzip_format) {
+    uint8_t trailer[8];
+    for (int i = 0; i < 4; i++) {
+      trailer[i] = (uint8_t)(sink->crc >> (8 * i));
+      trailer[i + 4] = (uint8_t)(sink->total_size >> (8 * i));
+    }
+    nbt__sink_output(sink, trailer, 8);
+  }
+
+}
+
+static void nbt__write_ex(nbt_context_t* context, nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  int compressed;
+  int gzip_format;
+  nbt__get_compression(write_flags, &compressed, &gzip_format);
+
+  nbt__write_stream_t write_stream;
+  if (!nbt__serialize(context, &write_stream, tag, write_flags, 0)) {
+    return;
+  }
+
+#ifdef NBT_THREADS
+  if (compressed && (write_flags & NBT_WRITE_FLAG_PARALLEL) && write_stream.size > NBT_PARALLEL_BLOCK_SIZE) {
+    if (nbt__write_parallel(writer, &write_stream, gzip_format)) {
+      return;
+    }
+  }
+#endif
+
+  nbt__sink_t sink;
+  if (nbt__sink_begin(&sink, context, writer, write_flags)) {
+    nbt__sink_write(&sink, write_stream.buffer, write_stream.size, 1);
+  }
+
+}
+
+void nbt_write_ex(nbt_context_t* context, nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  nbt__write_ex(context, writer, tag, write_flags);
+
+  nbt__call_end(&mark, context, "nbt_write");
+
+}
+
+void nbt_write(nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  nbt_write_ex(context, writer, tag, write_flags);
+
+  nbt_free_context(context);
+
+}
+
+static size_t nbt__write_packet_ex(nbt_context_t* context, nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  // Leave room for the longest possible VarInt in front of the payload, then fill in the length once it is known so
+  // that the whole packet can be written in one go.
+  nbt__write_stream_t write_stream;
+  if (!nbt__serialize(context, &write_stream, tag, write_flags, 5)) {
+    return 0;
+  }
+
+  if (write_stream.size > 0x7fffffff) {
+    return 0; // Doesn't fit in a VarInt.
+  }
+
+  uint8_t prefix[5];
+  size_t prefix_size = 0;
+  uint32_t length = (uint32_t)write_stream.size;
+  while (length >= 0x80) {
+    prefix[prefix_size++] = (uint8_t)(length | 0x80);
+    length >>= 7;
+  }
+  prefix[prefix_size++] = (uint8_t)length;
+
+  uint8_t* packet = write_stream.buffer + 5 - prefix_size;
+  NBT_MEMCPY(packet, prefix, prefix_size);
+
+  nbt__sink_t sink;
+  nbt__sink_begin(&sink, context, writer, (write_flags & ~3) | NBT_WRITE_FLAG_USE_RAW);
+  nbt__sink_write(&sink, packet, prefix_size + write_stream.size, 1);
+
+  return sink.error ? 0 : prefix_size + write_stream.size;
+
+}
+
+size_t nbt_write_packet_ex(nbt_context_t* context, nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  size_t written = nbt__write_packet_ex(context, writer, tag, write_flags);
+
+  nbt__call_end(&mark, context, "nbt_write_packet");
+
+  return written;
+
+}
+
+size_t nbt_write_packet(nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  size_t size = nbt_write_packet_ex(context, writer, tag, write_flags);
+
+  nbt_free_context(context);
+
+  return size;
+
+}
+
+// Walks serialized NBT data to find where it ends, checking that every tag fits in the data. The walk can stop at any
+// point when it runs out of data and carry on later once more is available.
+typedef struct {
+  nbt__scan_frame_t* frames;
+  size_t depth;
+  size_t frames_alloc_size;
+  size_t offset; // Start of the first tag which has not been fully scanned yet.
+  int started;
+  nbt__format_t format;
+  int root_name; // Whether the root tag has a name.
+} nbt__scanner_t;
+
+static void nbt__scanner_init(nbt__scanner_t* scanner, int parse_flags) {
+  scanner->frames = NULL;
+  scanner->depth = 0;
+  scanner->frames_alloc_size = 0;
+  scanner->offset = 0;
+  scanner->started = 0;
+  scanner->format = nbt__get_format(parse_flags);
+  scanner->root_name = !(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT);
+}
+
+static nbt__scan_status_t nbt__scan(nbt__scanner_t* scanner, const uint8_t* buffer, size_t size) {
+
+  nbt__format_t format = scanner->format;
+
+  for (;;) {
+
+    if (scanner->depth == 0 && scanner->started) {
+      return NBT__SCAN_DONE;
+    }
+
+    size_t p = scanner->offset;
+    nbt__scan_frame_t* frame = scanner->depth > 0 ? &scanner->frames[scanner->depth - 1] : NULL;
+    nbt__scan_status_t status;
+    uint32_t length;
+    int type;
+
+    // Work out the type of the next tag, and skip past its type and name.
+    if (frame && frame->type == NBT_TYPE_LIST) {
+      if (frame->list_remaining == 0) {
+        scanner->depth--;
+        continue;
+      }
+      type = frame->list_type;
+    } else {
+      if (p + 1 > size) {
+        return NBT__SCAN_NEED_MORE;
+      }
+      type = buffer[p++];
+
+      if (type == NBT_TYPE_END) {
+        scanner->offset = p;
+        if (frame) {
+          scanner->depth--;
+        } else {
+          scanner->started = 1;
+        }
+        continue;
+      }
+
+      if (frame || scanner->root_name) {
+        status = nbt__scan_length(buffer, size, &p, 1, format, &length);
+        if (status != NBT__SCAN_DONE) {
+          return status;
+        }
+        p += length;
+      }
+    }
+
+    // Skip past the payload, leaving lists and compounds to be pushed onto the stack.
+    uint8_t list_type = 0;
+    uint32_t list_length = 0;
+
+    status = nbt__scan_payload(buffer, size, &p, type, format, &list_type, &list_length);
+    if (status != NBT__SCAN_DONE) {
+      return status;
+    }
+
+    // The whole tag (or the header of a list or compound) is available, so move past it.
+    if (frame && frame->type == NBT_TYPE_LIST) {
+      frame->list_remaining--;
+    }
+
+    if (type == NBT_TYPE_LIST || type == NBT_TYPE_COMPOUND) {
+      if (scanner->depth == NBT_MAX_DEPTH) {
+        return NBT__SCAN_ERROR;
+      }
+      if (scanner->depth == scanner->frames_alloc_size) {
+        scanner->frames_alloc_size = scanner->frames_alloc_size ? scanner->frames_alloc_size * 2 : 16;
+        scanner->frames = (nbt__scan_frame_t*)nbt__realloc(scanner->frames, scanner->frames_alloc_size * sizeof(nbt__scan_frame_t));
+      }
+      frame = &scanner->frames[scanner->depth++];
+      frame->type = (uint8_t)type;
+      if (type == NBT_TYPE_LIST) {
+        frame->list_type = list_type;
+        frame->list_remaining = list_length;
+      }
+    }
+
+    scanner->offset = p;
+    scanner->started = 1;
+
+  }
+
+}
+
+typedef enum {
+  NBT__INCREMENTAL_GZIP_HEADER,
+  NBT__INCREMENTAL_BODY,
+  NBT__INCREMENTAL_GZIP_TRAILER,
+  NBT__INCREMENTAL_DONE,
+  NBT__INCREMENTAL_ERROR
+} nbt__incremental_stage_t;
+
+// Fields of the gzip header, in the order they appear.
+typedef enum {
+  NBT__GZIP_FIXED,
+  NBT__GZIP_EXTRA_LENGTH,
+  NBT__GZIP_EXTRA,
+  NBT__GZIP_NAME,
+  NBT__GZIP_COMMENT,
+  NBT__GZIP_HCRC,
+  NBT__GZIP_HEADER_DONE
+} nbt__gzip_field_t;
+
+struct nbt_incremental_parser_t {
+  int parse_flags;
+  int compressed;
+  int gzip_format;
+  nbt__incremental_stage_t stage;
+  nbt__gzip_field_t gzip_field;
+  uint8_t gzip_header[10]; // Also holds the trailer, once the header is finished with.
+  size_t gzip_remaining; // Bytes left in the current fixed-size gzip field.
+  nbt_context_t* context; // Holds the inflate stream and the decoded data.
+  size_t buffer_size;
+  nbt__scanner_t scanner;
+  nbt_tag_t* tag;
+  int tag_parsed;
+};
+
+nbt_incremental_parser_t* nbt_new_incremental_parser(int parse_flags) {
+
+  nbt_incremental_parser_t* parser = (nbt_incremental_parser_t*)nbt__malloc(sizeof(nbt_incremental_parser_t));
+
+  parser->parse_flags = parse_flags;
+  nbt__get_compression(parse_flags, &parser->compressed, &parser->gzip_format);
+  parser->context = nbt_new_context();
+  parser->tag = NULL;
+  nbt__scanner_init(&parser->scanner, parse_flags);
+
+  nbt_incremental_parser_reset(parser);
+
+  return parser;
+
+}
+
+void nbt_free_incremental_parser(nbt_incremental_parser_t* parser) {
+
+  if (parser->tag) {
+    nbt_free_tag(parser->tag);
+  }
+
+  nbt__free(parser->scanner.frames);
+  nbt_free_context(parser->context);
+  nbt__free(parser);
+
+}
+
+void nbt_incremental_parser_reset(nbt_incremental_parser_t* parser) {
+
+  if (parser->tag) {
+    nbt_free_tag(parser->tag);
+    parser->tag = NULL;
+  }
+
+  parser->stage = parser->gzip_format ? NBT__INCREMENTAL_GZIP_HEADER : NBT__INCREMENTAL_BODY;
+  parser->gzip_field = NBT__GZIP_FIXED;
+  parser->gzip_remaining = 10;
+  parser->buffer_size = 0;
+  parser->tag_parsed = 0;
+
+  parser->scanner.depth = 0;
+  parser->scanner.offset = 0;
+  parser->scanner.started = 0;
+
+  if (parser->compressed && !nbt__context_inflate_begin(parser->context, parser->gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS)) {
+    parser->stage = NBT__INCREMENTAL_ERROR;
+  }
+
+}
+
+// Moves on to the next gzip header field which is present according to the header flags.
+static void nbt__incremental_next_gzip_field(nbt_incremental_parser_t* parser) {
+
+  uint8_t flags = parser->gzip_header[3];
+
+  for (;;) {
+    parser->gzip_field = (nbt__gzip_field_t)(parser->gzip_field + 1);
+
+    switch (parser->gzip_field) {
+      case NBT__GZIP_EXTRA_LENGTH: {
+        if (flags & 4) {
+          parser->gzip_remaining = 2;
+          return;
+        }
+        break;
+      }
+      case NBT__GZIP_EXTRA: {
+        if (flags & 4) {
+          return; // gzip_remaining is set from the length field.
+        }
+        break;
+      }
+      case NBT__GZIP_NAME: {
+        if (flags & 8) {
+          return;
+        }
+        break;
+      }
+      case NBT__GZIP_COMMENT: {
+        if (flags & 16) {
+          return;
+        }
+        break;
+      }
+      case NBT__GZIP_HCRC: {
+        if (flags & 2) {
+          parser->gzip_remaining = 2;
+          return;
+        }
+        break;
+      }
+      default: {
+        parser->stage = NBT__INCREMENTAL_BODY;
+        return;
+      }
+    }
+  }
+
+}
+
+// Consumes gzip header bytes, returning the number used.
+static size_t nbt__incremental_gzip_header(nbt_incremental_parser_t* parser, const uint8_t* data, size_t size) {
+
+  size_t used = 0;
+
+  while (used < size && parser->stage == NBT__INCREMENTAL_GZIP_HEADER) {
+    uint8_t byte = data[used++];
+
+    switch (parser->gzip_field) {
+      case NBT__GZIP_FIXED: {
+        parser->gzip_header[10 - parser->gzip_remaining--] = byte;
+        if (parser->gzip_remaining == 0) {
+          if (parser->gzip_header[0] != 31 || parser->gzip_header[1] != 139) {
+            parser->stage = NBT__INCREMENTAL_ERROR;
+          } else {
+            nbt__incremental_next_gzip_field(parser);
+          }
+        }
+        break;
+      }
+      case NBT__GZIP_EXTRA_LENGTH: {
+        // Reuse the first two bytes of the header to hold the length.
+        parser->gzip_header[2 - parser->gzip_remaining--] = byte;
+        if (parser->gzip_remaining == 0) {
+          parser->gzip_remaining = parser->gzip_header[0] | (parser->gzip_header[1] << 8);
+          nbt__incremental_next_gzip_field(parser);
+          if (parser->gzip_field == NBT__GZIP_EXTRA && parser->gzip_remaining == 0) {
+            nbt__incremental_next_gzip_field(parser);
+          }
+        }
+        break;
+      }
+      case NBT__GZIP_NAME:
+      case NBT__GZIP_COMMENT: {
+        if (byte == 0) {
+          nbt__incremental_next_gzip_field(parser);
+        }
+        break;
+      }
+      default: { // Skipped fields.
+        if (--parser->gzip_remaining == 0) {
+          nbt__incremental_next_gzip_field(parser);
+        }
+        break;
+      }
+    }
+  }
+
+  return used;
+
+}
+
+nbt_incremental_status_t nbt_incremental_parser_feed(nbt_incremental_parser_t* parser, const void* data, size_t size, size_t* consumed) {
+
+  const uint8_t* in = (const uint8_t*)data;
+  size_t used = 0;
+  nbt_context_t* context = parser->context;
+
+  if (parser->stage == NBT__INCREMENTAL_GZIP_HEADER) {
+    used += nbt__incremental_gzip_header(parser, in, size);
+  }
+
+  if (parser->stage == NBT__INCREMENTAL_BODY) {
+
+    if (parser->compressed) {
+
+      z_stream* stream = &context->inflate_stream;
+      stream->next_in = in + used;
+      stream->avail_in = size - used;
+
+      int ret = Z_OK;
+      stream->avail_out = 0;
+      while (ret == Z_OK && (stream->avail_in > 0 || stream->avail_out == 0)) {
+        nbt__context_reserve(context, parser->buffer_size + NBT_BUFFER_SIZE);
+
+        size_t out_space = context->buffer_alloc_size - parser->buffer_size;
+        stream->next_out = context->buffer + parser->buffer_size;
+        stream->avail_out = out_space;
+
+        NBT__PHASE(NBT_PHASE_INFLATE, ret = inflate(stream, Z_NO_FLUSH));
+
+        parser->buffer_size += out_space - stream->avail_out;
+      }
+
+      used = size - stream->avail_in;
+
+      if (ret == Z_STREAM_END) {
+        parser->stage = parser->gzip_format ? NBT__INCREMENTAL_GZIP_TRAILER : NBT__INCREMENTAL_DONE;
+        parser->gzip_remaining = 8;
+      } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        parser->stage = NBT__INCREMENTAL_ERROR;
+      }
+
+    } else {
+
+      nbt__context_reserve(context, parser->buffer_size + size);
+      NBT_MEMCPY(context->buffer + parser->buffer_size, in, size);
+      parser->buffer_size += size;
+      used = size;
+
+    }
+
+    // Check the structure of what has arrived so far. This catches bad data early, and finds the end of raw data.
+    nbt__scan_status_t status = nbt__scan(&parser->scanner, context->buffer, parser->buffer_size);
+
+    if (status == NBT__SCAN_ERROR || (status == NBT__SCAN_NEED_MORE && parser->stage == NBT__INCREMENTAL_DONE)) {
+      parser->stage = NBT__INCREMENTAL_ERROR;
+    } else if (status == NBT__SCAN_DONE && !parser->compressed) {
+      // Anything after the end of the tag belongs to whatever comes next.
+      used -= parser->buffer_size - parser->scanner.offset;
+      parser->buffer_size = parser->scanner.offset;
+      parser->stage = NBT__INCREMENTAL_DONE;
+    }
+
+  }
+
+  if (parser->stage == NBT__INCREMENTAL_GZIP_TRAILER) {
+    while (used < size && parser->gzip_remaining > 0) {
+      parser->gzip_header[8 - parser->gzip_remaining--] = in[used++];
+    }
+    if (parser->gzip_remaining == 0) {
+      // The trailer holds the CRC-32 and size (modulo 2^32) of the uncompressed data, which is all in the buffer.
+      const uint8_t* trailer = parser->gzip_header;
+      uint32_t crc = (uint32_t)trailer[0] | ((uint32_t)trailer[1] << 8) | ((uint32_t)trailer[2] << 16) | ((uint32_t)trailer[3] << 24);
+      uint32_t isize = (uint32_t)trailer[4] | ((uint32_t)trailer[5] << 8) | ((uint32_t)trailer[6] << 16) | ((uint32_t)trailer[7] << 24);
+      uint32_t actual_crc;
+      NBT__PHASE(NBT_PHASE_INFLATE, actual_crc = nbt__update_crc(0, context->buffer, parser->buffer_size));
+      if (crc != actual_crc || isize != (uint32_t)parser->buffer_size) {
+        parser->stage = NBT__INCREMENTAL_ERROR;
+      } else {
+        parser->stage = NBT__INCREMENTAL_DONE;
+      }
+    }
+  }
+
+  if (consumed) {
+    *consumed = used;
+  }
+
+  switch (parser->stage) {
+    case NBT__INCREMENTAL_DONE: {
+      if (!parser->tag_parsed) {
+        if (!parser->scanner.started || parser->scanner.depth > 0) {
+          parser->stage = NBT__INCREMENTAL_ERROR;
+          return NBT_INCREMENTAL_ERROR;
+        }
+
+        // The scanner has checked that everything fits in the buffer, so this can't read past the end.
+        parser->tag = nbt__parse_buffer(context, context->buffer, parser->buffer_size, parser->parse_flags);
+        parser->tag_parsed = 1;
+        if (!parser->tag) {
+          parser->stage = NBT__INCREMENTAL_ERROR;
+          return NBT_INCREMENTAL_ERROR;
+        }
+      }
+      return NBT_INCREMENTAL_DONE;
+    }
+    case NBT__INCREMENTAL_ERROR: {
+      return NBT_INCREMENTAL_ERROR;
+    }
+    default: {
+      return NBT_INCREMENTAL_NEED_MORE;
+    }
+  }
+
+}
+
+nbt_tag_t* nbt_incremental_parser_take_tag(nbt_incremental_parser_t* parser) {
+  nbt_tag_t* tag = parser->tag;
+  parser->tag = NULL;
+  return tag;
+}
+
+#ifndef NBT_NO_STDIO
+
+static size_t nbt__file_read(void* userdata, uint8_t* data, size_t size) {
+  return fread(data, 1, size, (FILE*)userdata);
+}
+
+static nbt_tag_t* nbt__parse_file_ex(nbt_context_t* context, const char* path, int parse_flags) {
+
+#ifdef NBT__HAVE_MMAP
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+
+    void* data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (data != MAP_FAILED) {
+      close(fd);
+
+      // The whole file is about to be read from front to back. posix_madvise isn't declared in strict ISO C modes, in
+      // which case the hints are left out.
+#ifdef POSIX_MADV_SEQUENTIAL
+      posix_madvise(data, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+      posix_madvise(data, (size_t)st.st_size, POSIX_MADV_WILLNEED);
+#endif
+
+      nbt_tag_t* tag = nbt_parse_memory_ex(context, data, (size_t)st.st_size, parse_flags);
+
+      munmap(data, (size_t)st.st_size);
+
+      return tag;
+    }
+
+  }
+
+  close(fd);
+#endif
+
+  // Fall back to buffered reads when the file can't be mapped.
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    return NULL;
+  }
+
+  nbt_reader_t reader;
+  reader.read = nbt__file_read;
+  reader.userdata = file;
+
+  nbt_tag_t* tag = nbt_parse_ex(context, reader, parse_flags);
+
+  fclose(file);
+
+  return tag;
+
+}
+
+nbt_tag_t* nbt_parse_file_ex(nbt_context_t* context, const char* path, int parse_flags) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  nbt_tag_t* tag = nbt__parse_file_ex(context, path, parse_flags);
+
+  nbt__call_end(&mark, context, "nbt_parse_file");
+
+  return tag;
+
+}
+
+nbt_tag_t* nbt_parse_file(const char* path, int parse_flags) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  nbt_tag_t* tag = nbt_parse_file_ex(context, path, parse_flags);
+
+  nbt_free_context(context);
+
+  return tag;
+
+}
+
+#endif
+
+// Makes room for size more bytes after offset in a memory output buffer. Fixed-size buffers cannot be grown, in which
+// case 0 is returned.
+static int nbt__memory_output_reserve(uint8_t** out, size_t* out_alloc_size, int growable, size_t offset, size_t size) {
+  if (offset + size <= *out_alloc_size) {
+    return 1;
+  }
+
+  if (!growable) {
+    return 0;
+  }
+
+  size_t alloc_size = *out_alloc_size ? *out_alloc_size * 2 : NBT_BUFFER_SIZE;
+  while (alloc_size < offset + size) {
+    alloc_size *= 2;
+  }
+
+  *out = (uint8_t*)nbt__realloc(*out, alloc_size);
+  *out_alloc_size = alloc_size;
+  return 1;
+}
+
+// Compresses in_size bytes of in into *out, returning the compressed size, or 0 if it did not fit.
+static size_t nbt__compress_memory(nbt_context_t* context, const uint8_t* in, size_t in_size, int gzip_format, uint8_t** out, size_t* out_alloc_size, int growable) {
+
+  if (!nbt__context_deflate_begin(context, gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS)) {
+    return 0;
+  }
+
+  size_t out_size = 0;
+
+  if (gzip_format) {
+    uint8_t header[10] = { 31, 139, 8, 0, 0, 0, 0, 0, 2, 255 };
+    if (!nbt__memory_output_reserve(out, out_alloc_size, growable, out_size, 10)) {
+      return 0;
+    }
+    NBT_MEMCPY(*out, header, 10);
+    out_size += 10;
+  }
+
+  z_stream* stream = &context->deflate_stream;
+  size_t in_offset = 0;
+  int ret;
+
+  stream->avail_in = 0;
+
+  do {
+
+    // avail_in and avail_out are only 32 bits wide, so feed very large buffers through in pieces.
+    int flush = Z_FINISH;
+    if (stream->avail_in == 0) {
+      size_t chunk = in_size - in_offset < 0x40000000 ? in_size - in_offset : 0x40000000;
+      stream->next_in = in + in_offset;
+      stream->avail_in = chunk;
+      in_offset += chunk;
+    }
+    if (in_offset < in_size) {
+      flush = Z_NO_FLUSH;
+    }
+
+    if (out_size == *out_alloc_size && !nbt__memory_output_reserve(out, out_alloc_size, growable, out_size, 1)) {
+      return 0;
+    }
+
+    size_t out_space = *out_alloc_size - out_size;
+    if (out_space > 0x40000000) {
+      out_space = 0x40000000;
+    }
+
+    stream->next_out = *out + out_size;
+    stream->avail_out = out_space;
+
+    NBT__PHASE(NBT_PHASE_DEFLATE, ret = deflate(stream, flush));
+
+    out_size += out_space - stream->avail_out;
+
+    if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+      return 0;
+    }
+
+  } while (ret != Z_STREAM_END);
+
+  if (gzip_format) {
+    uint32_t crc;
+    NBT__PHASE(NBT_PHASE_DEFLATE, crc = nbt__update_crc(0, (uint8_t*)in, in_size));
+    if (!nbt__memory_output_reserve(out, out_alloc_size, growable, out_size, 8)) {
+      return 0;
+    }
+    for (int i = 0; i < 4; i++) {
+      (*out)[out_size + i] = (uint8_t)(crc >> (8 * i));
+      (*out)[out_size + 4 + i] = (uint8_t)(in_size >> (8 * i));
+    }
+    out_size += 8;
+  }
+
+  return out_size;
+
+}
+
+static uint8_t* nbt__write_memory_ex(nbt_context_t* context, nbt_tag_t* tag, int write_flags, size_t* size) {
+
+  int compressed;
+  int gzip_format;
+  nbt__get_compression(write_flags, &compressed, &gzip_format);
+
+  nbt__write_stream_t write_stream;
+  if (!nbt__serialize(context, &write_stream, tag, write_flags, 0)) {
+    *size = 0;
+    return NULL;
+  }
+
+  if (!compressed) {
+    // Hand the serialization buffer over to the caller rather than copying it. The context will allocate a new one
+    // next time it needs it.
+    context->buffer = NULL;
+    context->buffer_alloc_size = 0;
+
+    *size = write_stream.size;
+    return write_stream.buffer;
+  }
+
+  uint8_t* out = NULL;
+  size_t out_alloc_size = 0;
+
+  // Start from a rough guess at the compressed size.
+  nbt__memory_output_reserve(&out, &out_alloc_size, 1, 0, write_stream.size / 4 + 64);
+
+  *size = nbt__compress_memory(context, write_stream.buffer, write_stream.size, gzip_format, &out, &out_alloc_size, 1);
+
+  if (*size == 0) {
+    nbt__free(out);
+    return NULL;
+  }
+
+  return out;
+
+}
+
+uint8_t* nbt_write_memory_ex(nbt_context_t* context, nbt_tag_t* tag, int write_flags, size_t* size) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  uint8_t* buffer = nbt__write_memory_ex(context, tag, write_flags, size);
+
+  nbt__call_end(&mark, context, "nbt_write_memory");
+
+  return buffer;
+
+}
+
+uint8_t* nbt_write_memory(nbt_tag_t* tag, int write_flags, size_t* size) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  uint8_t* buffer = nbt_write_memory_ex(context, tag, write_flags, size);
+
+  nbt_free_context(context);
+
+  return buffer;
+
+}
+
+static size_t nbt__write_memory_to_ex(nbt_context_t* context, nbt_tag_t* tag, int write_flags, void* buffer, size_t capacity) {
+
+  int compressed;
+  int gzip_format;
+  nbt__get_compression(write_flags, &compressed, &gzip_format);
+
+  nbt__write_stream_t write_stream;
+  if (!nbt__serialize(context, &write_stream, tag, write_flags, 0)) {
+    return 0;
+  }
+
+  if (!compressed) {
+    if (write_stream.size > capacity) {
+      return 0;
+    }
+    NBT_MEMCPY(buffer, write_stream.buffer, write_stream.size);
+    return write_stream.size;
+  }
+
+  uint8_t* out = (uint8_t*)buffer;
+  size_t out_alloc_size = capacity;
+
+  return nbt__compress_memory(context, write_stream.buffer, write_stream.size, gzip_format, &out, &out_alloc_size, 0);
+
+}
+
+size_t nbt_write_memory_to_ex(nbt_context_t* context, nbt_tag_t* tag, int write_flags, void* buffer, size_t capacity) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  size_t written = nbt__write_memory_to_ex(context, tag, write_flags, buffer, capacity);
+
+  nbt__call_end(&mark, context, "nbt_write_memory_to");
+
+  return written;
+
+}
+
+size_t nbt_write_memory_to(nbt_tag_t* tag, int write_flags, void* buffer, size_t capacity) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  size_t size = nbt_write_memory_to_ex(context, tag, write_flags, buffer, capacity);
+
+  nbt_free_context(context);
+
+  return size;
+
+}
+
+typedef struct {
+  nbt_tag_t* tag;
+  size_t index; // Next child or array element to write.
+  uint8_t write_type;
+  uint8_t write_name;
+  uint8_t started;
+} nbt__write_frame_t;
+
+struct nbt_incremental_writer_t {
+  nbt_context_t* context;
+  nbt__sink_t sink;
+  nbt__write_stream_t stream; // Output which has not been passed to the sink yet.
+  nbt__write_frame_t* frames;
+  size_t depth;
+  size_t frames_alloc_size;
+  nbt__format_t format;
+  nbt_incremental_status_t status;
+};
+
+static void nbt__incremental_writer_push(nbt_incremental_writer_t* incremental_writer, nbt_tag_t* tag, int write_type, int write_name) {
+  if (incremental_writer->depth == incremental_writer->frames_alloc_size) {
+    incremental_writer->frames_alloc_size = incremental_writer->frames_alloc_size ? incremental_writer->frames_alloc_size * 2 : 16;
+    incremental_writer->frames = (nbt__write_frame_t*)nbt__realloc(incremental_writer->frames, incremental_writer->frames_alloc_size * sizeof(nbt__write_frame_t));
+  }
+
+  nbt__write_frame_t* frame = &incremental_writer->frames[incremental_writer->depth++];
+  frame->tag = tag;
+  frame->index = 0;
+  frame->write_type = (uint8_t)write_type;
+  frame->write_name = (uint8_t)write_name;
+  frame->started = 0;
+}
+
+nbt_incremental_writer_t* nbt_new_incremental_writer(nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+
+  nbt_incremental_writer_t* incremental_writer = (nbt_incremental_writer_t*)nbt__malloc(sizeof(nbt_incremental_writer_t));
+
+  incremental_writer->context = nbt_new_context();
+  incremental_writer->frames = NULL;
+  incremental_writer->depth = 0;
+  incremental_writer->frames_alloc_size = 0;
+  incremental_writer->format = nbt__get_format(write_flags);
+  incremental_writer->status = NBT_INCREMENTAL_NEED_MORE;
+
+  incremental_writer->stream.buffer = (uint8_t*)nbt__malloc(NBT_BUFFER_SIZE);
+  incremental_writer->stream.offset = 0;
+  incremental_writer->stream.size = 0;
+  incremental_writer->stream.alloc_size = NBT_BUFFER_SIZE;
+  incremental_writer->stream.error = 0;
+
+  if (!nbt__sink_begin(&incremental_writer->sink, incremental_writer->context, writer, write_flags)) {
+    incremental_writer->status = NBT_INCREMENTAL_ERROR;
+  }
+
+  nbt__incremental_writer_push(incremental_writer, tag, 1, !(write_flags & NBT_WRITE_FLAG_NAMELESS_ROOT));
+
+  return incremental_writer;
+
+}
+
+void nbt_free_incremental_writer(nbt_incremental_writer_t* incremental_writer) {
+
+  nbt__free(incremental_writer->frames);
+  nbt__free(incremental_writer->stream.buffer);
+  nbt_free_context(incremental_writer->context);
+  nbt__free(incremental_writer);
+
+}
+
+// Writes the next piece of the tree: a tag's header (and whole value, for anything that isn't a list, compound or
+// array), a run of array elements, or the end of a list or compound.
+static void nbt__incremental_writer_advance(nbt_incremental_writer_t* incremental_writer) {
+
+  nbt__write_stream_t* stream = &incremental_writer->stream;
+  nbt__write_frame_t* frame = &incremental_writer->frames[incremental_writer->depth - 1];
+  nbt_tag_t* tag = frame->tag;
+  nbt__format_t format = incremental_writer->format;
+
+  if (!frame->started) {
+    frame->started = 1;
+
+    if (!nbt__load(tag)) {
+      stream->error = 1;
+      return;
+    }
+
+    if (frame->write_type) {
+      nbt__put_byte(stream, tag->type);
+    }
+
+    if (frame->write_name && tag->type != NBT_TYPE_END) {
+      nbt__put_string_size(stream, tag->name_size, format);
+      nbt__put_bytes(stream, tag->name, tag->name_size);
+    }
+
+    switch (tag->type) {
+      case NBT_TYPE_BYTE_ARRAY: {
+        nbt__put_int32(stream, (int32_t)tag->tag_byte_array.size, format);
+        return;
+      }
+      case NBT_TYPE_INT_ARRAY: {
+        nbt__put_int32(stream, (int32_t)tag->tag_int_array.size, format);
+        return;
+      }
+      case NBT_TYPE_LONG_ARRAY: {
+        nbt__put_int32(stream, (int32_t)tag->tag_long_array.size, format);
+        return;
+      }
+      case NBT_TYPE_LIST: {
+        nbt__put_byte(stream, tag->tag_list.type);
+        nbt__put_int32(stream, (int32_t)tag->tag_list.size, format);
+        return;
+      }
+      case NBT_TYPE_COMPOUND: {
+        return;
+      }
+      default: {
+        // Everything else is small enough to write in one go.
+        nbt__write_tag(stream, tag, 0, 0, format);
+        incremental_writer->depth--;
+        return;
+      }
+    }
+  }
+
+  // Arrays are written in runs of at most a buffer's worth.
+  switch (tag->type) {
+    case NBT_TYPE_BYTE_ARRAY: {
+      size_t count = tag->tag_byte_array.size - frame->index;
+      count = count < NBT_BUFFER_SIZE ? count : NBT_BUFFER_SIZE;
+      nbt__put_bytes(stream, tag->tag_byte_array.value + frame->index, count);
+      frame->index += count;
+      if (frame->index == tag->tag_byte_array.size) {
+        incremental_writer->depth--;
+      }
+      break;
+    }
+    case NBT_TYPE_INT_ARRAY: {
+      size_t count = tag->tag_int_array.size - frame->index;
+      count = count < NBT_BUFFER_SIZE / 4 ? count : NBT_BUFFER_SIZE / 4;
+      nbt__put_int32_array(stream, tag->tag_int_array.value + frame->index, count, format);
+      frame->index += count;
+      if (frame->index == tag->tag_int_array.size) {
+        incremental_writer->depth--;
+      }
+      break;
+    }
+    case NBT_TYPE_LONG_ARRAY: {
+      size_t count = tag->tag_long_array.size - frame->index;
+      count = count < NBT_BUFFER_SIZE / 8 ? count : NBT_BUFFER_SIZE / 8;
+      nbt__put_int64_array(stream, tag->tag_long_array.value + frame->index, count, format);
+      frame->index += count;
+      if (frame->index == tag->tag_long_array.size) {
+        incremental_writer->depth--;
+      }
+      break;
+    }
+    case NBT_TYPE_LIST: {
+      if (frame->index < tag->tag_list.size) {
+        nbt__incremental_writer_push(incremental_writer, tag->tag_list.value[frame->index++], 0, 0);
+      } else {
+        incremental_writer->depth--;
+      }
+      break;
+    }
+    case NBT_TYPE_COMPOUND: {
+      if (frame->index < tag->tag_compound.size) {
+        nbt__incremental_writer_push(incremental_writer, tag->tag_compound.value[frame->index++], 1, 1);
+      } else {
+        nbt__put_byte(stream, 0); // End tag.
+        incremental_writer->depth--;
+      }
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+}
+
+nbt_incremental_status_t nbt_write_step(nbt_incremental_writer_t* incremental_writer, size_t byte_budget, uint32_t time_budget_us) {
+
+  if (incremental_writer->status != NBT_INCREMENTAL_NEED_MORE) {
+    return incremental_writer->status;
+  }
+
+  nbt__write_stream_t* stream = &incremental_writer->stream;
+  uint64_t start_time = time_budget_us ? nbt__get_time_ns() : 0;
+  size_t bytes_written = 0;
+  unsigned int iterations = 0;
+
+  for (;;) {
+
+    size_t size_before = stream->size;
+    nbt__incremental_writer_advance(incremental_writer);
+    bytes_written += stream->size - size_before;
+
+    if (stream->error) {
+      incremental_writer->status = NBT_INCREMENTAL_ERROR;
+      return NBT_INCREMENTAL_ERROR;
+    }
+
+    int finished = incremental_writer->depth == 0;
+
+    if (stream->size >= NBT_BUFFER_SIZE / 2 || finished) {
+      nbt__sink_write(&incremental_writer->sink, stream->buffer, stream->size, finished);
+      stream->offset = 0;
+      stream->size = 0;
+
+      if (incremental_writer->sink.error) {
+        incremental_writer->status = NBT_INCREMENTAL_ERROR;
+        return NBT_INCREMENTAL_ERROR;
+      }
+    }
+
+    if (finished) {
+      incremental_writer->status = NBT_INCREMENTAL_DONE;
+      return NBT_INCREMENTAL_DONE;
+    }
+
+    if (byte_budget && bytes_written >= byte_budget) {
+      break;
+    }
+
+    // Reading the clock isn't free, so only check it every so often.
+    if (time_budget_us && (++iterations & 63) == 0 && nbt__get_time_ns() - start_time >= (uint64_t)time_budget_us * 1000) {
+      break;
+    }
+
+  }
+
+  // Pass on whatever has been written so far, so that the writer sees steady progress.
+  if (stream->size > 0) {
+    nbt__sink_write(&incremental_writer->sink, stream->buffer, stream->size, 0);
+    stream->offset = 0;
+    stream->size = 0;
+  }
+
+  return NBT_INCREMENTAL_NEED_MORE;
+
+}
+
+static nbt_tag_t* nbt__new_tag_base(void) {
+  nbt_tag_t* tag = (nbt_tag_t*)nbt__malloc(sizeof(nbt_tag_t));
+  tag->flags = 0;
+  tag->name = NULL;
+  tag->name_size = 0;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_byte(int8_t value) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_BYTE;
+  tag->tag_byte.value = value;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_short(int16_t value) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_SHORT;
+  tag->tag_short.value = value;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_int(int32_t value) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_INT;
+  tag->tag_int.value = value;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_long(int64_t value) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_LONG;
+  tag->tag_long.value = value;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_float(float value) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_FLOAT;
+  tag->tag_float.value = value;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_double(double value) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_DOUBLE;
+  tag->tag_double.value = value;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_byte_array(int8_t* value, size_t size) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_BYTE_ARRAY;
+  tag->tag_byte_array.size = size;
+  tag->tag_byte_array.value = (int8_t*)nbt__malloc(size);
+
+  NBT_MEMCPY(tag->tag_byte_array.value, value, size);
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_string(const char* value, size_t size) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_STRING;
+  tag->tag_string.size = size;
+  tag->tag_string.value = (char*)nbt__malloc(size + 1);
+
+  NBT_MEMCPY(tag->tag_string.value, value, size);
+  tag->tag_string.value[tag->tag_string.size] = '\0';
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_list(nbt_tag_type_t type) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_LIST;
+  tag->tag_list.type = type;
+  tag->tag_list.size = 0;
+  tag->tag_list.value = NULL;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_compound(void) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_COMPOUND;
+  tag->tag_compound.size = 0;
+  tag->tag_compound.value = NULL;
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_int_array(int32_t* value, size_t size) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_INT_ARRAY;
+  tag->tag_int_array.size = size;
+  tag->tag_int_array.value = (int32_t*)nbt__malloc(size * sizeof(int32_t));
+
+  NBT_MEMCPY(tag->tag_int_array.value, value, size * sizeof(int32_t));
+
+  return tag;
+}
+
+nbt_tag_t* nbt_new_tag_long_array(int64_t* value, size_t size) {
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  tag->type = NBT_TYPE_LONG_ARRAY;
+  tag->tag_long_array.size = size;
+  tag->tag_long_array.value = (int64_t*)nbt__malloc(size * sizeof(int64_t));
+
+  NBT_MEMCPY(tag->tag_long_array.value, value, size * sizeof(int64_t));
+
+  return tag;
+}
+
+void nbt_set_tag_name(nbt_tag_t* tag, const char* name, size_t size) {
+  nbt__free_name(tag);
+#ifdef NBT_COMPACT_TAGS
+  if (size > 0xFFFF) {
+    size = 0xFFFF;
+  }
+#endif
+  char* new_name = nbt__alloc_name(tag, size);
+  NBT_MEMCPY(new_name, name, size);
+  new_name[size] = '\0';
+}
+
+// Moves a list or compound's value array out of the block it was allocated in, if it was, so that it can be resized.
+static void nbt__detach_value(nbt_tag_t* tag) {
+  if (tag->flags & NBT__IN_BLOCK_VALUE) {
+    nbt_tag_t*** value = tag->type == NBT_TYPE_LIST ? &tag->tag_list.value : &tag->tag_compound.value;
+    size_t size = tag->type == NBT_TYPE_LIST ? tag->tag_list.size : tag->tag_compound.size;
+    nbt_tag_t** new_value = (nbt_tag_t**)nbt__malloc(size * sizeof(nbt_tag_t*));
+    if (size > 0) {
+      NBT_MEMCPY(new_value, *value, size * sizeof(nbt_tag_t*));
+    }
+    *value = new_value;
+    tag->flags &= ~NBT__IN_BLOCK_VALUE;
+  }
+}
+
+void nbt_tag_list_append(nbt_tag_t* list, nbt_tag_t* value) {
+  if (!nbt__load(list)) {
+    return;
+  }
+  nbt__detach_value(list);
+  list->tag_list.value = nbt__realloc(list->tag_list.value, (list->tag_list.size + 1) * sizeof(nbt_tag_t*)) ;
+  list->tag_list.value[list->tag_list.size] = value;
+  list->tag_list.size++;
+}
+
+nbt_tag_t* nbt_tag_list_get(nbt_tag_t* tag, size_t index) {
+  if (!nbt__load(tag)) {
+    return NULL;
+  }
+  return tag->tag_list.value[index];
+}
+
+void nbt_tag_compound_append(nbt_tag_t* compound, nbt_tag_t* value) {
+  if (!nbt__load(compound)) {
+    return;
+  }
+  nbt__detach_value(compound);
+  compound->tag_compound.value = nbt__realloc(compound->tag_compound.value, (compound->tag_compound.size + 1) * sizeof(nbt_tag_t*));
+  compound->tag_compound.value[compound->tag_compound.size] = value;
+  compound->tag_compound.size++;
+}
+
+nbt_tag_t* nbt_tag_compound_get(nbt_tag_t* tag, const char* key) {
+  if (!nbt__load(tag)) {
+    return NULL;
+  }
+  for (size_t i = 0; i < tag->tag_compound.size; i++) {
+    nbt_tag_t* compare_tag = tag->tag_compound.value[i];
+
+    // Compared a byte at a time so that a shorter key isn't read past its end, and a name which is only the start of the
+    // key doesn't match.
+    size_t j = 0;
+    while (j < compare_tag->name_size && key[j] == compare_tag->name[j]) {
+      j++;
+    }
+    if (j == compare_tag->name_size && key[j] == '\0') {
+      return compare_tag;
+    }
+  }
+
+  return NULL;
+}
+
+// Frees a tag's own memory, but not any tags inside it, or anything in the block the tag was allocated in.
+static void nbt__free_tag_shallow(nbt_tag_t* tag) {
+  switch ((tag->flags & NBT__IN_BLOCK_VALUE) ? NBT_TYPE_END : tag->type) {
+    case NBT_TYPE_BYTE_ARRAY: {
+      nbt__free(tag->tag_byte_array.value);
+      break;
+    }
+    case NBT_TYPE_STRING: {
+      nbt__free(tag->tag_string.value);
+      break;
+    }
+    case NBT_TYPE_LIST:
+    case NBT_TYPE_COMPOUND: {
+      nbt__lazy_tag_t* lazy_tag = nbt__get_lazy(tag);
+      if (lazy_tag) {
+        nbt__lazy_release(lazy_tag);
+      } else {
+        nbt__free(tag->type == NBT_TYPE_LIST ? tag->tag_list.value : tag->tag_compound.value);
+      }
+      break;
+    }
+    case NBT_TYPE_INT_ARRAY: {
+      nbt__free(tag->tag_int_array.value);
+      break;
+    }
+    case NBT_TYPE_LONG_ARRAY: {
+      nbt__free(tag->tag_long_array.value);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  nbt__free_name(tag);
+
+  if (!(tag->flags & NBT__IN_BLOCK_TAG)) {
+    nbt__free(tag); // For the root of a preallocated structure, this frees the whole block.
+  }
+}
+
+typedef struct {
+  nbt_tag_t* tag;
+  size_t index;
+} nbt__free_frame_t;
+
+void nbt_free_tag(nbt_tag_t* tag) {
+
+  // Walk the tree with an explicit stack, freeing each list and compound once everything inside it has been freed.
+  nbt__free_frame_t local_frames[32];
+  nbt__free_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+
+  for (;;) {
+
+    if (tag) {
+      if ((tag->type == NBT_TYPE_LIST && tag->tag_list.size > 0) || (tag->type == NBT_TYPE_COMPOUND && tag->tag_compound.size > 0)) {
+        if (depth == frames_alloc_size) {
+          frames_alloc_size *= 2;
+          if (frames == local_frames) {
+            frames = (nbt__free_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__free_frame_t));
+            NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+          } else {
+            frames = (nbt__free_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__free_frame_t));
+          }
+        }
+        frames[depth].tag = tag;
+        frames[depth].index = 0;
+        depth++;
+      } else {
+        nbt__free_tag_shallow(tag);
+      }
+    }
+
+    if (depth == 0) {
+      break;
+    }
+
+    nbt__free_frame_t* frame = &frames[depth - 1];
+    nbt_tag_t* parent = frame->tag;
+    size_t size = parent->type == NBT_TYPE_LIST ? parent->tag_list.size : parent->tag_compound.size;
+
+    if (frame->index < size) {
+      tag = parent->type == NBT_TYPE_LIST ? parent->tag_list.value[frame->index] : parent->tag_compound.value[frame->index];
+      frame->index++;
+    } else {
+      nbt__free_tag_shallow(parent);
+      depth--;
+      tag = NULL;
+    }
+
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+}
+
+// Adds a block of memory belonging to the tree to the heap counts. Blocks of size 0 may or may not have been
+// allocated, so only non-NULL ones are counted. Parts of a preallocated structure only add to the size, as the block
+// they are in is counted with the root tag.
+static void nbt__tree_stats_block(nbt_tree_stats_t* stats, void* pointer, size_t size, int in_block) {
+  if (!pointer) {
+    return;
+  }
+  stats->heap_bytes += size;
+  if (in_block) {
+    return;
+  }
+  stats->heap_blocks++;
+  stats->heap_usable_bytes += nbt__usable_size(&nbt__alloc_state, pointer);
+}
+
+// Counts a single tag, not including any tags inside it. in_list is set for list elements, which are stored without
+// a type or name.
+static void nbt__tree_stats_tag(nbt_tree_stats_t* stats, nbt_tag_t* tag, int in_list) {
+
+  stats->tag_count++;
+  if (tag->type <= NBT_TYPE_LONG_ARRAY) {
+    stats->type_counts[tag->type]++;
+  }
+
+  int value_in_block = tag->flags & NBT__IN_BLOCK_VALUE;
+  nbt__tree_stats_block(stats, tag, sizeof(nbt_tag_t), tag->flags & NBT__IN_BLOCK_TAG);
+
+  if (!in_list) {
+    stats->serialized_bytes += 3 + tag->name_size;
+    stats->name_bytes += tag->name_size;
+    if (nbt__name_on_heap(tag) || (tag->flags & NBT__IN_BLOCK_NAME)) {
+      nbt__tree_stats_block(stats, tag->name, tag->name_size + 1, tag->flags & NBT__IN_BLOCK_NAME);
+    }
+  }
+
+  size_t payload_size = 0;
+  switch (tag->type) {
+    case NBT_TYPE_BYTE: {
+      payload_size = 1;
+      break;
+    }
+    case NBT_TYPE_SHORT: {
+      payload_size = 2;
+      break;
+    }
+    case NBT_TYPE_INT:
+    case NBT_TYPE_FLOAT: {
+      payload_size = 4;
+      break;
+    }
+    case NBT_TYPE_LONG:
+    case NBT_TYPE_DOUBLE: {
+      payload_size = 8;
+      break;
+    }
+    case NBT_TYPE_BYTE_ARRAY: {
+      payload_size = tag->tag_byte_array.size;
+      stats->serialized_bytes += 4;
+      nbt__tree_stats_block(stats, tag->tag_byte_array.value, payload_size, value_in_block);
+      break;
+    }
+    case NBT_TYPE_STRING: {
+      payload_size = tag->tag_string.size;
+      stats->serialized_bytes += 2;
+      nbt__tree_stats_block(stats, tag->tag_string.value, payload_size + 1, value_in_block);
+      break;
+    }
+    case NBT_TYPE_LIST:
+    case NBT_TYPE_COMPOUND: {
+      // Unparsed contents are counted as they are, without looking inside them.
+      nbt__lazy_tag_t* lazy_tag = nbt__get_lazy(tag);
+      if (lazy_tag) {
+        stats->serialized_bytes += lazy_tag->size;
+        stats->unparsed_bytes += lazy_tag->size;
+        nbt__tree_stats_block(stats, lazy_tag, sizeof(nbt__lazy_tag_t), 0);
+      } else if (tag->type == NBT_TYPE_LIST) {
+        stats->serialized_bytes += 5;
+        nbt__tree_stats_block(stats, tag->tag_list.value, tag->tag_list.size * sizeof(nbt_tag_t*), value_in_block);
+      } else {
+        stats->serialized_bytes += 1; // The end tag.
+        nbt__tree_stats_block(stats, tag->tag_compound.value, tag->tag_compound.size * sizeof(nbt_tag_t*), value_in_block);
+      }
+      break;
+    }
+    case NBT_TYPE_INT_ARRAY: {
+      payload_size = tag->tag_int_array.size * sizeof(int32_t);
+      stats->serialized_bytes += 4;
+      nbt__tree_stats_block(stats, tag->tag_int_array.value, payload_size, value_in_block);
+      break;
+    }
+    case NBT_TYPE_LONG_ARRAY: {
+      payload_size = tag->tag_long_array.size * sizeof(int64_t);
+      stats->serialized_bytes += 4;
+      nbt__tree_stats_block(stats, tag->tag_long_array.value, payload_size, value_in_block);
+      break;
+    }
+    default: {
+      break;
+    }
+  }
+
+  stats->payload_bytes += payload_size;
+  stats->serialized_bytes += payload_size;
+
+}
+
+void nbt_tree_stats(nbt_tag_t* tag, nbt_tree_stats_t* stats) {
+
+  nbt_tree_stats_t empty = { 0 };
+  *stats = empty;
+
+  // Walk the tree with an explicit stack, in the same way as nbt_free_tag.
+  nbt__free_frame_t local_frames[32];
+  nbt__free_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+  int in_list = 0;
+
+  for (;;) {
+
+    if (tag) {
+      nbt__tree_stats_tag(stats, tag, in_list);
+      if (depth + 1 > stats->max_depth) {
+        stats->max_depth = depth + 1;
+      }
+      if ((tag->type == NBT_TYPE_LIST && tag->tag_list.size > 0) || (tag->type == NBT_TYPE_COMPOUND && tag->tag_compound.size > 0)) {
+        if (depth == frames_alloc_size) {
+          frames_alloc_size *= 2;
+          if (frames == local_frames) {
+            frames = (nbt__free_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__free_frame_t));
+            NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+          } else {
+            frames = (nbt__free_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__free_frame_t));
+          }
+        }
+        frames[depth].tag = tag;
+        frames[depth].index = 0;
+        depth++;
+      }
+    }
+
+    if (depth == 0) {
+      break;
+    }
+
+    nbt__free_frame_t* frame = &frames[depth - 1];
+    nbt_tag_t* parent = frame->tag;
+    size_t size = parent->type == NBT_TYPE_LIST ? parent->tag_list.size : parent->tag_compound.size;
+
+    if (frame->index < size) {
+      tag = parent->type == NBT_TYPE_LIST ? parent->tag_list.value[frame->index] : parent->tag_compound.value[frame->index];
+      in_list = parent->type == NBT_TYPE_LIST;
+      frame->index++;
+    } else {
+      depth--;
+      tag = NULL;
+    }
+
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+}
+
+// Reads the input of nbt_transform a piece at a time, decompressing it if needed. Only data which hasn't been used yet
+// is kept, so the buffer only grows beyond NBT_BUFFER_SIZE to fit a single large tag.
+typedef struct {
+  nbt_reader_t reader;
+  z_stream* stream; // NULL if the input isn't compressed.
+  uint8_t* in_buffer;
+  uint8_t* buffer;
+  size_t offset; // Start of the data which hasn't been used yet.
+  size_t size;
+  size_t alloc_size;
+  int finished;
+} nbt__source_t;
+
+static int nbt__source_begin(nbt__source_t* source, nbt_context_t* context, nbt_reader_t reader, int parse_flags) {
+
+  int compressed;
+  int gzip_format;
+  nbt__get_compression(parse_flags, &compressed, &gzip_format);
+
+  source->reader = reader;
+  source->stream = NULL;
+  source->in_buffer = NULL;
+  source->buffer = (uint8_t*)nbt__malloc(NBT_BUFFER_SIZE);
+  source->offset = 0;
+  source->size = 0;
+  source->alloc_size = NBT_BUFFER_SIZE;
+  source->finished = 0;
+
+  if (!compressed) {
+    return 1;
+  }
+
+  if (!nbt__context_inflate_begin(context, gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS)) {
+    return 0;
+  }
+
+  if (!context->in_buffer) {
+    context->in_buffer = (uint8_t*)nbt__malloc(NBT_BUFFER_SIZE);
+  }
+
+  source->stream = &context->inflate_stream;
+  source->in_buffer = context->in_buffer;
+
+  // Fill the input buffer to start with, so that the gzip header can be found in it. This only fails if the header
+  // has a very long name or comment.
+  size_t size = 0;
+  size_t bytes_read;
+  do {
+    NBT__PHASE(NBT_PHASE_READ, bytes_read = reader.read(reader.userdata, source->in_buffer + size, NBT_BUFFER_SIZE - size));
+    size += bytes_read;
+  } while (bytes_read > 0 && size < NBT_BUFFER_SIZE);
+
+  source->stream->avail_in = (unsigned int)size;
+  source->stream->next_in = source->in_buffer;
+
+  if (gzip_format) {
+    size_t header_size = nbt__get_gzip_header_size(source->in_buffer, size);
+    if (header_size == 0) {
+      return 0;
+    }
+    source->stream->avail_in -= (unsigned int)header_size;
+    source->stream->next_in += header_size;
+  }
+
+  return 1;
+
+}
+
+// Reads more data into the buffer, returning 0 if there isn't any more.
+static int nbt__source_fill(nbt__source_t* source) {
+
+  if (source->finished) {
+    return 0;
+  }
+
+  // Move the unused data to the start of the buffer, then make sure there's a decent amount of room after it.
+  if (source->offset > 0) {
+    NBT_MEMMOVE(source->buffer, source->buffer + source->offset, source->size - source->offset);
+    source->size -= source->offset;
+    source->offset = 0;
+  }
+
+  if (source->alloc_size - source->size < NBT_BUFFER_SIZE) {
+    source->alloc_size *= 2;
+    source->buffer = (uint8_t*)nbt__realloc(source->buffer, source->alloc_size);
+  }
+
+  size_t old_size = source->size;
+
+  if (source->stream) {
+
+    z_stream* stream = source->stream;
+
+    while (source->size == old_size) {
+      if (stream->avail_in == 0) {
+        NBT__PHASE(NBT_PHASE_READ, stream->avail_in = (unsigned int)source->reader.read(source->reader.userdata, source->in_buffer, NBT_BUFFER_SIZE));
+        stream->next_in = source->in_buffer;
+        if (stream->avail_in == 0) {
+          source->finished = 1; // Truncated stream.
+          break;
+        }
+      }
+
+      stream->next_out = source->buffer + source->size;
+      stream->avail_out = (unsigned int)(source->alloc_size - source->size);
+
+      int ret;
+      NBT__PHASE(NBT_PHASE_INFLATE, ret = inflate(stream, Z_NO_FLUSH));
+
+      source->size = source->alloc_size - stream->avail_out;
+
+      if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        source->finished = 1; // Either the end of the stream or bad data.
+        break;
+      }
+    }
+
+  } else {
+
+    NBT__PHASE(NBT_PHASE_READ, source->size += source->reader.read(source->reader.userdata, source->buffer + source->size, source->alloc_size - source->size));
+    if (source->size == old_size) {
+      source->finished = 1;
+    }
+
+  }
+
+  return source->size > old_size;
+
+}
+
+typedef struct {
+  nbt_tag_type_t type;
+  int dropped; // Set if the tag and everything in it is being left out.
+  uint8_t list_type;
+  uint32_t list_remaining; // Elements still to be read from the input.
+  uint32_t list_length; // Length of the list in the input.
+  uint32_t list_size; // Elements which have been written.
+  size_t size_offset; // Where the list's length was written.
+} nbt__transform_frame_t;
+
+// Rewrites the length of a list once it's known how many of its elements were kept. Varints can change size, in which
+// case the elements are moved to fit.
+static void nbt__transform_patch_length(nbt__write_stream_t* stream, size_t offset, uint32_t old_length, uint32_t new_length, nbt__format_t format) {
+
+  if (format != NBT__FORMAT_BEDROCK_NETWORK) {
+    nbt__store_uint32(stream->buffer + offset, new_length, format);
+    return;
+  }
+
+  uint8_t varint[5];
+  size_t new_size = 0;
+  uint64_t value = nbt__zigzag_encode(new_length);
+  while (value >= 0x80) {
+    varint[new_size++] = (uint8_t)(value | 0x80);
+    value >>= 7;
+  }
+  varint[new_size++] = (uint8_t)value;
+
+  size_t old_size = 1;
+  for (value = nbt__zigzag_encode(old_length); value >= 0x80; value >>= 7) {
+    old_size++;
+  }
+
+  // A list can only shrink, so this never needs more room.
+  if (new_size != old_size) {
+    NBT_MEMMOVE(stream->buffer + offset + new_size, stream->buffer + offset + old_size, stream->offset - offset - old_size);
+    stream->offset -= old_size - new_size;
+    stream->size -= old_size - new_size;
+  }
+  NBT_MEMCPY(stream->buffer + offset, varint, new_size);
+
+}
+
+static int nbt__transform_ex(nbt_context_t* context, nbt_reader_t reader, int parse_flags, nbt_writer_t writer, int write_flags, nbt_visitor_t visitor) {
+
+  nbt__format_t in_format = nbt__get_format(parse_flags);
+  nbt__format_t out_format = nbt__get_format(write_flags);
+
+  nbt__source_t source;
+  nbt__sink_t sink;
+  if (!nbt__source_begin(&source, context, reader, parse_flags) || !nbt__sink_begin(&sink, context, writer, write_flags)) {
+    nbt__free(source.buffer);
+    return 0;
+  }
+
+  nbt__context_reserve(context, NBT_BUFFER_SIZE);
+
+  nbt__write_stream_t out;
+  out.buffer = context->buffer;
+  out.offset = 0;
+  out.size = 0;
+  out.alloc_size = context->buffer_alloc_size;
+  out.error = 0;
+
+  // The lists and compounds which are open, along with tags describing them for the visitor.
+  nbt__transform_frame_t* frames = NULL;
+  nbt_tag_t** path = NULL;
+  size_t frames_alloc_size = 0;
+  size_t depth = 0;
+
+  // Output from the start of the outermost list which is being written is held back, as its length will change if any
+  // of its elements are dropped. That can't happen if the visitor keeps every list element, so then nothing is held.
+  size_t hold_depth = (size_t)-1;
+
+  int started = 0;
+  int success = 0;
+
+  for (;;) {
+
+    nbt__transform_frame_t* frame = depth > 0 ? &frames[depth - 1] : NULL;
+    int in_list = frame && frame->type == NBT_TYPE_LIST;
+
+    // Close any lists and compounds which are finished.
+    int type;
+    size_t p = source.offset;
+
+    if (in_list && frame->list_remaining == 0) {
+      type = NBT_TYPE_END;
+    } else if (in_list) {
+      type = frame->list_type;
+    } else if (frame || !started) {
+      if (p + 1 > source.size) {
+        if (!nbt__source_fill(&source)) {
+          break;
+        }
+        continue;
+      }
+      type = source.buffer[p++];
+    } else {
+      success = 1;
+      break;
+    }
+
+    if (type == NBT_TYPE_END) {
+      if (!frame) {
+        break; // An end tag can't be the root.
+      }
+
+      if (!frame->dropped) {
+        if (frame->type == NBT_TYPE_LIST) {
+          if (frame->list_size != frame->list_length) {
+            nbt__transform_patch_length(&out, frame->size_offset, frame->list_length, frame->list_size, out_format);
+          }
+        } else {
+          nbt__put_byte(&out, 0);
+        }
+      }
+
+      if (depth - 1 == hold_depth) {
+        hold_depth = (size_t)-1;
+      }
+
+      nbt__free_tag_shallow(path[depth - 1]);
+      depth--;
+      source.offset = p;
+      continue;
+    }
+
+    // Find the end of the tag, or of the header of a list or compound, reading more until it's all there.
+    int named = in_list ? 0 : (frame ? 1 : !(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT));
+    size_t name_offset = p;
+    uint8_t list_type = 0;
+    uint32_t list_length = 0;
+    uint32_t name_size = 0;
+    nbt__scan_status_t status = NBT__SCAN_DONE;
+
+    if (named) {
+      status = nbt__scan_length(source.buffer, source.size, &p, 1, in_format, &name_size);
+      p += name_size;
+    }
+
+    if (status == NBT__SCAN_DONE) {
+      status = nbt__scan_payload(source.buffer, source.size, &p, type, in_format, &list_type, &list_length);
+    }
+
+    if (status == NBT__SCAN_NEED_MORE) {
+      if (!nbt__source_fill(&source)) {
+        break;
+      }
+      continue;
+    } else if (status == NBT__SCAN_ERROR) {
+      break;
+    }
+
+    int dropped = frame && frame->dropped;
+    int write_name = frame ? !in_list : !(write_flags & NBT_WRITE_FLAG_NAMELESS_ROOT);
+
+    if (in_list) {
+      frame->list_remaining--;
+    }
+
+    if (type == NBT_TYPE_LIST || type == NBT_TYPE_COMPOUND) {
+
+      if (depth == NBT_MAX_DEPTH) {
+        break;
+      }
+
+      if (depth == frames_alloc_size) {
+        frames_alloc_size = frames_alloc_size ? frames_alloc_size * 2 : 16;
+        frames = (nbt__transform_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__transform_frame_t));
+        path = (nbt_tag_t**)nbt__realloc(path, frames_alloc_size * sizeof(nbt_tag_t*));
+      }
+
+      // Describe the tag without its contents, which haven't been read yet.
+      nbt_tag_t* tag = (nbt_tag_t*)nbt__malloc(sizeof(nbt_tag_t));
+      tag->type = (nbt_tag_type_t)type;
+      tag->flags = 0;
+      tag->name = NULL;
+      tag->name_size = 0;
+      if (type == NBT_TYPE_LIST) {
+        tag->tag_list.value = NULL;
+        tag->tag_list.type = (nbt_tag_type_t)list_type;
+        tag->tag_list.size = list_length;
+      } else {
+        tag->tag_compound.value = NULL;
+        tag->tag_compound.size = 0;
+      }
+
+      if (!dropped) {
+        if (named) {
+          nbt__read_stream_t stream;
+          stream.buffer = source.buffer;
+          stream.buffer_offset = name_offset;
+          nbt__get_string_size(&stream, in_format);
+          nbt_set_tag_name(tag, (const char*)source.buffer + stream.buffer_offset, name_size);
+        }
+
+        dropped = visitor.visit(visitor.userdata, tag, path, depth) == NBT_VISIT_DROP;
+        if (dropped && in_list && visitor.keep_list_elements) {
+          nbt__free_tag_shallow(tag);
+          break; // The list's length has already been passed on.
+        }
+      }
+
+      frame = &frames[depth];
+      frame->type = (nbt_tag_type_t)type;
+      frame->dropped = dropped;
+      frame->list_type = list_type;
+      frame->list_remaining = list_length;
+      frame->list_length = list_length;
+      frame->list_size = 0;
+      frame->size_offset = 0;
+      path[depth] = tag;
+
+      if (!dropped) {
+        if (!in_list) {
+          nbt__put_byte(&out, (uint8_t)type);
+        }
+        if (write_name) {
+          nbt__put_string_size(&out, tag->name_size, out_format);
+          nbt__put_bytes(&out, tag->name, tag->name_size);
+        }
+        if (type == NBT_TYPE_LIST) {
+          nbt__put_byte(&out, list_type);
+          frame->size_offset = out.offset;
+          nbt__put_int32(&out, (int32_t)list_length, out_format);
+          if (hold_depth == (size_t)-1 && !visitor.keep_list_elements) {
+            hold_depth = depth;
+          }
+        }
+        if (in_list) {
+          frames[depth - 1].list_size++;
+        }
+      }
+
+      depth++;
+
+    } else if (!dropped) {
+
+      nbt__read_stream_t stream;
+      stream.buffer = source.buffer;
+      stream.buffer_offset = source.offset;
+
+      size_t unused;
+      nbt_tag_t* tag = nbt__parse_tag(&stream, named, in_list ? (nbt_tag_type_t)type : NBT_NO_OVERRIDE, &unused, in_format);
+      if (!tag) {
+        break;
+      }
+
+      if (visitor.visit(visitor.userdata, tag, path, depth) == NBT_VISIT_KEEP) {
+        if (in_list && tag->type != (nbt_tag_type_t)type) {
+          nbt_free_tag(tag);
+          break; // Lists can only hold one type of tag.
+        }
+        nbt__write_tag(&out, tag, write_name, !in_list, out_format);
+        if (in_list) {
+          frame->list_size++;
+        }
+      } else if (in_list && visitor.keep_list_elements) {
+        nbt_free_tag(tag);
+        break; // The list's length has already been passed on.
+      }
+
+      nbt_free_tag(tag);
+
+    }
+
+    source.offset = p;
+    started = 1;
+
+    // Pass on whatever isn't being held back once there's a decent amount of it.
+    if (out.offset >= NBT_BUFFER_SIZE) {
+      size_t size = hold_depth == (size_t)-1 ? out.offset : frames[hold_depth].size_offset;
+      if (size > 0) {
+        nbt__sink_write(&sink, out.buffer, size, 0);
+        NBT_MEMMOVE(out.buffer, out.buffer + size, out.offset - size);
+        out.offset -= size;
+        out.size -= size;
+        for (size_t i = hold_depth; i < depth; i++) {
+          frames[i].size_offset -= size; // Only matters for lists, which are all inside the held one.
+        }
+      }
+    }
+
+  }
+
+  if (success) {
+    nbt__sink_write(&sink, out.buffer, out.offset, 1);
+    success = !sink.error;
+  }
+
+  while (depth > 0) {
+    nbt__free_tag_shallow(path[--depth]);
+  }
+
+  nbt__free(frames);
+  nbt__free(path);
+  nbt__free(source.buffer);
+
+  // Hold on to the grown buffer for next time.
+  context->buffer = out.buffer;
+  context->buffer_alloc_size = out.alloc_size;
+
+  return success;
+
+}
+
+int nbt_transform_ex(nbt_context_t* context, nbt_reader_t reader, int parse_flags, nbt_writer_t writer, int write_flags, nbt_visitor_t visitor) {
+
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
+
+  int success = nbt__transform_ex(context, reader, parse_flags, writer, write_flags, visitor);
+
+  nbt__call_end(&mark, context, "nbt_transform");
+
+  return success;
+
+}
+
+int nbt_transform(nbt_reader_t reader, int parse_flags, nbt_writer_t writer, int write_flags, nbt_visitor_t visitor) {
+
+  nbt_context_t* context = nbt_new_context();
+
+  int success = nbt_transform_ex(context, reader, parse_flags, writer, write_flags, visitor);
+
+  nbt_free_context(context);
+
+  return success;
+
+}
+
+typedef struct {
+  const char* data;
+  size_t size;
+  size_t offset;
+} nbt__snbt_stream_t;
+
+typedef struct {
+  nbt_tag_t* tag;
+  size_t first; // Where the list or compound's first child is in the pending tag stack.
+} nbt__snbt_frame_t;
+
+static const double nbt__pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Used in place of strtod and strtof when NBT_NO_STDLIB is defined and they haven't been provided. This is only reached
+// for numbers which can't be converted exactly with a single multiplication or division, and scales by powers of ten
+// one step at a time, so the result may be off in the last bit or two.
+#ifndef NBT_STRTOD
+static double nbt__strtod(const char* string, char** end) {
+
+  const char* p = string;
+  int negative = 0;
+  if (*p == '+' || *p == '-') {
+    negative = *p == '-';
+    p++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  long exponent = 0;
+
+  for (; *p >= '0' && *p <= '9'; p++) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+      digits += mantissa > 0;
+    } else {
+      exponent++;
+    }
+  }
+  if (*p == '.') {
+    for (p++; *p >= '0' && *p <= '9'; p++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+        digits += mantissa > 0;
+        exponent--;
+      }
+    }
+  }
+  if (*p == 'e' || *p == 'E') {
+    p++;
+    int exponent_negative = *p == '-';
+    if (*p == '+' || *p == '-') {
+      p++;
+    }
+    long exponent_value = 0;
+    for (; *p >= '0' && *p <= '9'; p++) {
+      if (exponent_value < 100000) {
+        exponent_value = exponent_value * 10 + (*p - '0');
+      }
+    }
+    exponent += exponent_negative ? -exponent_value : exponent_value;
+  }
+
+  if (end) {
+    *end = (char*)p;
+  }
+
+  // Past these, any non-zero mantissa overflows or underflows anyway.
+  if (exponent > 400) {
+    exponent = 400;
+  } else if (exponent < -400) {
+    exponent = -400;
+  }
+
+  // Working in long double, where that's wider, keeps most of the rounding error out of the result.
+  long double value = (long double)mantissa;
+  while (exponent > 0 && value != 0) {
+    int step = exponent > 22 ? 22 : (int)exponent;
+    value *= nbt__pow10[step];
+    exponent -= step;
+  }
+  while (exponent < 0 && value != 0) {
+    int step = exponent < -22 ? 22 : (int)-exponent;
+    value /= nbt__pow10[step];
+    exponent += step;
+  }
+
+  return negative ? -(double)value : (double)value;
+
+}
+#define NBT_STRTOD nbt__strtod
+#endif
+
+#ifndef NBT_STRTOF
+#define NBT_STRTOF(string, end) ((float)NBT_STRTOD(string, end))
+#endif
+
+static void nbt__snbt_skip_whitespace(nbt__snbt_stream_t* stream) {
+  while (stream->offset < stream->size) {
+    char c = stream->data[stream->offset];
+    if (c != ' ' && c != '\t' && c != '\n' && c != '\r') {
+      break;
+    }
+    stream->offset++;
+  }
+}
+
+// Returns the next character, or -1 at the end of the data.
+static int nbt__snbt_peek(nbt__snbt_stream_t* stream) {
+  return stream->offset < stream->size ? (unsigned char)stream->data[stream->offset] : -1;
+}
+
+static int nbt__snbt_is_unquoted(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || c == '-' || c == '.' || c == '+';
+}
+
+// Reads a run of characters which may appear in an unquoted string, returning its length.
+static size_t nbt__snbt_read_unquoted(nbt__snbt_stream_t* stream, const char** token) {
+  size_t start = stream->offset;
+  while (stream->offset < stream->size && nbt__snbt_is_unquoted(stream->data[stream->offset])) {
+    stream->offset++;
+  }
+  *token = stream->data + start;
+  return stream->offset - start;
+}
+
+static int nbt__snbt_hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else {
+    return -1;
+  }
+}
+
+// Parses a string in single or double quotes into a null-terminated copy, with any escapes replaced. Returns NULL if the
+// string is not terminated or contains a bad escape.
+static char* nbt__snbt_parse_quoted(nbt__snbt_stream_t* stream, size_t* size) {
+
+  char quote = stream->data[stream->offset++];
+  size_t start = stream->offset;
+  int escaped = 0;
+
+  while (stream->offset < stream->size && stream->data[stream->offset] != quote) {
+    if (stream->data[stream->offset] == '\\') {
+      escaped = 1;
+      stream->offset++;
+    }
+    stream->offset++;
+  }
+
+  if (stream->offset >= stream->size) {
+    return NULL;
+  }
+
+  size_t end = stream->offset++;
+  char* value = (char*)nbt__malloc(end - start + 1);
+
+  if (!escaped) {
+    // Nothing to replace, so the string can be copied directly.
+    NBT_MEMCPY(value, stream->data + start, end - start);
+    value[end - start] = '\0';
+    *size = end - start;
+    return value;
+  }
+
+  // Escapes never decode to more bytes than they take up, so the string can only get shorter.
+  size_t value_size = 0;
+  for (size_t i = start; i < end; i++) {
+    char c = stream->data[i];
+    if (c != '\\') {
+      value[value_size++] = c;
+      continue;
+    }
+
+    c = stream->data[++i];
+    int digits = 0;
+    switch (c) {
+      case '\\': case '\'': case '"': value[value_size++] = c; break;
+      case 'b': value[value_size++] = '\b'; break;
+      case 'f': value[value_size++] = '\f'; break;
+      case 'n': value[value_size++] = '\n'; break;
+      case 'r': value[value_size++] = '\r'; break;
+      case 's': value[value_size++] = ' '; break;
+      case 't': value[value_size++] = '\t'; break;
+      case 'x': digits = 2; break;
+      case 'u': digits = 4; break;
+      default: {
+        nbt__free(value);
+        return NULL;
+      }
+    }
+
+    if (digits > 0) {
+      // Code point in hex, which is written out as UTF-8.
+      uint32_t code_point = 0;
+      for (int j = 0; j < digits; j++) {
+        int digit = i + 1 < end ? nbt__snbt_hex_digit(stream->data[++i]) : -1;
+        if (digit < 0) {
+          nbt__free(value);
+          return NULL;
+        }
+        code_point = (code_point << 4) | (uint32_t)digit;
+      }
+      if (code_point < 0x80) {
+        value[value_size++] = (char)code_point;
+      } else if (code_point < 0x800) {
+        value[value_size++] = (char)(0xc0 | (code_point >> 6));
+        value[value_size++] = (char)(0x80 | (code_point & 0x3f));
+      } else {
+        value[value_size++] = (char)(0xe0 | (code_point >> 12));
+        value[value_size++] = (char)(0x80 | ((code_point >> 6) & 0x3f));
+        value[value_size++] = (char)(0x80 | (code_point & 0x3f));
+      }
+    }
+  }
+
+  value[value_size] = '\0';
+  *size = value_size;
+  return value;
+
+}
+
+// Parses an optionally signed decimal integer which makes up the whole of data. Returns 0 if it isn't one, or if it
+// doesn't fit in 64 bits.
+static int nbt__snbt_parse_integer(const char* data, size_t size, int64_t* value) {
+
+  size_t i = 0;
+  int negative = 0;
+  if (i < size && (data[i] == '+' || data[i] == '-')) {
+    negative = data[i] == '-';
+    i++;
+  }
+
+  if (i == size) {
+    return 0;
+  }
+
+  uint64_t magnitude = 0;
+  for (; i < size; i++) {
+    unsigned int digit = (unsigned int)(data[i] - '0');
+    if (digit > 9 || magnitude > (UINT64_MAX - digit) / 10) {
+      return 0;
+    }
+    magnitude = magnitude * 10 + digit;
+  }
+
+  if (magnitude > (negative ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX)) {
+    return 0;
+  }
+
+  *value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+  return 1;
+
+}
+
+// Converts a decimal number which has already been checked to be well formed. When the significant digits fit in the
+// mantissa and the power of ten is exactly representable, a single multiplication or division gives the correctly
+// rounded result (Clinger's fast path). Anything else is passed to strtod or strtof.
+static double nbt__snbt_to_double(const char* data, size_t size, int is_float) {
+
+  size_t i = 0;
+  int negative = 0;
+  if (data[i] == '+' || data[i] == '-') {
+    negative = data[i] == '-';
+    i++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  int exact = 1;
+
+  for (; i < size && data[i] >= '0' && data[i] <= '9'; i++) {
+    if (digits < 19) {
+      mantissa = mantissa * 10 + (uint64_t)(data[i] - '0');
+      digits += mantissa > 0;
+    } else {
+      exponent++;
+      exact &= data[i] == '0';
+    }
+  }
+
+  if (i < size && data[i] == '.') {
+    for (i++; i < size && data[i] >= '0' && data[i] <= '9'; i++) {
+      if (digits < 19) {
+        mantissa = mantissa * 10 + (uint64_t)(data[i] - '0');
+        digits += mantissa > 0;
+        exponent--;
+      } else {
+        exact &= data[i] == '0';
+      }
+    }
+  }
+
+  if (i < size && (data[i] == 'e' || data[i] == 'E')) {
+    int64_t exponent_value;
+    if (!nbt__snbt_parse_integer(data + i + 1, size - i - 1, &exponent_value) || exponent_value > 100000 || exponent_value < -100000) {
+      exact = 0;
+    } else {
+      exponent += (int)exponent_value;
+    }
+  }
+
+  if (exact && is_float && mantissa <= ((uint64_t)1 << 24) && exponent >= -10 && exponent <= 10) {
+    float value = (float)mantissa;
+    value = exponent < 0 ? value / (float)nbt__pow10[-exponent] : value * (float)nbt__pow10[exponent];
+    return negative ? -value : value;
+  }
+
+  if (exact && !is_float && mantissa <= ((uint64_t)1 << 53) && exponent >= -22 && exponent <= 22) {
+    double value = (double)mantissa;
+    value = exponent < 0 ? value / nbt__pow10[-exponent] : value * nbt__pow10[exponent];
+    return negative ? -value : value;
+  }
+
+  // The slow path needs a null-terminated copy.
+  char local_buffer[64];
+  char* buffer = size < sizeof(local_buffer) ? local_buffer : (char*)nbt__malloc(size + 1);
+  NBT_MEMCPY(buffer, data, size);
+  buffer[size] = '\0';
+  double value = is_float ? (double)NBT_STRTOF(buffer, NULL) : NBT_STRTOD(buffer, NULL);
+  if (buffer != local_buffer) {
+    nbt__free(buffer);
+  }
+  return value;
+
+}
+
+// Works out what an unquoted value is. Numbers without a suffix are ints if they have no decimal point and doubles
+// otherwise, and anything which isn't a number (or is out of range for its type) is a string.
+static nbt_tag_t* nbt__snbt_parse_unquoted(const char* data, size_t size) {
+
+  nbt_tag_t* tag = nbt__new_tag_base();
+
+  // Split off the type suffix, if there is one.
+  char suffix = 0;
+  size_t number_size = size;
+  if (size > 1) {
+    switch (data[size - 1]) {
+      case 'b': case 'B': case 's': case 'S': case 'l': case 'L':
+      case 'f': case 'F': case 'd': case 'D': {
+        suffix = data[size - 1] | 0x20;
+        number_size--;
+        break;
+      }
+    }
+  }
+
+  // Check the number is well formed, and whether it's an integer.
+  size_t i = 0;
+  size_t mantissa_digits = 0;
+  int has_point = 0;
+  int has_exponent = 0;
+  if (i < number_size && (data[i] == '+' || data[i] == '-')) {
+    i++;
+  }
+  for (; i < number_size && data[i] >= '0' && data[i] <= '9'; i++) {
+    mantissa_digits++;
+  }
+  if (i < number_size && data[i] == '.') {
+    has_point = 1;
+    for (i++; i < number_size && data[i] >= '0' && data[i] <= '9'; i++) {
+      mantissa_digits++;
+    }
+  }
+  if (i < number_size && mantissa_digits > 0 && (data[i] == 'e' || data[i] == 'E')) {
+    has_exponent = 1;
+    i++;
+    if (i < number_size && (data[i] == '+' || data[i] == '-')) {
+      i++;
+    }
+    size_t exponent_start = i;
+    for (; i < number_size && data[i] >= '0' && data[i] <= '9'; i++);
+    if (i == exponent_start) {
+      i = number_size + 1; // Not a number.
+    }
+  }
+
+  if (i == number_size && mantissa_digits > 0) {
+    if (!has_point && !has_exponent && (suffix == 0 || suffix == 'b' || suffix == 's' || suffix == 'l')) {
+      int64_t value;
+      if (nbt__snbt_parse_integer(data, number_size, &value)) {
+        if (suffix == 'b' && value >= INT8_MIN && value <= INT8_MAX) {
+          tag->type = NBT_TYPE_BYTE;
+          tag->tag_byte.value = (int8_t)value;
+          return tag;
+        } else if (suffix == 's' && value >= INT16_MIN && value <= INT16_MAX) {
+          tag->type = NBT_TYPE_SHORT;
+          tag->tag_short.value = (int16_t)value;
+          return tag;
+        } else if (suffix == 'l') {
+          tag->type = NBT_TYPE_LONG;
+          tag->tag_long.value = value;
+          return tag;
+        } else if (suffix == 0 && value >= INT32_MIN && value <= INT32_MAX) {
+          tag->type = NBT_TYPE_INT;
+          tag->tag_int.value = (int32_t)value;
+          return tag;
+        }
+      }
+    } else if (suffix == 'f') {
+      tag->type = NBT_TYPE_FLOAT;
+      tag->tag_float.value = (float)nbt__snbt_to_double(data, number_size, 1);
+      return tag;
+    } else if (suffix == 'd' || (suffix == 0 && has_point)) {
+      tag->type = NBT_TYPE_DOUBLE;
+      tag->tag_double.value = nbt__snbt_to_double(data, number_size, 0);
+      return tag;
+    }
+  }
+
+  // NaN and infinities, as written by nbt_write_snbt. Minecraft reads these as strings, but they're read as numbers here
+  // so that such values survive being written and read back.
+  if (suffix == 'f' || suffix == 'd') {
+    size_t start = data[0] == '+' || data[0] == '-' ? 1 : 0;
+    uint64_t bits = 0;
+    if (start == 0 && number_size == 3 && NBT_MEMCMP(data, "NaN", 3) == 0) {
+      bits = 0x7ff8000000000000;
+    } else if (number_size - start == 8 && NBT_MEMCMP(data + start, "Infinity", 8) == 0) {
+      bits = 0x7ff0000000000000 | ((uint64_t)(data[0] == '-') << 63);
+    }
+    if (bits) {
+      double value;
+      NBT_MEMCPY(&value, &bits, sizeof(value));
+      if (suffix == 'f') {
+        tag->type = NBT_TYPE_FLOAT;
+        tag->tag_float.value = (float)value;
+      } else {
+        tag->type = NBT_TYPE_DOUBLE;
+        tag->tag_double.value = value;
+      }
+      return tag;
+    }
+  }
+
+  if ((size == 4 && NBT_MEMCMP(data, "true", 4) == 0) || (size == 5 && NBT_MEMCMP(data, "false", 5) == 0)) {
+    tag->type = NBT_TYPE_BYTE;
+    tag->tag_byte.value = size == 4;
+    return tag;
+  }
+
+  tag->type = NBT_TYPE_STRING;
+  tag->tag_string.size = size;
+  tag->tag_string.value = (char*)nbt__malloc(size + 1);
+  NBT_MEMCPY(tag->tag_string.value, data, size);
+  tag->tag_string.value[size] = '\0';
+  return tag;
+
+}
+
+// Parses the elements of a byte, int or long array, starting just after the "[B;", "[I;" or "[L;".
+static nbt_tag_t* nbt__snbt_parse_array(nbt__snbt_stream_t* stream, nbt_tag_type_t type) {
+
+  size_t element_size = type == NBT_TYPE_BYTE_ARRAY ? 1 : (type == NBT_TYPE_INT_ARRAY ? 4 : 8);
+  char suffix = type == NBT_TYPE_BYTE_ARRAY ? 'b' : (type == NBT_TYPE_LONG_ARRAY ? 'l' : 0);
+  int64_t min = type == NBT_TYPE_BYTE_ARRAY ? INT8_MIN : (type == NBT_TYPE_INT_ARRAY ? INT32_MIN : INT64_MIN);
+  int64_t max = type == NBT_TYPE_BYTE_ARRAY ? INT8_MAX : (type == NBT_TYPE_INT_ARRAY ? INT32_MAX : INT64_MAX);
+
+  uint8_t* values = NULL;
+  size_t size = 0;
+  size_t alloc_size = 0;
+
+  nbt__snbt_skip_whitespace(stream);
+
+  while (nbt__snbt_peek(stream) != ']') {
+    if (size > 0) {
+      if (nbt__snbt_peek(stream) != ',') {
+        nbt__free(values);
+        return NULL;
+      }
+      stream->offset++;
+      nbt__snbt_skip_whitespace(stream);
+      if (nbt__snbt_peek(stream) == ']') {
+        break; // Trailing comma.
+      }
+    }
+
+    const char* token;
+    size_t token_size = nbt__snbt_read_unquoted(stream, &token);
+
+    // Elements may have the suffix which matches the array type.
+    if (token_size > 1 && suffix && (token[token_size - 1] | 0x20) == suffix) {
+      token_size--;
+    }
+
+    int64_t value;
+    if (!nbt__snbt_parse_integer(token, token_size, &value) || value < min || value > max) {
+      nbt__free(values);
+      return NULL;
+    }
+
+    if (size == alloc_size) {
+      alloc_size = alloc_size ? alloc_size * 2 : 16;
+      values = (uint8_t*)nbt__realloc(values, alloc_size * element_size);
+    }
+
+    switch (type) {
+      case NBT_TYPE_BYTE_ARRAY: ((int8_t*)values)[size] = (int8_t)value; break;
+      case NBT_TYPE_INT_ARRAY: ((int32_t*)values)[size] = (int32_t)value; break;
+      default: ((int64_t*)values)[size] = value; break;
+    }
+    size++;
+
+    nbt__snbt_skip_whitespace(stream);
+  }
+
+  stream->offset++; // Closing bracket.
+
+  if (size > 0 && size < alloc_size) {
+    values = (uint8_t*)nbt__realloc(values, size * element_size);
+  }
+
+  nbt_tag_t* tag = nbt__new_tag_base();
+  tag->type = type;
+  switch (type) {
+    case NBT_TYPE_BYTE_ARRAY: {
+      tag->tag_byte_array.value = (int8_t*)values;
+      tag->tag_byte_array.size = size;
+      break;
+    }
+    case NBT_TYPE_INT_ARRAY: {
+      tag->tag_int_array.value = (int32_t*)values;
+      tag->tag_int_array.size = size;
+      break;
+    }
+    default: {
+      tag->tag_long_array.value = (int64_t*)values;
+      tag->tag_long_array.size = size;
+      break;
+    }
+  }
+  return tag;
+
+}
+
+// Parses a single value. Lists and compounds are returned empty, to be filled in by nbt_parse_snbt.
+static nbt_tag_t* nbt__snbt_parse_value(nbt__snbt_stream_t* stream) {
+
+  nbt__snbt_skip_whitespace(stream);
+
+  int c = nbt__snbt_peek(stream);
+
+  if (c == '{') {
+    stream->offset++;
+    nbt_tag_t* tag = nbt__new_tag_base();
+    tag->type = NBT_TYPE_COMPOUND;
+    tag->tag_compound.value = NULL;
+    tag->tag_compound.size = 0;
+    return tag;
+  }
+
+  if (c == '[') {
+    stream->offset++;
+    if (stream->offset + 1 < stream->size && stream->data[stream->offset + 1] == ';') {
+      switch (stream->data[stream->offset]) {
+        case 'B': stream->offset += 2; return nbt__snbt_parse_array(stream, NBT_TYPE_BYTE_ARRAY);
+        case 'I': stream->offset += 2; return nbt__snbt_parse_array(stream, NBT_TYPE_INT_ARRAY);
+        case 'L': stream->offset += 2; return nbt__snbt_parse_array(stream, NBT_TYPE_LONG_ARRAY);
+        default: return NULL;
+      }
+    }
+    nbt_tag_t* tag = nbt__new_tag_base();
+    tag->type = NBT_TYPE_LIST;
+    tag->tag_list.type = NBT_TYPE_END;
+    tag->tag_list.value = NULL;
+    tag->tag_list.size = 0;
+    return tag;
+  }
+
+  if (c == '"' || c == '\'') {
+    size_t size;
+    char* value = nbt__snbt_parse_quoted(stream, &size);
+    if (!value) {
+      return NULL;
+    }
+    nbt_tag_t* tag = nbt__new_tag_base();
+    tag->type = NBT_TYPE_STRING;
+    tag->tag_string.value = value;
+    tag->tag_string.size = size;
+    return tag;
+  }
+
+  const char* token;
+  size_t size = nbt__snbt_read_unquoted(stream, &token);
+  if (size == 0) {
+    return NULL;
+  }
+  return nbt__snbt_parse_unquoted(token, size);
+
+}
+
+// Parses a single value and everything inside it, leaving the stream just after it. This doesn't recurse: the children of
+// lists and compounds which are still being parsed are kept on a single stack of pending tags, and moved into an exactly
+// sized array once the list or compound ends, which saves growing an array for each one.
+static nbt_tag_t* nbt__snbt_parse(nbt__snbt_stream_t* stream) {
+
+  nbt__snbt_frame_t local_frames[32];
+  nbt__snbt_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+
+  nbt_tag_t* local_pending[256];
+  nbt_tag_t** pending = local_pending;
+  size_t pending_alloc_size = 256;
+  size_t pending_size = 0;
+
+  nbt_tag_t* root = NULL;
+  char* key = NULL;
+  size_t key_size = 0;
+  int error = 0;
+
+  for (;;) {
+
+    nbt_tag_t* tag = nbt__snbt_parse_value(stream);
+    if (!tag) {
+      error = 1;
+      break;
+    }
+
+    // Add the value to whatever it's inside of.
+    if (depth == 0) {
+      root = tag;
+    } else {
+      nbt__snbt_frame_t* frame = &frames[depth - 1];
+
+      if (frame->tag->type == NBT_TYPE_LIST) {
+        // Every element of a list must have the same type.
+        if (pending_size > frame->first && pending[frame->first]->type != tag->type) {
+          nbt_free_tag(tag);
+          error = 1;
+          break;
+        }
+      } else {
+        nbt__take_name(tag, key, key_size);
+        key = NULL;
+      }
+
+      if (pending_size == pending_alloc_size) {
+        pending_alloc_size *= 2;
+        if (pending == local_pending) {
+          pending = (nbt_tag_t**)nbt__malloc(pending_alloc_size * sizeof(nbt_tag_t*));
+          NBT_MEMCPY(pending, local_pending, sizeof(local_pending));
+        } else {
+          pending = (nbt_tag_t**)nbt__realloc(pending, pending_alloc_size * sizeof(nbt_tag_t*));
+        }
+      }
+      pending[pending_size++] = tag;
+    }
+
+    // Lists and compounds need their contents parsing before moving on.
+    if (tag->type == NBT_TYPE_LIST || tag->type == NBT_TYPE_COMPOUND) {
+      if (depth == NBT_MAX_DEPTH) {
+        error = 1;
+        break;
+      }
+
+      if (depth == frames_alloc_size) {
+        frames_alloc_size *= 2;
+        if (frames == local_frames) {
+          frames = (nbt__snbt_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__snbt_frame_t));
+          NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+        } else {
+          frames = (nbt__snbt_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__snbt_frame_t));
+        }
+      }
+
+      frames[depth].tag = tag;
+      frames[depth].first = pending_size;
+      depth++;
+    }
+
+    // Move past the separator before the next value, and back up the stack past any lists and compounds which end.
+    while (depth > 0) {
+      nbt__snbt_frame_t* frame = &frames[depth - 1];
+      nbt_tag_t* parent = frame->tag;
+      int is_list = parent->type == NBT_TYPE_LIST;
+      char close = is_list ? ']' : '}';
+      size_t children = pending_size - frame->first;
+
+      nbt__snbt_skip_whitespace(stream);
+      if (children > 0 && nbt__snbt_peek(stream) == ',') {
+        stream->offset++;
+        nbt__snbt_skip_whitespace(stream);
+      } else if (children > 0 && nbt__snbt_peek(stream) != close) {
+        error = 1;
+        break;
+      }
+
+      if (nbt__snbt_peek(stream) == close) {
+        stream->offset++;
+
+        nbt_tag_t** value = NULL;
+        if (children > 0) {
+          value = (nbt_tag_t**)nbt__malloc(children * sizeof(nbt_tag_t*));
+          NBT_MEMCPY(value, pending + frame->first, children * sizeof(nbt_tag_t*));
+        }
+        if (is_list) {
+          parent->tag_list.type = children > 0 ? value[0]->type : NBT_TYPE_END;
+          parent->tag_list.value = value;
+          parent->tag_list.size = children;
+        } else {
+          parent->tag_compound.value = value;
+          parent->tag_compound.size = children;
+        }
+
+        pending_size = frame->first;
+        depth--;
+        continue;
+      }
+
+      if (!is_list) {
+        // Compound entries start with a key, which may be quoted.
+        int c = nbt__snbt_peek(stream);
+        if (c == '"' || c == '\'') {
+          key = nbt__snbt_parse_quoted(stream, &key_size);
+        } else {
+          const char* token;
+          key_size = nbt__snbt_read_unquoted(stream, &token);
+          if (key_size > 0) {
+            key = (char*)nbt__malloc(key_size + 1);
+            NBT_MEMCPY(key, token, key_size);
+            key[key_size] = '\0';
+          }
+        }
+        nbt__snbt_skip_whitespace(stream);
+        if (!key || nbt__snbt_peek(stream) != ':') {
+          error = 1;
+          break;
+        }
+#ifdef NBT_COMPACT_TAGS
+        if (key_size > 0xFFFF) {
+          error = 1; // Too long to store.
+          break;
+        }
+#endif
+        stream->offset++;
+      }
+
+      break;
+    }
+
+    if (error || depth == 0) {
+      break;
+    }
+
+  }
+
+  if (error) {
+    // Lists and compounds which were still open have no children yet, so every tag is freed exactly once.
+    for (size_t i = 0; i < pending_size; i++) {
+      nbt_free_tag(pending[i]);
+    }
+    if (root) {
+      nbt_free_tag(root);
+    }
+    root = NULL;
+  }
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+  if (pending != local_pending) {
+    nbt__free(pending);
+  }
+
+  if (key) {
+    nbt__free(key);
+  }
+
+  return root;
+
+}
+
+nbt_tag_t* nbt_parse_snbt(const char* snbt, size_t size) {
+
+  nbt__snbt_stream_t stream;
+  stream.data = snbt;
+  stream.size = size;
+  stream.offset = 0;
+
+  nbt_tag_t* tag = nbt__snbt_parse(&stream);
+
+  // Only whitespace may follow the root tag.
+  nbt__snbt_skip_whitespace(&stream);
+  if (tag && stream.offset != stream.size) {
+    nbt_free_tag(tag);
+    tag = NULL;
+  }
+
+  return tag;
+
+}
+
+// Shortest round-trip formatting of floats and doubles, using the Grisu2 algorithm. This finds the shortest digit
+// string within the rounding interval of the value in almost every case, and always produces digits which read back
+// as the same value. Floats use the rounding interval of the float rather than of the double they are converted to.
+
+typedef struct {
+  uint64_t f;
+  int e;
+} nbt__diy_fp_t;
+
+typedef struct {
+  uint64_t f;
+  int e;
+  int k;
+} nbt__cached_power_t;
+
+// Normalised 64-bit approximations of 10^k, for k from -300 to 324 in steps of 8.
+static const nbt__cached_power_t nbt__cached_powers[] = {
+  { 0xAB70FE17C79AC6CA, -1060, -300 },
+  { 0xFF77B1FCBEBCDC4F, -1034, -292 },
+  { 0xBE5691EF416BD60C, -1007, -284 },
+  { 0x8DD01FAD907FFC3C, -980, -276 },
+  { 0xD3515C2831559A83, -954, -268 },
+  { 0x9D71AC8FADA6C9B5, -927, -260 },
+  { 0xEA9C227723EE8BCB, -901, -252 },
+  { 0xAECC49914078536D, -874, -244 },
+  { 0x823C12795DB6CE57, -847, -236 },
+  { 0xC21094364DFB5637, -821, -228 },
+  { 0x9096EA6F3848984F, -794, -220 },
+  { 0xD77485CB25823AC7, -768, -212 },
+  { 0xA086CFCD97BF97F4, -741, -204 },
+  { 0xEF340A98172AACE5, -715, -196 },
+  { 0xB23867FB2A35B28E, -688, -188 },
+  { 0x84C8D4DFD2C63F3B, -661, -180 },
+  { 0xC5DD44271AD3CDBA, -635, -172 },
+  { 0x936B9FCEBB25C996, -608, -164 },
+  { 0xDBAC6C247D62A584, -582, -156 },
+  { 0xA3AB66580D5FDAF6, -555, -148 },
+  { 0xF3E2F893DEC3F126, -529, -140 },
+  { 0xB5B5ADA8AAFF80B8, -502, -132 },
+  { 0x87625F056C7C4A8B, -475, -124 },
+  { 0xC9BCFF6034C13053, -449, -116 },
+  { 0x964E858C91BA2655, -422, -108 },
+  { 0xDFF9772470297EBD, -396, -100 },
+  { 0xA6DFBD9FB8E5B88F, -369, -92 },
+  { 0xF8A95FCF88747D94, -343, -84 },
+  { 0xB94470938FA89BCF, -316, -76 },
+  { 0x8A08F0F8BF0F156B, -289, -68 },
+  { 0xCDB02555653131B6, -263, -60 },
+  { 0x993FE2C6D07B7FAC, -236, -52 },
+  { 0xE45C10C42A2B3B06, -210, -44 },
+  { 0xAA242499697392D3, -183, -36 },
+  { 0xFD87B5F28300CA0E, -157, -28 },
+  { 0xBCE5086492111AEB, -130, -20 },
+  { 0x8CBCCC096F5088CC, -103, -12 },
+  { 0xD1B71758E219652C, -77, -4 },
+  { 0x9C40000000000000, -50, 4 },
+  { 0xE8D4A51000000000, -24, 12 },
+  { 0xAD78EBC5AC620000, 3, 20 },
+  { 0x813F3978F8940984, 30, 28 },
+  { 0xC097CE7BC90715B3, 56, 36 },
+  { 0x8F7E32CE7BEA5C70, 83, 44 },
+  { 0xD5D238A4ABE98068, 109, 52 },
+  { 0x9F4F2726179A2245, 136, 60 },
+  { 0xED63A231D4C4FB27, 162, 68 },
+  { 0xB0DE65388CC8ADA8, 189, 76 },
+  { 0x83C7088E1AAB65DB, 216, 84 },
+  { 0xC45D1DF942711D9A, 242, 92 },
+  { 0x924D692CA61BE758, 269, 100 },
+  { 0xDA01EE641A708DEA, 295, 108 },
+  { 0xA26DA3999AEF774A, 322, 116 },
+  { 0xF209787BB47D6B85, 348, 124 },
+  { 0xB454E4A179DD1877, 375, 132 },
+  { 0x865B86925B9BC5C2, 402, 140 },
+  { 0xC83553C5C8965D3D, 428, 148 },
+  { 0x952AB45CFA97A0B3, 455, 156 },
+  { 0xDE469FBD99A05FE3, 481, 164 },
+  { 0xA59BC234DB398C25, 508, 172 },
+  { 0xF6C69A72A3989F5C, 534, 180 },
+  { 0xB7DCBF5354E9BECE, 561, 188 },
+  { 0x88FCF317F22241E2, 588, 196 },
+  { 0xCC20CE9BD35C78A5, 614, 204 },
+  { 0x98165AF37B2153DF, 641, 212 },
+  { 0xE2A0B5DC971F303A, 667, 220 },
+  { 0xA8D9D1535CE3B396, 694, 228 },
+  { 0xFB9B7CD9A4A7443C, 720, 236 },
+  { 0xBB764C4CA7A44410, 747, 244 },
+  { 0x8BAB8EEFB6409C1A, 774, 252 },
+  { 0xD01FEF10A657842C, 800, 260 },
+  { 0x9B10A4E5E9913129, 827, 268 },
+  { 0xE7109BFBA19C0C9D, 853, 276 },
+  { 0xAC2820D9623BF429, 880, 284 },
+  { 0x80444B5E7AA7CF85, 907, 292 },
+  { 0xBF21E44003ACDD2D, 933, 300 },
+  { 0x8E679C2F5E44FF8F, 960, 308 },
+  { 0xD433179D9C8CB841, 986, 316 },
+  { 0x9E19DB92B4E31BA9, 1013, 324 },
+};
+
+static nbt__diy_fp_t nbt__diy_fp(uint64_t f, int e) {
+  nbt__diy_fp_t x;
+  x.f = f;
+  x.e = e;
+  return x;
+}
+
+// Multiplies two numbers, keeping the upper 64 bits of the product (rounded).
+static nbt__diy_fp_t nbt__diy_fp_mul(nbt__diy_fp_t x, nbt__diy_fp_t y) {
+  uint64_t x_lo = x.f & 0xffffffff;
+  uint64_t x_hi = x.f >> 32;
+  uint64_t y_lo = y.f & 0xffffffff;
+  uint64_t y_hi = y.f >> 32;
+
+  uint64_t p0 = x_lo * y_lo;
+  uint64_t p1 = x_lo * y_hi;
+  uint64_t p2 = x_hi * y_lo;
+  uint64_t p3 = x_hi * y_hi;
+
+  uint64_t q = (p0 >> 32) + (p1 & 0xffffffff) + (p2 & 0xffffffff) + ((uint64_t)1 << 31);
+  return nbt__diy_fp(p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32), x.e + y.e + 64);
+}
+
+static nbt__diy_fp_t nbt__diy_fp_normalize(nbt__diy_fp_t x) {
+  while (!(x.f >> 63)) {
+    x.f <<= 1;
+    x.e--;
+  }
+  return x;
+}
+
+// Rounds the last digit towards w (which is dist below the upper bound) while staying inside the rounding interval.
+static void nbt__grisu2_round(char* buffer, int length, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t ten_k) {
+  while (rest < dist && delta - rest >= ten_k && (rest + ten_k < dist || dist - rest > rest + ten_k - dist)) {
+    buffer[length - 1]--;
+    rest += ten_k;
+  }
+}
+
+// Writes the digits of value (without a decimal point), returning how many were written. The value is the digits
+// multiplied by 10^*decimal_exponent. value must be finite and positive.
+static int nbt__grisu2(char* buffer, int* decimal_exponent, double value, int is_float) {
+
+  // Work out the value and the bounds of the interval which rounds to it.
+  int precision = is_float ? 24 : 53;
+  int bias = is_float ? 150 : 1075;
+  uint64_t bits;
+  uint64_t fraction;
+  int biased_exponent;
+
+  if (is_float) {
+    float float_value = (float)value;
+    uint32_t float_bits;
+    NBT_MEMCPY(&float_bits, &float_value, 4);
+    bits = float_bits;
+  } else {
+    NBT_MEMCPY(&bits, &value, 8);
+  }
+
+  fraction = bits & (((uint64_t)1 << (precision - 1)) - 1);
+  biased_exponent = (int)(bits >> (precision - 1)) & (is_float ? 0xff : 0x7ff);
+
+  nbt__diy_fp_t v = biased_exponent == 0 ? nbt__diy_fp(fraction, 1 - bias) : nbt__diy_fp(fraction | ((uint64_t)1 << (precision - 1)), biased_exponent - bias);
+  int lower_boundary_closer = fraction == 0 && biased_exponent > 1;
+
+  nbt__diy_fp_t m_plus = nbt__diy_fp_normalize(nbt__diy_fp(2 * v.f + 1, v.e - 1));
+  nbt__diy_fp_t m_minus = lower_boundary_closer ? nbt__diy_fp(4 * v.f - 1, v.e - 2) : nbt__diy_fp(2 * v.f - 1, v.e - 1);
+  m_minus.f <<= m_minus.e - m_plus.e;
+  m_minus.e = m_plus.e;
+  v = nbt__diy_fp_normalize(v);
+
+  // Scale everything by a power of ten which brings the upper bound's exponent into [-60, -32].
+  int f = -60 - m_plus.e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  const nbt__cached_power_t* cached = &nbt__cached_powers[(300 + k + 7) / 8];
+  nbt__diy_fp_t c = nbt__diy_fp(cached->f, cached->e);
+
+  nbt__diy_fp_t w = nbt__diy_fp_mul(v, c);
+  nbt__diy_fp_t w_minus = nbt__diy_fp_mul(m_minus, c);
+  nbt__diy_fp_t w_plus = nbt__diy_fp_mul(m_plus, c);
+  w_minus.f++;
+  w_plus.f--;
+
+  *decimal_exponent = -cached->k;
+
+  // Generate digits until the remainder falls inside the interval.
+  uint64_t delta = w_plus.f - w_minus.f;
+  uint64_t dist = w_plus.f - w.f;
+  int shift = -w_plus.e;
+  uint64_t one = (uint64_t)1 << shift;
+  uint32_t p1 = (uint32_t)(w_plus.f >> shift);
+  uint64_t p2 = w_plus.f & (one - 1);
+  int length = 0;
+
+  uint32_t pow10 = 1;
+  int n = 1;
+  while (n < 10 && p1 >= pow10 * 10) {
+    pow10 *= 10;
+    n++;
+  }
+
+  while (n > 0) {
+    buffer[length++] = (char)('0' + p1 / pow10);
+    p1 %= pow10;
+    n--;
+
+    uint64_t rest = ((uint64_t)p1 << shift) + p2;
+    if (rest <= delta) {
+      *decimal_exponent += n;
+      nbt__grisu2_round(buffer, length, dist, delta, rest, (uint64_t)pow10 << shift);
+      return length;
+    }
+
+    pow10 /= 10;
+  }
+
+  int m = 0;
+  for (;;) {
+    p2 *= 10;
+    buffer[length++] = (char)('0' + (p2 >> shift));
+    p2 &= one - 1;
+    m++;
+    delta *= 10;
+    dist *= 10;
+    if (p2 <= delta) {
+      break;
+    }
+  }
+
+  *decimal_exponent -= m;
+  nbt__grisu2_round(buffer, length, dist, delta, p2, one);
+  return length;
+
+}
+
+// Formats a float or double as the shortest decimal which reads back as the same value, always with a decimal point or
+// an exponent. Plain notation is used for decimal exponents from -4 to 15 (6 for floats), and scientific notation
+// otherwise. The buffer must hold at least 32 characters. NaN and infinities are not handled here.
+static size_t nbt__format_double(char* buffer, double value, int is_float) {
+
+  char* p = buffer;
+
+  if (value < 0 || (value == 0 && 1 / value < 0)) {
+    *p++ = '-';
+    value = -value;
+  }
+
+  if (value == 0) {
+    p[0] = '0';
+    p[1] = '.';
+    p[2] = '0';
+    return (size_t)(p + 3 - buffer);
+  }
+
+  char digits[20];
+  int decimal_exponent;
+  int length = nbt__grisu2(digits, &decimal_exponent, value, is_float);
+
+  // Position of the decimal point relative to the start of the digits.
+  int point = length + decimal_exponent;
+  int max_point = is_float ? 7 : 16;
+
+  if (length <= point && point <= max_point) {
+    // Whole number: digits, trailing zeros, then ".0".
+    NBT_MEMCPY(p, digits, length);
+    for (int i = length; i < point; i++) {
+      p[i] = '0';
+    }
+    p += point;
+    *p++ = '.';
+    *p++ = '0';
+  } else if (0 < point && point <= max_point) {
+    // Point inside the digits.
+    NBT_MEMCPY(p, digits, point);
+    p[point] = '.';
+    NBT_MEMCPY(p + point + 1, digits + point, length - point);
+    p += length + 1;
+  } else if (-4 < point && point <= 0) {
+    // Small number: "0.", leading zeros, then the digits.
+    *p++ = '0';
+    *p++ = '.';
+    for (int i = point; i < 0; i++) {
+      *p++ = '0';
+    }
+    NBT_MEMCPY(p, digits, length);
+    p += length;
+  } else {
+    // Scientific notation, with at least one digit after the point.
+    *p++ = digits[0];
+    *p++ = '.';
+    if (length > 1) {
+      NBT_MEMCPY(p, digits + 1, length - 1);
+      p += length - 1;
+    } else {
+      *p++ = '0';
+    }
+    *p++ = 'e';
+    int exponent = point - 1;
+    if (exponent < 0) {
+      *p++ = '-';
+      exponent = -exponent;
+    }
+    if (exponent >= 100) {
+      *p++ = (char)('0' + exponent / 100);
+      exponent %= 100;
+      *p++ = (char)('0' + exponent / 10);
+    } else if (exponent >= 10) {
+      *p++ = (char)('0' + exponent / 10);
+    }
+    *p++ = (char)('0' + exponent % 10);
+  }
+
+  return (size_t)(p - buffer);
+
+}
+
+// Buffers text on its way to a writer.
+typedef struct {
+  nbt_writer_t writer;
+  char* buffer;
+  size_t size;
+  int json;
+} nbt__text_stream_t;
+
+static void nbt__text_flush(nbt__text_stream_t* stream) {
+  size_t offset = 0;
+  while (offset < stream->size) {
+    size_t bytes_written;
+    NBT__PHASE(NBT_PHASE_WRITE, bytes_written = stream->writer.write(stream->writer.userdata, (uint8_t*)stream->buffer + offset, stream->size - offset));
+    if (bytes_written == 0) {
+      break;
+    }
+    offset += bytes_written;
+  }
+  stream->size = 0;
+}
+
+// Makes sure there is room for size more characters, returning where they should go. size must be small compared to
+// NBT_BUFFER_SIZE.
+NBT__INLINE char* nbt__text_reserve(nbt__text_stream_t* stream, size_t size) {
+  if (stream->size + size > NBT_BUFFER_SIZE) {
+    nbt__text_flush(stream);
+  }
+  return stream->buffer + stream->size;
+}
+
+NBT__INLINE void nbt__text_put_char(nbt__text_stream_t* stream, char c) {
+  *nbt__text_reserve(stream, 1) = c;
+  stream->size++;
+}
+
+static void nbt__text_put(nbt__text_stream_t* stream, const char* data, size_t size) {
+  while (size > 0) {
+    size_t space = NBT_BUFFER_SIZE - stream->size;
+    if (space == 0) {
+      nbt__text_flush(stream);
+      space = NBT_BUFFER_SIZE;
+    }
+    size_t chunk = size < space ? size : space;
+    NBT_MEMCPY(stream->buffer + stream->size, data, chunk);
+    stream->size += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+}
+
+static const char nbt__digit_pairs[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// Writes an integer followed by an SNBT type suffix (if suffix isn't 0), two digits at a time.
+static void nbt__text_put_integer(nbt__text_stream_t* stream, int64_t value, char suffix) {
+  char digits[20];
+  char* p = digits + sizeof(digits);
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+
+  while (magnitude >= 100) {
+    const char* pair = nbt__digit_pairs + (magnitude % 100) * 2;
+    magnitude /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (magnitude >= 10) {
+    const char* pair = nbt__digit_pairs + magnitude * 2;
+    *--p = pair[1];
+    *--p = pair[0];
+  } else {
+    *--p = (char)('0' + magnitude);
+  }
+
+  size_t length = (size_t)(digits + sizeof(digits) - p);
+  char* out = nbt__text_reserve(stream, length + 2);
+  if (value < 0) {
+    *out++ = '-';
+    stream->size++;
+  }
+  NBT_MEMCPY(out, p, length);
+  stream->size += length;
+  if (suffix && !stream->json) {
+    out[length] = suffix;
+    stream->size++;
+  }
+}
+
+static void nbt__text_put_double(nbt__text_stream_t* stream, double value, int is_float) {
+  char* out = nbt__text_reserve(stream, 40);
+
+  if (value != value || value - value != 0) {
+    // NaN and infinities have no representation in JSON. In SNBT, they are written the same way as Minecraft does.
+    const char* text = stream->json ? "null" : (value != value ? "NaN" : (value > 0 ? "Infinity" : "-Infinity"));
+    size_t length = 0;
+    while (text[length]) {
+      length++;
+    }
+    NBT_MEMCPY(out, text, length);
+    stream->size += length;
+  } else {
+    stream->size += nbt__format_double(out, value, is_float);
+  }
+
+  if (!stream->json) {
+    stream->buffer[stream->size++] = is_float ? 'f' : 'd';
+  }
+}
+
+// Writes a quoted string, escaping quotes, backslashes and control characters. Runs of characters which don't need
+// escaping are copied in one go.
+static void nbt__text_put_string(nbt__text_stream_t* stream, const char* value, size_t size) {
+  nbt__text_put_char(stream, '"');
+
+  size_t start = 0;
+  for (size_t i = 0; i < size; i++) {
+    unsigned char c = (unsigned char)value[i];
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+
+    nbt__text_put(stream, value + start, i - start);
+    start = i + 1;
+
+    char* out = nbt__text_reserve(stream, 6);
+    out[0] = '\\';
+    switch (c) {
+      case '"': out[1] = '"'; break;
+      case '\\': out[1] = '\\'; break;
+      case '\b': out[1] = 'b'; break;
+      case '\f': out[1] = 'f'; break;
+      case '\n': out[1] = 'n'; break;
+      case '\r': out[1] = 'r'; break;
+      case '\t': out[1] = 't'; break;
+      default: {
+        out[1] = 'u';
+        out[2] = '0';
+        out[3] = '0';
+        out[4] = "0123456789abcdef"[c >> 4];
+        out[5] = "0123456789abcdef"[c & 15];
+        stream->size += 4;
+        break;
+      }
+    }
+    stream->size += 2;
+  }
+
+  nbt__text_put(stream, value + start, size - start);
+  nbt__text_put_char(stream, '"');
+}
+
+// Writes a compound key. In SNBT, keys are only quoted if they need to be.
+static void nbt__text_put_key(nbt__text_stream_t* stream, const char* name, size_t size) {
+  int quote = stream->json || size == 0;
+  for (size_t i = 0; i < size && !quote; i++) {
+    quote = !nbt__snbt_is_unquoted(name[i]);
+  }
+
+  if (quote) {
+    nbt__text_put_string(stream, name ? name : "", size);
+  } else {
+    nbt__text_put(stream, name, size);
+  }
+  nbt__text_put_char(stream, ':');
+}
+
+typedef struct {
+  nbt_tag_t* tag;
+  size_t index; // Next child to write.
+} nbt__text_frame_t;
+
+// Writes tag as SNBT or JSON, without recursing.
+static void nbt__write_text(nbt_writer_t writer, nbt_tag_t* tag, int json) {
+
+  nbt__text_stream_t stream;
+  stream.writer = writer;
+  stream.buffer = (char*)nbt__malloc(NBT_BUFFER_SIZE);
+  stream.size = 0;
+  stream.json = json;
+
+  nbt__text_frame_t local_frames[32];
+  nbt__text_frame_t* frames = local_frames;
+  size_t frames_alloc_size = 32;
+  size_t depth = 0;
+
+  while (tag) {
+
+    nbt__load(tag);
+
+    switch (tag->type) {
+      case NBT_TYPE_BYTE: {
+        nbt__text_put_integer(&stream, tag->tag_byte.value, 'b');
+        break;
+      }
+      case NBT_TYPE_SHORT: {
+        nbt__text_put_integer(&stream, tag->tag_short.value, 's');
+        break;
+      }
+      case NBT_TYPE_INT: {
+        nbt__text_put_integer(&stream, tag->tag_int.value, 0);
+        break;
+      }
+      case NBT_TYPE_LONG: {
+        nbt__text_put_integer(&stream, tag->tag_long.value, 'L');
+        break;
+      }
+      case NBT_TYPE_FLOAT: {
+        nbt__text_put_double(&stream, tag->tag_float.value, 1);
+        break;
+      }
+      case NBT_TYPE_DOUBLE: {
+        nbt__text_put_double(&stream, tag->tag_double.value, 0);
+        break;
+      }
+      case NBT_TYPE_BYTE_ARRAY: {
+        nbt__text_put(&stream, json ? "[" : "[B;", json ? 1 : 3);
+        for (size_t i = 0; i < tag->tag_byte_array.size; i++) {
+          if (i > 0) {
+            nbt__text_put_char(&stream, ',');
+          }
+          nbt__text_put_integer(&stream, tag->tag_byte_array.value[i], 'b');
+        }
+        nbt__text_put_char(&stream, ']');
+        break;
+      }
+      case NBT_TYPE_STRING: {
+        nbt__text_put_string(&stream, tag->tag_string.value, tag->tag_string.size);
+        break;
+      }
+      case NBT_TYPE_INT_ARRAY: {
+        nbt__text_put(&stream, json ? "[" : "[I;", json ? 1 : 3);
+        for (size_t i = 0; i < tag->tag_int_array.size; i++) {
+          if (i > 0) {
+            nbt__text_put_char(&stream, ',');
+          }
+          nbt__text_put_integer(&stream, tag->tag_int_array.value[i], 0);
+        }
+        nbt__text_put_char(&stream, ']');
+        break;
+      }
+      case NBT_TYPE_LONG_ARRAY: {
+        nbt__text_put(&stream, json ? "[" : "[L;", json ? 1 : 3);
+        for (size_t i = 0; i < tag->tag_long_array.size; i++) {
+          if (i > 0) {
+            nbt__text_put_char(&stream, ',');
+          }
+          nbt__text_put_integer(&stream, tag->tag_long_array.value[i], 'L');
+        }
+        nbt__text_put_char(&stream, ']');
+        break;
+      }
+      case NBT_TYPE_LIST:
+      case NBT_TYPE_COMPOUND: {
+        nbt__text_put_char(&stream, tag->type == NBT_TYPE_LIST ? '[' : '{');
+
+        if (depth == frames_alloc_size) {
+          frames_alloc_size *= 2;
+          if (frames == local_frames) {
+            frames = (nbt__text_frame_t*)nbt__malloc(frames_alloc_size * sizeof(nbt__text_frame_t));
+            NBT_MEMCPY(frames, local_frames, sizeof(local_frames));
+          } else {
+            frames = (nbt__text_frame_t*)nbt__realloc(frames, frames_alloc_size * sizeof(nbt__text_frame_t));
+          }
+        }
+
+        frames[depth].tag = tag;
+        frames[depth].index = 0;
+        depth++;
+        break;
+      }
+      default: {
+        // End tags only appear in empty lists, which have no elements to write.
+        break;
+      }
+    }
+
+    // Find the next tag to write, closing any lists and compounds which are complete.
+    tag = NULL;
+
+    while (depth > 0) {
+      nbt__text_frame_t* frame = &frames[depth - 1];
+      nbt_tag_t* parent = frame->tag;
+
+      if (parent->type == NBT_TYPE_LIST) {
+        if (frame->index < parent->tag_list.size) {
+          if (frame->index > 0) {
+            nbt__text_put_char(&stream, ',');
+          }
+          tag = parent->tag_list.value[frame->index++];
+          break;
+        }
+        nbt__text_put_char(&stream, ']');
+      } else {
+        if (frame->index < parent->tag_compound.size) {
+          if (frame->index > 0) {
+            nbt__text_put_char(&stream, ',');
+          }
+          tag = parent->tag_compound.value[frame->index++];
+          nbt__text_put_key(&stream, tag->name, tag->name_size);
+          break;
+        }
+        nbt__text_put_char(&stream, '}');
+      }
+
+      depth--;
+    }
+
+  }
+
+  nbt__text_flush(&stream);
+
+  if (frames != local_frames) {
+    nbt__free(frames);
+  }
+
+  nbt__free(stream.buffer);
+
+}
+
+void nbt_write_snbt(nbt_writer_t writer, nbt_tag_t* tag) {
+
+  nbt__write_text(writer, tag, 0);
+
+}
+
+void nbt_write_json(nbt_writer_t writer, nbt_tag_t* tag) {
+
+  nbt__write_text(writer, tag, 1);
+
+}
+
+typedef enum {
+  NBT__PATH_CHILD, // The child of a compound with the given name.
+  NBT__PATH_ALL, // Every element of a list.
+  NBT__PATH_INDEX, // One element of a list, counting back from the end if the index is negative.
+  NBT__PATH_FILTER // The tag itself, if it's a compound which matches the filter.
+} nbt__path_step_type_t;
+
+typedef struct {
+  nbt__path_step_type_t type;
+  char* name;
+  size_t name_size;
+  int64_t index;
+  nbt_tag_t* filter;
+} nbt__path_step_t;
+
+struct nbt_path_t {
+  nbt__path_step_t* steps;
+  size_t size;
+};
+
+static nbt__path_step_t* nbt__path_add_step(nbt_path_t* path, nbt__path_step_type_t type) {
+  path->steps = (nbt__path_step_t*)nbt__realloc(path->steps, (path->size + 1) * sizeof(nbt__path_step_t));
+  nbt__path_step_t* step = &path->steps[path->size++];
+  step->type = type;
+  step->name = NULL;
+  step->name_size = 0;
+  step->index = 0;
+  step->filter = NULL;
+  return step;
+}
+
+// Adds a filter step for the compound at the start of the stream.
+static int nbt__path_add_filter(nbt_path_t* path, nbt__snbt_stream_t* stream) {
+  nbt_tag_t* filter = nbt__snbt_parse(stream);
+  if (!filter || filter->type != NBT_TYPE_COMPOUND) {
+    if (filter) {
+      nbt_free_tag(filter);
+    }
+    return 0;
+  }
+  nbt__path_add_step(path, NBT__PATH_FILTER)->filter = filter;
+  return 1;
+}
+
+static int nbt__path_is_unquoted(char c) {
+  return c != ' ' && c != '"' && c != '\'' && c != '[' && c != ']' && c != '.' && c != '{' && c != '}';
+}
+
+nbt_path_t* nbt_path_compile(const char* path_string) {
+
+  nbt__snbt_stream_t stream;
+  stream.data = path_string;
+  stream.size = 0;
+  stream.offset = 0;
+  while (path_string[stream.size]) {
+    stream.size++;
+  }
+
+  nbt_path_t* path = (nbt_path_t*)nbt__malloc(sizeof(nbt_path_t));
+  path->steps = NULL;
+  path->size = 0;
+
+  int error = 0;
+
+  // The root tag can be checked against a filter before anything else.
+  if (nbt__snbt_peek(&stream) == '{') {
+    error = !nbt__path_add_filter(path, &stream);
+    if (nbt__snbt_peek(&stream) == '.') {
+      stream.offset++;
+    }
+  }
+
+  int separated = 1; // Whether a name can come next.
+
+  while (!error && stream.offset < stream.size) {
+
+    int c = nbt__snbt_peek(&stream);
+
+    if (c == '[') {
+      stream.offset++;
+      c = nbt__snbt_peek(&stream);
+
+      if (c == ']') {
+        nbt__path_add_step(path, NBT__PATH_ALL);
+      } else if (c == '{') {
+        nbt__path_add_step(path, NBT__PATH_ALL);
+        error = !nbt__path_add_filter(path, &stream);
+      } else {
+        size_t start = stream.offset;
+        while (stream.offset < stream.size && (stream.data[stream.offset] == '-' || (stream.data[stream.offset] >= '0' && stream.data[stream.offset] <= '9'))) {
+          stream.offset++;
+        }
+        int64_t index = 0;
+        error = !nbt__snbt_parse_integer(stream.data + start, stream.offset - start, &index) || index < INT32_MIN || index > INT32_MAX;
+        nbt__path_add_step(path, NBT__PATH_INDEX)->index = index;
+      }
+
+      if (nbt__snbt_peek(&stream) != ']') {
+        error = 1;
+      }
+      stream.offset++;
+      separated = 0;
+      continue;
+    }
+
+    if (!separated) {
+      if (c != '.') {
+        error = 1;
+        break;
+      }
+      stream.offset++;
+      c = nbt__snbt_peek(&stream);
+    }
+
+    // A name, which can optionally be followed by a filter.
+    nbt__path_step_t* step = nbt__path_add_step(path, NBT__PATH_CHILD);
+
+    if (c == '"' || c == '\'') {
+      step->name = nbt__snbt_parse_quoted(&stream, &step->name_size);
+      error = !step->name;
+    } else {
+      size_t start = stream.offset;
+      while (stream.offset < stream.size && nbt__path_is_unquoted(stream.data[stream.offset])) {
+        stream.offset++;
+      }
+      step->name_size = stream.offset - start;
+      step->name = (char*)nbt__malloc(step->name_size + 1);
+      NBT_MEMCPY(step->name, stream.data + start, step->name_size);
+      step->name[step->name_size] = '\0';
+      error = step->name_size == 0;
+    }
+
+    if (!error && nbt__snbt_peek(&stream) == '{') {
+      error = !nbt__path_add_filter(path, &stream);
+    }
+
+    separated = 0;
+
+  }
+
+  // An empty path or one ending in a dot doesn't select anything.
+  if (error || separated) {
+    nbt_free_path(path);
+    return NULL;
+  }
+
+  return path;
+
+}
+
+void nbt_free_path(nbt_path_t* path) {
+
+  for (size_t i = 0; i < path->size; i++) {
+    if (path->steps[i].name) {
+      nbt__free(path->steps[i].name);
+    }
+    if (path->steps[i].filter) {
+      nbt_free_tag(path->steps[i].filter);
+    }
+  }
+
+  nbt__free(path->steps);
+  nbt__free(path);
+
+}
+
+// Checks whether a tag matches a filter in the way Minecraft does: compounds match if every entry in the filter
+// matches an entry in the tag, and lists match if every element of the filter matches some element of the tag.
+static int nbt__path_matches(nbt_tag_t* filter, nbt_tag_t* tag) {
+
+  if (filter->type != tag->type) {
+    return 0;
+  }
+
+  nbt__load(tag);
+
+  switch (filter->type) {
+    case NBT_TYPE_BYTE: return filter->tag_byte.value == tag->tag_byte.value;
+    case NBT_TYPE_SHORT: return filter->tag_short.value == tag->tag_short.value;
+    case NBT_TYPE_INT: return filter->tag_int.value == tag->tag_int.value;
+    case NBT_TYPE_LONG: return filter->tag_long.value == tag->tag_long.value;
+    case NBT_TYPE_FLOAT: return filter->tag_float.value == tag->tag_float.value;
+    case NBT_TYPE_DOUBLE: return filter->tag_double.value == tag->tag_double.value;
+    case NBT_TYPE_BYTE_ARRAY: {
+      return filter->tag_byte_array.size == tag->tag_byte_array.size && NBT_MEMCMP(filter->tag_byte_array.value, tag->tag_byte_array.value, tag->tag_byte_array.size) == 0;
+    }
+    case NBT_TYPE_STRING: {
+      return filter->tag_string.size == tag->tag_string.size && NBT_MEMCMP(filter->tag_string.value, tag->tag_string.value, tag->tag_string.size) == 0;
+    }
+    case NBT_TYPE_INT_ARRAY: {
+      return filter->tag_int_array.size == tag->tag_int_array.size && NBT_MEMCMP(filter->tag_int_array.value, tag->tag_int_array.value, tag->tag_int_array.size * sizeof(int32_t)) == 0;
+    }
+    case NBT_TYPE_LONG_ARRAY: {
+      return filter->tag_long_array.size == tag->tag_long_array.size && NBT_MEMCMP(filter->tag_long_array.value, tag->tag_long_array.value, tag->tag_long_array.size * sizeof(int64_t)) == 0;
+    }
+    case NBT_TYPE_LIST: {
+      if (filter->tag_list.size == 0) {
+        return tag->tag_list.size == 0;
+      }
+      for (size_t i = 0; i < filter->tag_list.size; i++) {
+        size_t j = 0;
+        while (j < tag->tag_list.size && !nbt__path_matches(filter->tag_list.value[i], tag->tag_list.value[j])) {
+          j++;
+        }
+        if (j == tag->tag_list.size) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+    case NBT_TYPE_COMPOUND: {
+      for (size_t i = 0; i < filter->tag_compound.size; i++) {
+        nbt_tag_t* entry = filter->tag_compound.value[i];
+        size_t j = 0;
+        while (j < tag->tag_compound.size && !(tag->tag_compound.value[j]->name_size == entry->name_size && NBT_MEMCMP(tag->tag_compound.value[j]->name, entry->name, entry->name_size) == 0)) {
+          j++;
+        }
+        if (j == tag->tag_compound.size || !nbt__path_matches(entry, tag->tag_compound.value[j])) {
+          return 0;
+        }
+      }
+      return 1;
+    }
+    default: {
+      return 0;
+    }
+  }
+
+}
+
+// Follows the path from the given step onwards. This recurses once per step, so the depth is limited by the length of
+// the path rather than the data.
+static void nbt__path_collect(nbt_path_t* path, size_t step_index, nbt_tag_t* tag, nbt_tag_t** results, size_t max_results, size_t* count) {
+
+  if (*count == max_results) {
+    return;
+  }
+
+  if (step_index == path->size) {
+    results[(*count)++] = tag;
+    return;
+  }
+
+  nbt__path_step_t* step = &path->steps[step_index];
+
+  nbt__load(tag);
+
+  switch (step->type) {
+    case NBT__PATH_CHILD: {
+      if (tag->type == NBT_TYPE_COMPOUND) {
+        for (size_t i = 0; i < tag->tag_compound.size; i++) {
+          nbt_tag_t* child = tag->tag_compound.value[i];
+          if (child->name_size == step->name_size && NBT_MEMCMP(child->name, step->name, step->name_size) == 0) {
+            nbt__path_collect(path, step_index + 1, child, results, max_results, count);
+            break;
+          }
+        }
+      }
+      break;
+    }
+    case NBT__PATH_ALL: {
+      if (tag->type == NBT_TYPE_LIST) {
+        for (size_t i = 0; i < tag->tag_list.size; i++) {
+          nbt__path_collect(path, step_index + 1, tag->tag_list.value[i], results, max_results, count);
+        }
+      }
+      break;
+    }
+    case NBT__PATH_INDEX: {
+      if (tag->type == NBT_TYPE_LIST) {
+        int64_t index = step->index < 0 ? step->index + (int64_t)tag->tag_list.size : step->index;
+        if (index >= 0 && index < (int64_t)tag->tag_list.size) {
+          nbt__path_collect(path, step_index + 1, tag->tag_list.value[index], results, max_results, count);
+        }
+      }
+      break;
+    }
+    case NBT__PATH_FILTER: {
+      if (nbt__path_matches(step->filter, tag)) {
+        nbt__path_collect(path, step_index + 1, tag, results, max_results, count);
+      }
+      break;
+    }
+  }
+
+}
+
+size_t nbt_path_get(nbt_path_t* path, nbt_tag_t* tag, nbt_tag_t** results, size_t max_results) {
+
+  size_t count = 0;
+
+  nbt__path_collect(path, 0, tag, results, max_results, &count);
+
+  return count;
+
+}
+
+// State for following a path through serialized data.
+typedef struct {
+  nbt_path_t* path;
+  const uint8_t* buffer;
+  size_t size;
+  nbt__format_t format;
+  nbt_tag_t** results;
+  size_t max_results;
+  size_t count;
+  int error;
+} nbt__path_search_t;
+
+// Parses the tag at offset, which may have its type and name before it, after checking that it is all there.
+static nbt_tag_t* nbt__path_parse(nbt__path_search_t* search, size_t offset, size_t payload, int type, int parse_name, nbt_tag_type_t override_type) {
+
+  if (nbt__skip_payload(search->buffer, search->size, &payload, type, search->format) != NBT__SCAN_DONE) {
+    search->error = 1;
+    return NULL;
+  }
+
+  nbt__read_stream_t stream;
+  stream.buffer = search->buffer;
+  stream.buffer_offset = offset;
+
+  nbt_tag_t* tag = nbt__parse(&stream, parse_name, override_type, search->format, NULL);
+  if (!tag) {
+    search->error = 1;
+  }
+  return tag;
+
+}
+
+// Same as nbt__path_collect, but for the tag at offset in serialized data. Anything which isn't on the path is skipped
+// over without being parsed.
+static void nbt__path_search(nbt__path_search_t* search, size_t step_index, size_t offset, size_t payload, int type, int parse_name, nbt_tag_type_t override_type) {
+
+  if (search->error || search->count == search->max_results) {
+    return;
+  }
+
+  if (step_index == search->path->size) {
+    nbt_tag_t* tag = nbt__path_parse(search, offset, payload, type, parse_name, override_type);
+    if (tag) {
+      search->results[search->count++] = tag;
+    }
+    return;
+  }
+
+  nbt__path_step_t* step = &search->path->steps[step_index];
+  const uint8_t* buffer = search->buffer;
+  size_t size = search->size;
+  nbt__format_t format = search->format;
+  size_t p = payload;
+
+  switch (step->type) {
+    case NBT__PATH_CHILD:
+    case NBT__PATH_FILTER: {
+      if (type != NBT_TYPE_COMPOUND) {
+        break;
+      }
+
+      size_t matched = 0;
+
+      for (;;) {
+        // Read the type and name of the next entry.
+        size_t child_offset = p;
+        if (p + 1 > size) {
+          search->error = 1;
+          return;
+        }
+        int child_type = buffer[p++];
+        if (child_type == NBT_TYPE_END) {
+          break;
+        }
+
+        uint32_t name_size;
+        if (nbt__scan_length(buffer, size, &p, 1, format, &name_size) != NBT__SCAN_DONE || p + name_size > size) {
+          search->error = 1;
+          return;
+        }
+        const uint8_t* name = buffer + p;
+        p += name_size;
+
+        if (step->type == NBT__PATH_CHILD) {
+          if (name_size == step->name_size && NBT_MEMCMP(name, step->name, name_size) == 0) {
+            nbt__path_search(search, step_index + 1, child_offset, p, child_type, 1, NBT_NO_OVERRIDE);
+            return;
+          }
+        } else {
+          // Only entries which are named in the filter need parsing to compare them.
+          for (size_t i = 0; i < step->filter->tag_compound.size; i++) {
+            nbt_tag_t* entry = step->filter->tag_compound.value[i];
+            if (name_size == entry->name_size && NBT_MEMCMP(name, entry->name, name_size) == 0) {
+              nbt_tag_t* child = nbt__path_parse(search, child_offset, p, child_type, 1, NBT_NO_OVERRIDE);
+              if (!child) {
+                return;
+              }
+              int matches = nbt__path_matches(entry, child);
+              nbt_free_tag(child);
+              if (!matches) {
+                return;
+              }
+              matched++;
+              break;
+            }
+          }
+        }
+
+        if (nbt__skip_payload(buffer, size, &p, child_type, format) != NBT__SCAN_DONE) {
+          search->error = 1;
+          return;
+        }
+      }
+
+      if (step->type == NBT__PATH_FILTER && matched == step->filter->tag_compound.size) {
+        nbt__path_search(search, step_index + 1, offset, payload, type, parse_name, override_type);
+      }
+      break;
+    }
+    case NBT__PATH_ALL:
+    case NBT__PATH_INDEX: {
+      if (type != NBT_TYPE_LIST) {
+        break;
+      }
+
+      uint8_t list_type;
+      uint32_t list_length;
+      if (nbt__scan_payload(buffer, size, &p, NBT_TYPE_LIST, format, &list_type, &list_length) != NBT__SCAN_DONE) {
+        search->error = 1;
+        return;
+      }
+
+      int64_t first = 0;
+      int64_t last = (int64_t)list_length - 1;
+      if (step->type == NBT__PATH_INDEX) {
+        first = step->index < 0 ? step->index + (int64_t)list_length : step->index;
+        last = first;
+        if (first < 0 || first >= (int64_t)list_length) {
+          break;
+        }
+      }
+
+      for (int64_t i = 0; i <= last && !search->error; i++) {
+        if (i >= first) {
+          nbt__path_search(search, step_index + 1, p, p, list_type, 0, (nbt_tag_type_t)list_type);
+        }
+        if (i < last && nbt__skip_payload(buffer, size, &p, list_type, format) != NBT__SCAN_DONE) {
+          search->error = 1;
+        }
       }
+      break;
     }
-    nbt__crc_table[n] = c;
   }
-  nbt__crc_table_computed = 1;
+
 }
 
-static uint32_t nbt__update_crc(uint32_t crc, uint8_t* buf, size_t len) {
-  uint32_t c = crc ^ 0xffffffffL;
-  size_t n;
+// Follows a path through uncompressed serialized data. Returns 0 if the data is invalid, in which case no results are
+// given back.
+static int nbt__path_search_buffer(nbt_path_t* path, const uint8_t* buffer, size_t size, int parse_flags, nbt_tag_t** results, size_t max_results, size_t* count) {
 
-  if (!nbt__crc_table_computed) {
-    nbt__make_crc_table();
-  }
+  *count = 0;
 
-  for (n = 0; n < len; n++) {
-    c = nbt__crc_table[(c ^ buf[n]) & 0xff] ^ (c >> 8);
+  if (size == 0) {
+    return 0;
   }
-  return c ^ 0xffffffffL;
-}
 
-void nbt_write(nbt_writer_t writer, nbt_tag_t* tag, int write_flags) {
+  nbt__path_search_t search;
+  search.path = path;
+  search.buffer = buffer;
+  search.size = size;
+  search.format = nbt__get_format(parse_flags);
+  search.results = results;
+  search.max_results = max_results;
+  search.count = 0;
+  search.error = 0;
+
+  // Find the payload of the root tag.
+  int root_name = !(parse_flags & NBT_PARSE_FLAG_NAMELESS_ROOT);
+  size_t payload = 1;
+  uint32_t name_size = 0;
+
+  if (root_name && nbt__scan_length(buffer, size, &payload, 1, search.format, &name_size) != NBT__SCAN_DONE) {
+    return 0;
+  }
 
-  int compressed;
-  int gzip_format;
+  nbt__path_search(&search, 0, 0, payload + name_size, buffer[0], root_name, NBT_NO_OVERRIDE);
 
-  switch (write_flags & 3) {
-    case 1: { // gzip
-      compressed = 1;
-      gzip_format = 1;
-      break;
-    }
-    case 2: { // zlib
-      compressed = 1;
-      gzip_format = 0;
-      break;
-    }
-    case 3: { // raw
-      compressed = 0;
-      gzip_format = 0;
-      break;
+  if (search.error) {
+    // Give back nothing rather than a partial set of results.
+    for (size_t i = 0; i < search.count; i++) {
+      nbt_free_tag(results[i]);
     }
+    return 0;
   }
 
-  nbt__write_stream_t write_stream;
-  write_stream.buffer = (uint8_t*)NBT_MALLOC(NBT_BUFFER_SIZE);
-  write_stream.offset = 0;
-  write_stream.size = 0;
-  write_stream.alloc_size = NBT_BUFFER_SIZE;
-
-  nbt__write_tag(&write_stream, tag, 1, 1);
-
-  if (compressed) {
-
-    z_stream stream;
-    stream.zalloc = Z_NULL;
-    stream.zfree = Z_NULL;
-    stream.opaque = Z_NULL;
+  *count = search.count;
+  return 1;
 
-    int window_bits = gzip_format ? -Z_DEFAULT_WINDOW_BITS : Z_DEFAULT_WINDOW_BITS;
+}
 
-    if (deflateInit2(&stream, NBT_COMPRESSION_LEVEL, Z_DEFLATED, window_bits, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-      NBT_FREE(write_stream.buffer);
-      return;
-    }
+static size_t nbt__path_get_memory_ex(nbt_context_t* context, nbt_path_t* path, const void* data, size_t size, int parse_flags, nbt_tag_t** results, size_t max_results) {
 
-    if (gzip_format) {
-      uint8_t header[10] = { 31, 139, 8, 0, 0, 0, 0, 0, 2, 255 };
-      writer.write(writer.userdata, header, 10);
-    }
+  size_t buffer_size;
+  const uint8_t* buffer = nbt__memory_inflate(context, data, size, parse_flags, &buffer_size);
+  if (!buffer) {
+    return 0;
+  }
 
-    uint8_t in_buffer[NBT_BUFFER_SIZE];
-    uint8_t out_buffer[NBT_BUFFER_SIZE];
-    int flush;
-    uint32_t crc = 0;
+  size_t count;
+  nbt__path_search_buffer(path, buffer, buffer_size, parse_flags, results, max_results, &count);
 
-    write_stream.offset = 0;
+  return count;
 
-    do {
+}
 
-      flush = Z_NO_FLUSH;
-      size_t bytes_read = 0;
-      for (size_t i = 0; i < NBT_BUFFER_SIZE; i++) {
+size_t nbt_path_get_memory_ex(nbt_context_t* context, nbt_path_t* path, const void* data, size_t size, int parse_flags, nbt_tag_t** results, size_t max_results) {
 
-        in_buffer[i] = write_stream.buffer[write_stream.offset++];
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
 
-        bytes_read++;
+  size_t count = nbt__path_get_memory_ex(context, path, data, size, parse_flags, results, max_results);
 
-        if (write_stream.offset >= write_stream.size) {
-          flush = Z_FINISH;
-          break;
-        }
+  nbt__call_end(&mark, context, "nbt_path_get_memory");
 
-      }
+  return count;
 
-      stream.avail_in = bytes_read;
-      stream.next_in = in_buffer;
+}
 
-      do {
-        stream.avail_out = NBT_BUFFER_SIZE;
-        stream.next_out = out_buffer;
+size_t nbt_path_get_memory(nbt_path_t* path, const void* data, size_t size, int parse_flags, nbt_tag_t** results, size_t max_results) {
 
-        deflate(&stream, flush);
+  nbt_context_t* context = nbt_new_context();
 
-        size_t have = NBT_BUFFER_SIZE - stream.avail_out;
-        writer.write(writer.userdata, out_buffer, have);
+  size_t count = nbt_path_get_memory_ex(context, path, data, size, parse_flags, results, max_results);
 
-        crc = nbt__update_crc(crc, out_buffer, have);
+  nbt_free_context(context);
 
-      } while (stream.avail_out == 0);
+  return count;
 
-    } while (flush != Z_FINISH);
+}
 
-    deflateEnd(&stream);
+typedef struct {
+  nbt_column_t column;
+  nbt_path_t* path;
+  size_t value_size; // Size of each value, or 1 for strings.
+  size_t values_alloc_size; // In values, so in characters for strings.
+} nbt__column_t;
+
+struct nbt_columns_t {
+  nbt__column_t* columns;
+  size_t size;
+  size_t rows;
+  size_t rows_alloc_size;
+};
 
-    if (gzip_format) {
-      writer.write(writer.userdata, (uint8_t*)&crc, 4);
-      writer.write(writer.userdata, (uint8_t*)&write_stream.size, 4);
-    }
+static size_t nbt__column_value_size(nbt_tag_type_t type) {
+  switch (type) {
+    case NBT_TYPE_BYTE: return 1;
+    case NBT_TYPE_SHORT: return 2;
+    case NBT_TYPE_INT: return 4;
+    case NBT_TYPE_LONG: return 8;
+    case NBT_TYPE_FLOAT: return 4;
+    case NBT_TYPE_DOUBLE: return 8;
+    case NBT_TYPE_STRING: return 1;
+    default: return 0;
+  }
+}
 
+// Resizes the arrays of a column to hold the given number of rows.
+static void nbt__column_resize(nbt__column_t* column, size_t rows) {
+  nbt_column_t* view = &column->column;
+  view->validity = (uint8_t*)nbt__realloc(view->validity, (rows + 7) / 8);
+  if (view->type == NBT_TYPE_STRING) {
+    view->offsets = (size_t*)nbt__realloc(view->offsets, (rows + 1) * sizeof(size_t));
   } else {
-    size_t bytes_left = write_stream.size;
-    size_t offset = 0;
-    while (bytes_left > 0) {
-      size_t bytes_written = writer.write(writer.userdata, write_stream.buffer + offset, bytes_left);
-      offset += bytes_written;
-      bytes_left -= bytes_written;
-    }
+    view->values = nbt__realloc(view->values, rows * column->value_size);
+    column->values_alloc_size = rows;
   }
+}
 
-  NBT_FREE(write_stream.buffer);
+nbt_columns_t* nbt_new_columns(void) {
 
-}
+  nbt_columns_t* columns = (nbt_columns_t*)nbt__malloc(sizeof(nbt_columns_t));
 
-static nbt_tag_t* nbt__new_tag_base(void) {
-  nbt_tag_t* tag = (nbt_tag_t*)NBT_MALLOC(sizeof(nbt_tag_t));
-  tag->name = NULL;
-  tag->name_size = 0;
+  columns->columns = NULL;
+  columns->size = 0;
+  columns->rows = 0;
+  columns->rows_alloc_size = 0;
+
+  return columns;
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_byte(int8_t value) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+void nbt_free_columns(nbt_columns_t* columns) {
 
-  tag->type = NBT_TYPE_BYTE;
-  tag->tag_byte.value = value;
+  for (size_t i = 0; i < columns->size; i++) {
+    nbt__column_t* column = &columns->columns[i];
+    nbt_free_path(column->path);
+    nbt__free(column->column.path);
+    nbt__free(column->column.values);
+    nbt__free(column->column.offsets);
+    nbt__free(column->column.validity);
+  }
+
+  nbt__free(columns->columns);
+  nbt__free(columns);
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_short(int16_t value) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+int nbt_columns_add(nbt_columns_t* columns, const char* path, nbt_tag_type_t type) {
 
-  tag->type = NBT_TYPE_SHORT;
-  tag->tag_short.value = value;
+  size_t value_size = nbt__column_value_size(type);
+  if (value_size == 0 || columns->rows > 0) {
+    return -1;
+  }
 
-  return tag;
-}
+  nbt_path_t* compiled_path = nbt_path_compile(path);
+  if (!compiled_path) {
+    return -1;
+  }
 
-nbt_tag_t* nbt_new_tag_int(int32_t value) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+  columns->columns = (nbt__column_t*)nbt__realloc(columns->columns, (columns->size + 1) * sizeof(nbt__column_t));
+  nbt__column_t* column = &columns->columns[columns->size];
 
-  tag->type = NBT_TYPE_INT;
-  tag->tag_int.value = value;
+  size_t path_size = 0;
+  while (path[path_size]) {
+    path_size++;
+  }
 
-  return tag;
-}
+  column->column.path = (char*)nbt__malloc(path_size + 1);
+  NBT_MEMCPY(column->column.path, path, path_size + 1);
+  column->column.type = type;
+  column->column.values = NULL;
+  column->column.offsets = NULL;
+  column->column.validity = NULL;
+  column->column.size = 0;
+  column->path = compiled_path;
+  column->value_size = value_size;
+  column->values_alloc_size = 0;
+
+  // The column may be added after rows have been cleared, in which case the other columns already have room.
+  nbt__column_resize(column, columns->rows_alloc_size);
+  if (type == NBT_TYPE_STRING) {
+    column->column.offsets[0] = 0;
+  }
 
-nbt_tag_t* nbt_new_tag_long(int64_t value) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+  return (int)columns->size++;
 
-  tag->type = NBT_TYPE_LONG;
-  tag->tag_long.value = value;
+}
 
-  return tag;
+nbt_column_t* nbt_columns_get(nbt_columns_t* columns, size_t index) {
+  return &columns->columns[index].column;
 }
 
-nbt_tag_t* nbt_new_tag_float(float value) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+void nbt_columns_clear(nbt_columns_t* columns) {
 
-  tag->type = NBT_TYPE_FLOAT;
-  tag->tag_float.value = value;
+  for (size_t i = 0; i < columns->size; i++) {
+    columns->columns[i].column.size = 0;
+  }
+
+  columns->rows = 0;
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_double(double value) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+// Makes room for another row in every column.
+static void nbt__columns_reserve_row(nbt_columns_t* columns) {
 
-  tag->type = NBT_TYPE_DOUBLE;
-  tag->tag_double.value = value;
+  if (columns->rows < columns->rows_alloc_size) {
+    return;
+  }
+
+  columns->rows_alloc_size = columns->rows_alloc_size ? columns->rows_alloc_size * 2 : 1024;
+
+  for (size_t i = 0; i < columns->size; i++) {
+    nbt__column_resize(&columns->columns[i], columns->rows_alloc_size);
+  }
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_byte_array(int8_t* value, size_t size) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+// Stores the value of tag (which may be NULL) in the given row. Numbers are converted to the type of the column, and
+// anything else which doesn't match it becomes null.
+static void nbt__column_set(nbt__column_t* column, size_t row, nbt_tag_t* tag) {
+
+  nbt_column_t* view = &column->column;
+  int valid = tag != NULL;
+  int64_t integer = 0;
+  double real = 0;
+
+  if (tag) {
+    switch (tag->type) {
+      case NBT_TYPE_BYTE: integer = tag->tag_byte.value; real = (double)integer; break;
+      case NBT_TYPE_SHORT: integer = tag->tag_short.value; real = (double)integer; break;
+      case NBT_TYPE_INT: integer = tag->tag_int.value; real = (double)integer; break;
+      case NBT_TYPE_LONG: integer = tag->tag_long.value; real = (double)integer; break;
+      case NBT_TYPE_FLOAT: real = tag->tag_float.value; break;
+      case NBT_TYPE_DOUBLE: real = tag->tag_double.value; break;
+      case NBT_TYPE_STRING: valid = view->type == NBT_TYPE_STRING; break;
+      default: valid = 0; break;
+    }
+    if (view->type == NBT_TYPE_STRING && tag->type != NBT_TYPE_STRING) {
+      valid = 0;
+    }
+    if (tag->type == NBT_TYPE_FLOAT || tag->type == NBT_TYPE_DOUBLE) {
+      // Converting a floating-point value which is out of range (or NaN) to an integer type is undefined, so those are
+      // stored without a value. The comparisons are false for NaN.
+      double min = 0;
+      double max = 0;
+      switch (view->type) {
+        case NBT_TYPE_BYTE: min = -129.0; max = 128.0; break;
+        case NBT_TYPE_SHORT: min = -32769.0; max = 32768.0; break;
+        case NBT_TYPE_INT: min = -2147483649.0; max = 2147483648.0; break;
+        case NBT_TYPE_LONG: min = -9223372036854777856.0; max = 9223372036854775808.0; break;
+        default: break;
+      }
+      if (max != 0) {
+        if (real > min && real < max) {
+          integer = (int64_t)real;
+        } else {
+          valid = 0;
+        }
+      }
+    }
+  }
 
-  tag->type = NBT_TYPE_BYTE_ARRAY;
-  tag->tag_byte_array.size = size;
-  tag->tag_byte_array.value = (int8_t*)NBT_MALLOC(size);
+  if (valid) {
+    view->validity[row / 8] |= (uint8_t)(1 << (row % 8));
+  } else {
+    view->validity[row / 8] &= (uint8_t)~(1 << (row % 8));
+  }
 
-  NBT_MEMCPY(tag->tag_byte_array.value, value, size);
+  switch (view->type) {
+    case NBT_TYPE_BYTE: ((int8_t*)view->values)[row] = (int8_t)integer; break;
+    case NBT_TYPE_SHORT: ((int16_t*)view->values)[row] = (int16_t)integer; break;
+    case NBT_TYPE_INT: ((int32_t*)view->values)[row] = (int32_t)integer; break;
+    case NBT_TYPE_LONG: ((int64_t*)view->values)[row] = integer; break;
+    case NBT_TYPE_FLOAT: ((float*)view->values)[row] = (float)real; break;
+    case NBT_TYPE_DOUBLE: ((double*)view->values)[row] = real; break;
+    case NBT_TYPE_STRING: {
+      // All of the strings are stored one after the other, so the new one goes at the end.
+      size_t offset = view->offsets[row];
+      size_t size = valid ? tag->tag_string.size : 0;
+      if (offset + size > column->values_alloc_size) {
+        size_t alloc_size = column->values_alloc_size ? column->values_alloc_size * 2 : NBT_BUFFER_SIZE;
+        while (alloc_size < offset + size) {
+          alloc_size *= 2;
+        }
+        view->values = nbt__realloc(view->values, alloc_size);
+        column->values_alloc_size = alloc_size;
+      }
+      if (size > 0) {
+        NBT_MEMCPY((char*)view->values + offset, tag->tag_string.value, size);
+      }
+      view->offsets[row + 1] = offset + size;
+      break;
+    }
+    default: {
+      break;
+    }
+  }
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_string(const char* value, size_t size) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+// Counts the row which has been filled in.
+static void nbt__columns_finish_row(nbt_columns_t* columns) {
+  columns->rows++;
+  for (size_t i = 0; i < columns->size; i++) {
+    columns->columns[i].column.size = columns->rows;
+  }
+}
 
-  tag->type = NBT_TYPE_STRING;
-  tag->tag_string.size = size;
-  tag->tag_string.value = (char*)NBT_MALLOC(size + 1);
+void nbt_columns_append(nbt_columns_t* columns, nbt_tag_t* tag) {
 
-  NBT_MEMCPY(tag->tag_string.value, value, size);
-  tag->tag_string.value[tag->tag_string.size] = '\0';
+  nbt__columns_reserve_row(columns);
+
+  for (size_t i = 0; i < columns->size; i++) {
+    nbt_tag_t* result = NULL;
+    nbt_path_get(columns->columns[i].path, tag, &result, 1);
+    nbt__column_set(&columns->columns[i], columns->rows, result);
+  }
+
+  nbt__columns_finish_row(columns);
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_list(nbt_tag_type_t type) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+static int nbt__columns_append_memory_ex(nbt_context_t* context, nbt_columns_t* columns, const void* data, size_t size, int parse_flags) {
 
-  tag->type = NBT_TYPE_LIST;
-  tag->tag_list.type = type;
-  tag->tag_list.size = 0;
-  tag->tag_list.value = NULL;
+  size_t buffer_size;
+  const uint8_t* buffer = nbt__memory_inflate(context, data, size, parse_flags, &buffer_size);
+  if (!buffer) {
+    return 0;
+  }
 
-  return tag;
-}
+  nbt__columns_reserve_row(columns);
 
-nbt_tag_t* nbt_new_tag_compound(void) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+  // The row isn't counted until every column has been filled in, so nothing needs undoing if the data is invalid.
+  for (size_t i = 0; i < columns->size; i++) {
+    nbt_tag_t* result = NULL;
+    size_t count;
+    if (!nbt__path_search_buffer(columns->columns[i].path, buffer, buffer_size, parse_flags, &result, 1, &count)) {
+      return 0;
+    }
+    nbt__column_set(&columns->columns[i], columns->rows, count > 0 ? result : NULL);
+    if (count > 0) {
+      nbt_free_tag(result);
+    }
+  }
 
-  tag->type = NBT_TYPE_COMPOUND;
-  tag->tag_compound.size = 0;
-  tag->tag_compound.value = NULL;
+  nbt__columns_finish_row(columns);
+
+  return 1;
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_int_array(int32_t* value, size_t size) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+int nbt_columns_append_memory_ex(nbt_context_t* context, nbt_columns_t* columns, const void* data, size_t size, int parse_flags) {
 
-  tag->type = NBT_TYPE_INT_ARRAY;
-  tag->tag_int_array.size = size;
-  tag->tag_int_array.value = (int32_t*)NBT_MALLOC(size * sizeof(int32_t));
+  nbt__call_mark_t mark;
+  nbt__call_begin(&mark);
 
-  NBT_MEMCPY(tag->tag_int_array.value, value, size * sizeof(int32_t));
+  int success = nbt__columns_append_memory_ex(context, columns, data, size, parse_flags);
+
+  nbt__call_end(&mark, context, "nbt_columns_append_memory");
+
+  return success;
 
-  return tag;
 }
 
-nbt_tag_t* nbt_new_tag_long_array(int64_t* value, size_t size) {
-  nbt_tag_t* tag = nbt__new_tag_base();
+int nbt_columns_append_memory(nbt_columns_t* columns, const void* data, size_t size, int parse_flags) {
 
-  tag->type = NBT_TYPE_LONG_ARRAY;
-  tag->tag_long_array.size = size;
-  tag->tag_long_array.value = (int64_t*)NBT_MALLOC(size * sizeof(int64_t));
+  nbt_context_t* context = nbt_new_context();
 
-  NBT_MEMCPY(tag->tag_long_array.value, value, size * sizeof(int64_t));
+  int success = nbt_columns_append_memory_ex(context, columns, data, size, parse_flags);
 
-  return tag;
-}
+  nbt_free_context(context);
 
-void nbt_set_tag_name(nbt_tag_t* tag, const char* name, size_t size) {
-  if (tag->name) {
-    NBT_FREE(tag->name);
-  }
-  tag->name_size = size;
-  tag->name = (char*)NBT_MALLOC(size + 1);
-  NBT_MEMCPY(tag->name, name, size);
-  tag->name[tag->name_size] = '\0';
-}
+  return success;
 
-void nbt_tag_list_append(nbt_tag_t* list, nbt_tag_t* value) {
-  list->tag_list.value = NBT_REALLOC(list->tag_list.value, (list->tag_list.size + 1) * sizeof(nbt_tag_t*)) ;
-  list->tag_list.value[list->tag_list.size] = value;
-  list->tag_list.size++;
 }
 
-nbt_tag_t* nbt_tag_list_get(nbt_tag_t* tag, size_t index) {
-  return tag->tag_list.value[index];
+// Writes a CSV field in quotes, doubling any quotes inside it.
+static void nbt__text_put_csv_string(nbt__text_stream_t* stream, const char* value, size_t size) {
+  nbt__text_put_char(stream, '"');
+  size_t start = 0;
+  for (size_t i = 0; i < size; i++) {
+    if (value[i] == '"') {
+      nbt__text_put(stream, value + start, i + 1 - start);
+      start = i;
+    }
+  }
+  nbt__text_put(stream, value + start, size - start);
+  nbt__text_put_char(stream, '"');
 }
 
-void nbt_tag_compound_append(nbt_tag_t* compound, nbt_tag_t* value) {
-  compound->tag_compound.value = NBT_REALLOC(compound->tag_compound.value, (compound->tag_compound.size + 1) * sizeof(nbt_tag_t*));
-  compound->tag_compound.value[compound->tag_compound.size] = value;
-  compound->tag_compound.size++;
+// Writes a CSV number. Unlike in JSON, NaN and infinities can be written out.
+static void nbt__text_put_csv_double(nbt__text_stream_t* stream, double value, int is_float) {
+  if (value != value) {
+    nbt__text_put(stream, "NaN", 3);
+  } else if (value - value != 0) {
+    nbt__text_put(stream, value > 0 ? "Infinity" : "-Infinity", value > 0 ? 8 : 9);
+  } else {
+    nbt__text_put_double(stream, value, is_float);
+  }
 }
 
-nbt_tag_t* nbt_tag_compound_get(nbt_tag_t* tag, const char* key) {
-  for (size_t i = 0; i < tag->tag_compound.size; i++) {
-    nbt_tag_t* compare_tag = tag->tag_compound.value[i];
+void nbt_columns_write_csv(nbt_columns_t* columns, nbt_writer_t writer) {
 
-    if (NBT_MEMCMP(compare_tag->name, key, compare_tag->name_size) == 0) {
-      return compare_tag;
+  nbt__text_stream_t stream;
+  stream.writer = writer;
+  stream.buffer = (char*)nbt__malloc(NBT_BUFFER_SIZE);
+  stream.size = 0;
+  stream.json = 1; // No type suffixes on numbers.
+
+  for (size_t i = 0; i < columns->size; i++) {
+    const char* path = columns->columns[i].column.path;
+    size_t path_size = 0;
+    while (path[path_size]) {
+      path_size++;
+    }
+    if (i > 0) {
+      nbt__text_put_char(&stream, ',');
     }
+    nbt__text_put_csv_string(&stream, path, path_size);
+  }
+  nbt__text_put(&stream, "\r\n", 2);
+
+  // Null values are left empty.
+  for (size_t row = 0; row < columns->rows; row++) {
+    for (size_t i = 0; i < columns->size; i++) {
+      nbt_column_t* column = &columns->columns[i].column;
+      if (i > 0) {
+        nbt__text_put_char(&stream, ',');
+      }
+      if (!(column->validity[row / 8] & (1 << (row % 8)))) {
+        continue;
+      }
+      switch (column->type) {
+        case NBT_TYPE_BYTE: nbt__text_put_integer(&stream, ((int8_t*)column->values)[row], 0); break;
+        case NBT_TYPE_SHORT: nbt__text_put_integer(&stream, ((int16_t*)column->values)[row], 0); break;
+        case NBT_TYPE_INT: nbt__text_put_integer(&stream, ((int32_t*)column->values)[row], 0); break;
+        case NBT_TYPE_LONG: nbt__text_put_integer(&stream, ((int64_t*)column->values)[row], 0); break;
+        case NBT_TYPE_FLOAT: nbt__text_put_csv_double(&stream, ((float*)column->values)[row], 1); break;
+        case NBT_TYPE_DOUBLE: nbt__text_put_csv_double(&stream, ((double*)column->values)[row], 0); break;
+        case NBT_TYPE_STRING: {
+          nbt__text_put_csv_string(&stream, (char*)column->values + column->offsets[row], column->offsets[row + 1] - column->offsets[row]);
+          break;
+        }
+        default: {
+          break;
+        }
+      }
+    }
+    nbt__text_put(&stream, "\r\n", 2);
   }
 
-  return NULL;
+  nbt__text_flush(&stream);
+  nbt__free(stream.buffer);
+
 }
 
-void nbt_free_tag(nbt_tag_t* tag) {
-  switch (tag->type) {
-    case NBT_TYPE_BYTE_ARRAY: {
-      NBT_FREE(tag->tag_byte_array.value);
-      break;
-    }
-    case NBT_TYPE_STRING: {
-      NBT_FREE(tag->tag_string.value);
-      break;
+// Writes a little-endian integer of the given size for nbt_columns_write_binary.
+static void nbt__text_put_uint(nbt__text_stream_t* stream, uint64_t value, size_t size) {
+  uint8_t data[8];
+  for (size_t i = 0; i < size; i++) {
+    data[i] = (uint8_t)(value >> (8 * i));
+  }
+  nbt__text_put(stream, (const char*)data, size);
+}
+
+void nbt_columns_write_binary(nbt_columns_t* columns, nbt_writer_t writer) {
+
+  nbt__text_stream_t stream;
+  stream.writer = writer;
+  stream.buffer = (char*)nbt__malloc(NBT_BUFFER_SIZE);
+  stream.size = 0;
+  stream.json = 1;
+
+  size_t rows = columns->rows;
+
+  nbt__text_put(&stream, "NBTC", 4);
+  nbt__text_put_uint(&stream, 1, 4); // Version.
+  nbt__text_put_uint(&stream, columns->size, 4);
+  nbt__text_put_uint(&stream, rows, 8);
+
+  for (size_t i = 0; i < columns->size; i++) {
+    nbt__column_t* column = &columns->columns[i];
+    nbt_column_t* view = &column->column;
+
+    size_t path_size = 0;
+    while (view->path[path_size]) {
+      path_size++;
     }
-    case NBT_TYPE_LIST: {
-      for (size_t i = 0; i < tag->tag_list.size; i++) {
-        nbt_free_tag(tag->tag_list.value[i]);
+
+    nbt__text_put_uint(&stream, view->type, 1);
+    nbt__text_put_uint(&stream, path_size, 4);
+    nbt__text_put(&stream, view->path, path_size);
+
+    if (rows > 0) {
+      // Clear the unused bits at the end of the bitmap.
+      if (rows % 8) {
+        view->validity[rows / 8] &= (uint8_t)((1 << (rows % 8)) - 1);
       }
-      NBT_FREE(tag->tag_list.value);
-      break;
+      nbt__text_put(&stream, (const char*)view->validity, (rows + 7) / 8);
     }
-    case NBT_TYPE_COMPOUND: {
-      for (size_t i = 0; i < tag->tag_compound.size; i++) {
-        nbt_free_tag(tag->tag_compound.value[i]);
+
+    if (view->type == NBT_TYPE_STRING) {
+      for (size_t row = 0; row <= rows; row++) {
+        nbt__text_put_uint(&stream, view->offsets[row], 8);
       }
-      NBT_FREE(tag->tag_compound.value);
-      break;
-    }
-    case NBT_TYPE_INT_ARRAY: {
-      NBT_FREE(tag->tag_int_array.value);
-      break;
-    }
-    case NBT_TYPE_LONG_ARRAY: {
-      NBT_FREE(tag->tag_long_array.value);
-      break;
+      nbt__text_put(&stream, (const char*)view->values, view->offsets[rows]);
+      continue;
     }
-    default: {
-      break;
+
+#ifdef NBT__LITTLE_ENDIAN_HOST
+    nbt__text_put(&stream, (const char*)view->values, rows * column->value_size);
+#else
+    for (size_t row = 0; row < rows; row++) {
+      const uint8_t* value = (const uint8_t*)view->values + row * column->value_size;
+      for (size_t j = column->value_size; j > 0; j--) {
+        nbt__text_put_char(&stream, (char)value[j - 1]);
+      }
     }
+#endif
   }
 
-  if (tag->name) {
-    NBT_FREE(tag->name);
-  }
+  nbt__text_flush(&stream);
+  nbt__free(stream.buffer);
 
-  NBT_FREE(tag);
 }
 
 #endif
@@ -2,10 +2,6 @@
 #define NBT_IMPLEMENTATION
 #include "nbt.h"
 
-static size_t reader_read(void* userdata, uint8_t* data, size_t size) {
-  return fread(data, 1, size, userdata);
-}
-
 static size_t writer_write(void* userdata, uint8_t* data, size_t size) {
   return fwrite(data, 1, size, userdata);
 }
@@ -98,22 +94,6 @@ static void print_nbt_tree(nbt_tag_t* tag, int indentation) {
   printf("\n");
 }
 
-nbt_tag_t* read_nbt_file(const char* name, int flags) {
-
-  FILE* file = fopen(name, "rb");
-
-  nbt_reader_t reader;
-
-  reader.read = reader_read;
-  reader.userdata = file;
-
-  nbt_tag_t* tag = nbt_parse(reader, flags);
-
-  fclose(file);
-
-  return tag;
-}
-
 void write_nbt_file(const char* name, nbt_tag_t* tag, int flags) {
 
   FILE* file = fopen(name, "wb");
@@ -133,7 +113,7 @@ int main() {
   // Example 1: Loading an NBT file from disk.
   printf("Reading Example 1:\n");
 
-  nbt_tag_t* tag = read_nbt_file("bigtest_gzip.nbt", NBT_PARSE_FLAG_USE_GZIP);
+  nbt_tag_t* tag = nbt_parse_file("bigtest_gzip.nbt", NBT_PARSE_FLAG_USE_GZIP);
 
   print_nbt_tree(tag, 2);
 
@@ -162,7 +142,7 @@ int main() {
 
   write_nbt_file("write_test_raw.nbt", tag_level, NBT_WRITE_FLAG_USE_RAW);
 
-  nbt_tag_t* read_test_1 = read_nbt_file("write_test_raw.nbt", NBT_PARSE_FLAG_USE_RAW);
+  nbt_tag_t* read_test_1 = nbt_parse_file("write_test_raw.nbt", NBT_PARSE_FLAG_USE_RAW);
 
   print_nbt_tree(read_test_1, 2);
 
@@ -170,7 +150,7 @@ int main() {
 
   write_nbt_file("write_test_zlib.nbt", tag_level, NBT_WRITE_FLAG_USE_ZLIB);
 
-  nbt_tag_t* read_test_2 = read_nbt_file("write_test_zlib.nbt", NBT_PARSE_FLAG_USE_ZLIB);
+  nbt_tag_t* read_test_2 = nbt_parse_file("write_test_zlib.nbt", NBT_PARSE_FLAG_USE_ZLIB);
 
   print_nbt_tree(read_test_2, 2);
 
@@ -178,7 +158,7 @@ int main() {
 
   write_nbt_file("write_test_gzip.nbt", tag_level, NBT_WRITE_FLAG_USE_GZIP);
 
-  nbt_tag_t* read_test_3 = read_nbt_file("write_test_gzip.nbt", NBT_PARSE_FLAG_USE_GZIP);
+  nbt_tag_t* read_test_3 = nbt_parse_file("write_test_gzip.nbt", NBT_PARSE_FLAG_USE_GZIP);
 
   print_nbt_tree(read_test_3, 2);
 
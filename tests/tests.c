@@ -0,0 +1,1659 @@
+// Behavioural checks for libnbt. Run using `make check` from the repository root. Each failed check is printed, and the
+// exit status is non-zero if there were any.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+#define NBT_THREADS
+#define NBT_IMPLEMENTATION
+#include "../nbt.h"
+
+static int checks;
+static int failures;
+
+#define CHECK(condition) check((condition) != 0, #condition, __LINE__)
+
+static void check(int passed, const char* condition, int line) {
+  checks++;
+  if (!passed) {
+    failures++;
+    printf("tests.c:%d: check failed: %s\n", line, condition);
+  }
+}
+
+typedef struct {
+  uint8_t* data;
+  size_t size;
+  size_t offset; // Where reading has got to.
+  size_t limit; // The most bytes to accept per call, or 0 for no limit.
+} buffer_t;
+
+static size_t buffer_write(void* userdata, uint8_t* data, size_t size) {
+  buffer_t* buffer = (buffer_t*)userdata;
+  if (buffer->limit && size > buffer->limit) {
+    size = buffer->limit;
+  }
+  buffer->data = (uint8_t*)realloc(buffer->data, buffer->size + size + 1);
+  memcpy(buffer->data + buffer->size, data, size);
+  buffer->size += size;
+  buffer->data[buffer->size] = '\0'; // So that text output can be compared as a string.
+  return size;
+}
+
+static size_t buffer_read(void* userdata, uint8_t* data, size_t size) {
+  buffer_t* buffer = (buffer_t*)userdata;
+  size_t available = buffer->size - buffer->offset;
+  size_t read = size < available ? size : available;
+  memcpy(data, buffer->data + buffer->offset, read);
+  buffer->offset += read;
+  return read;
+}
+
+// A writer which stops accepting data after a given number of bytes.
+typedef struct {
+  size_t capacity;
+  size_t size;
+  int calls_after_full;
+} full_writer_t;
+
+static size_t full_write(void* userdata, uint8_t* data, size_t size) {
+  full_writer_t* writer = (full_writer_t*)userdata;
+  (void)data;
+  if (writer->size == writer->capacity) {
+    writer->calls_after_full++;
+    return 0;
+  }
+  size_t written = size < writer->capacity - writer->size ? size : writer->capacity - writer->size;
+  writer->size += written;
+  return written;
+}
+
+static uint8_t* read_file(const char* path, size_t* size) {
+  FILE* file = fopen(path, "rb");
+  if (!file) {
+    printf("can't open %s (run from the repository root)\n", path);
+    exit(1);
+  }
+  fseek(file, 0, SEEK_END);
+  *size = (size_t)ftell(file);
+  fseek(file, 0, SEEK_SET);
+  uint8_t* data = (uint8_t*)malloc(*size);
+  if (fread(data, 1, *size, file) != *size) {
+    *size = 0;
+  }
+  fclose(file);
+  return data;
+}
+
+// Compares two trees by their uncompressed Java Edition serialization, which covers every value and name.
+static int same_tree(nbt_tag_t* a, nbt_tag_t* b, int compare_root_name) {
+  int flags = NBT_WRITE_FLAG_USE_RAW | (compare_root_name ? 0 : NBT_WRITE_FLAG_NAMELESS_ROOT);
+  size_t a_size;
+  size_t b_size;
+  uint8_t* a_data = nbt_write_memory(a, flags, &a_size);
+  uint8_t* b_data = nbt_write_memory(b, flags, &b_size);
+  int same = a_data && b_data && a_size == b_size && memcmp(a_data, b_data, a_size) == 0;
+  nbt_free(a_data);
+  nbt_free(b_data);
+  return same;
+}
+
+static nbt_tag_t* named(nbt_tag_t* tag, const char* name) {
+  nbt_set_tag_name(tag, name, strlen(name));
+  return tag;
+}
+
+// A document big enough to be split up by NBT_WRITE_FLAG_PARALLEL, with a mix of every type.
+static nbt_tag_t* make_large_document(void) {
+
+  nbt_tag_t* root = named(nbt_new_tag_compound(), "large");
+  nbt_tag_t* entities = named(nbt_new_tag_list(NBT_TYPE_COMPOUND), "Entities");
+
+  for (int i = 0; i < 4000; i++) {
+    nbt_tag_t* entity = nbt_new_tag_compound();
+    char id[32];
+    snprintf(id, sizeof(id), "minecraft:mob_%d", i % 37);
+    int32_t uuid[4] = { i, i * 7, i * 13, -i };
+    int64_t longs[3] = { (int64_t)i << 40, -i, 12345 };
+    int8_t bytes[5] = { 1, 2, 3, (int8_t)i, -1 };
+    nbt_tag_t* position = named(nbt_new_tag_list(NBT_TYPE_DOUBLE), "Pos");
+    nbt_tag_list_append(position, nbt_new_tag_double(i * 0.5));
+    nbt_tag_list_append(position, nbt_new_tag_double(64.0));
+    nbt_tag_list_append(position, nbt_new_tag_double(-i / 3.0));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_string(id, strlen(id)), "id"));
+    nbt_tag_compound_append(entity, position);
+    nbt_tag_compound_append(entity, named(nbt_new_tag_int_array(uuid, 4), "UUID"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_long_array(longs, 3), "Longs"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_byte_array(bytes, 5), "Bytes"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_float(i / 7.0f), "Health"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_short((int16_t)i), "Air"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_byte((int8_t)(i & 1)), "OnGround"));
+    nbt_tag_compound_append(entity, named(nbt_new_tag_long((int64_t)i * 1000003), "Seed"));
+    nbt_tag_list_append(entities, entity);
+  }
+
+  nbt_tag_compound_append(root, entities);
+  nbt_tag_compound_append(root, named(nbt_new_tag_list(NBT_TYPE_END), "Empty"));
+  return root;
+
+}
+
+// Output compressed on several threads reads back the same as output compressed on one.
+static void test_parallel(nbt_tag_t* tag) {
+
+  const int compressions[2][2] = {
+    { NBT_WRITE_FLAG_USE_GZIP, NBT_PARSE_FLAG_USE_GZIP },
+    { NBT_WRITE_FLAG_USE_ZLIB, NBT_PARSE_FLAG_USE_ZLIB }
+  };
+
+  size_t raw_size;
+  uint8_t* raw = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_RAW, &raw_size);
+  CHECK(raw_size > 4 * NBT_PARALLEL_BLOCK_SIZE);
+
+  for (int c = 0; c < 2; c++) {
+
+    buffer_t serial = { NULL, 0, 0, 0 };
+    buffer_t parallel = { NULL, 0, 0, 0 };
+    nbt_writer_t serial_writer = { buffer_write, &serial };
+    nbt_writer_t parallel_writer = { buffer_write, &parallel };
+    nbt_write(serial_writer, tag, compressions[c][0]);
+    nbt_write(parallel_writer, tag, compressions[c][0] | NBT_WRITE_FLAG_PARALLEL);
+
+    // Priming each block with the one before keeps the output close to the size of a single stream.
+    CHECK(parallel.size > 0 && parallel.size < serial.size + serial.size / 100);
+
+    nbt_tag_t* parsed = nbt_parse_memory(parallel.data, parallel.size, compressions[c][1]);
+    CHECK(parsed && same_tree(tag, parsed, 1));
+    if (parsed) {
+      nbt_free_tag(parsed);
+    }
+
+    // The stream is checked when it is read through a reader too, including the trailer.
+    nbt_reader_t reader = { buffer_read, &parallel };
+    parsed = nbt_parse(reader, compressions[c][1]);
+    CHECK(parsed && same_tree(tag, parsed, 1));
+    if (parsed) {
+      nbt_free_tag(parsed);
+    }
+
+    if (c == 0 && parallel.size >= 8) {
+      uint8_t* trailer = parallel.data + parallel.size - 8;
+      uint32_t crc = (uint32_t)trailer[0] | (uint32_t)trailer[1] << 8 | (uint32_t)trailer[2] << 16 | (uint32_t)trailer[3] << 24;
+      uint32_t isize = (uint32_t)trailer[4] | (uint32_t)trailer[5] << 8 | (uint32_t)trailer[6] << 16 | (uint32_t)trailer[7] << 24;
+      CHECK(crc == (uint32_t)crc32(0, raw, raw_size));
+      CHECK(isize == (uint32_t)raw_size);
+    }
+
+    // Writers which take less than they are given get the rest in later calls.
+    buffer_t short_writes = { NULL, 0, 0, 1000 };
+    nbt_writer_t short_writer = { buffer_write, &short_writes };
+    nbt_write(short_writer, tag, compressions[c][0] | NBT_WRITE_FLAG_PARALLEL);
+    CHECK(short_writes.size == parallel.size && memcmp(short_writes.data, parallel.data, parallel.size) == 0);
+    free(short_writes.data);
+
+    // Nothing more is written once the writer fails.
+    full_writer_t full = { parallel.size / 2, 0, 0 };
+    nbt_writer_t failing_writer = { full_write, &full };
+    nbt_write(failing_writer, tag, compressions[c][0] | NBT_WRITE_FLAG_PARALLEL);
+    CHECK(full.size == full.capacity && full.calls_after_full == 1);
+
+    free(serial.data);
+    free(parallel.data);
+
+  }
+
+  nbt_free(raw);
+
+}
+
+// One context can be used for any number of calls, with any compression, including after a call which failed.
+static void test_contexts(nbt_tag_t* small, nbt_tag_t* large) {
+
+  const int compressions[3][2] = {
+    { NBT_WRITE_FLAG_USE_GZIP, NBT_PARSE_FLAG_USE_GZIP },
+    { NBT_WRITE_FLAG_USE_ZLIB, NBT_PARSE_FLAG_USE_ZLIB },
+    { NBT_WRITE_FLAG_USE_RAW, NBT_PARSE_FLAG_USE_RAW }
+  };
+
+  nbt_context_t* context = nbt_new_context();
+
+  for (int round = 0; round < 4; round++) {
+    for (int c = 0; c < 3; c++) {
+
+      nbt_tag_t* tag = (round + c) % 2 ? large : small;
+
+      buffer_t reused = { NULL, 0, 0, 0 };
+      buffer_t fresh = { NULL, 0, 0, 0 };
+      nbt_writer_t reused_writer = { buffer_write, &reused };
+      nbt_writer_t fresh_writer = { buffer_write, &fresh };
+      nbt_write_ex(context, reused_writer, tag, compressions[c][0]);
+      nbt_write(fresh_writer, tag, compressions[c][0]);
+      CHECK(reused.size == fresh.size && memcmp(reused.data, fresh.data, fresh.size) == 0);
+
+      if (round == 2) {
+        // Cut short, so that parsing fails part of the way through.
+        buffer_t truncated = { reused.data, reused.size / 2, 0, 0 };
+        nbt_reader_t truncated_reader = { buffer_read, &truncated };
+        CHECK(nbt_parse_ex(context, truncated_reader, compressions[c][1]) == NULL);
+      }
+
+      nbt_reader_t reader = { buffer_read, &reused };
+      nbt_tag_t* parsed = nbt_parse_ex(context, reader, compressions[c][1]);
+      CHECK(parsed && same_tree(tag, parsed, 1));
+      if (parsed) {
+        nbt_free_tag(parsed);
+      }
+
+      free(reused.data);
+      free(fresh.data);
+
+    }
+  }
+
+  nbt_free_context(context);
+
+}
+
+// Writes and parses every combination of compression, format and nameless root.
+static void test_round_trips(nbt_tag_t* tag) {
+
+  const int compressions[3][2] = {
+    { NBT_WRITE_FLAG_USE_GZIP, NBT_PARSE_FLAG_USE_GZIP },
+    { NBT_WRITE_FLAG_USE_ZLIB, NBT_PARSE_FLAG_USE_ZLIB },
+    { NBT_WRITE_FLAG_USE_RAW, NBT_PARSE_FLAG_USE_RAW }
+  };
+  const int formats[3][2] = {
+    { 0, 0 },
+    { NBT_WRITE_FLAG_BEDROCK, NBT_PARSE_FLAG_BEDROCK },
+    { NBT_WRITE_FLAG_BEDROCK_NETWORK, NBT_PARSE_FLAG_BEDROCK_NETWORK }
+  };
+  const int modes[3] = { 0, NBT_PARSE_FLAG_LAZY, NBT_PARSE_FLAG_PREALLOCATE };
+
+  for (int c = 0; c < 3; c++) {
+    for (int f = 0; f < 3; f++) {
+      for (int nameless = 0; nameless < 2; nameless++) {
+
+        int write_flags = compressions[c][0] | formats[f][0] | (nameless ? NBT_WRITE_FLAG_NAMELESS_ROOT : 0);
+        int parse_flags = compressions[c][1] | formats[f][1] | (nameless ? NBT_PARSE_FLAG_NAMELESS_ROOT : 0);
+
+        size_t size;
+        uint8_t* data = nbt_write_memory(tag, write_flags, &size);
+        CHECK(data != NULL);
+
+        for (int m = 0; m < 3; m++) {
+          nbt_tag_t* parsed = nbt_parse_memory(data, size, parse_flags | modes[m]);
+          CHECK(parsed != NULL);
+          if (!parsed) {
+            continue;
+          }
+
+          // A lazily parsed tree is written back out before anything in it is used, so its unparsed data is copied.
+          size_t rewritten_size;
+          uint8_t* rewritten = nbt_write_memory(parsed, write_flags, &rewritten_size);
+          CHECK(rewritten && rewritten_size == size && memcmp(rewritten, data, size) == 0);
+          nbt_free(rewritten);
+
+          CHECK(same_tree(tag, parsed, !nameless));
+          CHECK(!nameless || parsed->name_size == 0);
+          nbt_free_tag(parsed);
+        }
+
+        nbt_free(data);
+
+      }
+    }
+  }
+
+}
+
+// Each format lays out the same tag as the format's specification says.
+static void test_formats(void) {
+
+  nbt_tag_t* tag = named(nbt_new_tag_compound(), "r");
+  int32_t ints[2] = { -1, 300 };
+  nbt_tag_compound_append(tag, named(nbt_new_tag_int(-2), "i"));
+  nbt_tag_compound_append(tag, named(nbt_new_tag_short(0x1234), "s"));
+  nbt_tag_compound_append(tag, named(nbt_new_tag_int_array(ints, 2), "a"));
+
+  const uint8_t java[] = {
+    10, 0, 1, 'r',
+    3, 0, 1, 'i', 0xff, 0xff, 0xff, 0xfe,
+    2, 0, 1, 's', 0x12, 0x34,
+    11, 0, 1, 'a', 0, 0, 0, 2, 0xff, 0xff, 0xff, 0xff, 0, 0, 0x01, 0x2c,
+    0
+  };
+  const uint8_t bedrock[] = {
+    10, 1, 0, 'r',
+    3, 1, 0, 'i', 0xfe, 0xff, 0xff, 0xff,
+    2, 1, 0, 's', 0x34, 0x12,
+    11, 1, 0, 'a', 2, 0, 0, 0, 0xff, 0xff, 0xff, 0xff, 0x2c, 0x01, 0, 0,
+    0
+  };
+  // Lengths are varints, and ints are zigzag encoded varints.
+  const uint8_t network[] = {
+    10, 1, 'r',
+    3, 1, 'i', 3,
+    2, 1, 's', 0x34, 0x12,
+    11, 1, 'a', 4, 1, 0xd8, 0x04,
+    0
+  };
+
+  const uint8_t* expected[3] = { java, bedrock, network };
+  const size_t expected_sizes[3] = { sizeof(java), sizeof(bedrock), sizeof(network) };
+  const int write_flags[3] = { 0, NBT_WRITE_FLAG_BEDROCK, NBT_WRITE_FLAG_BEDROCK_NETWORK };
+
+  for (int f = 0; f < 3; f++) {
+    size_t size;
+    uint8_t* data = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_RAW | write_flags[f], &size);
+    CHECK(data && size == expected_sizes[f] && memcmp(data, expected[f], size) == 0);
+    nbt_free(data);
+  }
+
+  nbt_free_tag(tag);
+
+}
+
+// Every prefix of a document is rejected, rather than read past.
+static void test_truncation(const uint8_t* data, size_t size) {
+
+  int parse_failures = 0;
+  int compressed_failures = 0;
+  int path_failures = 0;
+  int validate_failures = 0;
+
+  // A path search stops once it has found what it is looking for, so it only needs the data up to there.
+  nbt_path_t* path = nbt_path_compile("'nested compound test'.egg.name");
+  size_t needed = 7;
+  while (needed < size && memcmp(data + needed - 7, "Eggbert", 7) != 0) {
+    needed++;
+  }
+
+  uLongf compressed_alloc_size = compressBound(size);
+  uint8_t* compressed = (uint8_t*)malloc(compressed_alloc_size);
+
+  for (size_t prefix = 0; prefix < size; prefix++) {
+    // Copied so that AddressSanitizer catches reads past the end.
+    uint8_t* copy = (uint8_t*)malloc(prefix ? prefix : 1);
+    memcpy(copy, data, prefix);
+
+    nbt_scan_stats_t scan;
+    if (nbt_validate(copy, prefix, NBT_PARSE_FLAG_USE_RAW) || nbt_scan(copy, prefix, NBT_PARSE_FLAG_USE_RAW, &scan, NULL, 0)) {
+      validate_failures++;
+    }
+
+    const int modes[3] = { 0, NBT_PARSE_FLAG_LAZY, NBT_PARSE_FLAG_PREALLOCATE };
+    for (int m = 0; m < 3; m++) {
+      nbt_tag_t* parsed = nbt_parse_memory(copy, prefix, NBT_PARSE_FLAG_USE_RAW | modes[m]);
+      if (parsed) {
+        parse_failures++;
+        nbt_free_tag(parsed);
+      }
+    }
+
+    nbt_tag_t* found;
+    if (nbt_path_get_memory(path, copy, prefix, NBT_PARSE_FLAG_USE_RAW, &found, 1)) {
+      if (prefix < needed || found->type != NBT_TYPE_STRING || found->tag_string.size != 7 || memcmp(found->tag_string.value, "Eggbert", 7) != 0) {
+        path_failures++;
+      }
+      nbt_free_tag(found);
+    } else if (prefix >= needed) {
+      path_failures++;
+    }
+
+    // A complete zlib stream can still hold a document which isn't.
+    uLongf compressed_size = compressed_alloc_size;
+    compress(compressed, &compressed_size, copy, prefix);
+    nbt_tag_t* parsed = nbt_parse_memory(compressed, compressed_size, NBT_PARSE_FLAG_USE_ZLIB);
+    if (parsed) {
+      compressed_failures++;
+      nbt_free_tag(parsed);
+    }
+
+    free(copy);
+  }
+
+  CHECK(parse_failures == 0);
+  CHECK(compressed_failures == 0);
+  CHECK(path_failures == 0);
+  CHECK(validate_failures == 0);
+
+  nbt_free_path(path);
+  free(compressed);
+
+}
+
+// Files which can be mapped are parsed in place, and anything else is read a piece at a time.
+static void test_files(nbt_tag_t* bigtest) {
+
+  const char* paths[3] = { "bigtest_gzip.nbt", "bigtest_zlib.nbt", "bigtest_raw.nbt" };
+  const int flags[3] = { NBT_PARSE_FLAG_USE_GZIP, NBT_PARSE_FLAG_USE_ZLIB, NBT_PARSE_FLAG_USE_RAW };
+
+  nbt_context_t* context = nbt_new_context();
+
+  for (int i = 0; i < 3; i++) {
+    nbt_tag_t* parsed = nbt_parse_file(paths[i], flags[i]);
+    CHECK(parsed && same_tree(bigtest, parsed, 1));
+    if (parsed) {
+      nbt_free_tag(parsed);
+    }
+
+    parsed = nbt_parse_file_ex(context, paths[i], flags[i] | NBT_PARSE_FLAG_LAZY);
+    CHECK(parsed && same_tree(bigtest, parsed, 1));
+    if (parsed) {
+      nbt_free_tag(parsed);
+    }
+  }
+
+  CHECK(nbt_parse_file("tests/missing.nbt", NBT_PARSE_FLAG_USE_GZIP) == NULL);
+
+#if defined(__unix__) || defined(__APPLE__)
+  // A pipe can't be mapped. bigtest is small enough to fit in the pipe's buffer, so it can all be written up front.
+  for (int i = 0; i < 3; i++) {
+    size_t size;
+    uint8_t* data = read_file(paths[i], &size);
+    int fds[2];
+    if (pipe(fds) != 0) {
+      free(data);
+      continue;
+    }
+    CHECK(write(fds[1], data, size) == (ssize_t)size);
+    close(fds[1]);
+
+    char path[32];
+    snprintf(path, sizeof(path), "/dev/fd/%d", fds[0]);
+    nbt_tag_t* parsed = nbt_parse_file_ex(context, path, flags[i]);
+    CHECK(parsed && same_tree(bigtest, parsed, 1));
+    if (parsed) {
+      nbt_free_tag(parsed);
+    }
+
+    close(fds[0]);
+    free(data);
+  }
+#endif
+
+  nbt_free_context(context);
+
+}
+
+static nbt_incremental_status_t feed_in_pieces(nbt_incremental_parser_t* parser, const uint8_t* data, size_t size, size_t piece_size) {
+  nbt_incremental_status_t status = NBT_INCREMENTAL_NEED_MORE;
+  for (size_t i = 0; i < size && status == NBT_INCREMENTAL_NEED_MORE; i += piece_size) {
+    status = nbt_incremental_parser_feed(parser, data + i, size - i < piece_size ? size - i : piece_size, NULL);
+  }
+  return status;
+}
+
+// Input can arrive in pieces of any size, and damaged Gzip trailers are caught.
+static void test_incremental(nbt_tag_t* tag) {
+
+  const int compressions[3][2] = {
+    { NBT_WRITE_FLAG_USE_GZIP, NBT_PARSE_FLAG_USE_GZIP },
+    { NBT_WRITE_FLAG_USE_ZLIB, NBT_PARSE_FLAG_USE_ZLIB },
+    { NBT_WRITE_FLAG_USE_RAW, NBT_PARSE_FLAG_USE_RAW }
+  };
+  const size_t piece_sizes[3] = { 1, 100, (size_t)-1 };
+  const int modes[3] = { 0, NBT_PARSE_FLAG_LAZY, NBT_PARSE_FLAG_PREALLOCATE };
+
+  for (int c = 0; c < 3; c++) {
+
+    size_t size;
+    uint8_t* data = nbt_write_memory(tag, compressions[c][0], &size);
+
+    for (int m = 0; m < 3; m++) {
+      nbt_incremental_parser_t* mode_parser = nbt_new_incremental_parser(compressions[c][1] | modes[m]);
+      for (int p = 0; p < 3; p++) {
+        CHECK(feed_in_pieces(mode_parser, data, size, piece_sizes[p]) == NBT_INCREMENTAL_DONE);
+        nbt_tag_t* parsed = nbt_incremental_parser_take_tag(mode_parser);
+        CHECK(parsed && same_tree(tag, parsed, 1));
+        if (parsed) {
+          nbt_free_tag(parsed);
+        }
+        nbt_incremental_parser_reset(mode_parser);
+      }
+      nbt_free_incremental_parser(mode_parser);
+    }
+
+    nbt_incremental_parser_t* parser = nbt_new_incremental_parser(compressions[c][1]);
+
+    // Whatever follows the document is left alone.
+    uint8_t* followed = (uint8_t*)malloc(size + 10);
+    memcpy(followed, data, size);
+    memset(followed + size, 0xff, 10);
+    size_t consumed = 0;
+    CHECK(nbt_incremental_parser_feed(parser, followed, size + 10, &consumed) == NBT_INCREMENTAL_DONE);
+    CHECK(consumed == size);
+    free(followed);
+
+    // Truncated data is never finished.
+    nbt_incremental_parser_reset(parser);
+    CHECK(feed_in_pieces(parser, data, size - 1, 7) == NBT_INCREMENTAL_NEED_MORE);
+
+    nbt_free_incremental_parser(parser);
+    nbt_free(data);
+
+  }
+
+  size_t size;
+  uint8_t* data = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_GZIP, &size);
+
+  for (int damage = 0; damage < 2; damage++) {
+    data[size - 8 + damage * 4] ^= 1; // The CRC-32, then the size as well.
+    nbt_incremental_parser_t* parser = nbt_new_incremental_parser(NBT_PARSE_FLAG_USE_GZIP);
+    CHECK(feed_in_pieces(parser, data, size, 100) == NBT_INCREMENTAL_ERROR);
+    CHECK(nbt_incremental_parser_take_tag(parser) == NULL);
+    nbt_free_incremental_parser(parser);
+  }
+
+  nbt_free(data);
+
+}
+
+// Writing a step at a time gives the same bytes as writing everything at once, whatever the budgets. The smallest
+// budgets take a long time for large documents, so those can start further into the list.
+static void test_write_steps(nbt_tag_t* tag, int first_budget) {
+
+  const int compressions[3] = { NBT_WRITE_FLAG_USE_GZIP, NBT_WRITE_FLAG_USE_ZLIB, NBT_WRITE_FLAG_USE_RAW };
+  const size_t byte_budgets[4] = { 1, 100, 4096, 0 };
+  const uint32_t time_budgets[4] = { 0, 0, 1, 0 };
+
+  for (int c = 0; c < 3; c++) {
+
+    size_t size;
+    uint8_t* data = nbt_write_memory(tag, compressions[c], &size);
+
+    for (int b = first_budget; b < 4; b++) {
+      buffer_t stepped = { NULL, 0, 0, 0 };
+      nbt_writer_t writer = { buffer_write, &stepped };
+      nbt_incremental_writer_t* incremental_writer = nbt_new_incremental_writer(writer, tag, compressions[c]);
+
+      nbt_incremental_status_t status;
+      size_t steps = 0;
+      do {
+        status = nbt_write_step(incremental_writer, byte_budgets[b], time_budgets[b]);
+        steps++;
+      } while (status == NBT_INCREMENTAL_NEED_MORE);
+
+      CHECK(status == NBT_INCREMENTAL_DONE);
+      CHECK(stepped.size == size && memcmp(stepped.data, data, size) == 0);
+      // Small budgets split the work up.
+      CHECK(byte_budgets[b] == 0 || byte_budgets[b] >= size || steps > 1);
+
+      nbt_free_incremental_writer(incremental_writer);
+      free(stepped.data);
+    }
+
+    nbt_free(data);
+
+  }
+
+  // A writer which stops accepting data makes the next step fail.
+  full_writer_t full = { 10, 0, 0 };
+  nbt_writer_t failing_writer = { full_write, &full };
+  nbt_incremental_writer_t* incremental_writer = nbt_new_incremental_writer(failing_writer, tag, NBT_WRITE_FLAG_USE_RAW);
+  nbt_incremental_status_t status;
+  do {
+    status = nbt_write_step(incremental_writer, 100, 0);
+  } while (status == NBT_INCREMENTAL_NEED_MORE);
+  CHECK(status == NBT_INCREMENTAL_ERROR);
+  nbt_free_incremental_writer(incremental_writer);
+
+}
+
+// Packets hold raw data after its length as a VarInt.
+static void test_packets(nbt_tag_t* tag) {
+
+  const int formats[3] = { 0, NBT_WRITE_FLAG_BEDROCK, NBT_WRITE_FLAG_BEDROCK_NETWORK };
+
+  nbt_context_t* context = nbt_new_context();
+
+  for (int f = 0; f < 3; f++) {
+    for (int nameless = 0; nameless < 2; nameless++) {
+
+      int write_flags = formats[f] | (nameless ? NBT_WRITE_FLAG_NAMELESS_ROOT : 0);
+
+      buffer_t packet = { NULL, 0, 0, 0 };
+      nbt_writer_t writer = { buffer_write, &packet };
+      // Compression flags are ignored.
+      size_t written = nbt_write_packet_ex(context, writer, tag, write_flags | NBT_WRITE_FLAG_USE_GZIP);
+      CHECK(written > 0 && written == packet.size);
+
+      size_t length = 0;
+      size_t prefix_size = 0;
+      while (prefix_size < packet.size && prefix_size < 5) {
+        uint8_t byte = packet.data[prefix_size];
+        length |= (size_t)(byte & 0x7f) << (7 * prefix_size);
+        prefix_size++;
+        if (!(byte & 0x80)) {
+          break;
+        }
+      }
+      CHECK(prefix_size + length == packet.size);
+
+      size_t size;
+      uint8_t* data = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_RAW | write_flags, &size);
+      CHECK(length == size && memcmp(packet.data + prefix_size, data, size) == 0);
+      nbt_free(data);
+
+      free(packet.data);
+
+    }
+  }
+
+  // Short writes are carried on with, but a writer which stops accepting data fails the packet.
+  buffer_t whole = { NULL, 0, 0, 0 };
+  buffer_t pieces = { NULL, 0, 0, 7 };
+  nbt_writer_t whole_writer = { buffer_write, &whole };
+  nbt_writer_t pieces_writer = { buffer_write, &pieces };
+  CHECK(nbt_write_packet(whole_writer, tag, 0) == nbt_write_packet(pieces_writer, tag, 0));
+  CHECK(whole.size == pieces.size && memcmp(whole.data, pieces.data, whole.size) == 0);
+  free(whole.data);
+  free(pieces.data);
+
+  full_writer_t full = { 3, 0, 0 };
+  nbt_writer_t failing_writer = { full_write, &full };
+  CHECK(nbt_write_packet(failing_writer, tag, NBT_WRITE_FLAG_NAMELESS_ROOT) == 0);
+
+  nbt_free_context(context);
+
+}
+
+static void test_snbt_parse(void) {
+
+  const char* input =
+    "{b: 1b, s: -2s, i: 3, l: 4L, f: 0.1f, d: 0.1, big: 1.7976931348623157e308d, tiny: 4.9e-324d,"
+    " str: 'it\\'s \"quoted\"', bare: hello, t: true, ba: [B; 1b, -1b], ia: [I; 1, 2, 3,],"
+    " la: [L; -9223372036854775808L], list: [[1, 2], [3]], compounds: [{a: 1}, {}], \"odd key\": 1.0e10d}";
+
+  nbt_tag_t* tag = nbt_parse_snbt(input, strlen(input));
+  CHECK(tag != NULL);
+  if (!tag) {
+    return;
+  }
+
+  CHECK(nbt_tag_compound_get(tag, "b")->tag_byte.value == 1);
+  CHECK(nbt_tag_compound_get(tag, "s")->tag_short.value == -2);
+  CHECK(nbt_tag_compound_get(tag, "i")->type == NBT_TYPE_INT && nbt_tag_compound_get(tag, "i")->tag_int.value == 3);
+  CHECK(nbt_tag_compound_get(tag, "l")->tag_long.value == 4);
+  CHECK(nbt_tag_compound_get(tag, "f")->tag_float.value == 0.1f);
+  CHECK(nbt_tag_compound_get(tag, "d")->type == NBT_TYPE_DOUBLE && nbt_tag_compound_get(tag, "d")->tag_double.value == 0.1);
+  CHECK(nbt_tag_compound_get(tag, "big")->tag_double.value == 1.7976931348623157e308);
+  CHECK(nbt_tag_compound_get(tag, "tiny")->tag_double.value == 4.9e-324);
+  CHECK(strcmp(nbt_tag_compound_get(tag, "str")->tag_string.value, "it's \"quoted\"") == 0);
+  CHECK(strcmp(nbt_tag_compound_get(tag, "bare")->tag_string.value, "hello") == 0);
+  CHECK(nbt_tag_compound_get(tag, "t")->type == NBT_TYPE_BYTE && nbt_tag_compound_get(tag, "t")->tag_byte.value == 1);
+  CHECK(nbt_tag_compound_get(tag, "ba")->tag_byte_array.size == 2 && nbt_tag_compound_get(tag, "ba")->tag_byte_array.value[1] == -1);
+  CHECK(nbt_tag_compound_get(tag, "ia")->tag_int_array.size == 3 && nbt_tag_compound_get(tag, "ia")->tag_int_array.value[2] == 3);
+  CHECK(nbt_tag_compound_get(tag, "la")->tag_long_array.value[0] == INT64_MIN);
+  CHECK(nbt_tag_list_get(nbt_tag_compound_get(tag, "list"), 1)->tag_list.size == 1);
+  CHECK(nbt_tag_list_get(nbt_tag_compound_get(tag, "compounds"), 1)->tag_compound.size == 0);
+  CHECK(nbt_tag_compound_get(tag, "odd key")->tag_double.value == 1e10);
+
+  nbt_free_tag(tag);
+
+  const char* invalid[] = { "", "{", "{a:}", "[1, 2b]", "[I; 1, 'a']", "{a: 1} x", "[I; 1,", "'unterminated" };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    nbt_tag_t* bad = nbt_parse_snbt(invalid[i], strlen(invalid[i]));
+    CHECK(bad == NULL);
+    if (bad) {
+      nbt_free_tag(bad);
+    }
+  }
+
+  // Nesting is limited in the same way as for binary data.
+  char nested[2 * (NBT_MAX_DEPTH + 1)];
+  for (size_t depth = NBT_MAX_DEPTH - 1; depth <= NBT_MAX_DEPTH + 1; depth += 2) {
+    memset(nested, '[', depth);
+    memset(nested + depth, ']', depth);
+    nbt_tag_t* parsed = nbt_parse_snbt(nested, 2 * depth);
+    CHECK((parsed != NULL) == (depth <= NBT_MAX_DEPTH));
+    if (parsed) {
+      nbt_free_tag(parsed);
+    }
+  }
+
+}
+
+static buffer_t to_text(nbt_tag_t* tag, int json) {
+  buffer_t buffer = { NULL, 0, 0, 0 };
+  nbt_writer_t writer = { buffer_write, &buffer };
+  if (json) {
+    nbt_write_json(writer, tag);
+  } else {
+    nbt_write_snbt(writer, tag);
+  }
+  return buffer;
+}
+
+static int text_matches(buffer_t text, const char* expected) {
+  if (text.data && strcmp((const char*)text.data, expected) == 0) {
+    return 1;
+  }
+  printf("  got      %s\n  expected %s\n", text.data ? (const char*)text.data : "(nothing)", expected);
+  return 0;
+}
+
+// SNBT which is written reads back as the same tree, and writes out as the same text again.
+static void test_snbt_write(void) {
+
+  const char* input =
+    "{b: 1b, s: -2s, i: 3, l: 4L, f: 0.1f, d: 0.1, big: 1.7976931348623157e308d, tiny: 4.9e-324d,"
+    " nan: NaNd, inf: Infinityf, ninf: -Infinityd, str: 'it\\'s \"quoted\"\\n', bare: hello, t: true,"
+    " ba: [B; 1b, -1b], ia: [I; 1, 2, 3], la: [L; -9223372036854775808L], list: [[1, 2], [3]],"
+    " compounds: [{a: 1}, {}], \"odd key\": 1.0e10d}";
+
+  nbt_tag_t* tag = nbt_parse_snbt(input, strlen(input));
+  CHECK(tag != NULL);
+  if (!tag) {
+    return;
+  }
+
+  // NaN and the infinities are written with suffixes so that they read back as numbers.
+  CHECK(nbt_tag_compound_get(tag, "nan")->type == NBT_TYPE_DOUBLE && isnan(nbt_tag_compound_get(tag, "nan")->tag_double.value));
+  CHECK(nbt_tag_compound_get(tag, "inf")->type == NBT_TYPE_FLOAT && isinf(nbt_tag_compound_get(tag, "inf")->tag_float.value));
+  CHECK(nbt_tag_compound_get(tag, "ninf")->tag_double.value == -INFINITY);
+
+  buffer_t first = to_text(tag, 0);
+  CHECK(text_matches(first,
+    "{b:1b,s:-2s,i:3,l:4L,f:0.1f,d:0.1d,big:1.7976931348623157e308d,tiny:5.0e-324d,nan:NaNd,inf:Infinityf,"
+    "ninf:-Infinityd,str:\"it's \\\"quoted\\\"\\n\",bare:\"hello\",t:1b,ba:[B;1b,-1b],ia:[I;1,2,3],"
+    "la:[L;-9223372036854775808L],list:[[1,2],[3]],compounds:[{a:1},{}],\"odd key\":10000000000.0d}"));
+
+  nbt_tag_t* reparsed = nbt_parse_snbt((const char*)first.data, first.size);
+  CHECK(reparsed && same_tree(tag, reparsed, 0));
+  if (reparsed) {
+    buffer_t second = to_text(reparsed, 0);
+    CHECK(second.size == first.size && memcmp(first.data, second.data, first.size) == 0);
+    free(second.data);
+    nbt_free_tag(reparsed);
+  }
+  free(first.data);
+
+  // JSON has no types, and no NaN or infinities.
+  buffer_t json = to_text(tag, 1);
+  CHECK(text_matches(json,
+    "{\"b\":1,\"s\":-2,\"i\":3,\"l\":4,\"f\":0.1,\"d\":0.1,\"big\":1.7976931348623157e308,\"tiny\":5.0e-324,"
+    "\"nan\":null,\"inf\":null,\"ninf\":null,\"str\":\"it's \\\"quoted\\\"\\n\",\"bare\":\"hello\",\"t\":1,"
+    "\"ba\":[1,-1],\"ia\":[1,2,3],\"la\":[-9223372036854775808],\"list\":[[1,2],[3]],\"compounds\":[{\"a\":1},{}],"
+    "\"odd key\":10000000000.0}"));
+  free(json.data);
+
+  nbt_free_tag(tag);
+
+}
+
+static void test_format_double(void) {
+
+  uint64_t state = 0x9e3779b97f4a7c15ull;
+  int double_mismatches = 0;
+  int float_mismatches = 0;
+
+  for (int i = 0; i < 200000; i++) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+
+    double d;
+    memcpy(&d, &state, sizeof(d));
+    if (isfinite(d)) {
+      char text[40];
+      text[nbt__format_double(text, d, 0)] = '\0';
+      double_mismatches += strtod(text, NULL) != d;
+    }
+
+    uint32_t bits = (uint32_t)state;
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    if (isfinite(f)) {
+      char text[40];
+      text[nbt__format_double(text, f, 1)] = '\0';
+      float_mismatches += strtof(text, NULL) != f;
+    }
+  }
+
+  CHECK(double_mismatches == 0);
+  CHECK(float_mismatches == 0);
+
+  const double doubles[] = { 0.0, -0.0, 0.1, 1e16, 1e17, 123456.789, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308 };
+  for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+    char text[40];
+    text[nbt__format_double(text, doubles[i], 0)] = '\0';
+    CHECK(strtod(text, NULL) == doubles[i]);
+  }
+
+  char text[40];
+  text[nbt__format_double(text, 0.1, 0)] = '\0';
+  CHECK(strcmp(text, "0.1") == 0);
+  text[nbt__format_double(text, 3.4028235e38f, 1)] = '\0';
+  CHECK(strcmp(text, "3.4028235e38") == 0);
+
+}
+
+static nbt_visit_result_t bump_air(void* userdata, nbt_tag_t* tag, nbt_tag_t** path, size_t depth) {
+  (void)userdata;
+  (void)path;
+  (void)depth;
+  if (tag->type == NBT_TYPE_SHORT) {
+    tag->tag_short.value++;
+  }
+  return tag->name && strcmp(tag->name, "OnGround") == 0 ? NBT_VISIT_DROP : NBT_VISIT_KEEP;
+}
+
+static nbt_visit_result_t drop_list_elements(void* userdata, nbt_tag_t* tag, nbt_tag_t** path, size_t depth) {
+  (void)userdata;
+  (void)tag;
+  return depth > 0 && path[depth - 1]->type == NBT_TYPE_LIST ? NBT_VISIT_DROP : NBT_VISIT_KEEP;
+}
+
+// Transformed output has the visitor's changes and nothing else, whether or not lists are held back.
+static void test_transform(nbt_tag_t* tag) {
+
+  size_t size;
+  uint8_t* data = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_GZIP, &size);
+  nbt_tag_t* entities = nbt_tag_compound_get(tag, "Entities");
+
+  for (int keep = 0; keep < 2; keep++) {
+    buffer_t input = { data, size, 0, 0 };
+    buffer_t output = { NULL, 0, 0, 0 };
+    nbt_reader_t reader = { buffer_read, &input };
+    nbt_writer_t writer = { buffer_write, &output };
+    nbt_visitor_t visitor = { bump_air, NULL, keep };
+    CHECK(nbt_transform(reader, NBT_PARSE_FLAG_USE_GZIP, writer, NBT_WRITE_FLAG_USE_RAW | NBT_WRITE_FLAG_BEDROCK, visitor));
+
+    nbt_tag_t* transformed = nbt_parse_memory(output.data, output.size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_BEDROCK);
+    CHECK(transformed != NULL);
+    if (transformed) {
+      nbt_tag_t* transformed_entities = nbt_tag_compound_get(transformed, "Entities");
+      CHECK(transformed_entities && transformed_entities->tag_list.size == entities->tag_list.size);
+      int matches = 1;
+      for (size_t i = 0; transformed_entities && i < transformed_entities->tag_list.size; i++) {
+        nbt_tag_t* before = nbt_tag_list_get(entities, i);
+        nbt_tag_t* after = nbt_tag_list_get(transformed_entities, i);
+        matches = matches && after->tag_compound.size == before->tag_compound.size - 1 && !nbt_tag_compound_get(after, "OnGround") &&
+          nbt_tag_compound_get(after, "Air")->tag_short.value == nbt_tag_compound_get(before, "Air")->tag_short.value + 1 &&
+          nbt_tag_compound_get(after, "Seed")->tag_long.value == nbt_tag_compound_get(before, "Seed")->tag_long.value &&
+          same_tree(nbt_tag_compound_get(after, "UUID"), nbt_tag_compound_get(before, "UUID"), 1) &&
+          same_tree(nbt_tag_compound_get(after, "Pos"), nbt_tag_compound_get(before, "Pos"), 1);
+      }
+      CHECK(matches);
+      nbt_free_tag(transformed);
+    }
+    free(output.data);
+
+    // Dropping list elements only works if the visitor hasn't promised to keep them.
+    input.offset = 0;
+    output.data = NULL;
+    output.size = 0;
+    visitor.visit = drop_list_elements;
+    CHECK(nbt_transform(reader, NBT_PARSE_FLAG_USE_GZIP, writer, NBT_WRITE_FLAG_USE_RAW, visitor) == !keep);
+    if (!keep) {
+      transformed = nbt_parse_memory(output.data, output.size, NBT_PARSE_FLAG_USE_RAW);
+      CHECK(transformed && nbt_tag_compound_get(transformed, "Entities")->tag_list.size == 0);
+      nbt_free_tag(transformed);
+    }
+    free(output.data);
+  }
+
+  nbt_free(data);
+
+}
+
+typedef struct {
+  const char* path;
+  size_t count;
+  int64_t first;
+  int64_t last;
+} path_case_t;
+
+static int64_t number_value(nbt_tag_t* tag) {
+  switch (tag->type) {
+    case NBT_TYPE_BYTE: return tag->tag_byte.value;
+    case NBT_TYPE_SHORT: return tag->tag_short.value;
+    case NBT_TYPE_INT: return tag->tag_int.value;
+    case NBT_TYPE_LONG: return tag->tag_long.value;
+    case NBT_TYPE_FLOAT: return (int64_t)(tag->tag_float.value * 100);
+    case NBT_TYPE_STRING: return (int64_t)tag->tag_string.size;
+    case NBT_TYPE_LIST: return (int64_t)tag->tag_list.size;
+    case NBT_TYPE_COMPOUND: return (int64_t)tag->tag_compound.size;
+    default: return -1;
+  }
+}
+
+// Paths select the right tags in order, and invalid paths don't compile. Floats are compared as hundredths, and strings,
+// lists and compounds by their sizes.
+static void test_paths(nbt_tag_t* tag, const uint8_t* data, size_t size) {
+
+  const path_case_t cases[] = {
+    { "intTest", 1, 2147483647, 2147483647 },
+    { "\"nested compound test\"", 1, 2, 2 },
+    { "\"nested compound test\".ham.value", 1, 75, 75 },
+    { "'nested compound test'.egg.name", 1, 7, 7 },
+    { "'listTest (long)'", 1, 5, 5 },
+    { "'listTest (long)'[]", 5, 11, 15 },
+    { "'listTest (long)'[2]", 1, 13, 13 },
+    { "'listTest (long)'[-1]", 1, 15, 15 },
+    { "'listTest (long)'[-5]", 1, 11, 11 },
+    { "'listTest (long)'[5]", 0, 0, 0 },
+    { "'listTest (long)'[-6]", 0, 0, 0 },
+    { "'listTest (compound)'[].created-on", 2, 1264099775885LL, 1264099775885LL },
+    { "'listTest (compound)'[{name: \"Compound tag #1\"}].name", 1, 15, 15 },
+    { "'listTest (compound)'[{name: \"Compound tag #2\"}]", 0, 0, 0 },
+    { "'listTest (compound)'[{created-on: 1264099775885}]", 0, 0, 0 },
+    { "{shortTest: 32767s}.byteTest", 1, 127, 127 },
+    { "{shortTest: 32766s}.byteTest", 0, 0, 0 },
+    { "'nested compound test'{egg: {name: \"Eggbert\"}}.ham.name", 1, 6, 6 },
+    { "missing", 0, 0, 0 },
+    { "intTest.value", 0, 0, 0 },
+    { "'listTest (long)'[0][0]", 0, 0, 0 }
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+
+    nbt_path_t* path = nbt_path_compile(cases[i].path);
+    CHECK(path != NULL);
+    if (!path) {
+      continue;
+    }
+
+    nbt_tag_t* results[8];
+    size_t count = nbt_path_get(path, tag, results, 8);
+    if (!(count == cases[i].count && (count == 0 || (number_value(results[0]) == cases[i].first && number_value(results[count - 1]) == cases[i].last)))) {
+      printf("  path %s\n", cases[i].path);
+      CHECK(0);
+    }
+
+    // Only max_results tags are stored, and they are the first ones.
+    if (cases[i].count > 1) {
+      CHECK(nbt_path_get(path, tag, results, 1) == 1 && number_value(results[0]) == cases[i].first);
+    }
+
+    // Searching the serialized data finds copies of the same tags.
+    nbt_tag_t* memory_results[8];
+    size_t memory_count = nbt_path_get_memory(path, data, size, NBT_PARSE_FLAG_USE_RAW, memory_results, 8);
+    CHECK(memory_count == count);
+    for (size_t j = 0; j < memory_count; j++) {
+      CHECK(j < count && same_tree(results[j], memory_results[j], 1));
+      nbt_free_tag(memory_results[j]);
+    }
+
+    nbt_free_path(path);
+
+  }
+
+  const char* invalid[] = { "", "'listTest (long)'[", "'listTest (long)'[x]", "a..b", ".a", "a.", "'unterminated", "a[{b: }]", "a{b: 1", "a.{b: 1}" };
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    nbt_path_t* path = nbt_path_compile(invalid[i]);
+    if (path) {
+      printf("  path %s\n", invalid[i]);
+      CHECK(0);
+      nbt_free_path(path);
+    }
+  }
+
+}
+
+static nbt_tag_t* make_row(int has_id, int32_t id, double score, const char* name) {
+  nbt_tag_t* row = nbt_new_tag_compound();
+  if (has_id) {
+    nbt_tag_compound_append(row, named(nbt_new_tag_int(id), "id"));
+  }
+  nbt_tag_compound_append(row, named(nbt_new_tag_double(score), "score"));
+  if (name) {
+    nbt_tag_compound_append(row, named(nbt_new_tag_string(name, strlen(name)), "name"));
+  }
+  return row;
+}
+
+// Each column holds the first value at its path in each document, converted to the column type where it fits.
+static void test_columns(void) {
+
+  nbt_columns_t* columns = nbt_new_columns();
+  CHECK(nbt_columns_add(columns, "id", NBT_TYPE_INT) == 0);
+  CHECK(nbt_columns_add(columns, "score", NBT_TYPE_DOUBLE) == 1);
+  CHECK(nbt_columns_add(columns, "score", NBT_TYPE_SHORT) == 2);
+  CHECK(nbt_columns_add(columns, "name", NBT_TYPE_STRING) == 3);
+  CHECK(nbt_columns_add(columns, "[", NBT_TYPE_INT) == -1);
+  CHECK(nbt_columns_add(columns, "id", NBT_TYPE_COMPOUND) == -1);
+
+  nbt_tag_t* rows[4];
+  rows[0] = make_row(1, 7, 2.5, "alpha");
+  rows[1] = make_row(0, 0, 1e300, "say \"hi\"");
+  rows[2] = make_row(1, -3, NAN, NULL);
+  rows[3] = make_row(1, 2147483647, -0.75, "");
+
+  for (int i = 0; i < 3; i++) {
+    nbt_columns_append(columns, rows[i]);
+  }
+
+  // Appending serialized data gives the same result as appending the tree.
+  size_t size;
+  uint8_t* data = nbt_write_memory(rows[3], NBT_WRITE_FLAG_USE_ZLIB, &size);
+  CHECK(nbt_columns_append_memory(columns, data, size, NBT_PARSE_FLAG_USE_ZLIB));
+  nbt_free(data);
+
+  nbt_column_t* id = nbt_columns_get(columns, 0);
+  nbt_column_t* score = nbt_columns_get(columns, 1);
+  nbt_column_t* short_score = nbt_columns_get(columns, 2);
+  CHECK(id->size == 4 && score->size == 4);
+  CHECK(((int32_t*)id->values)[0] == 7 && ((int32_t*)id->values)[3] == 2147483647);
+  CHECK((id->validity[0] & 0x0f) == 0x0d);
+  CHECK((score->validity[0] & 0x0f) == 0x0f);
+  // Values which don't fit an integer column, and NaN, have no value rather than an undefined one.
+  CHECK((short_score->validity[0] & 0x0f) == 0x09);
+  CHECK(((int16_t*)short_score->values)[0] == 2 && ((int16_t*)short_score->values)[3] == 0);
+
+  buffer_t csv = { NULL, 0, 0, 0 };
+  nbt_writer_t writer = { buffer_write, &csv };
+  nbt_columns_write_csv(columns, writer);
+  const char* expected =
+    "\"id\",\"score\",\"score\",\"name\"\r\n"
+    "7,2.5,2,\"alpha\"\r\n"
+    ",1.0e300,,\"say \"\"hi\"\"\"\r\n"
+    "-3,NaN,,\r\n"
+    "2147483647,-0.75,0,\"\"\r\n";
+  CHECK(csv.data && strcmp((const char*)csv.data, expected) == 0);
+  if (csv.data && strcmp((const char*)csv.data, expected) != 0) {
+    printf("  got\n%s  expected\n%s", csv.data, expected);
+  }
+  free(csv.data);
+
+  nbt_column_t* name = nbt_columns_get(columns, 3);
+  CHECK(name->offsets[0] == 0 && name->offsets[1] == 5 && name->offsets[2] == 13 && name->offsets[4] == 13);
+  CHECK(memcmp((char*)name->values + name->offsets[1], "say \"hi\"", 8) == 0);
+
+  buffer_t binary = { NULL, 0, 0, 0 };
+  writer.userdata = &binary;
+  nbt_columns_write_binary(columns, writer);
+  const uint8_t header[20] = { 'N', 'B', 'T', 'C', 1, 0, 0, 0, 4, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0 };
+  CHECK(binary.size == 169 && memcmp(binary.data, header, sizeof(header)) == 0);
+  free(binary.data);
+
+  // Clearing keeps the columns but not the rows.
+  nbt_columns_clear(columns);
+  CHECK(id->size == 0 && nbt_columns_get(columns, 3) == name);
+  nbt_columns_append(columns, rows[2]);
+  CHECK(id->size == 1 && ((int32_t*)id->values)[0] == -3 && (id->validity[0] & 1) && !(name->validity[0] & 1));
+
+  for (int i = 0; i < 4; i++) {
+    nbt_free_tag(rows[i]);
+  }
+  nbt_free_columns(columns);
+
+}
+
+typedef struct {
+  uint64_t allocations;
+  uint64_t reallocations;
+  uint64_t frees;
+  int64_t live_bytes;
+  uint64_t compressors; // Blocks the size of miniz's compressor state.
+  int other_threads; // Calls made from a thread other than the one which set the allocator.
+  pthread_t thread;
+} counting_allocator_t;
+
+// Each block starts with its size, so that the allocator can report it and keep its own count of live bytes.
+#define BLOCK_HEADER 16
+
+static void* counting_malloc(void* userdata, size_t size) {
+  counting_allocator_t* counts = (counting_allocator_t*)userdata;
+  counts->allocations++;
+  counts->live_bytes += (int64_t)size;
+  counts->other_threads += !pthread_equal(pthread_self(), counts->thread);
+#ifndef NBT_OWN_ZLIB
+  counts->compressors += size == sizeof(tdefl_compressor);
+#endif
+  size_t* block = (size_t*)malloc(size + BLOCK_HEADER);
+  *block = size;
+  return (uint8_t*)block + BLOCK_HEADER;
+}
+
+static void* counting_realloc(void* userdata, void* pointer, size_t size) {
+  counting_allocator_t* counts = (counting_allocator_t*)userdata;
+  size_t* block = (size_t*)((uint8_t*)pointer - BLOCK_HEADER);
+  counts->reallocations++;
+  counts->live_bytes += (int64_t)size - (int64_t)*block;
+  counts->other_threads += !pthread_equal(pthread_self(), counts->thread);
+  block = (size_t*)realloc(block, size + BLOCK_HEADER);
+  *block = size;
+  return (uint8_t*)block + BLOCK_HEADER;
+}
+
+static void counting_free(void* userdata, void* pointer) {
+  counting_allocator_t* counts = (counting_allocator_t*)userdata;
+  size_t* block = (size_t*)((uint8_t*)pointer - BLOCK_HEADER);
+  counts->frees++;
+  counts->live_bytes -= (int64_t)*block;
+  counts->other_threads += !pthread_equal(pthread_self(), counts->thread);
+  free(block);
+}
+
+static size_t counting_size(void* userdata, void* pointer) {
+  (void)userdata;
+  return *(size_t*)((uint8_t*)pointer - BLOCK_HEADER);
+}
+
+// Every allocation goes through the calling thread's allocator, including those for compression on other threads, and
+// the counts kept by libnbt agree with the allocator's own.
+static void test_allocator(const uint8_t* data, size_t size, nbt_tag_t* large) {
+
+  counting_allocator_t counts;
+  memset(&counts, 0, sizeof(counts));
+  counts.thread = pthread_self();
+  nbt_allocator_t allocator = { counting_malloc, counting_realloc, counting_free, counting_size, &counts };
+
+  nbt_set_allocator(&allocator);
+  nbt_set_alloc_size_tracking(1);
+  nbt_reset_alloc_stats();
+
+  nbt_context_t* context = nbt_new_context();
+
+  nbt_tag_t* tag = nbt_parse_memory_ex(context, data, size, NBT_PARSE_FLAG_USE_RAW);
+  CHECK(tag != NULL);
+
+  // The tree is still held after the call, and nothing else is.
+  nbt_alloc_stats_t call;
+  nbt_context_get_alloc_stats(context, &call);
+  CHECK(call.allocations > 0 && call.allocated_bytes > 0);
+  CHECK(call.current_bytes > 0 && call.peak_bytes >= call.current_bytes);
+  nbt_tree_stats_t tree;
+  nbt_tree_stats(tag, &tree);
+  CHECK(call.allocations - call.frees == tree.heap_blocks);
+  nbt_free_tag(tag);
+
+  // Only the serialization buffer is kept in the context after writing.
+  buffer_t written = { NULL, 0, 0, 0 };
+  nbt_writer_t writer = { buffer_write, &written };
+  nbt_write_ex(context, writer, large, NBT_WRITE_FLAG_USE_ZLIB | NBT_WRITE_FLAG_PARALLEL);
+  CHECK(written.size > 0);
+#ifndef NBT_OWN_ZLIB
+  CHECK(counts.compressors == NBT_PARALLEL_THREADS);
+#endif
+  nbt_context_get_alloc_stats(context, &call);
+  CHECK(call.current_bytes > 0 && call.peak_bytes > call.current_bytes);
+  free(written.data);
+
+  nbt_free_context(context);
+
+  nbt_alloc_stats_t stats;
+  nbt_get_alloc_stats(&stats);
+  CHECK(counts.other_threads == 0);
+  CHECK(stats.allocations == counts.allocations && stats.reallocations == counts.reallocations && stats.frees == counts.frees);
+  CHECK(counts.allocations == counts.frees && counts.live_bytes == 0);
+  CHECK(stats.current_bytes == 0 && stats.peak_bytes > 0 && stats.allocated_bytes > 0);
+
+  nbt_reset_alloc_stats();
+  nbt_get_alloc_stats(&stats);
+  CHECK(stats.allocations == 0 && stats.frees == 0 && stats.peak_bytes == 0);
+
+  nbt_set_alloc_size_tracking(0);
+  nbt_set_allocator(NULL);
+
+}
+
+#ifdef NBT_INSTRUMENT
+static int count_occurrences(const char* text, const char* pattern) {
+  int count = 0;
+  while (text && (text = strstr(text, pattern)) != NULL) {
+    count++;
+    text++;
+  }
+  return count;
+}
+#endif
+
+// With NBT_INSTRUMENT, each call records where its time went and can be traced. Otherwise the stats are all zero and
+// nothing is traced.
+static void test_instrument(nbt_tag_t* tag) {
+
+  size_t size;
+  uint8_t* data = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_GZIP, &size);
+
+  buffer_t trace = { NULL, 0, 0, 0 };
+  nbt_writer_t writer = { buffer_write, &trace };
+  nbt_context_t* context = nbt_new_context();
+
+  nbt_trace_begin(writer);
+  for (int i = 0; i < 2; i++) {
+    nbt_free_tag(nbt_parse_memory_ex(context, data, size, NBT_PARSE_FLAG_USE_GZIP));
+  }
+  nbt_trace_end();
+
+  nbt_phase_stats_t stats;
+  nbt_context_get_phase_stats(context, &stats);
+
+#ifdef NBT_INSTRUMENT
+  CHECK(stats.total_ns > 0);
+  CHECK(stats.calls[NBT_PHASE_INFLATE] > 0 && stats.calls[NBT_PHASE_BUILD] > 0 && stats.calls[NBT_PHASE_ALLOC] > 0);
+  CHECK(stats.time_ns[NBT_PHASE_INFLATE] <= stats.total_ns && stats.time_ns[NBT_PHASE_BUILD] <= stats.total_ns);
+  CHECK(stats.calls[NBT_PHASE_SERIALIZE] == 0 && stats.calls[NBT_PHASE_DEFLATE] == 0 && stats.calls[NBT_PHASE_WRITE] == 0);
+
+  // The stats are for the last call only.
+  nbt_free(nbt_write_memory_ex(context, tag, NBT_WRITE_FLAG_USE_ZLIB, &size));
+  nbt_context_get_phase_stats(context, &stats);
+  CHECK(stats.calls[NBT_PHASE_SERIALIZE] > 0 && stats.calls[NBT_PHASE_DEFLATE] > 0 && stats.calls[NBT_PHASE_INFLATE] == 0);
+
+  CHECK(trace.data && trace.data[0] == '[' && strcmp((const char*)trace.data + trace.size - 2, "]\n") == 0);
+  CHECK(count_occurrences((const char*)trace.data, "{\"name\":\"nbt_parse_memory\"") == 2);
+  CHECK(count_occurrences((const char*)trace.data, "{\"name\":\"inflate\"") >= 2);
+  CHECK(count_occurrences((const char*)trace.data, "\"inflate_us\":") == 2);
+#else
+  int all_zero = stats.total_ns == 0;
+  for (int i = 0; i < NBT_PHASE_COUNT; i++) {
+    all_zero = all_zero && stats.time_ns[i] == 0 && stats.calls[i] == 0;
+  }
+  CHECK(all_zero);
+  CHECK(trace.size == 0);
+#endif
+
+  free(trace.data);
+  nbt_free_context(context);
+  nbt_free(data);
+
+}
+
+// The counts for a parsed tree match those found by scanning its data, however it was parsed.
+static void test_tree_stats(const uint8_t* data, size_t size) {
+
+  nbt_scan_stats_t scan;
+  CHECK(nbt_scan(data, size, NBT_PARSE_FLAG_USE_RAW, &scan, NULL, 0) == size);
+
+  const int modes[3] = { 0, NBT_PARSE_FLAG_PREALLOCATE, NBT_PARSE_FLAG_LAZY };
+  for (int m = 0; m < 3; m++) {
+    nbt_tag_t* tag = nbt_parse_memory(data, size, NBT_PARSE_FLAG_USE_RAW | modes[m]);
+    CHECK(tag != NULL);
+    if (!tag) {
+      continue;
+    }
+
+    nbt_tree_stats_t stats;
+    nbt_tree_stats(tag, &stats);
+
+    if (modes[m] == NBT_PARSE_FLAG_LAZY) {
+      // Nothing below the root has been parsed yet, but it is still counted as it would be written.
+      CHECK(stats.unparsed_bytes > 0 && stats.tag_count < scan.tag_count);
+    } else {
+      CHECK(stats.unparsed_bytes == 0 && stats.tag_count == scan.tag_count);
+      CHECK(memcmp(stats.type_counts, scan.type_counts, sizeof(scan.type_counts)) == 0);
+      CHECK(stats.max_depth == scan.max_depth && stats.name_bytes == scan.name_bytes);
+      // Every tag and most names are blocks of their own, unless everything was put in a single block.
+      CHECK(modes[m] == NBT_PARSE_FLAG_PREALLOCATE ? stats.heap_blocks == 1 : stats.heap_blocks > stats.tag_count);
+    }
+    CHECK(stats.serialized_bytes == size);
+    CHECK(stats.heap_bytes >= stats.payload_bytes + stats.name_bytes + stats.tag_count * sizeof(nbt_tag_t));
+
+    nbt_free_tag(tag);
+  }
+
+  // {a: 7, s: "xyz"}, named r.
+  nbt_tag_t* tag = named(nbt_new_tag_compound(), "r");
+  nbt_tag_compound_append(tag, named(nbt_new_tag_int(7), "a"));
+  nbt_tag_compound_append(tag, named(nbt_new_tag_string("xyz", 3), "s"));
+
+  nbt_tree_stats_t stats;
+  nbt_tree_stats(tag, &stats);
+  CHECK(stats.tag_count == 3 && stats.type_counts[NBT_TYPE_COMPOUND] == 1 && stats.type_counts[NBT_TYPE_INT] == 1 && stats.type_counts[NBT_TYPE_STRING] == 1);
+  CHECK(stats.max_depth == 2 && stats.payload_bytes == 7 && stats.name_bytes == 3);
+  CHECK(stats.serialized_bytes == 22 && stats.unparsed_bytes == 0);
+
+  nbt_free_tag(tag);
+
+}
+
+// Names of every length are kept intact through renaming and round trips. With NBT_COMPACT_TAGS, short names live
+// inside the tag and don't need a block of their own.
+static void test_names(const uint8_t* data, size_t size) {
+
+#ifdef NBT_COMPACT_TAGS
+  CHECK(sizeof(void*) != 8 || sizeof(nbt_tag_t) == 40);
+#else
+  CHECK(sizeof(void*) != 8 || sizeof(nbt_tag_t) == 48);
+#endif
+
+  char* long_name = (char*)malloc(70000);
+  for (size_t i = 0; i < 70000; i++) {
+    long_name[i] = (char)('a' + i % 26);
+  }
+
+  const size_t sizes[] = { 0, 1, 11, 12, 300, 65535, 70000 };
+  nbt_tag_t* root = named(nbt_new_tag_compound(), "root");
+  nbt_tag_t* tag = nbt_new_tag_int(1);
+  nbt_tag_compound_append(root, tag);
+
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    // Renaming goes back and forth between short and long names, so that each kind of name replaces each other kind.
+    nbt_set_tag_name(tag, long_name, 12);
+    nbt_set_tag_name(tag, long_name, sizes[i]);
+
+#ifdef NBT_COMPACT_TAGS
+    size_t expected = sizes[i] > 65535 ? 65535 : sizes[i];
+    CHECK((tag->name == tag->name_inline) == (sizes[i] < 12));
+#else
+    size_t expected = sizes[i];
+#endif
+    CHECK(tag->name_size == expected && memcmp(tag->name, long_name, expected) == 0 && tag->name[expected] == '\0');
+
+    nbt_tree_stats_t stats;
+    nbt_tree_stats(tag, &stats);
+#ifdef NBT_COMPACT_TAGS
+    CHECK(stats.heap_blocks == (sizes[i] < 12 ? 1u : 2u));
+#else
+    CHECK(stats.heap_blocks == 2);
+#endif
+
+    // Names as long as NBT allows read back the same.
+    if (sizes[i] <= 65535) {
+      size_t written_size;
+      uint8_t* written = nbt_write_memory(root, NBT_WRITE_FLAG_USE_RAW, &written_size);
+      nbt_tag_t* parsed = nbt_parse_memory(written, written_size, NBT_PARSE_FLAG_USE_RAW);
+      CHECK(parsed && same_tree(root, parsed, 1));
+      nbt_free_tag(parsed);
+      nbt_free(written);
+    }
+  }
+
+  nbt_free_tag(root);
+
+  // Tags whose names are in a preallocated block can be renamed too.
+  root = nbt_parse_memory(data, size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_PREALLOCATE);
+  CHECK(root != NULL);
+  if (root) {
+    nbt_tag_t* nested = nbt_tag_compound_get(root, "nested compound test");
+    nbt_set_tag_name(nested, "n", 1);
+    CHECK(nbt_tag_compound_get(root, "n") == nested);
+    nbt_set_tag_name(nested, long_name, 300);
+    nbt_set_tag_name(nbt_tag_compound_get(root, "intTest"), "a much longer name than before", 30);
+    CHECK(nbt_tag_compound_get(root, "a much longer name than before")->tag_int.value == 2147483647);
+    nbt_free_tag(root);
+  }
+
+  free(long_name);
+
+}
+
+// Lists and compounds from the lazy depth down are left unparsed until they are used, and the default depth is
+// NBT_LAZY_DEPTH.
+static void test_lazy_depths(const uint8_t* data, size_t size, nbt_tag_t* bigtest) {
+
+  nbt_scan_stats_t scan;
+  nbt_scan(data, size, NBT_PARSE_FLAG_USE_RAW, &scan, NULL, 0);
+
+  nbt_context_t* context = nbt_new_context();
+  size_t tag_counts[4];
+
+  for (size_t depth = 0; depth < 4; depth++) {
+    nbt_context_set_lazy_depth(context, depth == 3 ? NBT_MAX_DEPTH : depth);
+    nbt_tag_t* tag = nbt_parse_memory_ex(context, data, size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_LAZY);
+    CHECK(tag != NULL);
+    if (!tag) {
+      continue;
+    }
+
+    nbt_tree_stats_t stats;
+    nbt_tree_stats(tag, &stats);
+    tag_counts[depth] = stats.tag_count;
+    CHECK(stats.serialized_bytes == size);
+
+    if (depth == 0) {
+      // Only the root exists until it is used.
+      CHECK(stats.tag_count == 1 && tag->tag_compound.size == 0);
+      CHECK(nbt_tag_load(tag) && tag->tag_compound.size == 11);
+    } else if (depth == 3) {
+      CHECK(stats.unparsed_bytes == 0 && stats.tag_count == scan.tag_count);
+    } else {
+      CHECK(stats.unparsed_bytes > 0 && stats.tag_count > tag_counts[depth - 1] && stats.tag_count < scan.tag_count);
+    }
+
+    CHECK(same_tree(bigtest, tag, 1));
+    nbt_free_tag(tag);
+  }
+
+  // A new context starts at the default depth.
+  nbt_free_context(context);
+  context = nbt_new_context();
+  nbt_tag_t* tag = nbt_parse_memory_ex(context, data, size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_LAZY);
+  nbt_tree_stats_t stats;
+  nbt_tree_stats(tag, &stats);
+  CHECK(stats.tag_count == tag_counts[NBT_LAZY_DEPTH < 3 ? NBT_LAZY_DEPTH : 3]);
+  nbt_free_tag(tag);
+  nbt_free_context(context);
+
+}
+
+// Writes a list nested depth levels deep, as a nameless root.
+static uint8_t* make_nested_lists(size_t depth, size_t* size) {
+  *size = 1 + depth * 5;
+  uint8_t* data = (uint8_t*)calloc(*size, 1);
+  data[0] = NBT_TYPE_LIST;
+  for (size_t i = 1; i < depth; i++) {
+    data[i * 5 - 4] = NBT_TYPE_LIST;
+    data[i * 5] = 1;
+  }
+  return data; // The innermost list is an empty list of end tags.
+}
+
+// Well-formed documents are measured exactly, and anything malformed is rejected.
+static void test_validate(const uint8_t* data, size_t size) {
+
+  CHECK(nbt_validate(data, size, NBT_PARSE_FLAG_USE_RAW) == size);
+
+  // Anything after the document isn't part of it.
+  uint8_t* padded = (uint8_t*)calloc(size + 5, 1);
+  memcpy(padded, data, size);
+  CHECK(nbt_validate(padded, size + 5, NBT_PARSE_FLAG_USE_RAW) == size);
+
+  // A bad type at the root, and a list of a bad type.
+  padded[0] = NBT_TYPE_LONG_ARRAY + 1;
+  CHECK(nbt_validate(padded, size, NBT_PARSE_FLAG_USE_RAW) == 0);
+  const uint8_t bad_list[] = { NBT_TYPE_COMPOUND, 0, 0, NBT_TYPE_LIST, 0, 1, 'l', 42, 0, 0, 0, 1, 0, 0 };
+  CHECK(nbt_validate(bad_list, sizeof(bad_list), NBT_PARSE_FLAG_USE_RAW) == 0);
+  const uint8_t negative_list[] = { NBT_TYPE_COMPOUND, 0, 0, NBT_TYPE_LIST, 0, 1, 'l', NBT_TYPE_BYTE, 0xff, 0xff, 0xff, 0xff, 0 };
+  CHECK(nbt_validate(negative_list, sizeof(negative_list), NBT_PARSE_FLAG_USE_RAW) == 0);
+  const uint8_t good_list[] = { NBT_TYPE_COMPOUND, 0, 0, NBT_TYPE_LIST, 0, 1, 'l', NBT_TYPE_BYTE, 0, 0, 0, 2, 1, 2, 0 };
+  CHECK(nbt_validate(good_list, sizeof(good_list), NBT_PARSE_FLAG_USE_RAW) == sizeof(good_list));
+  free(padded);
+
+  // Nesting is limited to NBT_MAX_DEPTH levels.
+  size_t nested_size;
+  uint8_t* nested = make_nested_lists(NBT_MAX_DEPTH, &nested_size);
+  CHECK(nbt_validate(nested, nested_size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_NAMELESS_ROOT) == nested_size);
+  free(nested);
+  nested = make_nested_lists(NBT_MAX_DEPTH + 1, &nested_size);
+  CHECK(nbt_validate(nested, nested_size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_NAMELESS_ROOT) == 0);
+  free(nested);
+
+  // Each format is checked with its own encoding.
+  nbt_tag_t* tag = nbt_parse_memory(data, size, NBT_PARSE_FLAG_USE_RAW);
+  const int formats[3][2] = {
+    { NBT_WRITE_FLAG_BEDROCK, NBT_PARSE_FLAG_BEDROCK },
+    { NBT_WRITE_FLAG_BEDROCK_NETWORK, NBT_PARSE_FLAG_BEDROCK_NETWORK },
+    { NBT_WRITE_FLAG_NAMELESS_ROOT, NBT_PARSE_FLAG_NAMELESS_ROOT }
+  };
+  for (int f = 0; f < 3; f++) {
+    size_t written_size;
+    uint8_t* written = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_RAW | formats[f][0], &written_size);
+    CHECK(nbt_validate(written, written_size, formats[f][1]) == written_size);
+    nbt_free(written);
+  }
+  nbt_free_tag(tag);
+
+}
+
+// Adds up what nbt_scan should find in a tree, the slow way.
+static void count_elements(nbt_tag_t* tag, size_t* element_counts, size_t* tag_count) {
+  (*tag_count)++;
+  switch (tag->type) {
+    case NBT_TYPE_BYTE_ARRAY: element_counts[tag->type] += tag->tag_byte_array.size; break;
+    case NBT_TYPE_INT_ARRAY: element_counts[tag->type] += tag->tag_int_array.size; break;
+    case NBT_TYPE_LONG_ARRAY: element_counts[tag->type] += tag->tag_long_array.size; break;
+    case NBT_TYPE_STRING: element_counts[tag->type] += tag->tag_string.size; break;
+    case NBT_TYPE_LIST:
+      element_counts[tag->type] += tag->tag_list.size;
+      for (size_t i = 0; i < tag->tag_list.size; i++) {
+        count_elements(tag->tag_list.value[i], element_counts, tag_count);
+      }
+      break;
+    case NBT_TYPE_COMPOUND:
+      element_counts[tag->type] += tag->tag_compound.size;
+      for (size_t i = 0; i < tag->tag_compound.size; i++) {
+        count_elements(tag->tag_compound.value[i], element_counts, tag_count);
+      }
+      break;
+    default: break;
+  }
+}
+
+// Scanning finds the same counts as walking the parsed tree, and describes each list and compound where it is.
+static void test_scan(const uint8_t* data, size_t size, nbt_tag_t* tag) {
+
+  size_t element_counts[NBT_TYPE_LONG_ARRAY + 1] = { 0 };
+  size_t tag_count = 0;
+  count_elements(tag, element_counts, &tag_count);
+
+  nbt_scan_stats_t stats;
+  CHECK(nbt_scan(data, size, NBT_PARSE_FLAG_USE_RAW, &stats, NULL, 0) == size);
+  CHECK(stats.tag_count == tag_count && memcmp(stats.element_counts, element_counts, sizeof(element_counts)) == 0);
+  CHECK(stats.type_counts[NBT_TYPE_COMPOUND] == 6 && stats.type_counts[NBT_TYPE_LIST] == 2 && stats.type_counts[NBT_TYPE_LONG] == 8);
+  CHECK(stats.max_depth == 4 && stats.element_counts[NBT_TYPE_BYTE_ARRAY] == 1000);
+
+  size_t entry_count = stats.type_counts[NBT_TYPE_LIST] + stats.type_counts[NBT_TYPE_COMPOUND];
+  nbt_scan_entry_t entries[8];
+  CHECK(entry_count <= 8);
+  if (entry_count > 8) {
+    return;
+  }
+
+  // Only as many entries as there is room for are filled in, but the counts are for everything.
+  nbt_scan_stats_t partial;
+  entries[1].length = 12345;
+  CHECK(nbt_scan(data, size, NBT_PARSE_FLAG_USE_RAW, &partial, entries, 1) == size);
+  CHECK(partial.tag_count == stats.tag_count && entries[1].length == 12345);
+
+  CHECK(nbt_scan(data, size, NBT_PARSE_FLAG_USE_RAW, &stats, entries, 8) == size);
+  CHECK(entries[0].type == NBT_TYPE_COMPOUND && entries[0].offset == 0 && entries[0].size == size && entries[0].depth == 0);
+  CHECK(entries[0].length == 11 && entries[0].tag_count == tag_count);
+  CHECK(entries[0].name_size == 5 && memcmp(entries[0].name, "Level", 5) == 0);
+
+  // Each entry is the same as the tag it describes, and covers exactly its serialized form.
+  for (size_t i = 1; i < entry_count; i++) {
+    nbt_tag_t* found = NULL;
+    if (entries[i].name) {
+      char name[64];
+      memcpy(name, entries[i].name, entries[i].name_size);
+      name[entries[i].name_size] = '\0';
+      nbt_tag_t* parent = entries[i].depth == 1 ? tag : nbt_tag_compound_get(tag, "nested compound test");
+      found = nbt_tag_compound_get(parent, name);
+    } else {
+      nbt_tag_t* list = nbt_tag_compound_get(tag, "listTest (compound)");
+      found = nbt_tag_list_get(list, i == entry_count - 1 ? 1 : 0);
+    }
+    CHECK(found && (size_t)found->type == (size_t)entries[i].type);
+    if (!found) {
+      continue;
+    }
+    size_t found_count = 0;
+    size_t found_elements[NBT_TYPE_LONG_ARRAY + 1] = { 0 };
+    count_elements(found, found_elements, &found_count);
+    size_t length = found->type == NBT_TYPE_LIST ? found->tag_list.size : found->tag_compound.size;
+    CHECK(entries[i].tag_count == found_count && entries[i].length == length);
+    CHECK(entries[i].offset + entries[i].size <= size);
+  }
+
+  // The list of longs, [11L, 12L, 13L, 14L, 15L], is its type, name, element type, length and elements.
+  for (size_t i = 0; i < entry_count; i++) {
+    if (entries[i].name_size == 15 && memcmp(entries[i].name, "listTest (long)", 15) == 0) {
+      CHECK(entries[i].size == 1 + 2 + 15 + 1 + 4 + 5 * 8 && data[entries[i].offset] == NBT_TYPE_LIST);
+    }
+  }
+
+}
+
+// A preallocated tree can be added to like any other, which moves the parts that grow out of the block.
+static void test_preallocate(const uint8_t* data, size_t size) {
+
+  nbt_tag_t* tag = nbt_parse_memory(data, size, NBT_PARSE_FLAG_USE_RAW | NBT_PARSE_FLAG_PREALLOCATE);
+  CHECK(tag != NULL);
+  if (!tag) {
+    return;
+  }
+
+  nbt_tag_t* longs = nbt_tag_compound_get(tag, "listTest (long)");
+  for (int i = 0; i < 100; i++) {
+    nbt_tag_list_append(longs, nbt_new_tag_long(16 + i));
+  }
+  nbt_tag_compound_append(tag, named(nbt_new_tag_string("added", 5), "added"));
+  nbt_set_tag_name(nbt_tag_compound_get(tag, "intTest"), "renamed", 7);
+
+  nbt_tree_stats_t stats;
+  nbt_tree_stats(tag, &stats);
+  CHECK(stats.heap_blocks > 1 && stats.tag_count == 29 + 101);
+
+  size_t written_size;
+  uint8_t* written = nbt_write_memory(tag, NBT_WRITE_FLAG_USE_RAW, &written_size);
+  nbt_tag_t* reparsed = nbt_parse_memory(written, written_size, NBT_PARSE_FLAG_USE_RAW);
+  CHECK(reparsed && same_tree(tag, reparsed, 1));
+  if (reparsed) {
+    nbt_tag_t* reparsed_longs = nbt_tag_compound_get(reparsed, "listTest (long)");
+    CHECK(reparsed_longs->tag_list.size == 105 && nbt_tag_list_get(reparsed_longs, 104)->tag_long.value == 115);
+    CHECK(nbt_tag_compound_get(reparsed, "renamed")->tag_int.value == 2147483647 && nbt_tag_compound_get(reparsed, "added"));
+    nbt_free_tag(reparsed);
+  }
+  nbt_free(written);
+
+  nbt_free_tag(tag);
+
+}
+
+int main(void) {
+
+  size_t size;
+  uint8_t* data = read_file("bigtest_raw.nbt", &size);
+  nbt_tag_t* bigtest = nbt_parse_memory(data, size, NBT_PARSE_FLAG_USE_RAW);
+  CHECK(bigtest != NULL);
+  if (!bigtest) {
+    return 1;
+  }
+
+  nbt_tag_t* large = make_large_document();
+
+  test_parallel(large);
+  test_contexts(bigtest, large);
+  test_round_trips(bigtest);
+  test_round_trips(large);
+  test_formats();
+  test_packets(bigtest);
+  test_packets(large);
+  test_snbt_parse();
+  test_snbt_write();
+  test_format_double();
+  test_transform(large);
+  test_paths(bigtest, data, size);
+  test_columns();
+  test_allocator(data, size, large);
+  test_instrument(bigtest);
+  test_tree_stats(data, size);
+  test_names(data, size);
+  test_lazy_depths(data, size, bigtest);
+  test_validate(data, size);
+  test_scan(data, size, bigtest);
+  test_preallocate(data, size);
+  test_truncation(data, size);
+  test_files(bigtest);
+  test_incremental(bigtest);
+  test_write_steps(bigtest, 0);
+  test_write_steps(large, 2);
+
+  nbt_free_tag(large);
+  nbt_free_tag(bigtest);
+  free(data);
+
+  printf("%d of %d checks passed\n", checks - failures, checks);
+
+  return failures > 0;
+
+}